@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <xtables.h>
+
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_RINGLOG.h>
+
+enum {
+	O_GROUP = 0,
+	O_PREFIX,
+	O_SNAPLEN,
+};
+
+#define s struct xt_ringlog_info
+static const struct xt_option_entry RINGLOG_opts[] = {
+	{.name = "ringlog-group", .id = O_GROUP, .type = XTTYPE_UINT16,
+	 .flags = XTOPT_PUT, XTOPT_POINTER(s, group)},
+	{.name = "ringlog-prefix", .id = O_PREFIX, .type = XTTYPE_STRING,
+	 .min = 1, .flags = XTOPT_PUT, XTOPT_POINTER(s, prefix)},
+	{.name = "ringlog-snaplen", .id = O_SNAPLEN, .type = XTTYPE_UINT32,
+	 .flags = XTOPT_PUT, XTOPT_POINTER(s, snaplen)},
+	XTOPT_TABLEEND,
+};
+#undef s
+
+static void RINGLOG_help(void)
+{
+	printf("RINGLOG target options:\n"
+	       " --ringlog-group NUM		Group number passed on in the records\n"
+	       " --ringlog-snaplen NUM		Number of bytes to copy\n"
+	       " --ringlog-prefix STRING	Prefix string for log records\n");
+}
+
+static void RINGLOG_parse(struct xt_option_call *cb)
+{
+	xtables_option_parse(cb);
+	switch (cb->entry->id) {
+	case O_PREFIX:
+		if (strchr(cb->arg, '\n') != NULL)
+			xtables_error(PARAMETER_PROBLEM,
+				   "Newlines not allowed in --ringlog-prefix");
+		break;
+	}
+}
+
+static void ringlog_print(const struct xt_ringlog_info *info, char *prefix)
+{
+	if (info->prefix[0] != '\0') {
+		printf(" %sringlog-prefix ", prefix);
+		xtables_save_string(info->prefix);
+	}
+	if (info->group)
+		printf(" %sringlog-group %u", prefix, info->group);
+	if (info->snaplen)
+		printf(" %sringlog-snaplen %u", prefix, info->snaplen);
+}
+
+static void RINGLOG_print(const void *ip, const struct xt_entry_target *target,
+			  int numeric)
+{
+	const struct xt_ringlog_info *info = (const void *)target->data;
+
+	ringlog_print(info, "");
+}
+
+static void RINGLOG_save(const void *ip, const struct xt_entry_target *target)
+{
+	const struct xt_ringlog_info *info = (const void *)target->data;
+
+	ringlog_print(info, "--");
+}
+
+static struct xtables_target ringlog_target = {
+	.family		= NFPROTO_UNSPEC,
+	.name		= "RINGLOG",
+	.version	= XTABLES_VERSION,
+	.size		= XT_ALIGN(sizeof(struct xt_ringlog_info)),
+	.userspacesize	= XT_ALIGN(sizeof(struct xt_ringlog_info)),
+	.help		= RINGLOG_help,
+	.x6_parse	= RINGLOG_parse,
+	.print		= RINGLOG_print,
+	.save		= RINGLOG_save,
+	.x6_options	= RINGLOG_opts,
+};
+
+void _init(void)
+{
+	xtables_register_target(&ringlog_target);
+}
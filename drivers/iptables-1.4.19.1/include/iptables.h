@@ -15,6 +15,8 @@ extern int flush_entries4(const xt_chainlabel chain, int verbose,
 			struct xtc_handle *handle);
 extern int for_each_chain4(int (*fn)(const xt_chainlabel, int, struct xtc_handle *),
 		int verbose, int builtinstoo, struct xtc_handle *handle);
+extern struct ipt_entry *iptables_last_append(void);
+extern void iptables_command_free(void);
 extern void print_rule4(const struct ipt_entry *e,
 		struct xtc_handle *handle, const char *chain, int counters);
 
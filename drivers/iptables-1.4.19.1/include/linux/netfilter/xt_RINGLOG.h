@@ -0,0 +1,75 @@
+#ifndef _XT_RINGLOG_TARGET_H
+#define _XT_RINGLOG_TARGET_H
+
+#include <linux/types.h>
+
+#ifndef IFNAMSIZ
+#define IFNAMSIZ 16
+#endif
+
+#define XT_RINGLOG_PREFIX_LEN	32
+#define XT_RINGLOG_MAC_LEN	16
+
+struct xt_ringlog_info {
+	__u32	snaplen;	/* bytes of packet to copy, 0: the ring maximum */
+	__u16	group;		/* passed on in the records */
+	__u16	flags;
+	char	prefix[XT_RINGLOG_PREFIX_LEN];
+};
+
+#define XT_RINGLOG_MASK		0x0
+
+/*
+ * There is one ring per CPU, mapped by mmap() of /proc/net/xt_RINGLOG/<cpu>.
+ * The mapping starts with a page holding struct xt_ringlog_hdr, followed by
+ * nr_recs records of rec_size bytes each.
+ *
+ * head and tail are free running counters: the kernel writes record
+ * head % nr_recs and then advances head; the reader consumes the records
+ * from tail to head and then advances tail. The kernel never waits for the
+ * reader. When the ring is full, the packet is counted in drops instead.
+ *
+ * A reader with nothing to do can poll() the file, it is woken when
+ * records are written.
+ */
+struct xt_ringlog_hdr {
+	/* Constant after the module is loaded */
+	__u32	version;
+	__u32	rec_size;
+	__u32	nr_recs;
+	__u32	data_offset;	/* of the first record, from the mapping */
+	__u32	snaplen;	/* max packet bytes in a record */
+	__u32	cpu;
+	__u32	__pad0[10];
+
+	/* Written by the kernel */
+	__u32	head;
+	__u32	__pad1;
+	__u64	drops;		/* packets not logged, because of a full ring */
+	__u32	__pad2[12];
+
+	/* Written by the reader */
+	__u32	tail;
+	__u32	__pad3[15];
+};
+
+#define XT_RINGLOG_VERSION	1
+
+struct xt_ringlog_rec {
+	__u64	tstamp;		/* nanoseconds since the epoch */
+	__u32	len;		/* length of the packet */
+	__u32	caplen;		/* bytes of it in data[] */
+	__u32	mark;
+	__u16	group;
+	__u8	pf;		/* NFPROTO_* */
+	__u8	hook;
+	char	indev[IFNAMSIZ];
+	char	outdev[IFNAMSIZ];
+	char	prefix[XT_RINGLOG_PREFIX_LEN];
+	__u8	mac_len;
+	__u8	mac[XT_RINGLOG_MAC_LEN];
+	__u8	__pad[7];
+	__u8	data[0];	/* the packet, from the network header on */
+};
+
+#endif /* _XT_RINGLOG_TARGET_H */
@@ -131,7 +131,8 @@ struct ipt_entry {
 
 #define IPT_SO_SET_REPLACE	(IPT_BASE_CTL)
 #define IPT_SO_SET_ADD_COUNTERS	(IPT_BASE_CTL + 1)
-#define IPT_SO_SET_MAX		IPT_SO_SET_ADD_COUNTERS
+#define IPT_SO_SET_DELTA	(IPT_BASE_CTL + 2)
+#define IPT_SO_SET_MAX		IPT_SO_SET_DELTA
 
 #define IPT_SO_GET_INFO			(IPT_BASE_CTL)
 #define IPT_SO_GET_ENTRIES		(IPT_BASE_CTL + 1)
@@ -202,6 +203,32 @@ struct ipt_replace {
 	struct ipt_entry entries[0];
 };
 
+/* Values for "op" field in struct ipt_delta. */
+#define IPT_DELTA_INSERT	1	/* Insert entry before the one at offset */
+#define IPT_DELTA_DELETE	2	/* Delete entry at offset */
+#define IPT_DELTA_REPLACE	3	/* Replace entry at offset */
+
+/* The argument to IPT_SO_SET_DELTA. */
+struct ipt_delta {
+	/* Which table. */
+	char name[XT_TABLE_MAXNAMELEN];
+
+	/* What to do. */
+	unsigned int op;
+
+	/* Number and size of entries the caller saw: if the table
+	   changed since, the delta fails with EAGAIN. */
+	unsigned int num_entries;
+	unsigned int size;
+
+	/* Offset of the entry the operation applies to. */
+	unsigned int offset;
+
+	/* The new entry for IPT_DELTA_INSERT and IPT_DELTA_REPLACE (hangs
+	   off end).  Jumps in it are offsets in the resulting table. */
+	struct ipt_entry entry[0];
+};
+
 /* The argument to IPT_SO_GET_ENTRIES. */
 struct ipt_get_entries {
 	/* Which table: user fills this in. */
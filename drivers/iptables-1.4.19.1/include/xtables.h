@@ -432,6 +432,7 @@ extern struct xtables_match *xtables_find_match(const char *name,
 	enum xtables_tryload, struct xtables_rule_match **match);
 extern struct xtables_target *xtables_find_target(const char *name,
 	enum xtables_tryload);
+extern int xtables_load_all_extensions(void);
 
 extern void xtables_rule_matches_free(struct xtables_rule_match **matches);
 
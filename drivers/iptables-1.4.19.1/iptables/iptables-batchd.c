@@ -0,0 +1,896 @@
+/* Resident iptables: keeps the tables cached and commits bursts at once.
+ *
+ * iptables-batchd reads iptables command lines (without the program name)
+ * from stdin or from the clients of a unix stream socket.  Every table has
+ * one libiptc handle which stays open, so a command neither fetches the
+ * table nor loads extensions.  Changes are committed together once the
+ * input goes quiet, or --latency milliseconds after the first one.
+ *
+ * Every command is answered with "OK <usec>" or "ERR <usec> <message>",
+ * <usec> being the time from its arrival to the answer.  The output of
+ * listing commands comes before the answer.  Changes are answered after
+ * their commit.  Whatever is answered right away, a listing or an error,
+ * first commits what is pending, so answers come in the order of the
+ * commands.
+ *
+ * The lines COMMIT, STATS and QUIT commit right away, print statistics
+ * and end the connection.
+ *
+ * This code is distributed under the terms of GNU GPL v2
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "iptables.h"
+#include "xtables.h"
+#include "libiptc/libiptc.h"
+#include "iptables-multi.h"
+
+#ifdef DEBUG
+#define DEBUGP(x, args...) fprintf(stderr, x, ## args)
+#else
+#define DEBUGP(x, args...)
+#endif
+
+#define BATCHD_MAX_CLIENTS	16
+#define BATCHD_LINE_MAX		10240
+
+struct batchd_client {
+	int in, out;
+	unsigned int line;
+	size_t len;
+	char buf[BATCHD_LINE_MAX];
+};
+
+struct batchd_table {
+	struct batchd_table *next;
+	char name[XT_TABLE_MAXNAMELEN];
+	struct xtc_handle *handle;
+	struct timeval deadline;	/* of the commit, if pending */
+	unsigned int pending;
+	unsigned long commits;
+};
+
+/* A change waiting for the commit of its table */
+struct batchd_cmd {
+	struct batchd_cmd *next;
+	struct batchd_client *client;	/* NULL once it went away */
+	struct batchd_table *table;
+	struct timeval start;
+	char *line;			/* to replay it on EAGAIN */
+};
+
+static int verbose = 0;
+static unsigned int latency = 0;	/* ms, 0 commits when input pauses */
+
+static struct batchd_client *clients[BATCHD_MAX_CLIENTS];
+static struct batchd_table *tables;
+static struct batchd_cmd *pending, **pending_tail = &pending;
+
+static struct {
+	unsigned long commands;
+	unsigned long failed;
+	unsigned long commits;
+	unsigned long commit_failed;
+	unsigned long long usec_total;
+	unsigned long usec_max;
+} stats;
+
+static sigjmp_buf cmd_env;
+static bool in_command;
+static char errmsg[256];
+
+static const struct option options[] = {
+	{.name = "socket",   .has_arg = true,  .val = 's'},
+	{.name = "latency",  .has_arg = true,  .val = 'l'},
+	{.name = "verbose",  .has_arg = false, .val = 'v'},
+	{.name = "help",     .has_arg = false, .val = 'h'},
+	{.name = "modprobe", .has_arg = true,  .val = 'M'},
+	{NULL},
+};
+
+static void print_usage(const char *name, const char *version) __attribute__((noreturn));
+
+#define prog_name iptables_globals.program_name
+
+static void print_usage(const char *name, const char *version)
+{
+	fprintf(stderr, "Usage: %s [-v] [-h]\n"
+			"	   [ --socket=<path> ]\n"
+			"	   [ --latency=<ms> ]\n"
+			"	   [ --verbose ]\n"
+			"	   [ --help ]\n"
+			"          [ --modprobe=<command>]\n", name);
+
+	exit(1);
+}
+
+/* Errors end the command, not the daemon */
+static void batchd_exit_error(enum xtables_exittype status,
+			      const char *msg, ...)
+	__attribute__((noreturn, format(printf,2,3)));
+
+static void batchd_exit_error(enum xtables_exittype status,
+			      const char *msg, ...)
+{
+	va_list args;
+	size_t len;
+
+	va_start(args, msg);
+	vsnprintf(errmsg, sizeof(errmsg), msg, args);
+	va_end(args);
+	len = strlen(errmsg);
+	while (len > 0 && errmsg[len-1] == '\n')
+		errmsg[--len] = '\0';
+
+	xtables_free_opts(1);
+	if (!in_command) {
+		fprintf(stderr, "%s: %s\n", prog_name, errmsg);
+		exit(status);
+	}
+	/* do_command4() does not get to free its rule */
+	iptables_command_free();
+	siglongjmp(cmd_env, status);
+}
+
+static unsigned long usec_since(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000UL +
+	       now.tv_usec - start->tv_usec;
+}
+
+static void batchd_write(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		buf += ret;
+		len -= ret;
+	}
+}
+
+/* Answer a command, NULL error for success */
+static void reply(struct batchd_client *cl, const struct timeval *start,
+		  const char *error)
+{
+	unsigned long usec = usec_since(start);
+	char buf[sizeof(errmsg) + 32];
+	int len;
+
+	stats.commands++;
+	stats.usec_total += usec;
+	if (usec > stats.usec_max)
+		stats.usec_max = usec;
+
+	if (error) {
+		stats.failed++;
+		len = snprintf(buf, sizeof(buf), "ERR %lu %s\n", usec, error);
+	} else
+		len = snprintf(buf, sizeof(buf), "OK %lu\n", usec);
+
+	if (cl != NULL)
+		batchd_write(cl->out, buf, len);
+	if (verbose && error)
+		fprintf(stderr, "%s: %s\n", prog_name, error);
+}
+
+/* global new argv and argc */
+static char *newargv[255];
+static int newargc;
+
+/* split a command line into newargv, honouring double quotes */
+static int split_line(char *buf)
+{
+	int quote_open = 0, escaped = 0, param_len = 0;
+	char param_buffer[1024], *curchar;
+
+	newargc = 0;
+	newargv[newargc++] = strdup(prog_name);
+
+	for (curchar = buf; ; curchar++) {
+		if (*curchar && quote_open) {
+			if (escaped) {
+				param_buffer[param_len++] = *curchar;
+				escaped = 0;
+			} else if (*curchar == '\\')
+				escaped = 1;
+			else if (*curchar == '"')
+				quote_open = 0;
+			else
+				param_buffer[param_len++] = *curchar;
+		} else if (*curchar == '"') {
+			quote_open = 1;
+		} else if (*curchar == ' ' || *curchar == '\t' ||
+			   *curchar == '\n' || *curchar == '\0') {
+			if (param_len) {
+				param_buffer[param_len] = '\0';
+				if (newargc + 1 >= ARRAY_SIZE(newargv))
+					return 0;
+				newargv[newargc++] = strdup(param_buffer);
+				param_len = 0;
+			}
+			if (*curchar == '\0')
+				break;
+		} else
+			param_buffer[param_len++] = *curchar;
+
+		if (param_len >= sizeof(param_buffer))
+			return 0;
+	}
+	newargv[newargc] = NULL;
+
+	return !quote_open;
+}
+
+static void free_argv(void)
+{
+	int i;
+
+	for (i = 0; i < newargc; i++)
+		free(newargv[i]);
+	newargc = 0;
+}
+
+/* The table a command goes to, as do_command4() will see it */
+static const char *argv_table(void)
+{
+	const char *table = "filter";
+	int i;
+
+	for (i = 1; i < newargc; i++) {
+		if (strcmp(newargv[i], "-t") == 0 ||
+		    strcmp(newargv[i], "--table") == 0) {
+			if (i + 1 < newargc)
+				table = newargv[++i];
+		} else if (strncmp(newargv[i], "--table=", 8) == 0)
+			table = newargv[i] + 8;
+		else if (strncmp(newargv[i], "-t", 2) == 0)
+			table = newargv[i] + 2;
+	}
+
+	return table;
+}
+
+/* Commands which only read the cache are answered right away */
+static bool argv_is_query(void)
+{
+	static const char *const queries[] = {
+		"--list", "--list-rules", "--check", NULL,
+	};
+	static const char *const changes[] = {
+		"--append", "--delete", "--insert", "--replace", "--flush",
+		"--zero", "--new-chain", "--delete-chain", "--rename-chain",
+		"--policy", NULL,
+	};
+	const char *const *p;
+	const char *arg;
+	bool query = false;
+	int i;
+
+	for (i = 1; i < newargc; i++) {
+		arg = newargv[i];
+		if (arg[0] != '-')
+			continue;
+		if (arg[1] == '-') {
+			for (p = queries; *p != NULL; p++)
+				if (strcmp(arg, *p) == 0)
+					query = true;
+			for (p = changes; *p != NULL; p++)
+				if (strcmp(arg, *p) == 0)
+					return false;
+			continue;
+		}
+		/* short options, the ones taking an argument end a group */
+		for (arg++; *arg != '\0'; arg++) {
+			if (strchr("LSC", *arg) != NULL)
+				query = true;
+			else if (strchr("ADRINXEPFZ", *arg) != NULL)
+				return false;
+			else if (strchr("tsdpjgiomcM", *arg) != NULL)
+				break;
+		}
+	}
+
+	return query;
+}
+
+/* Help and version end the process in do_command4() */
+static bool argv_is_allowed(void)
+{
+	int i;
+
+	for (i = 1; i < newargc; i++)
+		if (strcmp(newargv[i], "-h") == 0 ||
+		    strcmp(newargv[i], "--help") == 0 ||
+		    strcmp(newargv[i], "-V") == 0 ||
+		    strcmp(newargv[i], "--version") == 0)
+			return false;
+
+	return true;
+}
+
+static struct batchd_table *find_table(const char *name)
+{
+	struct batchd_table *t;
+
+	for (t = tables; t != NULL; t = t->next)
+		if (strcmp(t->name, name) == 0)
+			return t;
+
+	if (strlen(name) >= XT_TABLE_MAXNAMELEN)
+		return NULL;
+
+	t = xtables_calloc(1, sizeof(*t));
+	strcpy(t->name, name);
+	t->next = tables;
+	tables = t;
+	return t;
+}
+
+static int table_handle(struct batchd_table *t)
+{
+	if (t->handle != NULL)
+		return 1;
+
+	t->handle = iptc_init(t->name);
+	if (t->handle == NULL) {
+		/* try to insmod the module if iptc_init failed */
+		xtables_load_ko(xtables_modprobe_program, false);
+		t->handle = iptc_init(t->name);
+	}
+	if (t->handle == NULL) {
+		snprintf(errmsg, sizeof(errmsg), "can't initialize table `%s': %s",
+			 t->name, iptc_strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Run the command in newargv on the cached handle of its table */
+static int run_argv(struct batchd_table *t)
+{
+	char *table = t->name;
+	int ret = 0;
+
+	errmsg[0] = '\0';
+	if (!table_handle(t))
+		return 0;
+
+	in_command = true;
+	if (sigsetjmp(cmd_env, 0) == 0)
+		ret = do_command4(newargc, newargv, &table, &t->handle);
+	in_command = false;
+	fflush(stdout);
+
+	if (!ret && errmsg[0] == '\0')
+		snprintf(errmsg, sizeof(errmsg), "%s", iptc_strerror(errno));
+	return ret;
+}
+
+/* Run a command line, the output going to @out */
+static int run_line(struct batchd_table *t, char *cmdline, int out)
+{
+	int saved = -1, ret;
+
+	if (!split_line(cmdline)) {
+		free_argv();
+		snprintf(errmsg, sizeof(errmsg), "bad command line");
+		return 0;
+	}
+
+	if (out != STDOUT_FILENO) {
+		fflush(stdout);
+		saved = dup(STDOUT_FILENO);
+		dup2(out, STDOUT_FILENO);
+	}
+
+	ret = run_argv(t);
+
+	if (saved >= 0) {
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+	free_argv();
+	return ret;
+}
+
+static void free_cmd(struct batchd_cmd *cmd)
+{
+	free(cmd->line);
+	free(cmd);
+}
+
+/* Drop the cached handle of a table and replay its pending changes on a
+ * fresh one. Returns 0, with no handle cached, if a change fails now. */
+static int replay_table(struct batchd_table *t)
+{
+	struct batchd_cmd *cmd;
+
+	if (t->handle != NULL)
+		iptc_free(t->handle);
+	t->handle = NULL;
+
+	if (!t->pending)
+		return 1;
+
+	DEBUGP("replaying %u commands on table %s\n", t->pending, t->name);
+	for (cmd = pending; cmd != NULL; cmd = cmd->next) {
+		if (cmd->table != t)
+			continue;
+		if (!run_line(t, cmd->line, STDERR_FILENO)) {
+			/* the cache may hold half of the burst */
+			if (t->handle != NULL)
+				iptc_free(t->handle);
+			t->handle = NULL;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Commit one table and answer its pending changes */
+static void commit_table(struct batchd_table *t)
+{
+	struct batchd_cmd **pp, *cmd;
+	const char *error = NULL;
+	int ret;
+
+	if (!t->pending)
+		return;
+
+	if (t->handle != NULL) {
+		ret = iptc_commit(t->handle);
+		iptc_free(t->handle);
+		t->handle = NULL;
+	} else {
+		/* an earlier replay failed, try once more */
+		ret = 0;
+		errno = EAGAIN;
+	}
+
+	if (!ret && errno == EAGAIN) {
+		/* Somebody else changed the table: replay on a fresh copy */
+		if (replay_table(t)) {
+			ret = iptc_commit(t->handle);
+			iptc_free(t->handle);
+			t->handle = NULL;
+		} else {
+			errno = EAGAIN;
+		}
+	}
+
+	stats.commits++;
+	t->commits++;
+	if (!ret) {
+		stats.commit_failed++;
+		snprintf(errmsg, sizeof(errmsg), "commit failed: %s",
+			 iptc_strerror(errno));
+		error = errmsg;
+	}
+
+	for (pp = &pending; *pp != NULL; ) {
+		cmd = *pp;
+		if (cmd->table != t) {
+			pp = &cmd->next;
+			continue;
+		}
+		*pp = cmd->next;
+		reply(cmd->client, &cmd->start, error);
+		free_cmd(cmd);
+	}
+	pending_tail = pp;
+	t->pending = 0;
+}
+
+static void commit_all(void)
+{
+	struct batchd_table *t;
+
+	for (t = tables; t != NULL; t = t->next)
+		commit_table(t);
+}
+
+/* Commit what is due, returns the poll() timeout until the next one */
+static int commit_due(bool quiet)
+{
+	struct batchd_table *t;
+	struct timeval now;
+	long ms, timeout = -1;
+
+	gettimeofday(&now, NULL);
+	for (t = tables; t != NULL; t = t->next) {
+		if (!t->pending)
+			continue;
+		if (latency == 0) {
+			if (quiet)
+				commit_table(t);
+			else
+				timeout = 0;
+			continue;
+		}
+		ms = (t->deadline.tv_sec - now.tv_sec) * 1000 +
+		     (t->deadline.tv_usec - now.tv_usec) / 1000;
+		if (ms <= 0) {
+			commit_table(t);
+			continue;
+		}
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	return timeout;
+}
+
+static void print_stats(struct batchd_client *cl)
+{
+	struct batchd_table *t;
+	char buf[256];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "commands %lu failed %lu "
+		       "commits %lu commit-failures %lu "
+		       "latency-avg %llu latency-max %lu\n",
+		       stats.commands, stats.failed, stats.commits,
+		       stats.commit_failed,
+		       stats.commands ? stats.usec_total / stats.commands : 0,
+		       stats.usec_max);
+	batchd_write(cl->out, buf, len);
+
+	for (t = tables; t != NULL; t = t->next) {
+		len = snprintf(buf, sizeof(buf), "table %s commits %lu "
+			       "pending %u cached %s\n", t->name, t->commits,
+			       t->pending, t->handle ? "yes" : "no");
+		batchd_write(cl->out, buf, len);
+	}
+}
+
+/* Answer right away, after the changes which came before */
+static void answer(struct batchd_client *cl, const struct timeval *start,
+		   const char *error)
+{
+	char buf[sizeof(errmsg)];
+
+	if (pending != NULL) {
+		if (error != NULL) {
+			snprintf(buf, sizeof(buf), "%s", error);
+			error = buf;
+		}
+		commit_all();
+	}
+	reply(cl, start, error);
+}
+
+/* Handle one line of a client, returns 0 to end the connection */
+static int handle_line(struct batchd_client *cl, char *cmdline)
+{
+	struct batchd_table *t;
+	struct batchd_cmd *cmd;
+	struct timeval start;
+	bool query;
+
+	gettimeofday(&start, NULL);
+	cmdline[strcspn(cmdline, "\r\n")] = '\0';
+	cmdline += strspn(cmdline, " \t");
+
+	if (cmdline[0] == '\0' || cmdline[0] == '#')
+		return 1;
+	if (strcmp(cmdline, "QUIT") == 0)
+		return 0;
+	if (strcmp(cmdline, "COMMIT") == 0) {
+		answer(cl, &start, NULL);
+		return 1;
+	}
+	if (strcmp(cmdline, "STATS") == 0) {
+		if (pending != NULL)
+			commit_all();
+		print_stats(cl);
+		reply(cl, &start, NULL);
+		return 1;
+	}
+
+	if (!split_line(cmdline)) {
+		free_argv();
+		answer(cl, &start, "bad command line");
+		return 1;
+	}
+	t = find_table(argv_table());
+	query = argv_is_query();
+	if (!argv_is_allowed()) {
+		free_argv();
+		answer(cl, &start, "not available in batch mode");
+		return 1;
+	}
+	free_argv();
+	if (t == NULL) {
+		answer(cl, &start, "table name too long");
+		return 1;
+	}
+
+	if (query) {
+		/* listings show what is in the kernel */
+		if (pending != NULL)
+			commit_all();
+		reply(cl, &start, run_line(t, cmdline, cl->out) ? NULL : errmsg);
+		return 1;
+	}
+
+	/* a failed replay left no cache: settle the pending changes first */
+	if (t->handle == NULL && t->pending)
+		commit_table(t);
+
+	if (!run_line(t, cmdline, cl->out)) {
+		char error[sizeof(errmsg)];
+
+		/* The command may have changed the cache before it failed.
+		 * Rebuild it from the changes that did succeed. */
+		snprintf(error, sizeof(error), "%s", errmsg);
+		replay_table(t);
+		answer(cl, &start, error);
+		return 1;
+	}
+
+	cmd = xtables_calloc(1, sizeof(*cmd));
+	cmd->client = cl;
+	cmd->table = t;
+	cmd->start = start;
+	cmd->line = strdup(cmdline);
+	*pending_tail = cmd;
+	pending_tail = &cmd->next;
+
+	if (!t->pending++) {
+		t->deadline = start;
+		t->deadline.tv_sec += latency / 1000;
+		t->deadline.tv_usec += (latency % 1000) * 1000;
+		if (t->deadline.tv_usec >= 1000000) {
+			t->deadline.tv_sec++;
+			t->deadline.tv_usec -= 1000000;
+		}
+	}
+	return 1;
+}
+
+/* Read from a client, returns 0 on end of input */
+static int handle_input(struct batchd_client *cl)
+{
+	char *start, *nl;
+	ssize_t ret;
+
+	ret = read(cl->in, cl->buf + cl->len, sizeof(cl->buf) - cl->len - 1);
+	if (ret < 0 && errno == EINTR)
+		return 1;
+	if (ret <= 0)
+		return 0;
+	cl->len += ret;
+	cl->buf[cl->len] = '\0';
+
+	start = cl->buf;
+	while ((nl = strchr(start, '\n')) != NULL) {
+		*nl = '\0';
+		line = ++cl->line;
+		if (!handle_line(cl, start))
+			return 0;
+		start = nl + 1;
+	}
+
+	cl->len -= start - cl->buf;
+	memmove(cl->buf, start, cl->len);
+	if (cl->len == sizeof(cl->buf) - 1) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		answer(cl, &now, "line too long");
+		cl->len = 0;
+	}
+	return 1;
+}
+
+static struct batchd_client *new_client(int in, int out)
+{
+	struct batchd_client *cl;
+	int i;
+
+	for (i = 0; i < BATCHD_MAX_CLIENTS; i++)
+		if (clients[i] == NULL)
+			break;
+	if (i == BATCHD_MAX_CLIENTS)
+		return NULL;
+
+	cl = xtables_calloc(1, sizeof(*cl));
+	cl->in = in;
+	cl->out = out;
+	clients[i] = cl;
+	return cl;
+}
+
+static void drop_client(struct batchd_client *cl)
+{
+	struct batchd_cmd *cmd;
+	int i;
+
+	for (cmd = pending; cmd != NULL; cmd = cmd->next)
+		if (cmd->client == cl)
+			cmd->client = NULL;
+
+	for (i = 0; i < BATCHD_MAX_CLIENTS; i++)
+		if (clients[i] == cl)
+			clients[i] = NULL;
+
+	if (cl->in != STDIN_FILENO)
+		close(cl->in);
+	free(cl);
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", prog_name);
+		exit(1);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "%s: socket: %s\n", prog_name, strerror(errno));
+		exit(1);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(fd, 4) < 0) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, path,
+			strerror(errno));
+		exit(1);
+	}
+
+	return fd;
+}
+
+int
+iptables_batchd_main(int argc, char *argv[])
+{
+	struct pollfd fds[BATCHD_MAX_CLIENTS + 1];
+	struct batchd_client *polled[BATCHD_MAX_CLIENTS + 1];
+	struct batchd_client *cl;
+	const char *path = NULL;
+	int c, i, n, nfds, timeout, listen_fd = -1;
+	bool quiet;
+
+	iptables_globals.program_name = "iptables-batchd";
+	iptables_globals.exit_err = batchd_exit_error;
+	c = xtables_init_all(&iptables_globals, NFPROTO_IPV4);
+	if (c < 0) {
+		fprintf(stderr, "%s/%s Failed to initialize xtables\n",
+				iptables_globals.program_name,
+				iptables_globals.program_version);
+		exit(1);
+	}
+#if defined(ALL_INCLUSIVE) || defined(NO_SHARED_LIBS)
+	init_extensions();
+	init_extensions4();
+#endif
+
+	while ((c = getopt_long(argc, argv, "s:l:vhM:", options, NULL)) != -1) {
+		switch (c) {
+			case 's':
+				path = optarg;
+				break;
+			case 'l':
+				latency = strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+				print_usage("iptables-batchd",
+					    IPTABLES_VERSION);
+				break;
+			case 'M':
+				xtables_modprobe_program = optarg;
+				break;
+		}
+	}
+
+	if (optind < argc) {
+		fprintf(stderr, "Unknown arguments found on commandline\n");
+		exit(1);
+	}
+
+	/* Pay for the extensions once, not with the first rule using them */
+	n = xtables_load_all_extensions();
+	if (verbose)
+		fprintf(stderr, "%s: %d extension libraries loaded\n",
+			prog_name, n);
+
+	signal(SIGPIPE, SIG_IGN);
+	if (path != NULL)
+		listen_fd = open_socket(path);
+	else
+		new_client(STDIN_FILENO, STDOUT_FILENO);
+
+	for (;;) {
+		timeout = commit_due(false);
+
+		nfds = 0;
+		if (listen_fd >= 0) {
+			fds[nfds].fd = listen_fd;
+			fds[nfds].events = POLLIN;
+			polled[nfds++] = NULL;
+		}
+		for (i = 0; i < BATCHD_MAX_CLIENTS; i++) {
+			if (clients[i] == NULL)
+				continue;
+			fds[nfds].fd = clients[i]->in;
+			fds[nfds].events = POLLIN;
+			polled[nfds++] = clients[i];
+		}
+		if (nfds == 0)
+			break;
+
+		n = poll(fds, nfds, timeout);
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "%s: poll: %s\n", prog_name,
+				strerror(errno));
+			exit(1);
+		}
+		if (n <= 0)
+			continue;
+
+		for (i = 0; i < nfds; i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			cl = polled[i];
+			if (cl == NULL) {
+				c = accept(listen_fd, NULL, NULL);
+				if (c >= 0 && new_client(c, c) == NULL)
+					close(c);
+				continue;
+			}
+			if (!handle_input(cl)) {
+				/* the answers still go out */
+				commit_all();
+				drop_client(cl);
+				polled[i] = NULL;
+			}
+		}
+
+		/* A burst ends when no client has more to say right away */
+		for (i = 0; i < nfds; i++) {
+			fds[i].revents = 0;
+			if (polled[i] == NULL)
+				fds[i].fd = -1;
+		}
+		quiet = poll(fds, nfds, 0) == 0;
+		commit_due(quiet);
+	}
+
+	/* End of input */
+	commit_all();
+	return stats.failed ? 1 : 0;
+}
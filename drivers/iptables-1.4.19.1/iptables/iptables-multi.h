@@ -4,5 +4,6 @@
 extern int iptables_main(int, char **);
 extern int iptables_save_main(int, char **);
 extern int iptables_restore_main(int, char **);
+extern int iptables_batchd_main(int, char **);
 
 #endif /* _IPTABLES_MULTI_H */
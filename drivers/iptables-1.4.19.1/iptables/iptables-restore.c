@@ -177,6 +177,176 @@ static void add_param_to_argv(char *parsestart)
 	}
 }
 
+/* Rules which only differ in their numeric source and destination address
+ * have the same shape. Only the first rule of a shape is parsed by
+ * do_command4(), the others are appended with a copy of its entry. */
+#define SHAPE_HASH_SIZE	1024
+#define SHAPE_MAX	4096
+
+struct rule_shape {
+	struct rule_shape *next;
+	struct ipt_entry *entry;
+	unsigned int keylen;
+	char key[0];
+};
+
+static struct rule_shape *shapes[SHAPE_HASH_SIZE];
+static unsigned int shape_count;
+static char shape_buf[10240 + ARRAY_SIZE(newargv)];
+
+static void shape_flush(void)
+{
+	struct rule_shape *shape;
+	unsigned int i;
+
+	for (i = 0; i < SHAPE_HASH_SIZE; i++) {
+		while ((shape = shapes[i]) != NULL) {
+			shapes[i] = shape->next;
+			free(shape->entry);
+			free(shape);
+		}
+	}
+	shape_count = 0;
+}
+
+static bool is_address(const char *arg)
+{
+	return *arg && strspn(arg, "0123456789./") == strlen(arg);
+}
+
+static bool is_append(int counted)
+{
+	int i = counted ? 6 : 3;
+
+	return i < newargc && (strcmp(newargv[i], "-A") == 0 ||
+			       strcmp(newargv[i], "--append") == 0);
+}
+
+/* Build the shape of the rule in newargv[] in shape_buf. The rule starts at
+ * newargv[3], or at newargv[6] if restore added counters. Returns the length
+ * of the shape, or 0 if the rule can't be appended from a shape. */
+static unsigned int shape_build(int counted, const char **chain,
+				const char **src, const char **dst)
+{
+	unsigned int len = 1, n;
+	const char **addr;
+	int i = counted ? 6 : 3;
+
+	*src = *dst = NULL;
+	if (!is_append(counted) || i + 1 == newargc)
+		return 0;
+	*chain = newargv[i + 1];
+
+	shape_buf[0] = counted ? 'c' : '-';
+	for (; i < newargc; i++) {
+		n = strlen(newargv[i]) + 1;
+		if (len + n > sizeof(shape_buf))
+			return 0;
+		memcpy(shape_buf + len, newargv[i], n);
+		len += n;
+
+		if (!strcmp(newargv[i], "-s") ||
+		    !strcmp(newargv[i], "--source") ||
+		    !strcmp(newargv[i], "--src"))
+			addr = src;
+		else if (!strcmp(newargv[i], "-d") ||
+			 !strcmp(newargv[i], "--destination") ||
+			 !strcmp(newargv[i], "--dst"))
+			addr = dst;
+		else
+			continue;
+
+		/* Host names and lists may stand for any number of rules */
+		if (i + 1 == newargc || !is_address(newargv[i + 1]))
+			return 0;
+		*addr = newargv[++i];
+	}
+
+	return len;
+}
+
+static unsigned int shape_hash(unsigned int len)
+{
+	unsigned int i, hash = 0;
+
+	for (i = 0; i < len; i++)
+		hash = hash * 31 + (unsigned char)shape_buf[i];
+	return hash % SHAPE_HASH_SIZE;
+}
+
+static struct rule_shape *shape_find(unsigned int len)
+{
+	struct rule_shape *shape;
+
+	for (shape = shapes[shape_hash(len)]; shape; shape = shape->next)
+		if (shape->keylen == len && !memcmp(shape->key, shape_buf, len))
+			return shape;
+	return NULL;
+}
+
+static void shape_add(unsigned int len, struct ipt_entry *e)
+{
+	struct rule_shape *shape;
+	unsigned int hash;
+
+	if (!e || shape_count >= SHAPE_MAX) {
+		free(e);
+		return;
+	}
+
+	hash = shape_hash(len);
+	shape = xtables_malloc(sizeof(*shape) + len);
+	shape->entry = e;
+	shape->keylen = len;
+	memcpy(shape->key, shape_buf, len);
+	shape->next = shapes[hash];
+	shapes[hash] = shape;
+	shape_count++;
+}
+
+static int shape_address(const char *arg, struct in_addr *addr,
+			 struct in_addr *mask)
+{
+	struct in_addr *addrs, *masks;
+	unsigned int naddrs;
+
+	xtables_ipparse_multiple(arg, &addrs, &masks, &naddrs);
+	if (naddrs == 1) {
+		*addr = addrs[0];
+		*mask = masks[0];
+	}
+	free(addrs);
+	free(masks);
+	return naddrs == 1;
+}
+
+/* Append the rule in newargv[] with the entry of its shape. Returns -1 if
+ * the rule has to go through do_command4() after all. */
+static int shape_append(struct rule_shape *shape, int counted,
+			const char *chain, const char *src, const char *dst,
+			struct xtc_handle *handle)
+{
+	struct ipt_entry *e = shape->entry;
+	unsigned long long pcnt, bcnt;
+
+	if (counted) {
+		/* Anything else is for do_command4() to complain about */
+		if (strchr(newargv[4], ',') || newargv[5][0] == '-' ||
+		    sscanf(newargv[4], "%llu", &pcnt) != 1 ||
+		    sscanf(newargv[5], "%llu", &bcnt) != 1)
+			return -1;
+		e->counters.pcnt = pcnt;
+		e->counters.bcnt = bcnt;
+	}
+
+	if (src && !shape_address(src, &e->ip.src, &e->ip.smsk))
+		return -1;
+	if (dst && !shape_address(dst, &e->ip.dst, &e->ip.dmsk))
+		return -1;
+
+	return iptc_append_entry(chain, e, handle);
+}
+
 int
 iptables_restore_main(int argc, char *argv[])
 {
@@ -270,6 +440,7 @@ iptables_restore_main(int argc, char *argv[])
 				ret = 1;
 			}
 			in_table = 0;
+			shape_flush();
 		} else if ((buffer[0] == '*') && (!in_table)) {
 			/* New table */
 			char *table;
@@ -383,11 +554,14 @@ iptables_restore_main(int argc, char *argv[])
 			ret = 1;
 
 		} else if (in_table) {
-			int a;
+			int a, counted;
 			char *ptr = buffer;
 			char *pcnt = NULL;
 			char *bcnt = NULL;
 			char *parsestart;
+			const char *chain, *src, *dst;
+			struct rule_shape *shape = NULL;
+			unsigned int shape_len;
 
 			/* reset the newargv */
 			newargc = 0;
@@ -423,7 +597,8 @@ iptables_restore_main(int argc, char *argv[])
 			add_argv("-t");
 			add_argv(curtable);
 
-			if (counters && pcnt && bcnt) {
+			counted = counters && pcnt && bcnt;
+			if (counted) {
 				add_argv("--set-counters");
 				add_argv((char *) pcnt);
 				add_argv((char *) bcnt);
@@ -437,8 +612,27 @@ iptables_restore_main(int argc, char *argv[])
 			for (a = 0; a < newargc; a++)
 				DEBUGP("argv[%u]: %s\n", a, newargv[a]);
 
-			ret = do_command4(newargc, newargv,
-					 &newargv[2], &handle);
+			ret = -1;
+			shape_len = shape_build(counted, &chain, &src, &dst);
+			if (shape_len) {
+				shape = shape_find(shape_len);
+				if (shape)
+					ret = shape_append(shape, counted, chain,
+							   src, dst, handle);
+			}
+
+			if (ret < 0) {
+				ret = do_command4(newargc, newargv,
+						 &newargv[2], &handle);
+				if (ret && shape_len && !shape)
+					shape_add(shape_len,
+						  iptables_last_append());
+				else
+					free(iptables_last_append());
+				/* Other commands may change what a rule means */
+				if (!is_append(counted))
+					shape_flush();
+			}
 
 			free_argv();
 			fflush(stdout);
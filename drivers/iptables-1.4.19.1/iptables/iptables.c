@@ -1280,6 +1280,39 @@ static void command_match(struct iptables_command_state *cs)
 		xtables_error(OTHER_PROBLEM, "can't alloc memory!");
 }
 
+/* Entry of the last rule appended by do_command4() */
+static struct ipt_entry *last_append;
+
+/* Hand the entry of the last rule appended by do_command4() over to the
+ * caller, which may append further rules of the same shape with it. */
+struct ipt_entry *iptables_last_append(void)
+{
+	struct ipt_entry *e = last_append;
+
+	last_append = NULL;
+	return e;
+}
+
+/* Command state of the do_command4() call in progress */
+static struct iptables_command_state *command_state;
+
+/* Free the matches and the target of the do_command4() call in progress.
+ * For exit_err handlers which unwind out of it instead of exiting. */
+void iptables_command_free(void)
+{
+	struct iptables_command_state *cs = command_state;
+
+	command_state = NULL;
+	if (cs == NULL)
+		return;
+
+	xtables_rule_matches_free(&cs->matches);
+	if (cs->target != NULL) {
+		free(cs->target->t);
+		cs->target->t = NULL;
+	}
+}
+
 int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle)
 {
 	struct iptables_command_state cs;
@@ -1303,6 +1336,7 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 	memset(&cs, 0, sizeof(cs));
 	cs.jumpto = "";
 	cs.argv = argv;
+	command_state = &cs;
 
 	/* re-set optind to 0 in case do_command4 gets called
 	 * a second time */
@@ -1640,8 +1674,10 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 
 		case '6':
 			/* This is not the IPv6 ip6tables */
-			if (line != -1)
+			if (line != -1) {
+				command_state = NULL;
 				return 1; /* success: line ignored */
+			}
 			fprintf(stderr, "This is the IPv4 version of iptables.\n");
 			exit_tryhelp(2);
 
@@ -1655,8 +1691,8 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 				optarg[0] = '\0';
 				continue;
 			}
-			fprintf(stderr, "Bad argument `%s'\n", optarg);
-			exit_tryhelp(2);
+			xtables_error(PARAMETER_PROBLEM,
+				   "Bad argument `%s'", optarg);
 
 		default:
 			if (command_default(&cs, &iptables_globals) == 1)
@@ -1766,6 +1802,7 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 
 			if (cs.target->t)
 				free(cs.target->t);
+			cs.target->t = NULL;
 
 			cs.target = NULL;
 		}
@@ -1805,6 +1842,7 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 		} else {
 			e = generate_entry(&cs.fw, cs.matches, cs.target->t);
 			free(cs.target->t);
+			cs.target->t = NULL;
 		}
 	}
 
@@ -1903,10 +1941,16 @@ int do_command4(int argc, char *argv[], char **table, struct xtc_handle **handle
 	if (verbose > 1)
 		dump_entries(*handle);
 
+	command_state = NULL;
 	xtables_rule_matches_free(&cs.matches);
 
 	if (e != NULL) {
-		free(e);
+		free(last_append);
+		last_append = NULL;
+		if (command == CMD_APPEND && ret && !(cs.options & OPT_VERBOSE))
+			last_append = e;
+		else
+			free(e);
 		e = NULL;
 	}
 
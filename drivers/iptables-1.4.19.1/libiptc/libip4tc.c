@@ -46,6 +46,7 @@ typedef unsigned int socklen_t;
 #define STRUCT_COUNTERS_INFO	struct xt_counters_info
 #define STRUCT_STANDARD_TARGET	struct xt_standard_target
 #define STRUCT_REPLACE		struct ipt_replace
+#define STRUCT_DELTA		struct ipt_delta
 
 #define ENTRY_ITERATE		IPT_ENTRY_ITERATE
 #define TABLE_MAXNAMELEN	XT_TABLE_MAXNAMELEN
@@ -97,6 +98,7 @@ typedef unsigned int socklen_t;
 
 #define SO_SET_REPLACE		IPT_SO_SET_REPLACE
 #define SO_SET_ADD_COUNTERS	IPT_SO_SET_ADD_COUNTERS
+#define SO_SET_DELTA		IPT_SO_SET_DELTA
 #define SO_GET_INFO		IPT_SO_GET_INFO
 #define SO_GET_ENTRIES		IPT_SO_GET_ENTRIES
 #define SO_GET_VERSION		IPT_SO_GET_VERSION
@@ -110,6 +112,10 @@ typedef unsigned int socklen_t;
 #define ALIGN			XT_ALIGN
 #define RETURN			XT_RETURN
 
+#define DELTA_INSERT		IPT_DELTA_INSERT
+#define DELTA_DELETE		IPT_DELTA_DELETE
+#define DELTA_REPLACE		IPT_DELTA_REPLACE
+
 #include "libiptc.c"
 
 #define IP_PARTS_NATIVE(n)			\
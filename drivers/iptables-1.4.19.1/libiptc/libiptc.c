@@ -88,6 +88,14 @@ enum iptcc_rule_type {
 	IPTCC_R_JUMP,			/* jump to other chain */
 };
 
+/* changes the kernel can apply without a full table replace */
+enum iptcc_delta_type {
+	IPTCC_D_NONE,
+	IPTCC_D_INSERT,			/* rule inserted or appended */
+	IPTCC_D_DELETE,			/* rule deleted */
+	IPTCC_D_REPLACE,		/* rule replaced */
+};
+
 struct rule_head
 {
 	struct list_head list;
@@ -128,6 +136,10 @@ struct xtc_handle {
 	int sockfd;
 	int changed;			 /* Have changes been made? */
 
+	enum iptcc_delta_type delta;	 /* Is it a single rule delta? */
+	struct rule_head *delta_rule;	 /* new rule, if insert/replace */
+	unsigned int delta_offset;	 /* old offset, if delete */
+
 	struct list_head chains;
 
 	struct chain_head *chain_iterator_cur;
@@ -186,6 +198,24 @@ static inline void
 set_changed(struct xtc_handle *h)
 {
 	h->changed = 1;
+	h->delta = IPTCC_D_NONE;
+}
+
+/* notify us of a single rule change: if it is the only one, the commit
+ * can hand it to the kernel as a delta */
+static inline void
+set_delta(struct xtc_handle *h, enum iptcc_delta_type delta,
+	  struct rule_head *r, unsigned int offset)
+{
+	if (h->changed) {
+		set_changed(h);
+		return;
+	}
+
+	h->changed = 1;
+	h->delta = delta;
+	h->delta_rule = r;
+	h->delta_offset = offset;
 }
 
 #ifdef IPTC_DEBUG
@@ -1731,7 +1761,6 @@ iptcc_map_target(struct xtc_handle *const handle,
 	       0,
 	       FUNCTION_MAXNAMELEN - 1 - strlen(t->u.user.name));
 	r->type = IPTCC_R_MODULE;
-	set_changed(handle);
 	return 1;
 }
 
@@ -1789,7 +1818,7 @@ TC_INSERT_ENTRY(const IPT_CHAINLABEL chain,
 	list_add_tail(&r->list, prev);
 	c->num_rules++;
 
-	set_changed(handle);
+	set_delta(handle, IPTCC_D_INSERT, r, 0);
 
 	return 1;
 }
@@ -1839,7 +1868,7 @@ TC_REPLACE_ENTRY(const IPT_CHAINLABEL chain,
 	list_add(&r->list, &old->list);
 	iptcc_delete_rule(old);
 
-	set_changed(handle);
+	set_delta(handle, IPTCC_D_REPLACE, r, 0);
 
 	return 1;
 }
@@ -1879,7 +1908,7 @@ TC_APPEND_ENTRY(const IPT_CHAINLABEL chain,
 	list_add_tail(&r->list, &c->rules);
 	c->num_rules++;
 
-	set_changed(handle);
+	set_delta(handle, IPTCC_D_INSERT, r, 0);
 
 	return 1;
 }
@@ -2016,9 +2045,8 @@ static int delete_entry(const IPT_CHAINLABEL chain, const STRUCT_ENTRY *origfw,
 		}
 
 		c->num_rules--;
+		set_delta(handle, IPTCC_D_DELETE, NULL, i->offset);
 		iptcc_delete_rule(i);
-
-		set_changed(handle);
 		free(r);
 		return 1;
 	}
@@ -2081,10 +2109,9 @@ TC_DELETE_NUM_ENTRY(const IPT_CHAINLABEL chain,
 	}
 
 	c->num_rules--;
+	set_delta(handle, IPTCC_D_DELETE, NULL, r->offset);
 	iptcc_delete_rule(r);
 
-	set_changed(handle);
-
 	return 1;
 }
 
@@ -2513,6 +2540,65 @@ static void counters_map_set(STRUCT_COUNTERS_INFO *newcounters,
 	DEBUGP_C("SET\n");
 }
 
+#ifdef SO_SET_DELTA
+/* Hand the single rule change to the kernel, which keeps the counters of
+ * all other rules and does not check them again.  Returns -1 and sets
+ * errno if the kernel wants a full replace instead. */
+static int iptcc_commit_delta(struct xtc_handle *h, STRUCT_REPLACE *repl)
+{
+	STRUCT_DELTA *delta;
+	struct rule_head *r = h->delta_rule;
+	unsigned int size = 0;
+	int ret;
+
+	if (h->delta != IPTCC_D_DELETE)
+		size = r->size;
+
+	delta = malloc(sizeof(*delta) + size);
+	if (!delta) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(delta, 0, sizeof(*delta));
+
+	strcpy(delta->name, h->info.name);
+	delta->num_entries = h->info.num_entries;
+	delta->size = h->info.size;
+
+	switch (h->delta) {
+	case IPTCC_D_INSERT:
+		delta->op = DELTA_INSERT;
+		break;
+	case IPTCC_D_DELETE:
+		delta->op = DELTA_DELETE;
+		break;
+	case IPTCC_D_REPLACE:
+		delta->op = DELTA_REPLACE;
+		break;
+	default:
+		fprintf(stderr, "ERROR: bad delta %i\n", h->delta);
+		abort();
+	}
+
+	/* The new rule takes the place of the old one: its offset is the
+	 * same in the old and the new table, and the jumps in it have
+	 * been compiled for the new table. */
+	if (h->delta == IPTCC_D_DELETE)
+		delta->offset = h->delta_offset;
+	else {
+		delta->offset = r->offset;
+		memcpy(delta->entry, (char *)repl->entries + r->offset, size);
+	}
+
+	DEBUGP("delta op=%u, offset=%u, size=%u\n",
+		delta->op, delta->offset, size);
+
+	ret = setsockopt(h->sockfd, TC_IPPROTO, SO_SET_DELTA, delta,
+			 sizeof(*delta) + size);
+	free(delta);
+	return ret;
+}
+#endif
 
 int
 TC_COMMIT(struct xtc_handle *handle)
@@ -2584,6 +2670,21 @@ TC_COMMIT(struct xtc_handle *handle)
 		goto out_free_newcounters;
 	}
 
+#ifdef SO_SET_DELTA
+	/* Kernels without delta support, or deltas it cannot apply on
+	 * their own, fall back to a full replace. */
+	if (handle->delta != IPTCC_D_NONE) {
+		ret = iptcc_commit_delta(handle, repl);
+		if (ret == 0) {
+			free(repl->counters);
+			free(repl);
+			free(newcounters);
+			goto finished;
+		}
+		if (errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+			goto out_free_newcounters;
+	}
+#endif
 
 #ifdef IPTC_DEBUG2
 	{
@@ -49,6 +49,7 @@
 #include <libiptc/libxtc.h>
 
 #ifndef NO_SHARED_LIBS
+#include <dirent.h>
 #include <dlfcn.h>
 #endif
 #ifndef IPT_SO_GET_REVISION_MATCH /* Old kernel source. */
@@ -590,6 +591,63 @@ static void *load_extension(const char *search_path, const char *af_prefix,
 }
 #endif
 
+/**
+ * xtables_load_all_extensions - load every extension of the search path
+ *
+ * Resident programs use this to dlopen all extensions once up front, rather
+ * than on first use of each. Loaded extensions are registered as pending and
+ * found by xtables_find_match/xtables_find_target without another lookup
+ * in the file system. Returns the number of libraries loaded.
+ */
+int xtables_load_all_extensions(void)
+{
+	int loaded = 0;
+#ifndef NO_SHARED_LIBS
+	const char *all_prefixes[] = {"libxt_", afinfo->libprefix, NULL};
+	const char **prefix;
+	const char *dir = xtables_libdir, *next;
+	struct dirent *ent;
+	char path[256];
+	size_t len;
+	DIR *dh;
+
+	do {
+		next = strchr(dir, ':');
+		if (next == NULL)
+			next = dir + strlen(dir);
+
+		snprintf(path, sizeof(path), "%.*s",
+		         (unsigned int)(next - dir), dir);
+		dh = opendir(path);
+		while (dh != NULL && (ent = readdir(dh)) != NULL) {
+			len = strlen(ent->d_name);
+			if (len < 3 || strcmp(ent->d_name + len - 3, ".so") != 0)
+				continue;
+
+			for (prefix = all_prefixes; *prefix != NULL; ++prefix)
+				if (strncmp(ent->d_name, *prefix,
+				    strlen(*prefix)) == 0)
+					break;
+			if (*prefix == NULL)
+				continue;
+
+			snprintf(path, sizeof(path), "%.*s/%s",
+			         (unsigned int)(next - dir), dir, ent->d_name);
+			if (dlopen(path, RTLD_NOW) == NULL) {
+				fprintf(stderr, "%s: %s\n", path, dlerror());
+				continue;
+			}
+			++loaded;
+		}
+		if (dh != NULL)
+			closedir(dh);
+		dir = next + 1;
+	} while (*next != '\0');
+#endif
+
+	return loaded;
+}
+
 struct xtables_match *
 xtables_find_match(const char *name, enum xtables_tryload tryload,
 		   struct xtables_rule_match **matches)
@@ -0,0 +1,257 @@
+/*
+ * nfringlog - read the packet records of the RINGLOG target
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Every CPU has a ring in /proc/net/xt_RINGLOG/<cpu>. The rings are mapped
+ * and the records between tail and head consumed directly; poll() is only
+ * called when all rings are empty. Each record is printed as one line,
+ * or with -c only counted, which is what the throughput measurements use.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/time.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+#include <linux/netfilter/xt_RINGLOG.h>
+
+#define RINGLOG_DIR	"/proc/net/xt_RINGLOG"
+#define MAX_RINGS	64
+
+struct ring {
+	int fd;
+	struct xt_ringlog_hdr *hdr;
+	size_t size;
+	unsigned long long drops;	/* already reported */
+};
+
+static struct ring rings[MAX_RINGS];
+static struct pollfd pfds[MAX_RINGS];
+static unsigned int nrings;
+
+static int count_only;
+static unsigned int interval;
+static int group = -1;
+
+static void print_rec(const struct xt_ringlog_rec *rec)
+{
+	const struct iphdr *iph = (const void *)rec->data;
+	char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+	unsigned int i;
+
+	printf("%llu.%06llu %sIN=%s OUT=%s", rec->tstamp / 1000000000ULL,
+	       rec->tstamp % 1000000000ULL / 1000, rec->prefix,
+	       rec->indev, rec->outdev);
+	if (rec->mac_len) {
+		printf(" MAC=");
+		for (i = 0; i < rec->mac_len; i++)
+			printf("%02x%c", rec->mac[i],
+			       i == rec->mac_len - 1U ? ' ' : ':');
+	} else
+		putchar(' ');
+	printf("GROUP=%u HOOK=%u MARK=0x%x LEN=%u", rec->group, rec->hook,
+	       rec->mark, rec->len);
+
+	if (rec->pf == AF_INET && rec->caplen >= sizeof(*iph)) {
+		inet_ntop(AF_INET, &iph->saddr, src, sizeof(src));
+		inet_ntop(AF_INET, &iph->daddr, dst, sizeof(dst));
+		printf(" SRC=%s DST=%s TTL=%u ID=%u PROTO=%u", src, dst,
+		       iph->ttl, ntohs(iph->id), iph->protocol);
+	}
+	putchar('\n');
+}
+
+/* Consume the records of one ring, returns how many there were */
+static unsigned int drain(struct ring *r)
+{
+	struct xt_ringlog_hdr *hdr = r->hdr;
+	const char *data = (const char *)hdr + hdr->data_offset;
+	const struct xt_ringlog_rec *rec;
+	unsigned int head, tail, n;
+
+	head = *(volatile __u32 *)&hdr->head;
+	/* Read the records only after head */
+	__sync_synchronize();
+	tail = hdr->tail;
+
+	for (n = 0; tail + n != head; n++) {
+		rec = (const void *)(data + ((tail + n) & (hdr->nr_recs - 1)) *
+				     hdr->rec_size);
+		if (count_only || (group >= 0 && rec->group != group))
+			continue;
+		print_rec(rec);
+	}
+
+	/* Done with the records before the kernel may reuse them */
+	__sync_synchronize();
+	*(volatile __u32 *)&hdr->tail = head;
+	return n;
+}
+
+static int open_rings(void)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct ring *r;
+	DIR *dir;
+
+	dir = opendir(RINGLOG_DIR);
+	if (dir == NULL) {
+		fprintf(stderr, "cannot open %s: %s (is xt_RINGLOG loaded?)\n",
+			RINGLOG_DIR, strerror(errno));
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL && nrings < MAX_RINGS) {
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), RINGLOG_DIR "/%s", de->d_name);
+		r = &rings[nrings];
+		r->fd = open(path, O_RDWR);
+		if (r->fd < 0)
+			goto err;
+
+		/* Map the header first to learn the size */
+		r->hdr = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED,
+			      r->fd, 0);
+		if (r->hdr == MAP_FAILED)
+			goto err;
+		if (r->hdr->version != XT_RINGLOG_VERSION) {
+			fprintf(stderr, "%s: unknown version %u\n", path,
+				r->hdr->version);
+			closedir(dir);
+			return -1;
+		}
+		r->size = r->hdr->data_offset +
+			  (size_t)r->hdr->nr_recs * r->hdr->rec_size;
+		munmap(r->hdr, getpagesize());
+
+		r->hdr = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, r->fd, 0);
+		if (r->hdr == MAP_FAILED)
+			goto err;
+		r->drops = r->hdr->drops;
+		pfds[nrings].fd = r->fd;
+		pfds[nrings].events = POLLIN;
+		nrings++;
+	}
+	closedir(dir);
+	return nrings ? 0 : -1;
+
+err:
+	fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	closedir(dir);
+	return -1;
+}
+
+static unsigned long long total_drops(void)
+{
+	unsigned long long drops = 0;
+	unsigned int i;
+
+	for (i = 0; i < nrings; i++)
+		drops += rings[i].hdr->drops - rings[i].drops;
+	return drops;
+}
+
+static void print_help(const char *name)
+{
+	printf("Usage: %s [-c] [-g group] [-i seconds]\n"
+	       "  -c, --count          count records instead of printing them\n"
+	       "  -g, --group NUM      print only the records of a group\n"
+	       "  -i, --interval SEC   report records and drops per second\n",
+	       name);
+}
+
+static const struct option options[] = {
+	{ .name = "count",    .has_arg = 0, .val = 'c' },
+	{ .name = "group",    .has_arg = 1, .val = 'g' },
+	{ .name = "interval", .has_arg = 1, .val = 'i' },
+	{ .name = "help",     .has_arg = 0, .val = 'h' },
+	{NULL},
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned long long records = 0, last_records = 0, last_drops = 0;
+	struct timeval now, last;
+	unsigned int i, n;
+	double secs;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "cg:i:h", options, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			count_only = 1;
+			break;
+		case 'g':
+			group = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'h':
+			print_help(argv[0]);
+			exit(0);
+		default:
+			print_help(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (open_rings() < 0)
+		exit(1);
+
+	gettimeofday(&last, NULL);
+	for (;;) {
+		for (n = 0, i = 0; i < nrings; i++)
+			n += drain(&rings[i]);
+		records += n;
+
+		if (interval) {
+			gettimeofday(&now, NULL);
+			secs = now.tv_sec - last.tv_sec +
+			       (now.tv_usec - last.tv_usec) / 1e6;
+			if (secs >= interval) {
+				fprintf(stderr, "%.0f records/s, %.0f drops/s\n",
+					(records - last_records) / secs,
+					(total_drops() - last_drops) / secs);
+				last_records = records;
+				last_drops = total_drops();
+				last = now;
+			}
+		}
+
+		if (n)
+			continue;
+		fflush(stdout);
+		if (poll(pfds, nrings, interval ? interval * 1000 : -1) < 0 &&
+		    errno != EINTR) {
+			perror("poll");
+			exit(1);
+		}
+	}
+}
@@ -28,19 +28,45 @@
 
 #include <asm/rheap.h>
 #include <linux/spinlock.h>
+#include <linux/list.h>
 
 /*
  * Cache-SRAM
  */
 
+#define MPC85XX_CACHE_SRAM_NAME_LEN	16
+
+/*
+ * Every user of the SRAM allocates under a client name, so that each one
+ * can be given a budget and its usage shows up in sysfs. A client that
+ * hits its budget (or finds the SRAM full) gets NULL and is expected to
+ * fall back to DDR; such fallbacks are counted as well.
+ */
+struct mpc85xx_cache_sram_client {
+	struct list_head list;
+	char name[MPC85XX_CACHE_SRAM_NAME_LEN];
+	unsigned int budget;	/* bytes, 0 keeps the client out of SRAM */
+	unsigned int used;
+	unsigned int peak;
+	unsigned int fallbacks;
+};
+
 struct mpc85xx_cache_sram {
 	phys_addr_t base_phys;
 	void *base_virt;
 	unsigned int size;
+	unsigned int used;
 	rh_info_t *rh;
 	spinlock_t lock;
+	struct list_head clients;
 };
 
+extern void *mpc85xx_cache_sram_alloc_client(const char *name,
+		unsigned int size, phys_addr_t *phys, unsigned int align);
+extern void mpc85xx_cache_sram_free_client(const char *name, void *ptr);
+extern int mpc85xx_cache_sram_set_budget(const char *name,
+		unsigned int budget);
+
 extern void mpc85xx_cache_sram_free(void *ptr);
 extern void *mpc85xx_cache_sram_alloc(unsigned int size,
 				  phys_addr_t *phys, unsigned int align);
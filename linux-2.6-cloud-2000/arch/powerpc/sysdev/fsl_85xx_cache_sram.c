@@ -35,10 +35,49 @@
 
 struct mpc85xx_cache_sram *cache_sram;
 
-void *mpc85xx_cache_sram_alloc(unsigned int size,
-				phys_addr_t *phys, unsigned int align)
+/* "name:bytes,..." budgets given with cache-sram-budget= */
+static char *sram_budgets;
+
+static int __init get_budgets_from_cmdline(char *str)
+{
+	if (!str)
+		return 0;
+
+	sram_budgets = str;
+	return 1;
+}
+
+__setup("cache-sram-budget=", get_budgets_from_cmdline);
+
+/* Look up a client, creating it with no budget limit. Lock held. */
+static struct mpc85xx_cache_sram_client *cache_sram_client(const char *name,
+		int create)
+{
+	struct mpc85xx_cache_sram_client *client;
+
+	list_for_each_entry(client, &cache_sram->clients, list)
+		if (!strncmp(client->name, name, sizeof(client->name)))
+			return client;
+
+	if (!create)
+		return NULL;
+
+	client = kzalloc(sizeof(*client), GFP_ATOMIC);
+	if (!client)
+		return NULL;
+
+	strlcpy(client->name, name, sizeof(client->name));
+	client->budget = cache_sram->size;
+	list_add_tail(&client->list, &cache_sram->clients);
+
+	return client;
+}
+
+void *mpc85xx_cache_sram_alloc_client(const char *name, unsigned int size,
+		phys_addr_t *phys, unsigned int align)
 {
-	unsigned long offset;
+	struct mpc85xx_cache_sram_client *client;
+	unsigned long offset = -ENOMEM;
 	unsigned long flags;
 
 	if (unlikely(cache_sram == NULL))
@@ -56,8 +95,29 @@ void *mpc85xx_cache_sram_alloc(unsigned int size,
 		return NULL;
 	}
 
+	/* Account what the heap really hands out */
+	size = (size + cache_sram->rh->alignment - 1) &
+			~(cache_sram->rh->alignment - 1);
+
 	spin_lock_irqsave(&cache_sram->lock, flags);
-	offset = rh_alloc_align(cache_sram->rh, size, align, NULL);
+	client = cache_sram_client(name, 1);
+	if (!client)
+		goto out;
+
+	if (size <= client->budget - min(client->used, client->budget))
+		offset = rh_alloc_align(cache_sram->rh, size, align,
+					client->name);
+
+	if (IS_ERR_VALUE(offset)) {
+		client->fallbacks++;
+		goto out;
+	}
+
+	client->used += size;
+	if (client->used > client->peak)
+		client->peak = client->used;
+	cache_sram->used += size;
+out:
 	spin_unlock_irqrestore(&cache_sram->lock, flags);
 
 	if (IS_ERR_VALUE(offset))
@@ -67,19 +127,146 @@ void *mpc85xx_cache_sram_alloc(unsigned int size,
 
 	return (unsigned char *)cache_sram->base_virt + offset;
 }
-EXPORT_SYMBOL(mpc85xx_cache_sram_alloc);
+EXPORT_SYMBOL(mpc85xx_cache_sram_alloc_client);
 
-void mpc85xx_cache_sram_free(void *ptr)
+void mpc85xx_cache_sram_free_client(const char *name, void *ptr)
 {
+	struct mpc85xx_cache_sram_client *client;
 	unsigned long flags;
+	int size;
+
 	BUG_ON(!ptr);
 
 	spin_lock_irqsave(&cache_sram->lock, flags);
-	rh_free(cache_sram->rh, ptr - cache_sram->base_virt);
+	size = rh_free(cache_sram->rh, ptr - cache_sram->base_virt);
+	client = cache_sram_client(name, 0);
+	if (size > 0) {
+		if (client)
+			client->used -= min_t(unsigned int, size, client->used);
+		cache_sram->used -= size;
+	}
 	spin_unlock_irqrestore(&cache_sram->lock, flags);
 }
+EXPORT_SYMBOL(mpc85xx_cache_sram_free_client);
+
+/*
+ * Limit what a client may hold from now on; memory it already owns is
+ * not taken back. A budget of 0 keeps the client in DDR.
+ */
+int mpc85xx_cache_sram_set_budget(const char *name, unsigned int budget)
+{
+	struct mpc85xx_cache_sram_client *client;
+	unsigned long flags;
+
+	if (unlikely(cache_sram == NULL))
+		return -ENODEV;
+
+	spin_lock_irqsave(&cache_sram->lock, flags);
+	client = cache_sram_client(name, 1);
+	if (client)
+		client->budget = min(budget, cache_sram->size);
+	spin_unlock_irqrestore(&cache_sram->lock, flags);
+
+	return client ? 0 : -ENOMEM;
+}
+EXPORT_SYMBOL(mpc85xx_cache_sram_set_budget);
+
+void *mpc85xx_cache_sram_alloc(unsigned int size,
+				phys_addr_t *phys, unsigned int align)
+{
+	return mpc85xx_cache_sram_alloc_client("misc", size, phys, align);
+}
+EXPORT_SYMBOL(mpc85xx_cache_sram_alloc);
+
+void mpc85xx_cache_sram_free(void *ptr)
+{
+	mpc85xx_cache_sram_free_client("misc", ptr);
+}
 EXPORT_SYMBOL(mpc85xx_cache_sram_free);
 
+static ssize_t show_cache_sram_size(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", cache_sram->size);
+}
+
+static DEVICE_ATTR(cache_sram_size, 0444, show_cache_sram_size, NULL);
+
+static ssize_t show_cache_sram_used(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", cache_sram->used);
+}
+
+static DEVICE_ATTR(cache_sram_used, 0444, show_cache_sram_used, NULL);
+
+static ssize_t show_cache_sram_clients(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct mpc85xx_cache_sram_client *client;
+	unsigned long flags;
+	ssize_t len;
+
+	len = sprintf(buf, "%-16s %10s %10s %10s %10s\n",
+			"client", "used", "peak", "budget", "fallbacks");
+
+	spin_lock_irqsave(&cache_sram->lock, flags);
+	list_for_each_entry(client, &cache_sram->clients, list) {
+		if (len > PAGE_SIZE - 64)
+			break;
+		len += sprintf(buf + len, "%-16s %10u %10u %10u %10u\n",
+				client->name, client->used, client->peak,
+				client->budget, client->fallbacks);
+	}
+	spin_unlock_irqrestore(&cache_sram->lock, flags);
+
+	return len;
+}
+
+/* "echo <client> <bytes> > cache_sram_clients" sets a budget */
+static ssize_t set_cache_sram_clients(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	char name[MPC85XX_CACHE_SRAM_NAME_LEN];
+	char budget[24];
+	int err;
+
+	if (sscanf(buf, "%15s %23s", name, budget) != 2)
+		return -EINVAL;
+
+	err = mpc85xx_cache_sram_set_budget(name, memparse(budget, NULL));
+
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(cache_sram_clients, 0644, show_cache_sram_clients,
+		set_cache_sram_clients);
+
+static void __init cache_sram_parse_budgets(void)
+{
+	char name[MPC85XX_CACHE_SRAM_NAME_LEN];
+	char *s = sram_budgets;
+	char *colon, *next;
+	size_t len;
+
+	while (s && *s) {
+		colon = strchr(s, ':');
+		next = strchr(s, ',');
+
+		if (colon && (!next || colon < next)) {
+			len = min_t(size_t, colon - s, sizeof(name) - 1);
+			memcpy(name, s, len);
+			name[len] = '\0';
+			mpc85xx_cache_sram_set_budget(name,
+					memparse(colon + 1, NULL));
+		} else {
+			pr_warning("cache-sram: bad budget \"%s\"\n", s);
+		}
+
+		s = next ? next + 1 : NULL;
+	}
+}
+
 int __init instantiate_cache_sram(struct of_device *dev,
 		struct sram_parameters sram_params)
 {
@@ -126,6 +313,13 @@ int __init instantiate_cache_sram(struct of_device *dev,
 
 	rh_attach_region(cache_sram->rh, 0, cache_sram->size);
 	spin_lock_init(&cache_sram->lock);
+	INIT_LIST_HEAD(&cache_sram->clients);
+	cache_sram_parse_budgets();
+
+	if (device_create_file(&dev->dev, &dev_attr_cache_sram_size) ||
+	    device_create_file(&dev->dev, &dev_attr_cache_sram_used) ||
+	    device_create_file(&dev->dev, &dev_attr_cache_sram_clients))
+		dev_warn(&dev->dev, "Can't create cache-sram sysfs files\n");
 
 	dev_info(&dev->dev, "[base:0x%llx, size:0x%x] configured and loaded\n",
 		(unsigned long long)cache_sram->base_phys, cache_sram->size);
@@ -145,8 +339,19 @@ out_free:
 
 void remove_cache_sram(struct of_device *dev)
 {
+	struct mpc85xx_cache_sram_client *client, *tmp;
+
 	BUG_ON(!cache_sram);
 
+	device_remove_file(&dev->dev, &dev_attr_cache_sram_clients);
+	device_remove_file(&dev->dev, &dev_attr_cache_sram_used);
+	device_remove_file(&dev->dev, &dev_attr_cache_sram_size);
+
+	list_for_each_entry_safe(client, tmp, &cache_sram->clients, list) {
+		list_del(&client->list);
+		kfree(client);
+	}
+
 	rh_detach_region(cache_sram->rh, 0, cache_sram->size);
 	rh_destroy(cache_sram->rh);
 
@@ -26,6 +26,11 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/rtnetlink.h>
+#include <linux/slab.h>
+#include <crypto/aead.h>
+#include <crypto/authenc.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -49,6 +54,7 @@ static char *alg = NULL;
 static u32 type;
 static u32 mask;
 static int mode;
+static unsigned int threads;
 static char *tvmem[TVMEMSIZE];
 
 static char *check[] = {
@@ -711,6 +717,261 @@ out:
 	crypto_free_ahash(tfm);
 }
 
+/*
+ * Multi-threaded AEAD throughput, as seen by IPsec ESP: every thread is
+ * bound to a cpu and keeps AEAD_SPEED_DEPTH requests in flight, each
+ * completion resubmitting its request until the time is up.
+ */
+#define AEAD_SPEED_DEPTH	8
+#define AEAD_SPEED_ASSOCLEN	8	/* SPI and sequence number */
+#define AEAD_SPEED_AUTHSIZE	12	/* HMAC-SHA1-96 */
+#define AEAD_SPEED_MAXLEN	1536
+
+static unsigned int aead_speed_sizes[] = { 64, 128, 256, 512, 1024, 1500, 0 };
+
+struct aead_speed_thread;
+
+struct aead_speed_slot {
+	struct aead_speed_thread *t;
+	struct aead_request *req;
+	struct scatterlist sg;
+	struct scatterlist asg;
+	char *buf;
+	u8 iv[32];
+};
+
+struct aead_speed_thread {
+	struct crypto_aead *tfm;
+	unsigned int len;
+	unsigned long deadline;
+	atomic_t inflight;
+	atomic_long_t ops;
+	int err;
+	struct completion done;
+	struct completion exited;
+	struct aead_speed_slot slot[AEAD_SPEED_DEPTH];
+};
+
+/* 0 while the request is in flight or the time is up, error otherwise */
+static int aead_speed_issue(struct aead_speed_slot *slot)
+{
+	struct aead_speed_thread *t = slot->t;
+	int ret;
+
+	do {
+		if (!time_before(jiffies, t->deadline))
+			return -ETIME;
+		ret = crypto_aead_encrypt(slot->req);
+		if (ret == -EINPROGRESS || ret == -EBUSY)
+			return 0;
+		if (!ret)
+			atomic_long_inc(&t->ops);
+	} while (!ret);
+
+	return ret;
+}
+
+static void aead_speed_complete(struct crypto_async_request *req, int err)
+{
+	struct aead_speed_slot *slot = req->data;
+	struct aead_speed_thread *t = slot->t;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	if (err)
+		t->err = err;
+	else
+		atomic_long_inc(&t->ops);
+
+	if (!err && !aead_speed_issue(slot))
+		return;
+
+	if (atomic_dec_and_test(&t->inflight))
+		complete(&t->done);
+}
+
+static int aead_speed_fn(void *data)
+{
+	struct aead_speed_thread *t = data;
+	int i, ret;
+
+	/* the thread holds a reference of its own while it submits */
+	atomic_set(&t->inflight, 1);
+	for (i = 0; i < AEAD_SPEED_DEPTH; i++) {
+		atomic_inc(&t->inflight);
+		ret = aead_speed_issue(&t->slot[i]);
+		if (ret) {
+			if (ret != -ETIME)
+				t->err = ret;
+			atomic_dec(&t->inflight);
+		}
+	}
+	if (!atomic_dec_and_test(&t->inflight))
+		wait_for_completion(&t->done);
+
+	complete(&t->exited);
+	return 0;
+}
+
+static void aead_speed_free(struct aead_speed_thread *t)
+{
+	int i;
+
+	for (i = 0; i < AEAD_SPEED_DEPTH; i++) {
+		aead_request_free(t->slot[i].req);
+		kfree(t->slot[i].buf);
+	}
+}
+
+static int aead_speed_alloc(struct aead_speed_thread *t)
+{
+	struct aead_speed_slot *slot;
+	int i;
+
+	for (i = 0; i < AEAD_SPEED_DEPTH; i++) {
+		slot = &t->slot[i];
+		slot->t = t;
+		slot->buf = kzalloc(AEAD_SPEED_ASSOCLEN + AEAD_SPEED_MAXLEN +
+				    AEAD_SPEED_AUTHSIZE, GFP_KERNEL);
+		slot->req = aead_request_alloc(t->tfm, GFP_KERNEL);
+		if (!slot->buf || !slot->req)
+			return -ENOMEM;
+
+		aead_request_set_callback(slot->req,
+					  CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  aead_speed_complete, slot);
+		sg_init_one(&slot->asg, slot->buf, AEAD_SPEED_ASSOCLEN);
+		aead_request_set_assoc(slot->req, &slot->asg,
+				       AEAD_SPEED_ASSOCLEN);
+	}
+
+	return 0;
+}
+
+static void test_aead_speed_mt(const char *algo, unsigned int sec)
+{
+	struct aead_speed_thread *t;
+	unsigned int nthreads, bs, len;
+	unsigned long ops, deadline;
+	struct rtattr *rta;
+	struct crypto_authenc_key_param *param;
+	u8 key[RTA_SPACE(sizeof(*param)) + 20 + 16];
+	int cpu, i, j, n, err;
+
+	nthreads = threads ? threads : num_online_cpus();
+	if (!sec)
+		sec = 1;
+
+	printk(KERN_INFO "\ntesting speed of %s, %u threads, "
+	       "%d requests in flight each\n", algo, nthreads,
+	       AEAD_SPEED_DEPTH);
+
+	t = kcalloc(nthreads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return;
+
+	/* authenc key blob: parameters, hmac key, cipher key */
+	memset(key, 0x5a, sizeof(key));
+	rta = (struct rtattr *)key;
+	rta->rta_type = CRYPTO_AUTHENC_KEYA_PARAM;
+	rta->rta_len = RTA_LENGTH(sizeof(*param));
+	param = RTA_DATA(rta);
+	param->enckeylen = cpu_to_be32(16);
+
+	for (i = 0; i < nthreads; i++) {
+		t[i].tfm = crypto_alloc_aead(algo, 0, 0);
+		if (IS_ERR(t[i].tfm)) {
+			pr_err("failed to load transform for %s: %ld\n",
+			       algo, PTR_ERR(t[i].tfm));
+			t[i].tfm = NULL;
+			goto out;
+		}
+		if (crypto_aead_setkey(t[i].tfm, key, sizeof(key)) ||
+		    crypto_aead_setauthsize(t[i].tfm, AEAD_SPEED_AUTHSIZE)) {
+			pr_err("setkey/setauthsize failed for %s\n", algo);
+			goto out;
+		}
+		if (aead_speed_alloc(&t[i])) {
+			pr_err("aead request allocation failure\n");
+			goto out;
+		}
+	}
+
+	for (i = 0; aead_speed_sizes[i]; i++) {
+		/* ESP pads the payload to the cipher block */
+		bs = crypto_aead_blocksize(t[0].tfm);
+		len = ALIGN(aead_speed_sizes[i], bs);
+		err = 0;
+		ops = 0;
+
+		for (j = 0; j < nthreads; j++) {
+			for (n = 0; n < AEAD_SPEED_DEPTH; n++) {
+				struct aead_speed_slot *slot = &t[j].slot[n];
+
+				sg_init_one(&slot->sg,
+					    slot->buf + AEAD_SPEED_ASSOCLEN,
+					    len + AEAD_SPEED_AUTHSIZE);
+				aead_request_set_crypt(slot->req, &slot->sg,
+						       &slot->sg, len,
+						       slot->iv);
+			}
+			t[j].len = len;
+			t[j].err = 0;
+			atomic_long_set(&t[j].ops, 0);
+			init_completion(&t[j].done);
+			init_completion(&t[j].exited);
+		}
+
+		/* start all threads against the same deadline */
+		deadline = jiffies + sec * HZ;
+		cpu = -1;
+		for (j = 0; j < nthreads; j++) {
+			struct task_struct *tsk;
+
+			t[j].deadline = deadline;
+			tsk = kthread_create(aead_speed_fn, &t[j],
+					     "tcrypt_aead/%d", j);
+			if (IS_ERR(tsk)) {
+				complete(&t[j].exited);
+				err = PTR_ERR(tsk);
+				continue;
+			}
+			cpu = cpumask_next(cpu, cpu_online_mask);
+			if (cpu >= nr_cpu_ids)
+				cpu = cpumask_first(cpu_online_mask);
+			kthread_bind(tsk, cpu);
+			wake_up_process(tsk);
+		}
+
+		for (j = 0; j < nthreads; j++) {
+			wait_for_completion(&t[j].exited);
+			ops += atomic_long_read(&t[j].ops);
+			if (t[j].err)
+				err = t[j].err;
+		}
+
+		if (err) {
+			pr_err("encryption failed ret=%d\n", err);
+			break;
+		}
+
+		printk(KERN_INFO "test%3u (%4u byte packets): %lu ops in "
+		       "%u s, %lu ops/s, %lu Mbit/s\n", i,
+		       aead_speed_sizes[i], ops, sec, ops / sec,
+		       ops / sec * aead_speed_sizes[i] * 8 / 1000000);
+	}
+
+out:
+	for (i = 0; i < nthreads; i++) {
+		if (!t[i].tfm)
+			break;
+		aead_speed_free(&t[i]);
+		crypto_free_aead(t[i].tfm);
+	}
+	kfree(t);
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -1215,6 +1476,10 @@ static int do_test(int m)
 	case 499:
 		break;
 
+	case 500:
+		test_aead_speed_mt("authenc(hmac(sha1),cbc(aes))", sec);
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -1283,6 +1548,9 @@ module_param(mode, int, 0);
 module_param(sec, uint, 0);
 MODULE_PARM_DESC(sec, "Length in seconds of speed tests "
 		      "(defaults to zero which uses CPU cycles instead)");
+module_param(threads, uint, 0);
+MODULE_PARM_DESC(threads, "Threads for the multi-threaded speed tests "
+			  "(defaults to one per online cpu)");
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Quick & dirty crypto testing module");
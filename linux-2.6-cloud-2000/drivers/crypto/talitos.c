@@ -55,6 +55,10 @@
 #include <linux/etherdevice.h>
 #include <linux/ip.h>
 
+#ifdef CONFIG_FSL_85XX_CACHE_SRAM
+#include <asm/fsl_85xx_cache_sram.h>
+#endif
+
 #include "talitos.h"
 #ifdef CONFIG_AS_FASTPATH
 struct secfp_ivInfo_s {
@@ -78,6 +82,17 @@ struct secfp_ivInfo_s {
 #define PRIMARY_EU(desc_hdr) ((be32_to_cpu(desc_hdr) >> 28) & 0xf)
 #define SECONDARY_EU(desc_hdr) ((be32_to_cpu(desc_hdr) >> 16) & 0xf)
 
+/*
+ * Doorbell batching: while this many descriptors are already in a
+ * channel's fetch fifo, new ones are only queued in software and are
+ * written to the h/w by the done handler, but never more than
+ * TALITOS_BATCH_MAX at a time.
+ */
+#define TALITOS_BATCH_INFLIGHT	4
+#define TALITOS_BATCH_MAX	8
+/* requests per core group held back while all its channels are full */
+#define TALITOS_BACKLOG_LEN	256
+
 #define MAP_ARRAY(chan_no)	(3 << (chan_no * 2))
 #define MAP_ARRAY_DONE(chan_no)	(1 << (chan_no * 2))
 #define MAX_DESC_LEN   160
@@ -108,10 +123,34 @@ struct talitos_request {
 	void (*callback) (struct device *dev, struct talitos_desc *desc,
 	                  void *context, int error);
 	void *context;
+	/* left the backlog, to be told -EINPROGRESS before it completes */
+	struct crypto_async_request *areq;
+};
+
+/**
+ * talitos_backlog_req - request waiting for room in the channel fifos
+ * @areq: crypto request accepted with -EBUSY, to notify with -EINPROGRESS
+ *	  once it has left the backlog
+ */
+struct talitos_backlog_req {
+	struct list_head list;
+	struct talitos_desc *desc;
+	void (*callback) (struct device *dev, struct talitos_desc *desc,
+			  void *context, int error);
+	void *context;
+	struct crypto_async_request *areq;
+};
+
+struct talitos_backlog {
+	spinlock_t lock;
+	struct list_head list;
+	unsigned int len;
 };
 
 /* per-channel fifo management */
 struct talitos_channel {
+	/* protects the fifo indexes and submit_count */
+	spinlock_t lock;
 	/* request fifo */
 	struct talitos_request *fifo;
 	/* number of requests pending in channel h/w fifo */
@@ -120,8 +159,12 @@ struct talitos_channel {
 	u8 head;
 	/* index to next in-progress/done descriptor request */
 	u8 tail;
+	/* index to first request not yet written to the fetch fifo */
+	u8 hw_head;
 	/* Channel id */
 	u8 id;
+	/* request fifo lives in L2 cache-SRAM */
+	u8 fifo_in_sram;
 	struct talitos_private *priv;
 };
 
@@ -154,7 +197,7 @@ struct talitos_private {
 
 	/* next channel to be assigned next incoming
 		descriptor */
-	u8 last_chan[MAX_GROUPS];
+	atomic_t last_chan[MAX_GROUPS];
 	u32 chan_isr[MAX_GROUPS];
 	u32 chan_imr[MAX_GROUPS];
 	/* number of channels mapped to a core */
@@ -171,6 +214,9 @@ struct talitos_private {
 	/* request callback napi */
 	struct napi_struct *done_task;
 
+	/* requests waiting for a free channel slot, per core group */
+	struct talitos_backlog backlog[MAX_GROUPS];
+
 	/* list of registered algorithms */
 	struct list_head alg_list;
 
@@ -423,74 +469,265 @@ static int init_device(struct device *dev)
 	return 0;
 }
 
+/* requests the channel holds, whether already fetched or not */
+static inline int chan_inflight(struct talitos_private *priv,
+				struct talitos_channel *chan)
+{
+	return chan->submit_count + priv->chfifo_len - 1;
+}
+
+/* requests queued since the last doorbell */
+static inline int chan_unpushed(struct talitos_private *priv,
+				struct talitos_channel *chan)
+{
+	return (chan->head - chan->hw_head) & (priv->fifo_len - 1);
+}
+
+/*
+ * write the requests queued since the last doorbell to the channel
+ * fetch fifo, with a single barrier for the batch; chan->lock held
+ */
+static void talitos_push(struct talitos_private *priv,
+			 struct talitos_channel *chan)
+{
+	struct talitos_request *request;
+	u8 i = chan->hw_head;
+
+	if (i == chan->head)
+		return;
+
+	/* GO! */
+	wmb();
+	do {
+		request = &chan->fifo[i];
+		out_be32(priv->reg + TALITOS_FF(chan->id, priv),
+			cpu_to_be32(upper_32_bits(request->dma_desc)));
+		out_be32(priv->reg + TALITOS_FF_LO(chan->id, priv),
+			cpu_to_be32(lower_32_bits(request->dma_desc)));
+		i = (i + 1) & (priv->fifo_len - 1);
+	} while (i != chan->head);
+
+	chan->hw_head = i;
+}
+
+/*
+ * pick the channel of this core group with the fewest requests queued,
+ * starting after the one used last so that equally loaded channels
+ * take turns
+ */
+static struct talitos_channel *talitos_pick_chan(struct talitos_private *priv,
+						 int grp_id)
+{
+	struct talitos_channel *chan, *best = NULL;
+	u8 total_chan = priv->core_num_chan[grp_id];
+	unsigned int first;
+	u8 i;
+
+	/* a group need not have a power of 2 channels */
+	first = (unsigned int)atomic_inc_return(&priv->last_chan[grp_id]) %
+		total_chan;
+	for (i = 0; i < total_chan; i++) {
+		chan = priv->chan +
+		       priv->core_chan_no[grp_id][(first + i) % total_chan];
+		if (!best || chan->submit_count < best->submit_count)
+			best = chan;
+	}
+
+	return best;
+}
+
+/*
+ * queue a request on the least loaded channel of the group; with
+ * @push the doorbell is rung unless the channel is busy enough for the
+ * done handler to do it for a whole batch. -EAGAIN if all are full.
+ * @areq, if set, is told -EINPROGRESS by the done handler.
+ */
+static int talitos_queue(struct device *dev, int grp_id,
+			 struct talitos_desc *desc,
+			 void (*callback)(struct device *dev,
+					  struct talitos_desc *desc,
+					  void *context, int error),
+			 void *context, struct crypto_async_request *areq,
+			 int push)
+{
+	struct talitos_private *priv = dev_get_drvdata(dev);
+	struct talitos_channel *chan;
+	struct talitos_request *request;
+	unsigned long flags;
+	int unpushed;
+
+	chan = talitos_pick_chan(priv, grp_id);
+
+	spin_lock_irqsave(&chan->lock, flags);
+
+	if (chan->submit_count >= 0) {
+		/* h/w fifo is full */
+		spin_unlock_irqrestore(&chan->lock, flags);
+		return -EAGAIN;
+	}
+	++chan->submit_count;
+
+	request = &chan->fifo[chan->head];
+
+	/* map descriptor and save caller data */
+	request->dma_desc = dma_map_single(dev, desc, sizeof(*desc),
+					   DMA_BIDIRECTIONAL);
+	request->callback = callback;
+	request->context = context;
+	request->areq = areq;
+
+	/* increment fifo head */
+	chan->head = (chan->head + 1) & (priv->fifo_len - 1);
+
+	smp_wmb();
+	request->desc = desc;
+
+	unpushed = chan_unpushed(priv, chan);
+	if (push && (chan_inflight(priv, chan) - unpushed <
+		     TALITOS_BATCH_INFLIGHT || unpushed >= TALITOS_BATCH_MAX))
+		talitos_push(priv, chan);
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+
+	return 0;
+}
+
+/* ring the doorbell of every channel of the group that has requests queued */
+static void talitos_push_group(struct talitos_private *priv, int grp_id)
+{
+	struct talitos_channel *chan;
+	unsigned long flags;
+	u8 i;
+
+	for (i = 0; i < priv->core_num_chan[grp_id]; i++) {
+		chan = priv->chan + priv->core_chan_no[grp_id][i];
+		if (chan->hw_head == chan->head)
+			continue;
+		spin_lock_irqsave(&chan->lock, flags);
+		talitos_push(priv, chan);
+		spin_unlock_irqrestore(&chan->lock, flags);
+	}
+}
+
+static int talitos_group_full(struct talitos_private *priv, int grp_id)
+{
+	u8 i;
+
+	for (i = 0; i < priv->core_num_chan[grp_id]; i++)
+		if (priv->chan[priv->core_chan_no[grp_id][i]].submit_count < 0)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * move backlogged requests to the channels while they have room. The
+ * doorbells are left to the caller. The done handler tells each request
+ * that it is in progress before it completes.
+ */
+static void talitos_drain_backlog(struct device *dev, int grp_id)
+{
+	struct talitos_private *priv = dev_get_drvdata(dev);
+	struct talitos_backlog *bl = &priv->backlog[grp_id];
+	struct talitos_backlog_req *req;
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&bl->lock, flags);
+		if (list_empty(&bl->list) || talitos_group_full(priv, grp_id)) {
+			spin_unlock_irqrestore(&bl->lock, flags);
+			return;
+		}
+		req = list_first_entry(&bl->list, struct talitos_backlog_req,
+				       list);
+		list_del(&req->list);
+		bl->len--;
+		spin_unlock_irqrestore(&bl->lock, flags);
+
+		if (talitos_queue(dev, grp_id, req->desc, req->callback,
+				  req->context, req->areq, 0)) {
+			/* lost the slot to a new submission, keep our turn */
+			spin_lock_irqsave(&bl->lock, flags);
+			list_add(&req->list, &bl->list);
+			bl->len++;
+			spin_unlock_irqrestore(&bl->lock, flags);
+			return;
+		}
+		kfree(req);
+	}
+}
+
 /**
  * talitos_submit - submits a descriptor to the device for processing
  * @dev:	the SEC device to be used
  * @desc:	the descriptor to be processed by the device
  * @callback:	whom to call when processing is complete
  * @context:	a handle for use by caller (optional)
+ * @areq:	crypto request behind the descriptor (optional)
  *
  * desc must contain valid dma-mapped (bus physical) address pointers.
  * callback must check err and feedback in descriptor header
  * for device processing status.
+ *
+ * Returns -EINPROGRESS once the request is queued. When all channels of
+ * this core are full and @areq allows backlogging, it is put on a backlog
+ * instead and -EBUSY is returned; it is notified with -EINPROGRESS once
+ * it has left the backlog. -EAGAIN means the request was not taken.
  */
 static int talitos_submit(struct device *dev, struct talitos_desc *desc,
 			  void (*callback)(struct device *dev,
 					   struct talitos_desc *desc,
 					   void *context, int error),
-			  void *context)
+			  void *context, struct crypto_async_request *areq)
 {
 	struct talitos_private *priv = dev_get_drvdata(dev);
-	struct talitos_request *request;
-	u8 ch;
 	int grp_id = get_grp_id(priv);
+	struct talitos_backlog *bl = &priv->backlog[grp_id];
+	struct talitos_backlog_req *req;
+	unsigned long flags;
+	int ret;
 
-	u8 head, last_chan, total_chan;
-	if (priv->core_num_chan[grp_id] > 0) {
-		total_chan = priv->core_num_chan[grp_id];
-		last_chan = priv->last_chan[grp_id];
-		/* select done notification */
-		desc->hdr |= DESC_HDR_DONE_NOTIFY;
-
-		if (last_chan <  total_chan) {
-			ch = priv->core_chan_no[grp_id][last_chan];
-			priv->last_chan[grp_id]++;
-		} else {
-			ch = priv->core_chan_no[grp_id][0];
-			priv->last_chan[grp_id] = 1;
-		}
-		if (priv->chan[ch].submit_count != 0)
-			++priv->chan[ch].submit_count;
-		else
-			/* h/w fifo is full */
-			return -EAGAIN;
+	if (!priv->core_num_chan[grp_id])
+		return -EAGAIN;
 
-		head = priv->chan[ch].head;
-		request = &priv->chan[ch].fifo[head];
+	/* select done notification */
+	desc->hdr |= DESC_HDR_DONE_NOTIFY;
 
-		/* map descriptor and save caller data */
-		request->dma_desc = dma_map_single(dev, desc, sizeof(*desc),
-					   DMA_BIDIRECTIONAL);
-		request->callback = callback;
-		request->context = context;
+	if (!areq || !(areq->flags & CRYPTO_TFM_REQ_MAY_BACKLOG)) {
+		ret = talitos_queue(dev, grp_id, desc, callback, context,
+				    NULL, 1);
+		return ret ? ret : -EINPROGRESS;
+	}
 
-		/* increment fifo head */
-		priv->chan[ch].head = (priv->chan[ch].head + 1) &
-					(priv->fifo_len - 1);
+	/* don't overtake requests that are already waiting */
+	if (likely(list_empty(&bl->list)) &&
+	    !talitos_queue(dev, grp_id, desc, callback, context, NULL, 1))
+		return -EINPROGRESS;
 
-		smp_wmb();
-		request->desc = desc;
+	req = kmalloc(sizeof(*req), GFP_ATOMIC);
+	if (!req)
+		return -EAGAIN;
 
-		/* GO! */
-		wmb();
-		out_be32(priv->reg + TALITOS_FF(ch, priv),
-			cpu_to_be32(upper_32_bits(request->dma_desc)));
-		out_be32(priv->reg + TALITOS_FF_LO(ch, priv),
-			cpu_to_be32(lower_32_bits(request->dma_desc)));
-		return -EINPROGRESS;
-	} else {
+	req->desc = desc;
+	req->callback = callback;
+	req->context = context;
+	req->areq = areq;
+
+	spin_lock_irqsave(&bl->lock, flags);
+	if (bl->len >= TALITOS_BACKLOG_LEN) {
+		spin_unlock_irqrestore(&bl->lock, flags);
+		kfree(req);
 		return -EAGAIN;
 	}
+	list_add_tail(&req->list, &bl->list);
+	bl->len++;
+	spin_unlock_irqrestore(&bl->lock, flags);
+
+	/* the channels may have drained while we queued up */
+	talitos_drain_backlog(dev, grp_id);
+	talitos_push_group(priv, grp_id);
+
+	return -EBUSY;
 }
 
 #ifdef CONFIG_AS_FASTPATH
@@ -498,7 +735,7 @@ int secfp_talitos_submit(struct device *dev, struct talitos_desc *desc,
 	void (*callback) (struct device *dev, struct talitos_desc *desc,
 	void *context, int err), void *context)
 {
-	return talitos_submit(dev, desc, callback, context);
+	return talitos_submit(dev, desc, callback, context, NULL);
 }
 EXPORT_SYMBOL(secfp_talitos_submit);
 #endif /* CONFIG_AS_FASTPATH */
@@ -512,9 +749,12 @@ static int flush_channel(struct talitos_channel *chan, int error,
 	struct talitos_private *priv = chan->priv;
 	struct device *dev = &priv->ofdev->dev;
 	struct talitos_request *request, saved_req;
+	unsigned long flags;
 	int tail, status;
 	u8 count = 0;
 
+	spin_lock_irqsave(&chan->lock, flags);
+
 	tail = chan->tail;
 	while (chan->fifo[tail].desc && (count < weight)) {
 		request = &chan->fifo[tail];
@@ -537,6 +777,7 @@ static int flush_channel(struct talitos_channel *chan, int error,
 		saved_req.desc = request->desc;
 		saved_req.callback = request->callback;
 		saved_req.context = request->context;
+		saved_req.areq = request->areq;
 
 		/* release request entry in fifo */
 		smp_wmb();
@@ -544,16 +785,26 @@ static int flush_channel(struct talitos_channel *chan, int error,
 
 		/* increment fifo tail */
 		chan->tail  = (tail + 1) & (priv->fifo_len - 1);
+		/* flushed on error before its doorbell was rung */
+		if (chan->hw_head == tail)
+			chan->hw_head = chan->tail;
 		chan->submit_count -= 1;
+
+		spin_unlock_irqrestore(&chan->lock, flags);
+		if (saved_req.areq)
+			saved_req.areq->complete(saved_req.areq, -EINPROGRESS);
 		saved_req.callback(dev, saved_req.desc, saved_req.context,
 				   status);
 		count++;
 		/* channel may resume processing in single desc error case */
 		if (error && !reset_ch && status == error)
 			return 0;
+		spin_lock_irqsave(&chan->lock, flags);
 		tail = chan->tail;
 	}
-return count;
+
+	spin_unlock_irqrestore(&chan->lock, flags);
+	return count;
 }
 
 /*
@@ -574,6 +825,10 @@ static int talitos_done(struct napi_struct *napi, int budget)
 			work_done += flush_channel(priv->chan +
 					priv->core_chan_no[grp_id][ch]
 					, 0, 0, budget_per_channel);
+
+		/* refill the freed slots and ring each doorbell once */
+		talitos_drain_backlog(priv->dev, grp_id);
+		talitos_push_group(priv, grp_id);
 		if (work_done < budget) {
 			napi_complete(per_cpu_ptr(priv->done_task,
 						smp_processor_id()));
@@ -1026,7 +1281,7 @@ static void talitos_process_pending(struct talitos_xor_chan *xor_chan)
 
 	list_for_each_entry_safe(desc, _desc, &xor_chan->pending_q, node) {
 		status = talitos_submit(xor_chan->dev, &desc->hwdesc,
-					talitos_release_xor, desc);
+					talitos_release_xor, desc, NULL);
 		if (status != -EINPROGRESS)
 			break;
 
@@ -1744,8 +1999,8 @@ static int ipsec_esp(struct talitos_edesc *edesc, struct aead_request *areq,
 	map_single_talitos_ptr(dev, &desc->ptr[6], ivsize, ctx->iv, 0,
 			       DMA_FROM_DEVICE);
 
-	ret = talitos_submit(dev, desc, callback, areq);
-	if (ret != -EINPROGRESS) {
+	ret = talitos_submit(dev, desc, callback, areq, &areq->base);
+	if (ret != -EINPROGRESS && ret != -EBUSY) {
 		ipsec_esp_unmap(dev, edesc, areq);
 		crypto_edesc_free(edesc, priv);
 	}
@@ -2154,8 +2409,8 @@ static int common_nonsnoop(struct talitos_edesc *edesc,
 	to_talitos_ptr(&desc->ptr[6], 0);
 	desc->ptr[6].j_extent = 0;
 
-	ret = talitos_submit(dev, desc, callback, areq);
-	if (ret != -EINPROGRESS) {
+	ret = talitos_submit(dev, desc, callback, areq, &areq->base);
+	if (ret != -EINPROGRESS && ret != -EBUSY) {
 		common_nonsnoop_unmap(dev, edesc, areq);
 		crypto_edesc_free(edesc, priv);
 	}
@@ -2332,8 +2587,8 @@ static int common_nonsnoop_hash(struct talitos_edesc *edesc,
 	/* last DWORD empty */
 	desc->ptr[6] = zero_entry;
 
-	ret = talitos_submit(dev, desc, callback, areq);
-	if (ret != -EINPROGRESS) {
+	ret = talitos_submit(dev, desc, callback, areq, &areq->base);
+	if (ret != -EINPROGRESS && ret != -EBUSY) {
 		common_nonsnoop_hash_unmap(dev, edesc, areq);
 		kfree(edesc);
 	}
@@ -2934,6 +3189,43 @@ static int hw_supports(struct device *dev, __be32 desc_hdr_template)
 	return ret;
 }
 
+/*
+ * The request fifos are walked by every submit and done tasklet; keep
+ * them in L2 cache-SRAM when the "talitos" budget allows, DDR otherwise.
+ */
+static int talitos_alloc_fifo(struct talitos_channel *chan, size_t size)
+{
+#ifdef CONFIG_FSL_85XX_CACHE_SRAM
+	phys_addr_t phys;
+
+	chan->fifo = mpc85xx_cache_sram_alloc_client("talitos", size, &phys,
+				L1_CACHE_BYTES);
+	if (chan->fifo) {
+		memset(chan->fifo, 0, size);
+		chan->fifo_in_sram = 1;
+		return 0;
+	}
+#endif
+	chan->fifo = kzalloc(size, GFP_KERNEL);
+
+	return chan->fifo ? 0 : -ENOMEM;
+}
+
+static void talitos_free_fifo(struct talitos_channel *chan)
+{
+	if (!chan->fifo)
+		return;
+#ifdef CONFIG_FSL_85XX_CACHE_SRAM
+	if (chan->fifo_in_sram) {
+		mpc85xx_cache_sram_free_client("talitos", chan->fifo);
+		chan->fifo = NULL;
+		return;
+	}
+#endif
+	kfree(chan->fifo);
+	chan->fifo = NULL;
+}
+
 static int talitos_remove(struct of_device *ofdev)
 {
 	struct device *dev = &ofdev->dev;
@@ -2958,9 +3250,20 @@ static int talitos_remove(struct of_device *ofdev)
 	if (hw_supports(dev, DESC_HDR_SEL0_RNG))
 		talitos_unregister_rng(dev);
 
+	for (i = 0; i < MAX_GROUPS; i++) {
+		struct talitos_backlog_req *req, *tmp;
+
+		list_for_each_entry_safe(req, tmp, &priv->backlog[i].list,
+					 list) {
+			list_del(&req->list);
+			req->areq->complete(req->areq, -EINPROGRESS);
+			req->callback(dev, req->desc, req->context, -ENODEV);
+			kfree(req);
+		}
+	}
+
 	for (i = 0; i < priv->num_channels; i++)
-		if (priv->chan[i].fifo)
-			kfree(priv->chan[i].fifo);
+		talitos_free_fifo(&priv->chan[i]);
 
 	kfree(priv->chan);
 
@@ -3074,6 +3377,12 @@ static int talitos_probe(struct of_device *ofdev,
 	priv = kzalloc(sizeof(struct talitos_private), GFP_KERNEL);
 	if (!priv)
 		return -ENOMEM;
+
+	for (i = 0; i < MAX_GROUPS; i++) {
+		spin_lock_init(&priv->backlog[i].lock);
+		INIT_LIST_HEAD(&priv->backlog[i].list);
+	}
+
 	net_dev = alloc_percpu(struct net_device);
 	for_each_possible_cpu(i) {
 		(per_cpu_ptr(net_dev, i))->dev = *dev;
@@ -3235,6 +3544,8 @@ static int talitos_probe(struct of_device *ofdev,
 		priv->chan[i].priv = priv;
 		priv->chan[i].head = 0;
 		priv->chan[i].tail = 0;
+		priv->chan[i].hw_head = 0;
+		spin_lock_init(&priv->chan[i].lock);
 	}
 
 	priv->fifo_len = roundup_pow_of_two(priv->chfifo_len);
@@ -3243,9 +3554,9 @@ static int talitos_probe(struct of_device *ofdev,
 		/* save memory, remove if dynamic channel map is used */
 		if (!is_channel_used(i, priv))
 			continue;
-		priv->chan[i].fifo = kzalloc(sizeof(struct talitos_request) *
-					     priv->fifo_len, GFP_KERNEL);
-		if (!priv->chan[i].fifo) {
+		if (talitos_alloc_fifo(&priv->chan[i],
+				       sizeof(struct talitos_request) *
+				       priv->fifo_len)) {
 			dev_err(dev, "failed to allocate request fifo %d\n", i);
 			err = -ENOMEM;
 			goto err_out;
@@ -0,0 +1,376 @@
+/*
+ * Copy offload of large kernel memory copies to a DMA engine
+ *
+ * Copies of at least a per-client threshold are handed to a DMA_MEMCPY
+ * channel (fsldma on the 85xx) and polled for completion.  Anything the
+ * engine cannot take -- small, misaligned, highmem or vmalloc buffers,
+ * atomic context, no channel -- is copied by the cpu instead.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ */
+#include <linux/dma_copy.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/hardirq.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+/* A stuck engine is given up on after this long */
+#define DMA_COPY_TIMEOUT	msecs_to_jiffies(100)
+
+struct dma_copy_stats {
+	const char *name;
+	size_t threshold;		/* 0 keeps the client on the cpu */
+	atomic_long_t dma_copies;
+	atomic_long_t dma_bytes;
+	atomic_long_t cpu_copies;
+	atomic_long_t cpu_bytes;
+	atomic_long_t errors;
+};
+
+static struct dma_copy_stats dma_copy_clients[DMA_COPY_CLIENTS] = {
+	[DMA_COPY_UBIFS] = {
+		.name		= "ubifs",
+		.threshold	= 4096,
+	},
+	[DMA_COPY_SPLICE] = {
+		.name		= "splice",
+		.threshold	= 4096,
+	},
+};
+
+static int dma_copy_ready;
+static int dma_copy_broken;
+
+/* "name:bytes,..." thresholds given with dma-copy= */
+static char *dma_copy_thresholds;
+
+static int __init get_thresholds_from_cmdline(char *str)
+{
+	if (!str)
+		return 0;
+
+	dma_copy_thresholds = str;
+	return 1;
+}
+
+__setup("dma-copy=", get_thresholds_from_cmdline);
+
+static struct dma_copy_stats *dma_copy_lookup(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < DMA_COPY_CLIENTS; i++)
+		if (strlen(dma_copy_clients[i].name) == len &&
+		    !strncmp(dma_copy_clients[i].name, name, len))
+			return &dma_copy_clients[i];
+
+	return NULL;
+}
+
+static void dma_copy_account(struct dma_copy_stats *c, size_t len, int dma)
+{
+	if (dma) {
+		atomic_long_inc(&c->dma_copies);
+		atomic_long_add(len, &c->dma_bytes);
+	} else {
+		atomic_long_inc(&c->cpu_copies);
+		atomic_long_add(len, &c->cpu_bytes);
+	}
+}
+
+/* Pick a channel for a copy of @len bytes, NULL to stay on the cpu. */
+static struct dma_chan *dma_copy_chan(struct dma_copy_stats *c, size_t len)
+{
+	if (!dma_copy_ready || dma_copy_broken)
+		return NULL;
+
+	if (!c->threshold || len < c->threshold)
+		return NULL;
+
+	/* completion is only seen once the engine's interrupt has run */
+	if (in_interrupt() || irqs_disabled())
+		return NULL;
+
+	return dma_find_channel(DMA_MEMCPY);
+}
+
+/*
+ * Without coherent DMA the destination is invalidated on unmap, which
+ * must not take neighbouring data in a shared cache line with it.
+ */
+static int dma_copy_aligned(unsigned long dst, size_t len)
+{
+	unsigned long align = dma_get_cache_alignment();
+
+	return !((dst | len) & (align - 1));
+}
+
+/* The engine wants physically contiguous, directly mapped memory. */
+static int dma_copy_lowmem(const void *p, size_t len)
+{
+	unsigned long addr = (unsigned long)p;
+
+	return addr >= PAGE_OFFSET && addr + len <= (unsigned long)high_memory;
+}
+
+static int dma_copy_run(struct dma_chan *chan, dma_addr_t dst,
+		dma_addr_t src, size_t len)
+{
+	struct dma_device *dev = chan->device;
+	struct dma_async_tx_descriptor *tx;
+	enum dma_status status;
+	dma_cookie_t cookie;
+	unsigned long timeout;
+
+	tx = dev->device_prep_dma_memcpy(chan, dst, src, len,
+			DMA_CTRL_ACK | DMA_COMPL_SKIP_SRC_UNMAP |
+			DMA_COMPL_SKIP_DEST_UNMAP);
+	if (!tx)
+		return -ENOMEM;
+
+	tx->callback = NULL;
+	cookie = tx->tx_submit(tx);
+	if (cookie < 0)
+		return -EIO;
+
+	dma_async_issue_pending(chan);
+
+	timeout = jiffies + DMA_COPY_TIMEOUT;
+	while ((status = dma_async_is_tx_complete(chan, cookie, NULL, NULL))
+			== DMA_IN_PROGRESS) {
+		if (time_after(jiffies, timeout)) {
+			/* the engine must not write into memory we gave back */
+			dev->device_control(chan, DMA_TERMINATE_ALL, 0);
+			dma_copy_broken = 1;
+			printk(KERN_ERR "dma_copy: %s timed out, "
+			       "copy offload disabled\n", dma_chan_name(chan));
+			return -ETIMEDOUT;
+		}
+		cpu_relax();
+	}
+
+	return status == DMA_SUCCESS ? 0 : -EIO;
+}
+
+/**
+ * dma_copy - copy between kernel buffers, offloading large copies
+ * @client: caller, selects the threshold and statistics
+ * @dst: destination
+ * @src: source
+ * @len: length in bytes
+ *
+ * Behaves like memcpy().  Copies from interrupt context or with
+ * interrupts disabled stay on the cpu: completion is polled and needs
+ * the DMA interrupt to be delivered.
+ */
+void dma_copy(enum dma_copy_client client, void *dst, const void *src,
+		size_t len)
+{
+	struct dma_copy_stats *c = &dma_copy_clients[client];
+	struct dma_chan *chan = dma_copy_chan(c, len);
+	struct device *dev;
+	dma_addr_t d, s;
+	int err;
+
+	if (!chan || !dma_copy_lowmem(dst, len) || !dma_copy_lowmem(src, len) ||
+	    !dma_copy_aligned((unsigned long)dst, len))
+		goto cpu;
+
+	dev = chan->device->dev;
+	s = dma_map_single(dev, (void *)src, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, s))
+		goto error;
+	d = dma_map_single(dev, dst, len, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, d)) {
+		dma_unmap_single(dev, s, len, DMA_TO_DEVICE);
+		goto error;
+	}
+
+	err = dma_copy_run(chan, d, s, len);
+
+	dma_unmap_single(dev, d, len, DMA_FROM_DEVICE);
+	dma_unmap_single(dev, s, len, DMA_TO_DEVICE);
+
+	if (!err) {
+		dma_copy_account(c, len, 1);
+		return;
+	}
+
+error:
+	atomic_long_inc(&c->errors);
+cpu:
+	memcpy(dst, src, len);
+	dma_copy_account(c, len, 0);
+}
+EXPORT_SYMBOL_GPL(dma_copy);
+
+/**
+ * dma_copy_try_page - offload a copy between two pages
+ * @client: caller, selects the threshold and statistics
+ * @dst: destination page
+ * @dst_off: offset into @dst
+ * @src: source page
+ * @src_off: offset into @src
+ * @len: length in bytes, not crossing either page
+ *
+ * Highmem pages are fine.  Returns 0 when the engine did the copy and
+ * an error when the caller has to copy the data itself.
+ */
+int dma_copy_try_page(enum dma_copy_client client,
+		struct page *dst, unsigned int dst_off,
+		struct page *src, unsigned int src_off, size_t len)
+{
+	struct dma_copy_stats *c = &dma_copy_clients[client];
+	struct dma_chan *chan = dma_copy_chan(c, len);
+	struct device *dev;
+	dma_addr_t d, s;
+	int err = -EAGAIN;
+
+	if (!chan || dst_off + len > PAGE_SIZE || src_off + len > PAGE_SIZE ||
+	    !dma_copy_aligned(dst_off, len))
+		goto cpu;
+
+	dev = chan->device->dev;
+	s = dma_map_page(dev, src, src_off, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, s)) {
+		err = -ENOMEM;
+		goto error;
+	}
+	d = dma_map_page(dev, dst, dst_off, len, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, d)) {
+		dma_unmap_page(dev, s, len, DMA_TO_DEVICE);
+		err = -ENOMEM;
+		goto error;
+	}
+
+	err = dma_copy_run(chan, d, s, len);
+
+	dma_unmap_page(dev, d, len, DMA_FROM_DEVICE);
+	dma_unmap_page(dev, s, len, DMA_TO_DEVICE);
+
+	if (!err) {
+		dma_copy_account(c, len, 1);
+		return 0;
+	}
+
+error:
+	atomic_long_inc(&c->errors);
+cpu:
+	dma_copy_account(c, len, 0);
+	return err;
+}
+EXPORT_SYMBOL_GPL(dma_copy_try_page);
+
+static int dma_copy_seq_show(struct seq_file *seq, void *v)
+{
+	struct dma_copy_stats *c;
+	int i;
+
+	seq_printf(seq, "%-8s %10s %12s %16s %12s %16s %8s\n",
+		   "client", "threshold", "dma_copies", "dma_bytes",
+		   "cpu_copies", "cpu_bytes", "errors");
+
+	for (i = 0; i < DMA_COPY_CLIENTS; i++) {
+		c = &dma_copy_clients[i];
+		seq_printf(seq, "%-8s %10zu %12lu %16lu %12lu %16lu %8lu\n",
+			   c->name, c->threshold,
+			   atomic_long_read(&c->dma_copies),
+			   atomic_long_read(&c->dma_bytes),
+			   atomic_long_read(&c->cpu_copies),
+			   atomic_long_read(&c->cpu_bytes),
+			   atomic_long_read(&c->errors));
+	}
+
+	if (dma_copy_broken)
+		seq_printf(seq, "offload disabled after an engine timeout\n");
+
+	return 0;
+}
+
+static int dma_copy_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dma_copy_seq_show, NULL);
+}
+
+/* "echo <client> <bytes> > /proc/dma_copy" sets a threshold, 0 disables */
+static ssize_t dma_copy_seq_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos)
+{
+	struct dma_copy_stats *c;
+	char buf[48], name[16], threshold[24];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%15s %23s", name, threshold) != 2)
+		return -EINVAL;
+
+	c = dma_copy_lookup(name, strlen(name));
+	if (!c)
+		return -ENOENT;
+
+	c->threshold = memparse(threshold, NULL);
+
+	return count;
+}
+
+static const struct file_operations dma_copy_seq_fops = {
+	.owner		= THIS_MODULE,
+	.open		= dma_copy_seq_open,
+	.read		= seq_read,
+	.write		= dma_copy_seq_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init dma_copy_parse_thresholds(void)
+{
+	struct dma_copy_stats *c;
+	char *p = dma_copy_thresholds;
+	char *colon, *end;
+
+	while (p && *p) {
+		colon = strchr(p, ':');
+		if (!colon)
+			break;
+
+		c = dma_copy_lookup(p, colon - p);
+		if (c)
+			c->threshold = memparse(colon + 1, &end);
+		else
+			printk(KERN_WARNING "dma_copy: unknown client %.*s\n",
+			       (int)(colon - p), p);
+
+		p = strchr(colon, ',');
+		if (p)
+			p++;
+	}
+}
+
+static int __init dma_copy_init(void)
+{
+	dma_copy_parse_thresholds();
+
+	/* keep DMA_MEMCPY channels allocated for dma_find_channel() */
+	dmaengine_get();
+	dma_copy_ready = 1;
+
+	if (!proc_create("dma_copy", S_IRUGO | S_IWUSR, NULL,
+			 &dma_copy_seq_fops))
+		printk(KERN_WARNING "dma_copy: can't create /proc/dma_copy\n");
+
+	return 0;
+}
+late_initcall(dma_copy_init);
@@ -25,6 +25,13 @@
 #include <linux/types.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#endif
 
 #include <linux/mtd/nand.h>
 #include <linux/mtd/partitions.h>
@@ -33,6 +40,34 @@
 #define MAX_BANKS 8
 #define ERR_BYTE 0xFF /* Value returned for read bytes when read failed */
 #define FCM_TIMEOUT_MSECS 500 /* Maximum number of mSecs to wait for FCM */
+#define FCM_DMA_THRESHOLD 512 /* Smallest buffer transfer given to DMA */
+#define FCM_BUF_SIZE 4096 /* Largest FCM buffer: 2KB page plus OOB */
+#define FCM_MAX_SEGS 2 /* Page data and OOB */
+
+/* Operations timed in fcm_stats */
+enum {
+	FCM_STAT_READ,		/* page or OOB read into the FCM buffer */
+	FCM_STAT_PROGRAM,	/* page program from the FCM buffer */
+	FCM_STAT_ERASE,
+	FCM_STAT_OTHER,		/* status, id, reset, ECC read-back */
+	FCM_STAT_DMA_IN,	/* FCM buffer to memory by DMA */
+	FCM_STAT_DMA_OUT,	/* memory to FCM buffer by DMA */
+	FCM_STAT_PIO_IN,	/* FCM buffer to memory by the cpu */
+	FCM_STAT_PIO_OUT,	/* memory to FCM buffer by the cpu */
+	FCM_STATS
+};
+
+static const char *fcm_stat_names[FCM_STATS] = {
+	"read", "program", "erase", "other",
+	"dma-in", "dma-out", "pio-in", "pio-out",
+};
+
+struct fsl_elbc_stat {
+	unsigned long count;
+	u64 bytes;
+	u64 total_ns;
+	u32 max_ns;
+};
 
 /* mtd information per set */
 
@@ -44,6 +79,7 @@ struct fsl_elbc_mtd {
 	struct device *dev;
 	int bank;               /* Chip select bank number           */
 	u8 __iomem *vbase;      /* Chip select base virtual address  */
+	phys_addr_t pbase;      /* Chip select base physical address */
 	int page_size;          /* NAND page size (0=512, 1=2048)    */
 	unsigned int fmr;       /* FCM Flash Mode Register value     */
 };
@@ -64,6 +100,19 @@ struct fsl_elbc_fcm_ctrl {
 	unsigned int use_mdr;    /* Non zero if the MDR is to be set      */
 	unsigned int oob;        /* Non zero if operating on OOB data     */
 	char *oob_poi;           /* Place to write ECC after read back    */
+
+	struct fsl_elbc_stat stats[FCM_STATS];
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+	struct dma_chan *dma_chan;       /* Private DMA_MEMCPY channel     */
+	unsigned int dma_threshold;      /* Smallest transfer done by DMA  */
+	u8 *bounce;                      /* For buffers DMA can't reach    */
+#endif
+};
+
+/* A piece of memory on the other side of an FCM buffer transfer */
+struct fsl_elbc_seg {
+	u8 *buf;
+	int len;
 };
 
 static struct fsl_elbc_fcm_ctrl *elbc_fcm_ctrl;
@@ -195,15 +244,28 @@ static void set_addr(struct mtd_info *mtd, int column, int page_addr, int oob)
 	         chip->phys_erase_shift, chip->page_shift);
 }
 
+static void fsl_elbc_account(int stat, unsigned int bytes, ktime_t start)
+{
+	struct fsl_elbc_stat *st = &elbc_fcm_ctrl->stats[stat];
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	st->count++;
+	st->bytes += bytes;
+	st->total_ns += ns;
+	if (ns > st->max_ns)
+		st->max_ns = min_t(s64, ns, (u32)~0U);
+}
+
 /*
  * execute FCM command and wait for it to complete
  */
-static int fsl_elbc_run_command(struct mtd_info *mtd)
+static int fsl_elbc_run_command(struct mtd_info *mtd, int stat)
 {
 	struct nand_chip *chip = mtd->priv;
 	struct fsl_elbc_mtd *priv = chip->priv;
 	struct fsl_lbc_ctrl *ctrl = priv->ctrl;
 	struct fsl_lbc_regs __iomem *lbc = ctrl->regs;
+	ktime_t start;
 
 	/* Setup the FMR[OP] to execute without write protection */
 	out_be32(&lbc->fmr, priv->fmr | 3);
@@ -220,6 +282,7 @@ static int fsl_elbc_run_command(struct mtd_info *mtd)
 	         in_be32(&lbc->fbcr), priv->bank);
 
 	ctrl->irq_status = 0;
+	start = ktime_get();
 	/* execute special operation */
 	out_be32(&lbc->lsor, priv->bank);
 
@@ -227,6 +290,7 @@ static int fsl_elbc_run_command(struct mtd_info *mtd)
 	wait_event_timeout(ctrl->irq_wait, ctrl->irq_status,
 	                   FCM_TIMEOUT_MSECS * HZ/1000);
 	elbc_fcm_ctrl->status = ctrl->irq_status;
+	fsl_elbc_account(stat, 0, start);
 	/* store mdr value in case it was needed */
 	if (elbc_fcm_ctrl->use_mdr)
 		elbc_fcm_ctrl->mdr = in_be32(&lbc->mdr);
@@ -309,7 +373,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		elbc_fcm_ctrl->index += column;
 
 		fsl_elbc_do_read(chip, 0);
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_READ);
 		return;
 
 	/* READOOB reads only the OOB because no ECC is performed. */
@@ -324,7 +388,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		elbc_fcm_ctrl->read_bytes = mtd->writesize + mtd->oobsize;
 
 		fsl_elbc_do_read(chip, 1);
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_READ);
 		return;
 
 	/* READID must read all 5 possible bytes while CEB is active */
@@ -342,7 +406,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		elbc_fcm_ctrl->mdr = 0;
 
 		set_addr(mtd, 0, 0, 0);
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_OTHER);
 		return;
 
 	/* ERASE1 stores the block and page address */
@@ -373,7 +437,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		elbc_fcm_ctrl->read_bytes = 0;
 		elbc_fcm_ctrl->use_mdr = 1;
 
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_ERASE);
 		return;
 
 	/* SEQIN sets up the addr buffer and all registers except the length */
@@ -448,7 +512,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 			full_page = 1;
 		}
 
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_PROGRAM);
 
 		/* Read back the page in order to fill in the ECC for the
 		 * caller.  Is this really needed?
@@ -460,7 +524,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 			elbc_fcm_ctrl->read_bytes = mtd->writesize + 9;
 
 			fsl_elbc_do_read(chip, 1);
-			fsl_elbc_run_command(mtd);
+			fsl_elbc_run_command(mtd, FCM_STAT_OTHER);
 
 			memcpy_fromio(elbc_fcm_ctrl->oob_poi + 6,
 				&elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index], 3);
@@ -482,7 +546,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		set_addr(mtd, 0, 0, 0);
 		elbc_fcm_ctrl->read_bytes = 1;
 
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_OTHER);
 
 		/* The chip always seems to report that it is
 		 * write-protected, even when it is not.
@@ -495,7 +559,7 @@ static void fsl_elbc_cmdfunc(struct mtd_info *mtd, unsigned int command,
 		dev_dbg(priv->dev, "fsl_elbc_cmdfunc: NAND_CMD_RESET.\n");
 		out_be32(&lbc->fir, FIR_OP_CM0 << FIR_OP0_SHIFT);
 		out_be32(&lbc->fcr, NAND_CMD_RESET << FCR_CMD0_SHIFT);
-		fsl_elbc_run_command(mtd);
+		fsl_elbc_run_command(mtd, FCM_STAT_OTHER);
 		return;
 
 	default:
@@ -512,6 +576,159 @@ static void fsl_elbc_select_chip(struct mtd_info *mtd, int chip)
 	 */
 }
 
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+/* Whether the engine can reach @buf without going through the bounce */
+static int fsl_elbc_dma_direct(const u8 *buf, int len)
+{
+	unsigned long addr = (unsigned long)buf;
+	unsigned long align = dma_get_cache_alignment();
+
+	return addr >= PAGE_OFFSET && addr + len <= (unsigned long)high_memory &&
+	       !((addr | len) & (align - 1));
+}
+
+/*
+ * Move the segments to or from the FCM buffer at the current index with
+ * one descriptor each, issued back to back and waited for once.  Returns
+ * 0 on success; on failure nothing is assumed about the copy and the
+ * caller falls back to the cpu.
+ */
+static int fsl_elbc_dma_xfer(struct fsl_elbc_mtd *priv,
+                             struct fsl_elbc_seg *seg, int nseg,
+                             unsigned int total, int to_fcm)
+{
+	struct dma_chan *chan = elbc_fcm_ctrl->dma_chan;
+	enum dma_data_direction dir = to_fcm ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	struct dma_async_tx_descriptor *tx;
+	struct dma_device *dma;
+	dma_addr_t fcm, mem[FCM_MAX_SEGS];
+	u8 *p[FCM_MAX_SEGS];
+	dma_cookie_t cookie = 0;
+	unsigned int off;
+	int i, err = 0;
+
+	if (!chan || total < elbc_fcm_ctrl->dma_threshold ||
+	    total > FCM_BUF_SIZE)
+		return -EINVAL;
+
+	dma = chan->device;
+	fcm = priv->pbase + (elbc_fcm_ctrl->addr - priv->vbase) +
+	      elbc_fcm_ctrl->index;
+
+	for (i = 0, off = 0; i < nseg; off += seg[i].len, i++) {
+		p[i] = seg[i].buf;
+		if (!fsl_elbc_dma_direct(p[i], seg[i].len)) {
+			p[i] = elbc_fcm_ctrl->bounce + off;
+			if (to_fcm)
+				memcpy(p[i], seg[i].buf, seg[i].len);
+		}
+		mem[i] = dma_map_single(dma->dev, p[i], seg[i].len, dir);
+		if (dma_mapping_error(dma->dev, mem[i])) {
+			while (--i >= 0)
+				dma_unmap_single(dma->dev, mem[i], seg[i].len,
+				                 dir);
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0, off = 0; i < nseg; off += seg[i].len, i++) {
+		tx = dma->device_prep_dma_memcpy(chan,
+				to_fcm ? fcm + off : mem[i],
+				to_fcm ? mem[i] : fcm + off, seg[i].len,
+				DMA_CTRL_ACK | DMA_COMPL_SKIP_SRC_UNMAP |
+				DMA_COMPL_SKIP_DEST_UNMAP);
+		if (!tx) {
+			err = -ENOMEM;
+			break;
+		}
+		cookie = tx->tx_submit(tx);
+	}
+
+	/* descriptors on a channel complete in order */
+	if (cookie > 0 && dma_sync_wait(chan, cookie) != DMA_SUCCESS) {
+		dma->device_control(chan, DMA_TERMINATE_ALL, 0);
+		err = -EIO;
+	}
+
+	for (i = 0; i < nseg; i++) {
+		dma_unmap_single(dma->dev, mem[i], seg[i].len, dir);
+		if (!err && !to_fcm && p[i] != seg[i].buf)
+			memcpy(seg[i].buf, p[i], seg[i].len);
+	}
+
+	return err;
+}
+
+static void fsl_elbc_dma_init(struct device *dev)
+{
+	dma_cap_mask_t mask;
+
+	if (elbc_fcm_ctrl->dma_chan)
+		return;
+
+	if (!elbc_fcm_ctrl->bounce) {
+		elbc_fcm_ctrl->bounce = kmalloc(FCM_BUF_SIZE, GFP_KERNEL);
+		if (!elbc_fcm_ctrl->bounce)
+			return;
+	}
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	elbc_fcm_ctrl->dma_chan = dma_request_channel(mask, NULL, NULL);
+	if (!elbc_fcm_ctrl->dma_chan)
+		dev_info(dev, "no DMA channel for the FCM buffer, "
+		         "using the cpu\n");
+}
+
+static void fsl_elbc_dma_free(void)
+{
+	if (elbc_fcm_ctrl->dma_chan)
+		dma_release_channel(elbc_fcm_ctrl->dma_chan);
+	kfree(elbc_fcm_ctrl->bounce);
+}
+#endif
+
+/*
+ * Copy between memory and the FCM buffer at the current index and move
+ * the index past the transfer.  Large transfers go to the DMA engine,
+ * small ones and anything it fails on are copied by the cpu.
+ */
+static void fsl_elbc_xfer(struct mtd_info *mtd, struct fsl_elbc_seg *seg,
+                          int nseg, int to_fcm)
+{
+	u8 __iomem *fcm = &elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index];
+	ktime_t start = ktime_get();
+	unsigned int total = 0;
+	int i;
+
+	for (i = 0; i < nseg; i++)
+		total += seg[i].len;
+
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+	if (!fsl_elbc_dma_xfer(((struct nand_chip *)mtd->priv)->priv,
+	                       seg, nseg, total, to_fcm)) {
+		fsl_elbc_account(to_fcm ? FCM_STAT_DMA_OUT : FCM_STAT_DMA_IN,
+		                 total, start);
+		goto out;
+	}
+#endif
+
+	for (i = 0; i < nseg; i++) {
+		if (to_fcm)
+			memcpy_toio(fcm, seg[i].buf, seg[i].len);
+		else
+			memcpy_fromio(seg[i].buf, fcm, seg[i].len);
+		fcm += seg[i].len;
+	}
+	fsl_elbc_account(to_fcm ? FCM_STAT_PIO_OUT : FCM_STAT_PIO_IN,
+	                 total, start);
+
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+out:
+#endif
+	elbc_fcm_ctrl->index += total;
+}
+
 /*
  * Write buf to the FCM Controller Data Buffer
  */
@@ -520,6 +737,7 @@ static void fsl_elbc_write_buf(struct mtd_info *mtd, const u8 *buf, int len)
 	struct nand_chip *chip = mtd->priv;
 	struct fsl_elbc_mtd *priv = chip->priv;
 	unsigned int bufsize = mtd->writesize + mtd->oobsize;
+	struct fsl_elbc_seg seg;
 
 	if (len <= 0) {
 		dev_err(priv->dev, "write_buf of %d bytes", len);
@@ -535,7 +753,9 @@ static void fsl_elbc_write_buf(struct mtd_info *mtd, const u8 *buf, int len)
 		len = bufsize - elbc_fcm_ctrl->index;
 	}
 
-	memcpy_toio(&elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index], buf, len);
+	seg.buf = (u8 *)buf;
+	seg.len = len;
+	fsl_elbc_xfer(mtd, &seg, 1, 1);
 	/*
 	 * This is workaround for the weird elbc hangs during nand write,
 	 * Scott Wood says: "...perhaps difference in how long it takes a
@@ -543,9 +763,7 @@ static void fsl_elbc_write_buf(struct mtd_info *mtd, const u8 *buf, int len)
 	 * is causing problems, and sync isn't helping for some reason."
 	 * Reading back the last byte helps though.
 	 */
-	in_8(&elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index] + len - 1);
-
-	elbc_fcm_ctrl->index += len;
+	in_8(&elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index] - 1);
 }
 
 /*
@@ -572,6 +790,7 @@ static void fsl_elbc_read_buf(struct mtd_info *mtd, u8 *buf, int len)
 {
 	struct nand_chip *chip = mtd->priv;
 	struct fsl_elbc_mtd *priv = chip->priv;
+	struct fsl_elbc_seg seg;
 	int avail;
 
 	if (len < 0)
@@ -579,8 +798,9 @@ static void fsl_elbc_read_buf(struct mtd_info *mtd, u8 *buf, int len)
 
 	avail = min((unsigned int)len,
 			elbc_fcm_ctrl->read_bytes - elbc_fcm_ctrl->index);
-	memcpy_fromio(buf, &elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index], avail);
-	elbc_fcm_ctrl->index += avail;
+	seg.buf = buf;
+	seg.len = avail;
+	fsl_elbc_xfer(mtd, &seg, 1, 0);
 
 	if (len > avail)
 		dev_err(priv->dev,
@@ -724,8 +944,19 @@ static int fsl_elbc_read_page(struct mtd_info *mtd,
 			      uint8_t *buf,
 			      int page)
 {
-	fsl_elbc_read_buf(mtd, buf, mtd->writesize);
-	fsl_elbc_read_buf(mtd, chip->oob_poi, mtd->oobsize);
+	struct fsl_elbc_seg seg[FCM_MAX_SEGS] = {
+		{ buf, mtd->writesize },
+		{ chip->oob_poi, mtd->oobsize },
+	};
+
+	/* data and OOB are adjacent in the FCM buffer: one transfer */
+	if (elbc_fcm_ctrl->index + mtd->writesize + mtd->oobsize <=
+	    elbc_fcm_ctrl->read_bytes) {
+		fsl_elbc_xfer(mtd, seg, FCM_MAX_SEGS, 0);
+	} else {
+		fsl_elbc_read_buf(mtd, buf, mtd->writesize);
+		fsl_elbc_read_buf(mtd, chip->oob_poi, mtd->oobsize);
+	}
 
 	if (fsl_elbc_wait(mtd, chip) & NAND_STATUS_FAIL)
 		mtd->ecc_stats.failed++;
@@ -740,8 +971,19 @@ static void fsl_elbc_write_page(struct mtd_info *mtd,
                                 struct nand_chip *chip,
                                 const uint8_t *buf)
 {
-	fsl_elbc_write_buf(mtd, buf, mtd->writesize);
-	fsl_elbc_write_buf(mtd, chip->oob_poi, mtd->oobsize);
+	struct fsl_elbc_seg seg[FCM_MAX_SEGS] = {
+		{ (u8 *)buf, mtd->writesize },
+		{ chip->oob_poi, mtd->oobsize },
+	};
+
+	if (!elbc_fcm_ctrl->index) {
+		fsl_elbc_xfer(mtd, seg, FCM_MAX_SEGS, 1);
+		/* see fsl_elbc_write_buf() */
+		in_8(&elbc_fcm_ctrl->addr[elbc_fcm_ctrl->index] - 1);
+	} else {
+		fsl_elbc_write_buf(mtd, buf, mtd->writesize);
+		fsl_elbc_write_buf(mtd, chip->oob_poi, mtd->oobsize);
+	}
 
 	elbc_fcm_ctrl->oob_poi = chip->oob_poi;
 }
@@ -816,6 +1058,77 @@ static int fsl_elbc_chip_remove(struct fsl_elbc_mtd *priv)
 	return 0;
 }
 
+static ssize_t show_fcm_stats(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct fsl_elbc_stat *st;
+	ssize_t len;
+	int i;
+
+	len = sprintf(buf, "%-8s %10s %12s %8s %8s %8s\n",
+			"op", "count", "bytes", "avg_us", "max_us", "MB/s");
+
+	for (i = 0; i < FCM_STATS; i++) {
+		st = &elbc_fcm_ctrl->stats[i];
+		len += sprintf(buf + len, "%-8s %10lu %12llu %8llu %8u %8llu\n",
+				fcm_stat_names[i], st->count,
+				(unsigned long long)st->bytes,
+				st->count ? div64_u64(st->total_ns,
+						      st->count * 1000ULL) : 0,
+				st->max_ns / 1000,
+				st->total_ns ? div64_u64(st->bytes * 1000,
+							 st->total_ns) : 0);
+	}
+
+	return len;
+}
+
+/* Writing anything clears the counters */
+static ssize_t clear_fcm_stats(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	memset(elbc_fcm_ctrl->stats, 0, sizeof(elbc_fcm_ctrl->stats));
+	return count;
+}
+
+static DEVICE_ATTR(fcm_stats, 0644, show_fcm_stats, clear_fcm_stats);
+
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+static ssize_t show_fcm_dma_threshold(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", elbc_fcm_ctrl->dma_threshold);
+}
+
+/* 0 keeps every transfer on the cpu */
+static ssize_t set_fcm_dma_threshold(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long val;
+
+	if (strict_strtoul(buf, 0, &val))
+		return -EINVAL;
+
+	elbc_fcm_ctrl->dma_threshold = val ? val : UINT_MAX;
+	return count;
+}
+
+static DEVICE_ATTR(fcm_dma_threshold, 0644, show_fcm_dma_threshold,
+		set_fcm_dma_threshold);
+#endif
+
+static struct attribute *fsl_elbc_fcm_attrs[] = {
+	&dev_attr_fcm_stats.attr,
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+	&dev_attr_fcm_dma_threshold.attr,
+#endif
+	NULL
+};
+
+static struct attribute_group fsl_elbc_fcm_attr_group = {
+	.attrs = fsl_elbc_fcm_attrs,
+};
+
 static int __devinit fsl_elbc_nand_probe(struct of_device *dev,
 					 const struct of_device_id *match)
 {
@@ -873,12 +1186,22 @@ static int __devinit fsl_elbc_nand_probe(struct of_device *dev,
 		spin_lock_init(&elbc_fcm_ctrl->controller.lock);
 		init_waitqueue_head(&elbc_fcm_ctrl->controller.wq);
 		fsl_lbc_ctrl_dev->nand = elbc_fcm_ctrl;
+
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+		elbc_fcm_ctrl->dma_threshold = FCM_DMA_THRESHOLD;
+		fsl_elbc_dma_init(fsl_lbc_ctrl_dev->dev);
+#endif
+		if (sysfs_create_group(&fsl_lbc_ctrl_dev->dev->kobj,
+				       &fsl_elbc_fcm_attr_group))
+			dev_warn(fsl_lbc_ctrl_dev->dev,
+			         "can't create FCM sysfs files\n");
 	}
 
 	elbc_fcm_ctrl->chips[bank] = priv;
 	priv->bank = bank;
 	priv->ctrl = fsl_lbc_ctrl_dev;
 	priv->dev = fsl_lbc_ctrl_dev->dev;
+	priv->pbase = res.start;
 
 	priv->vbase = ioremap(res.start, resource_size(&res));
 	if (!priv->vbase) {
@@ -947,6 +1270,11 @@ static int fsl_elbc_nand_remove(struct of_device *ofdev)
 		if (elbc_fcm_ctrl->chips[i])
 			fsl_elbc_chip_remove(elbc_fcm_ctrl->chips[i]);
 
+	sysfs_remove_group(&fsl_lbc_ctrl_dev->dev->kobj,
+			   &fsl_elbc_fcm_attr_group);
+#ifdef CONFIG_MTD_NAND_FSL_ELBC_DMA
+	fsl_elbc_dma_free();
+#endif
 	fsl_lbc_ctrl_dev->nand = NULL;
 	kfree(elbc_fcm_ctrl);
 	return 0;
@@ -60,10 +60,13 @@
  * @name: MTD character device node path, MTD device name, or MTD device number
  *        string
  * @vid_hdr_offs: VID header offset
+ * @snap_name: MTD device holding attach snapshots, same forms as @name, or an
+ *             empty string
  */
 struct mtd_dev_param {
 	char name[MTD_PARAM_LEN_MAX];
 	int vid_hdr_offs;
+	char snap_name[MTD_PARAM_LEN_MAX];
 };
 
 /* Numbers of elements set in the @mtd_dev_param array */
@@ -841,6 +844,7 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * @mtd: MTD device description object
  * @ubi_num: number to assign to the new UBI device
  * @vid_hdr_offset: VID header offset
+ * @snap_mtd: MTD device for attach snapshots, or %NULL
  *
  * This function attaches MTD device @mtd_dev to UBI and assign @ubi_num number
  * to the newly created UBI device, unless @ubi_num is %UBI_DEV_NUM_AUTO, in
@@ -848,13 +852,19 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * automatically. Returns the new UBI device number in case of success and a
  * negative error code in case of failure.
  *
+ * If @snap_mtd is given, UBI attaches from the snapshot stored there when
+ * it can, and keeps it up to date. An unsuitable @snap_mtd only disables
+ * the snapshots. The UBI device owns @snap_mtd once attached; in case of
+ * failure the caller still has to put it.
+ *
  * Note, the invocations of this function has to be serialized by the
  * @ubi_devices_mutex.
  */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       struct mtd_info *snap_mtd)
 {
 	struct ubi_device *ubi;
-	int i, err, ref = 0;
+	int i, err, ref = 0, snap_off = 0;
 //sxl
 	//printk("vid_hdr_offset  = %d ++++++++++++\n", vid_hdr_offset);
 	vid_hdr_offset = 2048;
@@ -944,6 +954,16 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		goto out_free;
 #endif
 
+	err = ubi_snap_init(ubi, snap_mtd);
+	if (err == -EINVAL || err == -EROFS) {
+		/* Attaching by scanning still works */
+		ubi_warn("attach snapshots disabled for mtd%d", mtd->index);
+		snap_off = 1;
+		err = 0;
+	}
+	if (err)
+		goto out_free;
+
 	err = attach_by_scanning(ubi);
 	if (err) {
 		dbg_err("failed to attach by scanning, error %d", err);
@@ -997,6 +1017,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 
 	ubi_devices[ubi_num] = ubi;
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
+	ubi_snap_start(ubi);
+	/* The snapshot MTD device is not kept if it was unsuitable */
+	if (snap_off)
+		put_mtd_device(snap_mtd);
 	return ubi_num;
 
 out_uif:
@@ -1006,6 +1030,7 @@ out_detach:
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_free:
+	ubi_snap_free(ubi);
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
@@ -1068,6 +1093,9 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	/* Leave a snapshot behind while the volumes are still there */
+	ubi_snap_close(ubi);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1199,7 +1227,7 @@ static int __init ubi_init(void)
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
 		struct mtd_dev_param *p = &mtd_dev_param[i];
-		struct mtd_info *mtd;
+		struct mtd_info *mtd, *snap_mtd;
 
 		cond_resched();
 
@@ -1209,13 +1237,27 @@ static int __init ubi_init(void)
 			goto out_detach;
 		}
 
+		snap_mtd = NULL;
+		if (p->snap_name[0]) {
+			snap_mtd = open_mtd_device(p->snap_name);
+			if (IS_ERR(snap_mtd)) {
+				/* Attaching by scanning still works */
+				ubi_warn("cannot open snapshot MTD device "
+					 "\"%s\", error %ld", p->snap_name,
+					 PTR_ERR(snap_mtd));
+				snap_mtd = NULL;
+			}
+		}
+
 		mutex_lock(&ubi_devices_mutex);
 		err = ubi_attach_mtd_dev(mtd, UBI_DEV_NUM_AUTO,
-					 p->vid_hdr_offs);
+					 p->vid_hdr_offs, snap_mtd);
 		mutex_unlock(&ubi_devices_mutex);
 		if (err < 0) {
 			ubi_err("cannot attach mtd%d", mtd->index);
 			put_mtd_device(mtd);
+			if (snap_mtd)
+				put_mtd_device(snap_mtd);
 
 			/*
 			 * Originally UBI stopped initializing on any error.
@@ -1327,7 +1369,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	struct mtd_dev_param *p;
 	char buf[MTD_PARAM_LEN_MAX];
 	char *pbuf = &buf[0];
-	char *tokens[2] = {NULL, NULL};
+	char *tokens[3] = {NULL, NULL, NULL};
 
 	if (!val)
 		return -EINVAL;
@@ -1357,7 +1399,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (buf[len - 1] == '\n')
 		buf[len - 1] = '\0';
 
-	for (i = 0; i < 2; i++)
+	for (i = 0; i < 3; i++)
 		tokens[i] = strsep(&pbuf, ",");
 
 	if (pbuf) {
@@ -1375,18 +1417,30 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (p->vid_hdr_offs < 0)
 		return p->vid_hdr_offs;
 
+	if (tokens[2]) {
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+		strcpy(&p->snap_name[0], tokens[2]);
+#else
+		printk(KERN_WARNING "UBI warning: attach snapshots are not "
+		       "supported, \"%s\" ignored\n", tokens[2]);
+#endif
+	}
+
 	mtd_devs += 1;
 	return 0;
 }
 
 module_param_call(mtd, ubi_mtd_param_parse, NULL, NULL, 000);
 MODULE_PARM_DESC(mtd, "MTD devices to attach. Parameter format: "
-		      "mtd=<name|num|path>[,<vid_hdr_offs>].\n"
+		      "mtd=<name|num|path>[,<vid_hdr_offs>[,<snapshot mtd>]].\n"
 		      "Multiple \"mtd\" parameters may be specified.\n"
 		      "MTD devices may be specified by their number, name, or "
 		      "path to the MTD character device node.\n"
 		      "Optional \"vid_hdr_offs\" parameter specifies UBI VID "
 		      "header position to be used by UBI.\n"
+		      "Optional \"snapshot mtd\" parameter specifies an MTD "
+		      "device where UBI keeps attach snapshots "
+		      "(CONFIG_MTD_UBI_SNAPSHOT).\n"
 		      "Example 1: mtd=/dev/mtd0 - attach MTD device "
 		      "/dev/mtd0.\n"
 		      "Example 2: mtd=content,1984 mtd=4 - attach MTD device "
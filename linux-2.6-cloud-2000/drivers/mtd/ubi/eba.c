@@ -248,9 +248,12 @@ static int leb_write_lock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	ubi_snap_hold(ubi);
 	le = ltree_add_entry(ubi, vol_id, lnum);
-	if (IS_ERR(le))
+	if (IS_ERR(le)) {
+		ubi_snap_release(ubi);
 		return PTR_ERR(le);
+	}
 	down_write(&le->mutex);
 	return 0;
 }
@@ -270,9 +273,15 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	/* An attach snapshot is being taken, treat it as contention */
+	if (!ubi_snap_tryhold(ubi))
+		return 1;
+
 	le = ltree_add_entry(ubi, vol_id, lnum);
-	if (IS_ERR(le))
+	if (IS_ERR(le)) {
+		ubi_snap_release(ubi);
 		return PTR_ERR(le);
+	}
 	if (down_write_trylock(&le->mutex))
 		return 0;
 
@@ -285,6 +294,7 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 		kfree(le);
 	}
 	spin_unlock(&ubi->ltree_lock);
+	ubi_snap_release(ubi);
 
 	return 1;
 }
@@ -309,6 +319,7 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 		kfree(le);
 	}
 	spin_unlock(&ubi->ltree_lock);
+	ubi_snap_release(ubi);
 }
 
 /**
@@ -885,12 +885,37 @@ adjust_mean_ec:
 	return 0;
 }
 
+/**
+ * alloc_si - allocate empty scanning information.
+ *
+ * Returns %NULL if there is not enough memory.
+ */
+static struct ubi_scan_info *alloc_si(void)
+{
+	struct ubi_scan_info *si;
+
+	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	if (!si)
+		return NULL;
+
+	INIT_LIST_HEAD(&si->corr);
+	INIT_LIST_HEAD(&si->free);
+	INIT_LIST_HEAD(&si->erase);
+	INIT_LIST_HEAD(&si->alien);
+	si->volumes = RB_ROOT;
+	si->is_empty = 1;
+	return si;
+}
+
 /**
  * ubi_scan - scan an MTD device.
  * @ubi: UBI device description object
  *
  * This function does full scanning of an MTD device and returns complete
  * information about it. In case of failure, an error code is returned.
+ *
+ * If the device has an attach snapshot which still matches the flash, the
+ * information is taken from the snapshot instead and nothing is scanned.
  */
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 {
@@ -900,17 +925,10 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
-	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	si = alloc_si();
 	if (!si)
 		return ERR_PTR(-ENOMEM);
 
-	INIT_LIST_HEAD(&si->corr);
-	INIT_LIST_HEAD(&si->free);
-	INIT_LIST_HEAD(&si->erase);
-	INIT_LIST_HEAD(&si->alien);
-	si->volumes = RB_ROOT;
-	si->is_empty = 1;
-
 	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
@@ -920,6 +938,22 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (!vidh)
 		goto out_ech;
 
+	err = ubi_snap_load(ubi, si);
+	if (err == 0)
+		goto scanned;
+	if (err < 0) {
+		/* Start over with clean scanning information */
+		ubi_warn("cannot use attach snapshot, error %d", err);
+		ubi_scan_destroy_si(si);
+		ubi->image_seq = 0;
+		si = alloc_si();
+		if (!si) {
+			ubi_free_vid_hdr(ubi, vidh);
+			kfree(ech);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+
 	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
 		cond_resched();
 
@@ -931,6 +965,8 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 
 	dbg_msg("scanning is finished");
 
+scanned:
+
 	/* Calculate mean erase counter */
 	if (si->ec_count)
 		si->mean_ec = div_u64(si->ec_sum, si->ec_count);
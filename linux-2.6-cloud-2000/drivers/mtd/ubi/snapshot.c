@@ -0,0 +1,986 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ */
+
+/*
+ * UBI attach snapshots.
+ *
+ * Attaching by scanning reads the EC and VID headers of every physical
+ * eraseblock, so it takes time proportional to the size of the flash. An
+ * attach snapshot is a copy of what scanning would find - the state and erase
+ * counter of each PEB and the LEB it is mapped to - kept on a separate small
+ * MTD device. When the newest snapshot still describes the flash, the
+ * scanning information is built from it and the UBI device itself is not
+ * scanned at all.
+ *
+ * A snapshot is only good as long as the UBI device has not been changed
+ * since it was taken. Before the first write or erase after that, the I/O
+ * sub-system invalidates it by programming the marker which follows the
+ * snapshot header (see 'ubi_snap_dirty()'). After an unclean reboot UBI
+ * therefore finds either a snapshot which matches the flash, or a stale one,
+ * in which case it falls back to scanning.
+ *
+ * Snapshots are taken when the device is detached, on reboot, and by a
+ * periodic work once the device has not been changed for %SNAP_IDLE_TIME.
+ * While a snapshot is taken, EBA changes are held off by @ubi->snap_sem and
+ * WL works by @ubi->work_sem, so the EBA tables and the WL trees are in a
+ * consistent state.
+ *
+ * A snapshot consists of a header eraseblock and the eraseblocks with the
+ * records listed in the header. The header is written last, so a header is
+ * only ever found for a complete snapshot. Snapshots go round-robin over the
+ * good eraseblocks of the snapshot MTD device, and the one with the highest
+ * sequence number is the newest. Only the newest snapshot is ever used: all
+ * older ones were invalidated before it was taken.
+ *
+ * Nothing but UBI may write to the UBI device while snapshots are in use,
+ * because only UBI invalidates them.
+ */
+
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/jiffies.h>
+#include <linux/reboot.h>
+#include "ubi.h"
+
+/* A snapshot is taken once the device has not been changed for this long */
+#define SNAP_IDLE_TIME (30 * HZ)
+
+/*
+ * snap_hdr_size - size of the snapshot header and of the invalidation marker,
+ * in minimal I/O units of the snapshot MTD device.
+ */
+static int snap_hdr_size(const struct ubi_device *ubi)
+{
+	return ALIGN(UBI_SNAP_HDR_SIZE, ubi->snap_mtd->writesize);
+}
+
+/* snap_max_data - largest possible size of the snapshot records */
+static int snap_max_data(const struct ubi_device *ubi)
+{
+	return (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) * UBI_SNAP_VOL_SIZE +
+	       ubi->peb_count * UBI_SNAP_PEB_SIZE;
+}
+
+static int snap_block_count(const struct ubi_device *ubi)
+{
+	return mtd_div_by_eb(ubi->snap_mtd->size, ubi->snap_mtd);
+}
+
+static loff_t snap_block_addr(const struct ubi_device *ubi, int block)
+{
+	return (loff_t)block * ubi->snap_mtd->erasesize;
+}
+
+static int snap_block_isbad(const struct ubi_device *ubi, int block)
+{
+	struct mtd_info *mtd = ubi->snap_mtd;
+
+	if (!mtd->block_isbad)
+		return 0;
+	return mtd->block_isbad(mtd, snap_block_addr(ubi, block));
+}
+
+static int snap_mtd_read(const struct ubi_device *ubi, void *buf, loff_t addr,
+			 int len)
+{
+	struct mtd_info *mtd = ubi->snap_mtd;
+	size_t read;
+	int err;
+
+	err = mtd->read(mtd, addr, len, &read, buf);
+	/* Corrected bit-flips are fine, the snapshot is re-written anyway */
+	if (err == -EUCLEAN)
+		err = 0;
+	if (!err && read != len)
+		err = -EIO;
+	return err;
+}
+
+static int snap_mtd_write(const struct ubi_device *ubi, const void *buf,
+			  loff_t addr, int len)
+{
+	struct mtd_info *mtd = ubi->snap_mtd;
+	size_t written;
+	int err;
+
+	err = mtd->write(mtd, addr, len, &written, buf);
+	if (!err && written != len)
+		err = -EIO;
+	return err;
+}
+
+static void snap_erase_callback(struct erase_info *ei)
+{
+	wake_up((wait_queue_head_t *)ei->priv);
+}
+
+/**
+ * snap_erase - synchronously erase an eraseblock of the snapshot MTD device.
+ * @ubi: UBI device description object
+ * @block: the eraseblock to erase
+ *
+ * An eraseblock which fails to erase is marked bad. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int snap_erase(const struct ubi_device *ubi, int block)
+{
+	struct mtd_info *mtd = ubi->snap_mtd;
+	struct erase_info ei;
+	wait_queue_head_t wq;
+	int err;
+
+	init_waitqueue_head(&wq);
+	memset(&ei, 0, sizeof(struct erase_info));
+
+	ei.mtd      = mtd;
+	ei.addr     = snap_block_addr(ubi, block);
+	ei.len      = mtd->erasesize;
+	ei.callback = snap_erase_callback;
+	ei.priv     = (unsigned long)&wq;
+
+	err = mtd->erase(mtd, &ei);
+	if (!err) {
+		wait_event(wq, ei.state == MTD_ERASE_DONE ||
+			       ei.state == MTD_ERASE_FAILED);
+		if (ei.state == MTD_ERASE_FAILED)
+			err = -EIO;
+	}
+
+	if (err == -EIO && mtd->block_markbad) {
+		ubi_warn("mark snapshot eraseblock %d bad", block);
+		mtd->block_markbad(mtd, ei.addr);
+	}
+	return err;
+}
+
+/**
+ * snap_mark - invalidate a snapshot.
+ * @ubi: UBI device description object
+ * @block: header eraseblock of the snapshot
+ *
+ * Programs the invalidation marker. If that fails, the header eraseblock is
+ * erased, which gets rid of the snapshot just as well. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int snap_mark(struct ubi_device *ubi, int block)
+{
+	int err, size = snap_hdr_size(ubi);
+
+	memset(ubi->snap_hdr, 0, size);
+	err = snap_mtd_write(ubi, ubi->snap_hdr,
+			     snap_block_addr(ubi, block) + size, size);
+	if (err) {
+		ubi_warn("cannot write snapshot marker, error %d", err);
+		err = snap_erase(ubi, block);
+	}
+	if (err)
+		ubi_err("cannot invalidate attach snapshot, error %d", err);
+	return err;
+}
+
+/**
+ * ubi_snap_invalidate - invalidate the on-flash attach snapshot.
+ * @ubi: UBI device description object
+ *
+ * This function is called through 'ubi_snap_dirty()' before the UBI device is
+ * written to or erased, while the snapshot still matches the flash. Returns
+ * zero in case of success and a negative error code in case of failure, in
+ * which case the flash must not be changed.
+ */
+int ubi_snap_invalidate(struct ubi_device *ubi)
+{
+	int err = 0;
+
+	mutex_lock(&ubi->snap_mutex);
+	if (ubi->snap_valid) {
+		dbg_gen("invalidate attach snapshot %llu", ubi->snap_sqnum);
+		err = snap_mark(ubi, ubi->snap_block);
+		if (!err)
+			ubi->snap_valid = 0;
+	}
+	mutex_unlock(&ubi->snap_mutex);
+
+	return err;
+}
+
+/**
+ * snap_find - find the newest snapshot.
+ * @ubi: UBI device description object
+ *
+ * Returns the header eraseblock of the newest snapshot, whose header is left
+ * in @ubi->snap_hdr, or %-ENOENT if there is no snapshot.
+ */
+static int snap_find(struct ubi_device *ubi)
+{
+	struct ubi_snap_hdr *hdr = ubi->snap_hdr;
+	int err, block, best = -ENOENT, size = snap_hdr_size(ubi);
+	unsigned long long sqnum, best_sqnum = 0;
+	uint32_t crc;
+
+	for (block = 0; block < snap_block_count(ubi); block++) {
+		err = snap_block_isbad(ubi, block);
+		if (err)
+			continue;
+
+		err = snap_mtd_read(ubi, hdr, snap_block_addr(ubi, block),
+				    size);
+		if (err)
+			continue;
+
+		if (be32_to_cpu(hdr->magic) != UBI_SNAP_HDR_MAGIC ||
+		    hdr->version != UBI_SNAP_VERSION)
+			continue;
+
+		crc = crc32(UBI_CRC32_INIT, hdr, UBI_SNAP_HDR_SIZE_CRC);
+		if (crc != be32_to_cpu(hdr->hdr_crc))
+			continue;
+
+		sqnum = be64_to_cpu(hdr->sqnum);
+		if (best < 0 || sqnum > best_sqnum) {
+			best = block;
+			best_sqnum = sqnum;
+		}
+	}
+
+	if (best < 0)
+		return best;
+
+	err = snap_mtd_read(ubi, hdr, snap_block_addr(ubi, best), size);
+	if (err)
+		return err;
+	return best;
+}
+
+/**
+ * snap_is_stale - check the invalidation marker of a snapshot.
+ * @ubi: UBI device description object
+ * @block: header eraseblock of the snapshot
+ *
+ * Returns zero if the snapshot has not been invalidated, %1 if it has, and a
+ * negative error code in case of failure.
+ */
+static int snap_is_stale(struct ubi_device *ubi, int block)
+{
+	int i, err, size = snap_hdr_size(ubi);
+	uint8_t *marker = ubi->snap_buf;
+
+	err = snap_mtd_read(ubi, marker, snap_block_addr(ubi, block) + size,
+			    size);
+	if (err)
+		return err;
+
+	for (i = 0; i < size; i++)
+		if (marker[i] != 0xFF)
+			return 1;
+	return 0;
+}
+
+/**
+ * snap_read_records - read and check the records of the newest snapshot.
+ * @ubi: UBI device description object
+ *
+ * The header is expected in @ubi->snap_hdr, the records are read to
+ * @ubi->snap_buf. Returns zero in case of success and a negative error code if
+ * the records cannot be used.
+ */
+static int snap_read_records(struct ubi_device *ubi)
+{
+	struct ubi_snap_hdr *hdr = ubi->snap_hdr;
+	struct mtd_info *mtd = ubi->snap_mtd;
+	int i, err, block, len, done = 0;
+	int vol_count = be32_to_cpu(hdr->vol_count);
+	int data_size = be32_to_cpu(hdr->data_size);
+	int block_count = be32_to_cpu(hdr->block_count);
+	uint32_t crc;
+
+	if (be32_to_cpu(hdr->peb_count) != ubi->peb_count ||
+	    be32_to_cpu(hdr->peb_size) != ubi->peb_size ||
+	    be32_to_cpu(hdr->vid_hdr_offset) != ubi->vid_hdr_offset) {
+		dbg_err("snapshot of different flash geometry");
+		return -EINVAL;
+	}
+
+	if (vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT ||
+	    data_size != vol_count * UBI_SNAP_VOL_SIZE +
+			 ubi->peb_count * UBI_SNAP_PEB_SIZE ||
+	    block_count != DIV_ROUND_UP(data_size, mtd->erasesize) ||
+	    block_count > UBI_SNAP_MAX_BLOCKS) {
+		dbg_err("bad snapshot header");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < block_count; i++) {
+		block = be32_to_cpu(hdr->blocks[i]);
+		if (block < 0 || block >= snap_block_count(ubi))
+			return -EINVAL;
+
+		len = min_t(int, data_size - done, mtd->erasesize);
+		err = snap_mtd_read(ubi, ubi->snap_buf + done,
+				    snap_block_addr(ubi, block), len);
+		if (err)
+			return err;
+		done += len;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, ubi->snap_buf, data_size);
+	if (crc != be32_to_cpu(hdr->data_crc)) {
+		dbg_err("bad snapshot records CRC");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* find_vol - find the record of volume @vol_id among @vol_count records */
+static struct ubi_snap_vol *find_vol(struct ubi_snap_vol *vols, int vol_count,
+				     __be32 vol_id)
+{
+	int i;
+
+	for (i = 0; i < vol_count; i++)
+		if (vols[i].vol_id == vol_id)
+			return &vols[i];
+	return NULL;
+}
+
+/**
+ * snap_check_records - check the snapshot records for consistency.
+ * @ubi: UBI device description object
+ *
+ * Returns zero if the records are consistent and %-EINVAL if not.
+ */
+static int snap_check_records(struct ubi_device *ubi)
+{
+	int vol_count = be32_to_cpu(ubi->snap_hdr->vol_count);
+	struct ubi_snap_vol *vols = ubi->snap_buf;
+	struct ubi_snap_peb *pebs = (void *)(vols + vol_count);
+	int i, vol_id, pnum;
+
+	for (i = 0; i < vol_count; i++) {
+		vol_id = be32_to_cpu(vols[i].vol_id);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto bad;
+		if (vols[i].vol_type != UBI_VID_DYNAMIC &&
+		    vols[i].vol_type != UBI_VID_STATIC)
+			goto bad;
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		struct ubi_snap_peb *p = &pebs[pnum];
+
+		switch (p->state) {
+		case UBI_SNAP_PEB_USED:
+			if (!find_vol(vols, vol_count, p->vol_id) ||
+			    (int)be32_to_cpu(p->lnum) < 0 ||
+			    (int)be32_to_cpu(p->lnum) >= ubi->peb_count)
+				goto bad;
+			/* Fall through */
+		case UBI_SNAP_PEB_FREE:
+		case UBI_SNAP_PEB_ERASE:
+			if (be32_to_cpu(p->ec) > UBI_MAX_ERASECOUNTER)
+				goto bad;
+			break;
+		case UBI_SNAP_PEB_BAD:
+			break;
+		default:
+			goto bad;
+		}
+	}
+
+	return 0;
+
+bad:
+	dbg_err("inconsistent snapshot records");
+	return -EINVAL;
+}
+
+/**
+ * snap_verify - compare the snapshot to the flash.
+ * @ubi: UBI device description object
+ *
+ * Reads the headers of the layout volume PEBs and makes sure they agree with
+ * the snapshot. This catches a snapshot left over from a UBI image which has
+ * since been re-flashed. Returns zero if the snapshot agrees and a negative
+ * error code if not.
+ */
+static int snap_verify(struct ubi_device *ubi)
+{
+	struct ubi_snap_hdr *hdr = ubi->snap_hdr;
+	int vol_count = be32_to_cpu(hdr->vol_count);
+	struct ubi_snap_peb *pebs = ubi->snap_buf + vol_count *
+						   UBI_SNAP_VOL_SIZE;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_ec_hdr *ec_hdr;
+	int err = -ENOMEM, pnum, found = 0;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return err;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		goto out_ec;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		struct ubi_snap_peb *p = &pebs[pnum];
+
+		if (p->state != UBI_SNAP_PEB_USED ||
+		    be32_to_cpu(p->vol_id) != UBI_LAYOUT_VOLUME_ID)
+			continue;
+
+		err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto mismatch;
+		if (be64_to_cpu(ec_hdr->ec) != be32_to_cpu(p->ec) ||
+		    ec_hdr->image_seq != hdr->image_seq)
+			goto mismatch;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto mismatch;
+		if (vid_hdr->vol_id != p->vol_id || vid_hdr->lnum != p->lnum)
+			goto mismatch;
+
+		found += 1;
+	}
+
+	err = found ? 0 : -EINVAL;
+	goto out;
+
+mismatch:
+	dbg_err("PEB %d does not match the snapshot, error %d", pnum, err);
+	err = err < 0 ? err : -EINVAL;
+out:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_ec:
+	kfree(ec_hdr);
+	return err;
+}
+
+/* add_peb - add a PEB to one of the lists of the scanning information */
+static int add_peb(struct ubi_scan_info *si, int pnum, int ec,
+		   struct list_head *list)
+{
+	struct ubi_scan_leb *seb;
+
+	seb = kmalloc(sizeof(struct ubi_scan_leb), GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->pnum = pnum;
+	seb->ec = ec;
+	list_add_tail(&seb->u.list, list);
+	return 0;
+}
+
+/**
+ * snap_fill - build scanning information from the snapshot records.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int snap_fill(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	struct ubi_snap_hdr *hdr = ubi->snap_hdr;
+	int vol_count = be32_to_cpu(hdr->vol_count);
+	struct ubi_snap_vol *v, *vols = ubi->snap_buf;
+	struct ubi_snap_peb *pebs = (void *)(vols + vol_count);
+	struct ubi_vid_hdr *vid_hdr;
+	int err = 0, pnum, ec;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		struct ubi_snap_peb *p = &pebs[pnum];
+
+		ec = be32_to_cpu(p->ec);
+
+		switch (p->state) {
+		case UBI_SNAP_PEB_BAD:
+			si->bad_peb_count += 1;
+			continue;
+		case UBI_SNAP_PEB_FREE:
+			err = add_peb(si, pnum, ec, &si->free);
+			break;
+		case UBI_SNAP_PEB_ERASE:
+			err = add_peb(si, pnum, ec, &si->erase);
+			break;
+		case UBI_SNAP_PEB_USED:
+			/*
+			 * Only the fields scanning looks at are needed. There
+			 * is exactly one PEB per LEB, so the sequence number
+			 * does not matter.
+			 */
+			v = find_vol(vols, vol_count, p->vol_id);
+			vid_hdr->vol_type = v->vol_type;
+			vid_hdr->compat = v->compat;
+			vid_hdr->vol_id = p->vol_id;
+			vid_hdr->lnum = p->lnum;
+			vid_hdr->data_size = v->last_data_size;
+			vid_hdr->used_ebs = v->used_ebs;
+			vid_hdr->data_pad = v->data_pad;
+			vid_hdr->sqnum = 0;
+			err = ubi_scan_add_used(ubi, si, pnum, ec, vid_hdr, 0);
+			break;
+		}
+		if (err)
+			goto out;
+
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	si->is_empty = 0;
+	si->max_sqnum = be64_to_cpu(hdr->max_sqnum);
+	ubi->image_seq = be32_to_cpu(hdr->image_seq);
+
+out:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * ubi_snap_load - build scanning information from the attach snapshot.
+ * @ubi: UBI device description object
+ * @si: empty scanning information to fill
+ *
+ * Returns zero if @si was filled from the snapshot, %1 if there is no usable
+ * snapshot and the device has to be scanned, and a negative error code in
+ * case of failure, in which case @si has to be thrown away and the device
+ * scanned as well.
+ */
+int ubi_snap_load(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, block, count;
+	unsigned long long sqnum;
+
+	if (!ubi->snap_mtd)
+		return 1;
+
+	block = snap_find(ubi);
+	if (block < 0) {
+		ubi_msg("no attach snapshot found, scanning");
+		return 1;
+	}
+
+	/* Newer snapshots start after this one whether it is usable or not */
+	sqnum = be64_to_cpu(ubi->snap_hdr->sqnum);
+	count = be32_to_cpu(ubi->snap_hdr->block_count);
+	ubi->snap_sqnum = sqnum;
+	ubi->snap_block = block;
+	ubi->snap_next = block + 1;
+	if (count > 0 && count <= UBI_SNAP_MAX_BLOCKS)
+		ubi->snap_next = be32_to_cpu(ubi->snap_hdr->blocks[count - 1]) + 1;
+	if (ubi->snap_next < 0 || ubi->snap_next >= snap_block_count(ubi))
+		ubi->snap_next = 0;
+
+	err = snap_is_stale(ubi, block);
+	if (err) {
+		ubi_msg("attach snapshot %llu is stale, scanning", sqnum);
+		return 1;
+	}
+
+	err = snap_read_records(ubi);
+	if (!err)
+		err = snap_check_records(ubi);
+	if (!err)
+		err = snap_verify(ubi);
+	if (!err)
+		err = snap_fill(ubi, si);
+	if (err) {
+		/* Make sure it is not tried again */
+		snap_mark(ubi, block);
+		return err;
+	}
+
+	ubi->snap_valid = 1;
+	ubi_msg("attached from snapshot %llu on mtd%d", sqnum,
+		ubi->snap_mtd->index);
+	return 0;
+}
+
+/**
+ * snap_collect - fill @ubi->snap_buf with the snapshot records.
+ * @ubi: UBI device description object
+ * @vol_count: the number of volume records is returned here
+ *
+ * The EBA and WL sub-systems have to be held off by the caller. Returns the
+ * size of the records in case of success and a negative error code in case of
+ * failure.
+ */
+static int snap_collect(struct ubi_device *ubi, int *vol_count)
+{
+	struct ubi_snap_vol *v = ubi->snap_buf;
+	struct ubi_snap_peb *pebs;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+	int err, i, n = 0, pnum, lnum, last, leb_count, data_size;
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++)
+		if (ubi->volumes[i])
+			n += 1;
+	pebs = (void *)(v + n);
+
+	/* Every good PEB has a WL entry, those not in a tree await erasure */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		struct ubi_snap_peb *p = &pebs[pnum];
+
+		memset(p, 0, UBI_SNAP_PEB_SIZE);
+		e = ubi->lookuptbl[pnum];
+		if (e) {
+			p->state = UBI_SNAP_PEB_ERASE;
+			p->ec = cpu_to_be32(e->ec);
+			continue;
+		}
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (!err) {
+			/* E.g., a PEB of a "preserve" internal volume */
+			dbg_err("PEB %d is not known to UBI", pnum);
+			return -EINVAL;
+		}
+		p->state = UBI_SNAP_PEB_BAD;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		pebs[e->pnum].state = UBI_SNAP_PEB_FREE;
+	spin_unlock(&ubi->wl_lock);
+
+	err = 0;
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		last = -1;
+		leb_count = 0;
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			struct ubi_snap_peb *p;
+
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+
+			p = &pebs[pnum];
+			if (p->state != UBI_SNAP_PEB_ERASE) {
+				dbg_err("LEB %d:%d maps to PEB %d in state %d",
+					vol->vol_id, lnum, pnum, p->state);
+				err = -EINVAL;
+				break;
+			}
+			p->state = UBI_SNAP_PEB_USED;
+			p->vol_id = cpu_to_be32(vol->vol_id);
+			p->lnum = cpu_to_be32(lnum);
+			last = lnum;
+			leb_count += 1;
+		}
+		if (err)
+			break;
+
+		memset(v, 0, UBI_SNAP_VOL_SIZE);
+		v->vol_id = cpu_to_be32(vol->vol_id);
+		v->compat = vol->vol_id == UBI_LAYOUT_VOLUME_ID ?
+			    UBI_LAYOUT_VOLUME_COMPAT : 0;
+		v->data_pad = cpu_to_be32(vol->data_pad);
+		v->leb_count = cpu_to_be32(leb_count);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			v->vol_type = UBI_VID_DYNAMIC;
+		else {
+			v->vol_type = UBI_VID_STATIC;
+			v->used_ebs = cpu_to_be32(vol->used_ebs);
+			if (last == vol->used_ebs - 1)
+				v->last_data_size =
+					cpu_to_be32(vol->last_eb_bytes);
+			else
+				v->last_data_size =
+					cpu_to_be32(vol->usable_leb_size);
+		}
+		v += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+	if (err)
+		return err;
+
+	*vol_count = n;
+	data_size = n * UBI_SNAP_VOL_SIZE + ubi->peb_count * UBI_SNAP_PEB_SIZE;
+
+	/* Pad the last minimal I/O unit */
+	memset(ubi->snap_buf + data_size, 0xFF,
+	       ALIGN(data_size, ubi->snap_mtd->writesize) - data_size);
+	return data_size;
+}
+
+/**
+ * snap_pick_blocks - pick the eraseblocks for the next snapshot.
+ * @ubi: UBI device description object
+ * @blocks: the eraseblocks are returned here
+ * @count: how many eraseblocks are needed
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int snap_pick_blocks(struct ubi_device *ubi, int *blocks, int count)
+{
+	int err, i, n = 0, nblocks = snap_block_count(ubi);
+	int block = ubi->snap_next;
+
+	for (i = 0; i < nblocks && n < count; i++) {
+		err = snap_block_isbad(ubi, block);
+		if (err < 0)
+			return err;
+		if (!err)
+			blocks[n++] = block;
+		block = (block + 1) % nblocks;
+	}
+
+	if (n < count) {
+		ubi_err("not enough good eraseblocks for a snapshot");
+		return -ENOSPC;
+	}
+
+	ubi->snap_next = block;
+	return 0;
+}
+
+/**
+ * ubi_snap_take - take an attach snapshot.
+ * @ubi: UBI device description object
+ *
+ * Does nothing if the newest snapshot still matches the flash. Returns zero
+ * in case of success and a negative error code in case of failure.
+ */
+int ubi_snap_take(struct ubi_device *ubi)
+{
+	struct ubi_snap_hdr *hdr = ubi->snap_hdr;
+	struct mtd_info *mtd = ubi->snap_mtd;
+	int err, i, len, done, count, vol_count, data_size;
+	int blocks[UBI_SNAP_MAX_BLOCKS + 1];
+	uint32_t crc;
+
+	if (!mtd)
+		return 0;
+
+	mutex_lock(&ubi->device_mutex);
+	down_write(&ubi->snap_sem);
+	down_write(&ubi->work_sem);
+	mutex_lock(&ubi->snap_mutex);
+
+	err = 0;
+	if (ubi->snap_valid || ubi->ro_mode)
+		goto out_unlock;
+
+	err = snap_collect(ubi, &vol_count);
+	if (err < 0)
+		goto out_unlock;
+	data_size = err;
+
+	count = 1 + DIV_ROUND_UP(data_size, mtd->erasesize);
+	err = snap_pick_blocks(ubi, blocks, count);
+	if (err)
+		goto out_unlock;
+
+	for (i = 0; i < count; i++) {
+		err = snap_erase(ubi, blocks[i]);
+		if (err)
+			goto out_unlock;
+	}
+
+	for (i = 1, done = 0; i < count; i++, done += len) {
+		len = min_t(int, data_size - done, mtd->erasesize);
+		err = snap_mtd_write(ubi, ubi->snap_buf + done,
+				     snap_block_addr(ubi, blocks[i]),
+				     ALIGN(len, mtd->writesize));
+		if (err)
+			goto out_unlock;
+	}
+
+	memset(hdr, 0xFF, snap_hdr_size(ubi));
+	memset(hdr, 0, UBI_SNAP_HDR_SIZE);
+	hdr->magic = cpu_to_be32(UBI_SNAP_HDR_MAGIC);
+	hdr->version = UBI_SNAP_VERSION;
+	hdr->sqnum = cpu_to_be64(ubi->snap_sqnum + 1);
+	spin_lock(&ubi->ltree_lock);
+	hdr->max_sqnum = cpu_to_be64(ubi->global_sqnum);
+	spin_unlock(&ubi->ltree_lock);
+	hdr->image_seq = cpu_to_be32(ubi->image_seq);
+	hdr->peb_count = cpu_to_be32(ubi->peb_count);
+	hdr->peb_size = cpu_to_be32(ubi->peb_size);
+	hdr->vid_hdr_offset = cpu_to_be32(ubi->vid_hdr_offset);
+	hdr->vol_count = cpu_to_be32(vol_count);
+	hdr->data_size = cpu_to_be32(data_size);
+	crc = crc32(UBI_CRC32_INIT, ubi->snap_buf, data_size);
+	hdr->data_crc = cpu_to_be32(crc);
+	hdr->block_count = cpu_to_be32(count - 1);
+	for (i = 1; i < count; i++)
+		hdr->blocks[i - 1] = cpu_to_be32(blocks[i]);
+	crc = crc32(UBI_CRC32_INIT, hdr, UBI_SNAP_HDR_SIZE_CRC);
+	hdr->hdr_crc = cpu_to_be32(crc);
+
+	err = snap_mtd_write(ubi, hdr, snap_block_addr(ubi, blocks[0]),
+			     snap_hdr_size(ubi));
+	if (err)
+		goto out_unlock;
+
+	ubi->snap_sqnum += 1;
+	ubi->snap_block = blocks[0];
+	ubi->snap_valid = 1;
+	dbg_gen("took attach snapshot %llu at eraseblock %d",
+		ubi->snap_sqnum, blocks[0]);
+
+out_unlock:
+	if (err)
+		ubi_warn("cannot take attach snapshot, error %d", err);
+	mutex_unlock(&ubi->snap_mutex);
+	up_write(&ubi->work_sem);
+	up_write(&ubi->snap_sem);
+	mutex_unlock(&ubi->device_mutex);
+	return err;
+}
+
+static void snap_work_fn(struct work_struct *work)
+{
+	struct ubi_device *ubi = container_of(work, struct ubi_device,
+					      snap_work.work);
+
+	/* Pending works would invalidate the snapshot straight away */
+	if (!ubi->snap_valid && !ubi->works_count &&
+	    time_after(jiffies, ubi->snap_changed + SNAP_IDLE_TIME))
+		ubi_snap_take(ubi);
+
+	schedule_delayed_work(&ubi->snap_work, SNAP_IDLE_TIME);
+}
+
+static int snap_reboot_notify(struct notifier_block *nb, unsigned long action,
+			      void *unused)
+{
+	struct ubi_device *ubi = container_of(nb, struct ubi_device,
+					      snap_reboot);
+
+	ubi_snap_take(ubi);
+	return NOTIFY_DONE;
+}
+
+/**
+ * ubi_snap_init - initialize attach snapshots of an UBI device.
+ * @ubi: UBI device description object
+ * @snap_mtd: MTD device to keep the snapshots on, or %NULL
+ *
+ * Has to be called before the device is scanned, even without @snap_mtd.
+ * Returns zero in case of success and a negative error code in case of
+ * failure. %-EINVAL and %-EROFS mean that @snap_mtd cannot hold snapshots;
+ * the device is then set up without them and can still be scanned.
+ */
+int ubi_snap_init(struct ubi_device *ubi, struct mtd_info *snap_mtd)
+{
+	int count;
+
+	init_rwsem(&ubi->snap_sem);
+	mutex_init(&ubi->snap_mutex);
+	INIT_DELAYED_WORK(&ubi->snap_work, snap_work_fn);
+	ubi->snap_reboot.notifier_call = snap_reboot_notify;
+
+	if (!snap_mtd)
+		return 0;
+
+	if (snap_mtd->index == ubi->mtd->index) {
+		ubi_warn("snapshots cannot be kept on the UBI device itself");
+		return -EINVAL;
+	}
+
+	if (!(snap_mtd->flags & MTD_WRITEABLE)) {
+		ubi_warn("snapshot MTD device mtd%d is read-only",
+			snap_mtd->index);
+		return -EROFS;
+	}
+
+	ubi->snap_mtd = snap_mtd;
+	count = DIV_ROUND_UP(snap_max_data(ubi), snap_mtd->erasesize);
+	if (snap_mtd->numeraseregions != 0 || count > UBI_SNAP_MAX_BLOCKS ||
+	    count + 1 > snap_block_count(ubi) ||
+	    2 * snap_hdr_size(ubi) > snap_mtd->erasesize) {
+		ubi_warn("mtd%d cannot hold snapshots, %d eraseblocks needed",
+			snap_mtd->index, count + 1);
+		ubi->snap_mtd = NULL;
+		return -EINVAL;
+	}
+
+	ubi->snap_hdr = kmalloc(snap_hdr_size(ubi), GFP_KERNEL);
+	ubi->snap_buf = vmalloc(ALIGN(snap_max_data(ubi),
+				      snap_mtd->writesize));
+	if (!ubi->snap_hdr || !ubi->snap_buf) {
+		ubi_snap_free(ubi);
+		ubi->snap_mtd = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_snap_start - start keeping attach snapshots up to date.
+ * @ubi: UBI device description object
+ */
+void ubi_snap_start(struct ubi_device *ubi)
+{
+	if (!ubi->snap_mtd)
+		return;
+
+	ubi->snap_changed = jiffies;
+	register_reboot_notifier(&ubi->snap_reboot);
+	schedule_delayed_work(&ubi->snap_work, SNAP_IDLE_TIME);
+}
+
+/**
+ * ubi_snap_free - free the attach snapshot buffers.
+ * @ubi: UBI device description object
+ */
+void ubi_snap_free(struct ubi_device *ubi)
+{
+	kfree(ubi->snap_hdr);
+	vfree(ubi->snap_buf);
+	ubi->snap_hdr = NULL;
+	ubi->snap_buf = NULL;
+}
+
+/**
+ * ubi_snap_close - take the final attach snapshot on detach.
+ * @ubi: UBI device description object
+ *
+ * Also releases the snapshot MTD device.
+ */
+void ubi_snap_close(struct ubi_device *ubi)
+{
+	if (!ubi->snap_mtd)
+		return;
+
+	unregister_reboot_notifier(&ubi->snap_reboot);
+	cancel_delayed_work_sync(&ubi->snap_work);
+	ubi_snap_take(ubi);
+
+	ubi_snap_free(ubi);
+	put_mtd_device(ubi->snap_mtd);
+	ubi->snap_mtd = NULL;
+}
@@ -375,4 +375,126 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* Attach snapshot header magic number (ASCII "UBIs") */
+#define UBI_SNAP_HDR_MAGIC 0x55424973
+
+/* The version of the attach snapshot format */
+#define UBI_SNAP_VERSION 1
+
+/* Maximum count of eraseblocks holding the records of one snapshot */
+#define UBI_SNAP_MAX_BLOCKS 32
+
+/*
+ * Physical eraseblock states recorded in an attach snapshot.
+ *
+ * @UBI_SNAP_PEB_FREE: erased, with a valid EC header
+ * @UBI_SNAP_PEB_USED: mapped to a logical eraseblock
+ * @UBI_SNAP_PEB_ERASE: has to be erased
+ * @UBI_SNAP_PEB_BAD: bad physical eraseblock
+ */
+enum {
+	UBI_SNAP_PEB_FREE = 1,
+	UBI_SNAP_PEB_USED,
+	UBI_SNAP_PEB_ERASE,
+	UBI_SNAP_PEB_BAD
+};
+
+/* Sizes of the attach snapshot header and records */
+#define UBI_SNAP_HDR_SIZE  sizeof(struct ubi_snap_hdr)
+#define UBI_SNAP_VOL_SIZE  sizeof(struct ubi_snap_vol)
+#define UBI_SNAP_PEB_SIZE  sizeof(struct ubi_snap_peb)
+
+/* Size of the attach snapshot header without the ending CRC */
+#define UBI_SNAP_HDR_SIZE_CRC (UBI_SNAP_HDR_SIZE - sizeof(__be32))
+
+/**
+ * struct ubi_snap_hdr - attach snapshot header.
+ * @magic: attach snapshot header magic number (%UBI_SNAP_HDR_MAGIC)
+ * @version: version of the snapshot format (%UBI_SNAP_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @sqnum: snapshot sequence number, the newest snapshot has the highest one
+ * @max_sqnum: highest VID header sequence number used on the UBI device
+ * @image_seq: image sequence number of the UBI device
+ * @peb_count: count of physical eraseblocks of the UBI device
+ * @peb_size: physical eraseblock size of the UBI device
+ * @vid_hdr_offset: VID header offset of the UBI device
+ * @vol_count: count of &struct ubi_snap_vol records
+ * @data_size: size of the records in bytes
+ * @data_crc: CRC checksum of the records
+ * @block_count: count of eraseblocks in @blocks
+ * @blocks: eraseblocks of the snapshot MTD device holding the records
+ * @padding2: reserved for future, zeroes
+ * @hdr_crc: attach snapshot header CRC checksum
+ *
+ * An attach snapshot is a copy of the scanning information of an UBI device.
+ * It lives on a separate MTD device, so that attaching does not have to read
+ * the headers of every physical eraseblock. The header is stored at the
+ * beginning of an eraseblock of that MTD device and is followed, in the next
+ * minimal I/O unit, by the invalidation marker. A snapshot whose marker is
+ * not all 0xFF bytes is stale and must not be used.
+ *
+ * The records are stored in the eraseblocks listed in @blocks: @vol_count
+ * &struct ubi_snap_vol objects followed by @peb_count &struct ubi_snap_peb
+ * objects indexed by physical eraseblock number.
+ */
+struct ubi_snap_hdr {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be64  sqnum;
+	__be64  max_sqnum;
+	__be32  image_seq;
+	__be32  peb_count;
+	__be32  peb_size;
+	__be32  vid_hdr_offset;
+	__be32  vol_count;
+	__be32  data_size;
+	__be32  data_crc;
+	__be32  block_count;
+	__be32  blocks[UBI_SNAP_MAX_BLOCKS];
+	__u8    padding2[4];
+	__be32  hdr_crc;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_snap_vol - attach snapshot volume record.
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding: reserved for future, zeroes
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @last_data_size: amount of data in the last logical eraseblock (static
+ *                  volumes only)
+ * @leb_count: count of mapped logical eraseblocks
+ */
+struct ubi_snap_vol {
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding[2];
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_data_size;
+	__be32  leb_count;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_snap_peb - attach snapshot physical eraseblock record.
+ * @ec: erase counter
+ * @vol_id: ID of the volume the physical eraseblock is mapped to
+ * @lnum: logical eraseblock number the physical eraseblock is mapped to
+ * @state: state of the physical eraseblock (%UBI_SNAP_PEB_FREE, etc)
+ * @padding: reserved for future, zeroes
+ *
+ * @vol_id and @lnum are only meaningful for %UBI_SNAP_PEB_USED eraseblocks.
+ */
+struct ubi_snap_peb {
+	__be32  ec;
+	__be32  vol_id;
+	__be32  lnum;
+	__u8    state;
+	__u8    padding[3];
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
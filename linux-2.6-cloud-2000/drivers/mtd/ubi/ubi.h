@@ -38,6 +38,7 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 
@@ -382,6 +383,21 @@ struct ubi_wl_entry;
  * @ckvol_mutex: serializes static volume checking when opening
  * @dbg_peb_buf: buffer of PEB size used for debugging
  * @dbg_buf_mutex: protects @dbg_peb_buf
+ *
+ * @snap_mtd: MTD device holding attach snapshots, %NULL if there is none
+ * @snap_sem: held for reading by EBA changes, for writing while a snapshot
+ *            is taken
+ * @snap_mutex: protects @snap_valid, @snap_block, @snap_next, @snap_sqnum,
+ *              @snap_hdr and @snap_buf
+ * @snap_valid: the newest on-flash snapshot matches the flash
+ * @snap_block: header eraseblock of the newest snapshot
+ * @snap_next: eraseblock the next snapshot starts at
+ * @snap_sqnum: sequence number of the newest snapshot
+ * @snap_changed: time of the last change of the flash, in jiffies
+ * @snap_hdr: buffer for the snapshot header
+ * @snap_buf: buffer for the snapshot records
+ * @snap_work: takes a snapshot once the device is idle
+ * @snap_reboot: takes a snapshot on reboot
  */
 struct ubi_device {
 	struct cdev cdev;
@@ -466,6 +482,20 @@ struct ubi_device {
 	void *dbg_peb_buf;
 	struct mutex dbg_buf_mutex;
 #endif
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+	struct mtd_info *snap_mtd;
+	struct rw_semaphore snap_sem;
+	struct mutex snap_mutex;
+	int snap_valid;
+	int snap_block;
+	int snap_next;
+	unsigned long long snap_sqnum;
+	unsigned long snap_changed;
+	struct ubi_snap_hdr *snap_hdr;
+	void *snap_buf;
+	struct delayed_work snap_work;
+	struct notifier_block snap_reboot;
+#endif
 };
 
 extern struct kmem_cache *ubi_wl_entry_slab;
@@ -549,8 +579,34 @@ int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
 
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+/* snapshot.c */
+int ubi_snap_init(struct ubi_device *ubi, struct mtd_info *snap_mtd);
+void ubi_snap_start(struct ubi_device *ubi);
+void ubi_snap_close(struct ubi_device *ubi);
+void ubi_snap_free(struct ubi_device *ubi);
+int ubi_snap_load(struct ubi_device *ubi, struct ubi_scan_info *si);
+int ubi_snap_take(struct ubi_device *ubi);
+int ubi_snap_invalidate(struct ubi_device *ubi);
+#else
+static inline int ubi_snap_init(struct ubi_device *ubi,
+				struct mtd_info *snap_mtd)
+{
+	return 0;
+}
+static inline void ubi_snap_start(struct ubi_device *ubi) {}
+static inline void ubi_snap_close(struct ubi_device *ubi) {}
+static inline void ubi_snap_free(struct ubi_device *ubi) {}
+static inline int ubi_snap_load(struct ubi_device *ubi,
+				struct ubi_scan_info *si)
+{
+	return 1;
+}
+#endif
+
 /* build.c */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset);
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       struct mtd_info *snap_mtd);
 int ubi_detach_mtd_dev(int ubi_num, int anyway);
 struct ubi_device *ubi_get_device(int ubi_num);
 void ubi_put_device(struct ubi_device *ubi);
@@ -658,6 +714,65 @@ static inline void ubi_ro_mode(struct ubi_device *ubi)
 	}
 }
 
+/**
+ * ubi_snap_dirty - note that the flash is about to change.
+ * @ubi: UBI device description object
+ *
+ * Invalidates the on-flash attach snapshot if it still matches the flash.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static inline int ubi_snap_dirty(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+	ubi->snap_changed = jiffies;
+	if (unlikely(ubi->snap_valid))
+		return ubi_snap_invalidate(ubi);
+#endif
+	return 0;
+}
+
+/**
+ * ubi_snap_hold - keep attach snapshots from being taken.
+ * @ubi: UBI device description object
+ *
+ * Taken around EBA changes, so that a snapshot never sees a logical eraseblock
+ * half way through being mapped or un-mapped.
+ */
+static inline void ubi_snap_hold(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+	down_read(&ubi->snap_sem);
+#endif
+}
+
+/**
+ * ubi_snap_tryhold - keep attach snapshots from being taken, if possible.
+ * @ubi: UBI device description object
+ *
+ * Returns non-zero if no snapshot is being taken and it has to be released
+ * with 'ubi_snap_release()'.
+ */
+static inline int ubi_snap_tryhold(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+	return down_read_trylock(&ubi->snap_sem);
+#else
+	return 1;
+#endif
+}
+
+/**
+ * ubi_snap_release - allow attach snapshots again.
+ * @ubi: UBI device description object
+ */
+static inline void ubi_snap_release(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_SNAPSHOT
+	up_read(&ubi->snap_sem);
+#endif
+}
+
 /**
  * vol_id2idx - get table index by volume ID.
  * @ubi: UBI device description object
@@ -96,16 +96,12 @@
 #include <linux/phy_fixed.h>
 #include <linux/of.h>
 #include <net/xfrm.h>
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-#include <asm/fsl_msg.h>
-#endif
 
 #ifdef CONFIG_NET_GIANFAR_FP
 #include <linux/if_arp.h>
 #include <linux/netdevice.h>
 #include <net/route.h>
 #include <net/ip.h>
-#include <linux/jhash.h>
 #endif
 
 #include <net/tcp.h>
@@ -176,14 +172,19 @@ static void gfar_netpoll(struct net_device *dev);
 static int gfar_accept_fastpath(struct net_device *dev, struct dst_entry *dst);
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
 #endif
-int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit);
+int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit,
+		struct napi_struct *napi);
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+static int gfar_rx_page_map(struct gfar_priv_rx_q *rx_queue,
+		struct rxbd8 *bdp, struct gfar_rx_page *rp);
+#endif
 #ifdef CONFIG_GIANFAR_TXNAPI
 static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue, int tx_work_limit);
 #else
 static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue);
 #endif
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull);
+			      int amount_pull, struct napi_struct *napi);
 static void gfar_vlan_rx_register(struct net_device *netdev,
 		                struct vlan_group *grp);
 void gfar_halt(struct net_device *dev);
@@ -209,6 +210,8 @@ static void gfar_skbr_register_truesize(struct gfar_private *priv);
 static int gfar_kfree_skb(struct sk_buff *skb, int qindex);
 static void gfar_reset_skb_handler(struct gfar_skb_handler *sh);
 static inline void gfar_clean_reclaim_skb(struct sk_buff *skb);
+static struct sk_buff *gfar_skbr_alloc(struct net_device *dev);
+static void gfar_skbr_drain(struct gfar_private *priv);
 #endif
 
 MODULE_AUTHOR("Freescale Semiconductor, Inc");
@@ -273,6 +276,26 @@ static int gfar_init_bds(struct net_device *ndev)
 		rx_queue->skb_currx = 0;
 		rxbdp = rx_queue->rx_bd_base;
 
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+		if (rx_queue->rx_page) {
+			for (j = 0; j < rx_queue->rx_ring_size; j++) {
+				struct gfar_rx_page *rp = &rx_queue->rx_page[j];
+
+				if (rp->page) {
+					gfar_init_rxbdp(rx_queue, rxbdp,
+							rp->dma);
+				} else if (gfar_rx_page_map(rx_queue, rxbdp,
+							    rp)) {
+					pr_err("%s: Can't allocate RX buffers\n",
+							ndev->name);
+					goto err_rxalloc_fail;
+				}
+				rxbdp++;
+			}
+			continue;
+		}
+#endif
+
 		for (j = 0; j < rx_queue->rx_ring_size; j++) {
 			struct sk_buff *skb = rx_queue->rx_skbuff[j];
 
@@ -314,9 +337,12 @@ unsigned long alloc_bds(struct gfar_private *priv, dma_addr_t *addr)
 	               priv->total_rx_ring_size;
 
 #ifdef CONFIG_GIANFAR_L2SRAM
-	vaddr =  (unsigned long) mpc85xx_cache_sram_alloc(region_size,
-					(phys_addr_t *)addr, ALIGNMENT);
-	if (vaddr == NULL) {
+	vaddr = 0;
+	if (priv->bd_sram)
+		vaddr = (unsigned long) mpc85xx_cache_sram_alloc_client(
+				GFAR_SRAM_CLIENT, region_size,
+				(phys_addr_t *)addr, ALIGNMENT);
+	if (!vaddr) {
 		/* fallback to normal memory rather than stop working */
 		vaddr = (unsigned long) dma_alloc_coherent(&priv->ofdev->dev,
 				region_size, addr, GFP_KERNEL);
@@ -432,6 +458,16 @@ static int gfar_alloc_skb_resources(struct net_device *ndev)
 
 		for (j = 0; j < rx_queue->rx_ring_size; j++)
 			rx_queue->rx_skbuff[j] = NULL;
+
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+		/* Frames must fit in half a page; the wake up queue keeps
+		 * its own buffers */
+		if (priv->rx_buffer_size <= GFAR_RX_PAGE_BUF &&
+		    !((priv->device_flags & FSL_GIANFAR_DEV_HAS_ARP_PACKET) &&
+		      i == priv->num_rx_queues - 1))
+			rx_queue->rx_page = kcalloc(rx_queue->rx_ring_size,
+					sizeof(*rx_queue->rx_page), GFP_KERNEL);
+#endif
 	}
 
 	if (gfar_init_bds(ndev))
@@ -600,9 +636,6 @@ static void gfar_init_mac(struct net_device *ndev)
 
 }
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-DEFINE_PER_CPU(struct gfar_cpu_dev, gfar_cpu_dev);
-#endif
 
 static struct net_device_stats *gfar_get_stats(struct net_device *dev)
 {
@@ -721,17 +754,8 @@ static void disable_napi(struct gfar_private *priv)
 {
 	int i = 0;
 #ifdef CONFIG_GIANFAR_TXNAPI
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int j;
-	int cpus  = num_online_cpus();
-#endif
 	for (i = 0; i < priv->num_grps; i++) {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		for (j = 0; j < cpus; j++)
-			napi_disable(&priv->gfargrp[i].napi_tx[j]);
-#else
 		napi_disable(&priv->gfargrp[i].napi_tx);
-#endif
 		napi_disable(&priv->gfargrp[i].napi_rx);
 	}
 #else
@@ -745,17 +769,8 @@ static void enable_napi(struct gfar_private *priv)
 	int i = 0;
 
 #ifdef CONFIG_GIANFAR_TXNAPI
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int j;
-	int cpus = num_online_cpus();
-#endif
 	for (i = 0; i < priv->num_grps; i++) {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		for (j = 0; j < cpus; j++)
-			napi_enable(&priv->gfargrp[i].napi_tx[j]);
-#else
 		napi_enable(&priv->gfargrp[i].napi_tx);
-#endif
 		napi_enable(&priv->gfargrp[i].napi_rx);
 	}
 #else
@@ -768,10 +783,6 @@ static int gfar_parse_group(struct device_node *np,
 		struct gfar_private *priv, const char *model)
 {
 	u32 *queue_mask;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int i;
-	int cpus = num_online_cpus();
-#endif
 	priv->gfargrp[priv->num_grps].regs = of_iomap(np, 0);
 	if (!priv->gfargrp[priv->num_grps].regs)
 		return -ENOMEM;
@@ -808,24 +819,6 @@ static int gfar_parse_group(struct device_node *np,
 		priv->gfargrp[priv->num_grps].rx_bit_map = 0xFF;
 		priv->gfargrp[priv->num_grps].tx_bit_map = 0xFF;
 	}
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps) {
-		/* register msg unit for virtual tx interrupt for each cpu */
-		for (i = 0; i < cpus; i++) { /* for each cpu */
-			priv->gfargrp[priv->num_grps].msg_virtual_tx[i]
-				= fsl_get_msg_unit();
-			if (IS_ERR
-			(priv->gfargrp[priv->num_grps].msg_virtual_tx[i])) {
-				priv->sps = 0;
-				printk(KERN_WARNING
-				"%s: unable to allocate msg interrupt for pkt"
-				"steering, error = %ld!\n", __func__,
-				PTR_ERR(priv->gfargrp[priv->num_grps].
-				msg_virtual_tx[i]));
-			}
-		}
-	}
-#endif
 	priv->num_grps++;
 
 	return 0;
@@ -851,9 +844,6 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 	u32 *busFreq;
 	u32 etsec_clk;
 	u32 max_filer_rules;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int sps;
-#endif
 
 	if (!np || !of_device_is_available(np))
 		return -ENODEV;
@@ -869,14 +859,6 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 		return -EINVAL;
 	}
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if ((num_online_cpus() == 2) &&
-		(!of_device_is_compatible(np, "fsl,etsec2"))) {
-		printk(KERN_INFO "ETSEC: IPS Enabled\n");
-		num_tx_qs = num_online_cpus();
-		sps = 1;
-	}
-#endif
 #ifdef CONFIG_RX_TX_BD_XNGE
 	/* Creating multilple queues for avoiding lock in xmit function.*/
 	num_tx_qs = (num_tx_qs < 3) ? 3 : num_tx_qs;
@@ -900,9 +882,6 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 	priv = netdev_priv(dev);
 	priv->node = ofdev->dev.of_node;
 	priv->ndev = dev;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	priv->sps = sps;
-#endif
 
 	busFreq = (u32 *)of_get_property
 			(of_get_parent(np), "bus-frequency", NULL);
@@ -1095,6 +1074,11 @@ static int gfar_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 	if (!netif_running(dev))
 		return -EINVAL;
 
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	if (cmd == SIOCSHWTSTAMP)
+		return gfar_hwtstamp_ioctl(dev, rq);
+#endif
+
 	if (!priv->phydev)
 		return -ENODEV;
 
@@ -1270,7 +1254,7 @@ inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 
 	if (iph->ihl > 5 || (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
 		(gfar_sk->sk_state != TCP_ESTABLISHED)) {
-		gfar_process_frame(priv->ndev, skb, amount_pull);
+		gfar_process_frame(priv->ndev, skb, amount_pull, NULL);
 		return;
 	}
 
@@ -1422,6 +1406,16 @@ static void gfar_init_filer_table(struct gfar_private *priv)
 		priv->ftp_rqfpr[i] = rqfpr;
 		gfar_write_filer(priv, i, rqfcr, rqfpr);
 	}
+
+	/* The bottom of the table holds the flow steering rules */
+	if (priv->rx_filer_enable &&
+	    priv->cur_filer_idx > GFAR_FLOW_HASH_RESERVE)
+		priv->flow_max_rules = min_t(unsigned int, GFAR_FLOW_MAX_RULES,
+			(priv->cur_filer_idx - GFAR_FLOW_HASH_RESERVE) /
+			GFAR_FLOW_RULE_ENTRIES);
+	else
+		priv->flow_max_rules = 0;
+	gfar_flow_restore(priv);
 	return;
 out:
 	kfree(priv->ftp_rqfcr);
@@ -1430,390 +1424,6 @@ out:
 
 }
 
-static int get_cpu_number(unsigned char *eth_pkt, int len)
-{
-	u32 addr1, addr2, ports;
-	struct ipv6hdr *ip6;
-	struct iphdr *ip;
-	u32 hash, ihl;
-	u8 ip_proto;
-	int cpu;
-	struct ethhdr *eth;
-	static u32 simple_hashrnd;
-	static int simple_hashrnd_initialized;
-
-	if (len < ETH_HLEN)
-		return -1;
-	else
-		eth = eth_pkt;
-
-	if (unlikely(!simple_hashrnd_initialized)) {
-		get_random_bytes(&simple_hashrnd, 4);
-		simple_hashrnd_initialized = 1;
-	}
-
-	switch (eth->h_proto) {
-	case __constant_htons(ETH_P_IP):
-		if (len < (ETH_HLEN + sizeof(*ip)))
-			return -1;
-
-		ip = (struct iphdr *) (eth_pkt + ETH_HLEN);
-		ip_proto = ip->protocol;
-		addr1 = ip->saddr;
-		addr2 = ip->daddr;
-		ihl = ip->ihl;
-		break;
-	case __constant_htons(ETH_P_IPV6):
-		if (len < (ETH_HLEN + sizeof(*ip6)))
-			return -1;
-
-		ip6 = (struct ipv6hdr *)(eth_pkt + ETH_HLEN);
-		ip_proto = ip6->nexthdr;
-		addr1 = ip6->saddr.s6_addr32[3];
-		addr2 = ip6->daddr.s6_addr32[3];
-		ihl = (40 >> 2);
-		break;
-	default:
-		return -1;
-	}
-	ports = 0;
-	switch (ip_proto) {
-	case IPPROTO_TCP:
-	case IPPROTO_UDP:
-	case IPPROTO_DCCP:
-	case IPPROTO_ESP:
-	case IPPROTO_SCTP:
-	case IPPROTO_UDPLITE:
-		if (len >= (ETH_HLEN + (ihl * 4) + 4))
-			ports = *((u32 *) (eth_pkt + ETH_HLEN + (ihl * 4)));
-		break;
-	case IPPROTO_AH:
-		if (len >= (ETH_HLEN + (ihl * 4) + 4))
-			ports = *((u32 *) (eth_pkt + ETH_HLEN + (ihl * 4) + 4));
-		break;
-
-	default:
-		break;
-	}
-
-	hash = jhash_3words(addr1, addr2, ports, simple_hashrnd);
-	cpu = hash & 0x1;
-
-	return cpu_online(cpu) ? cpu : -1;
-}
-
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-static int gfar_cpu_poll(struct napi_struct *napi, int budget)
-{
-	struct gfar_cpu_dev *cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	struct sk_buff *skb = NULL, *new_recycle_head = NULL;
-	int cpu = smp_processor_id();
-	int rx_cleaned = 0;
-	struct net_device *dev;
-	struct gfar_private *priv;
-	int amount_pull;
-	struct shared_buffer *buf = &per_cpu(gfar_cpu_dev, !cpu).tx_queue;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	struct gfar_skb_handler *sh = &cpu_dev->sh;
-#endif
-
-	while (budget--) {
-		smp_rmb();
-
-		spin_lock_irq(&buf->lock);
-		if (buf->buff_cnt == 0) {
-			spin_unlock_irq(&buf->lock);
-			break;
-		} else {
-			skb = buf->buffer[buf->out];
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-			if (sh->recycle_count > 0) {
-				new_recycle_head = sh->recycle_queue->next;
-				buf->buffer[buf->out] = sh->recycle_queue;
-				sh->recycle_queue->next = NULL;
-				sh->recycle_queue = new_recycle_head;
-				sh->recycle_count--;
-			} else {
-				buf->buffer[buf->out] = NULL;
-			}
-#endif
-			buf->out = (buf->out + 1) % GFAR_CPU_BUFF_SIZE;
-			buf->buff_cnt--;
-			spin_unlock_irq(&buf->lock);
-
-			dev = skb->dev;
-			priv = netdev_priv(dev);
-
-			if (priv->ptimer_present)
-				amount_pull =
-				(gfar_uses_fcb(priv) ? GMAC_FCB_LEN : 0);
-			else
-				amount_pull =
-				(gfar_uses_fcb(priv) ? GMAC_FCB_LEN : 0) +
-					priv->padding;
-
-			gfar_process_frame(dev, skb, amount_pull);
-
-			rx_cleaned++;
-		}
-	}
-
-	if (budget > 0)
-		napi_complete(napi);
-
-	return rx_cleaned;
-}
-
-static irqreturn_t gfar_cpu_receive(int irq, void *dev_id)
-{
-	unsigned long flags;
-	struct gfar_cpu_dev *cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-
-	/* clear the interrupt by reading message */
-	fsl_clear_msg(cpu_dev->msg_virtual_rx);
-
-	local_irq_save(flags);
-	if (napi_schedule_prep(&cpu_dev->napi))
-		__napi_schedule(&cpu_dev->napi);
-
-	local_irq_restore(flags);
-
-	return IRQ_HANDLED;
-}
-
-void gfar_cpu_setup(struct net_device *dev)
-{
-	return;
-}
-
-static enum hrtimer_restart gfar_cpu_timer_handle(struct hrtimer *timer)
-{
-	struct gfar_cpu_dev *this_cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	struct gfar_cpu_dev *other_cpu_dev =
-		&per_cpu(gfar_cpu_dev, !smp_processor_id());
-
-	if (timer == &this_cpu_dev->intr_coalesce_timer) {
-		fsl_send_msg(other_cpu_dev->msg_virtual_rx, 0x1);
-		this_cpu_dev->intr_coalesce_cnt = 0;
-	} else {
-		fsl_send_msg(this_cpu_dev->msg_virtual_rx, 0x1);
-		other_cpu_dev->intr_coalesce_cnt = 0;
-	}
-
-	return HRTIMER_NORESTART;
-}
-
-void gfar_cpu_dev_init(void)
-{
-	int err = -1;
-	int i = 0;
-	int j;
-	struct gfar_cpu_dev *cpu_dev;
-	struct cpumask cpumask_msg_intrs;
-
-	for_each_possible_cpu(i) {
-		cpu_dev = &per_cpu(gfar_cpu_dev, i);
-		cpu_dev->enabled = 0;
-
-		init_dummy_netdev(&cpu_dev->dev);
-		spin_lock_init(&cpu_dev->tx_queue.lock);
-		netif_napi_add(&cpu_dev->dev,
-			&cpu_dev->napi, gfar_cpu_poll, GFAR_DEV_WEIGHT);
-
-		cpu_dev->msg_virtual_rx = fsl_get_msg_unit();
-		if (IS_ERR(cpu_dev->msg_virtual_rx)) {
-			printk(KERN_WARNING
-				"%s: fsl_get_msg_unit returned error %ld!\n",
-				__func__, IS_ERR(cpu_dev->msg_virtual_rx));
-			goto msg_fail;
-		}
-
-		sprintf(cpu_dev->int_name, "cpu%d_vrx", i);
-		err = request_irq(cpu_dev->msg_virtual_rx->irq,
-			gfar_cpu_receive, 0, cpu_dev->int_name, NULL);
-		if (err < 0) {
-			printk(KERN_WARNING "Can't request msg IRQ %d\n",
-				cpu_dev->msg_virtual_rx->irq);
-			goto irq_fail;
-		}
-		cpumask_clear(&cpumask_msg_intrs);
-		cpumask_set_cpu(i, &cpumask_msg_intrs);
-		irq_set_affinity(cpu_dev->msg_virtual_rx->irq,
-					&cpumask_msg_intrs);
-		fsl_enable_msg(cpu_dev->msg_virtual_rx);
-
-		for (j = 0; j < GFAR_CPU_BUFF_SIZE; j++)
-			cpu_dev->tx_queue.buffer[j] = NULL;
-
-		cpu_dev->tx_queue.in = 0;
-		cpu_dev->tx_queue.out = 0;
-		cpu_dev->tx_queue.buff_cnt = 0;
-
-		napi_enable(&cpu_dev->napi);
-
-		cpu_dev->intr_coalesce_cnt = 0;
-		hrtimer_init(&cpu_dev->intr_coalesce_timer, CLOCK_MONOTONIC,
-			 HRTIMER_MODE_ABS);
-		cpu_dev->intr_coalesce_timer.function = gfar_cpu_timer_handle;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-		gfar_reset_skb_handler(&cpu_dev->sh);
-#endif
-
-		cpu_dev->enabled = 1;
-	}
-	return;
-
-irq_fail:
-	fsl_release_msg_unit(cpu_dev->msg_virtual_rx);
-
-msg_fail:
-	netif_napi_del(&cpu_dev->napi);
-
-	for (j = 0; j < i; j++) {
-		cpu_dev = &per_cpu(gfar_cpu_dev, j);
-
-		cpu_dev->enabled = 0;
-		napi_disable(&cpu_dev->napi);
-		free_irq(cpu_dev->msg_virtual_rx->irq, NULL);
-		fsl_release_msg_unit(cpu_dev->msg_virtual_rx);
-		netif_napi_del(&cpu_dev->napi);
-	}
-}
-
-void gfar_cpu_dev_exit(void)
-{
-	int i = 0;
-	struct gfar_cpu_dev *cpu_dev;
-
-	for_each_possible_cpu(i) {
-		cpu_dev = &per_cpu(gfar_cpu_dev, i);
-
-		hrtimer_cancel(&cpu_dev->intr_coalesce_timer);
-		napi_disable(&cpu_dev->napi);
-		free_irq(cpu_dev->msg_virtual_rx->irq, NULL);
-		fsl_release_msg_unit(cpu_dev->msg_virtual_rx);
-		netif_napi_del(&cpu_dev->napi);
-	}
-}
-
-int distribute_packet(struct net_device *dev,
-			struct sk_buff *skb,
-			int amount_pull)
-{
-	struct gfar_private *priv = netdev_priv(dev);
-	struct gfar_cpu_dev *cpu_dev;
-	int target_cpu;
-	int current_cpu = smp_processor_id();
-	unsigned char *skb_data;
-	unsigned int skb_len;
-	unsigned int eth_hdr_offset = 0;
-	unsigned char *eth;
-	struct shared_buffer *buf;
-	ktime_t time;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	struct gfar_skb_handler *sh;
-	struct sk_buff *new_skb;
-#endif
-
-	skb_data = skb->data;
-	skb_len = skb->len;
-
-	if (amount_pull)
-		eth_hdr_offset += amount_pull;
-	if (priv->ptimer_present)
-		eth_hdr_offset += 8;
-
-	if (eth_hdr_offset > skb_len)
-		return -1;
-
-	eth = skb_data + eth_hdr_offset;
-	target_cpu = get_cpu_number(eth, skb_len - eth_hdr_offset);
-	if (-1 == target_cpu)
-		return -1;
-
-	if (target_cpu == current_cpu)
-		return -1;
-
-	cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	if (!cpu_dev->enabled)
-		return -1;
-
-	buf = &cpu_dev->tx_queue;
-	spin_lock_irq(&buf->lock);
-	if (buf->buff_cnt == (GFAR_CPU_BUFF_SIZE - 1)) {
-		dev_kfree_skb_any(skb);    /* buffer full, drop packet */
-		spin_unlock_irq(&buf->lock);
-		return 0;
-	}
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	sh = &cpu_dev->sh;
-	if (sh->recycle_count < sh->recycle_max) {
-		if (buf->buffer[buf->in] != NULL)
-			new_skb = buf->buffer[buf->in];
-		else
-			new_skb = gfar_new_skb(dev);
-
-		/* put the obtained/allocated skb into
-		current cpu's recycle buffer */
-		if (new_skb) {
-			new_skb->next = sh->recycle_queue;
-			sh->recycle_queue = new_skb;
-			sh->recycle_count++;
-		}
-	}
-#endif
-
-	/* inform other cpu which dev this skb was received on */
-	skb->dev = dev;
-	buf->buffer[buf->in] = skb;
-	buf->in = (buf->in + 1) % GFAR_CPU_BUFF_SIZE;
-	smp_wmb();
-	buf->buff_cnt++;
-	spin_unlock_irq(&buf->lock);
-
-	/* raise other core's msg intr */
-	if (0 == cpu_dev->intr_coalesce_cnt++) {
-		time = ktime_set(0, 0);
-		time = ktime_add_ns(time, INTR_COALESCE_TIMEOUT);
-		hrtimer_start(&cpu_dev->intr_coalesce_timer,
-			time, HRTIMER_MODE_ABS);
-	} else {
-		if (cpu_dev->intr_coalesce_cnt == INTR_COALESCE_CNT) {
-			cpu_dev->intr_coalesce_cnt = 0;
-			hrtimer_cancel(&cpu_dev->intr_coalesce_timer);
-			fsl_send_msg(per_cpu
-			(gfar_cpu_dev, target_cpu).msg_virtual_rx, 0x1);
-		}
-	}
-	return 0;
-}
-
-static irqreturn_t gfar_virtual_transmit(int irq, void *grp_id)
-{
-	unsigned long flags;
-	int cpu = smp_processor_id();
-	struct gfar_priv_grp *grp = (struct gfar_priv_grp *)grp_id;
-	int cpus = num_online_cpus();
-	int i;
-
-	for (i = 0; i < cpus; i++)
-		/* clear the interrupt */
-		/* although only one virtual tx intr is enabled at a time,
-		 * we are clearing virtual tx intr of all cpus, to ensure
-		 * this intr is cleared even if user sets wrong affinity
-		 */
-		fsl_clear_msg(grp->msg_virtual_tx[i]);
-
-	local_irq_save(flags);
-	if (napi_schedule_prep(&grp->napi_tx[cpu]))
-		__napi_schedule(&grp->napi_tx[cpu]);
-
-	local_irq_restore(flags);
-
-	return IRQ_HANDLED;
-}
-#endif
-
 /* Set up the ethernet device structure, private data,
  * and anything else we need before we start */
 static int gfar_probe(struct of_device *ofdev,
@@ -1828,10 +1438,6 @@ static int gfar_probe(struct of_device *ofdev,
 	u32 rstat = 0, tstat = 0, rqueue = 0, tqueue = 0;
 	u32 isrg = 0;
 	u32 __iomem *baddr;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int j;
-	int cpus = num_online_cpus();
-#endif
 
 	err = gfar_of_init(ofdev, &dev);
 
@@ -1857,6 +1463,11 @@ static int gfar_probe(struct of_device *ofdev,
 
 	spin_lock_init(&priv->bflock);
 	INIT_WORK(&priv->reset_task, gfar_reset_task);
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+	/* free_skb_resources() drains the depot, even before the first open */
+	spin_lock_init(&priv->skb_depot.lock);
+	priv->skb_depot.recycle_max = GFAR_MAX_RECYCLE_MAX;
+#endif
 
 	dev_set_drvdata(&ofdev->dev, priv);
 	regs = priv->gfargrp[0].regs;
@@ -1894,12 +1505,7 @@ static int gfar_probe(struct of_device *ofdev,
 #ifdef CONFIG_GIANFAR_TXNAPI
 	/* Seperate napi for tx and rx for each group */
 	for (i = 0; i < priv->num_grps; i++) {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		for (j = 0; j < cpus; j++)
-			netif_napi_add(dev, &priv->gfargrp[i].napi_tx[j],
-#else
-			netif_napi_add(dev, &priv->gfargrp[i].napi_tx,
-#endif
+		netif_napi_add(dev, &priv->gfargrp[i].napi_tx,
 				gfar_poll_tx, GFAR_DEV_WEIGHT);
 		netif_napi_add(dev, &priv->gfargrp[i].napi_rx, gfar_poll_rx,
 				GFAR_DEV_WEIGHT);
@@ -1916,6 +1522,12 @@ static int gfar_probe(struct of_device *ofdev,
 	} else
 		priv->rx_csum_enable = 0;
 
+	dev->features |= NETIF_F_GRO;
+
+#ifdef CONFIG_GIANFAR_L2SRAM
+	priv->bd_sram = 1;
+#endif
+
 	priv->vlgrp = NULL;
 
 	if (priv->device_flags & FSL_GIANFAR_DEV_HAS_VLAN)
@@ -2029,14 +1641,19 @@ static int gfar_probe(struct of_device *ofdev,
 	priv->rx_queue[priv->num_rx_queues - 1]->rx_ring_size = DEFAULT_WK_RING_SIZE;
 
 	/* enable filer if using multiple RX queues*/
-	if (priv->num_rx_queues > 1)
+	if (priv->num_rx_queues > 1) {
 		priv->rx_filer_enable = 1;
+		dev->features |= NETIF_F_NTUPLE;
+	}
 
 	for (i = 0; i < priv->num_rx_queues; i++) {
 		priv->rx_queue[i]->rx_ring_size = DEFAULT_RX_RING_SIZE;
 		priv->rx_queue[i]->rxcoalescing = DEFAULT_RX_COALESCE;
 		priv->rx_queue[i]->rxic = DEFAULT_RXIC;
 	}
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	gfar_aic_init(priv);
+#endif
 
 	/* Enable most messages by default */
 	priv->msg_enable = (NETIF_MSG_IFUP << 1 ) - 1;
@@ -2100,6 +1717,12 @@ static int gfar_probe(struct of_device *ofdev,
 
 	/* Create all the sysfs files */
 	gfar_init_sysfs(dev);
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	gfar_aic_debugfs_init(priv);
+#endif
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	gfar_ptp_clock_register(priv);
+#endif
 
 	/* Print out the device info */
 	printk(KERN_INFO DEVICE_NAME "%pM\n", dev->name, dev->dev_addr);
@@ -2141,11 +1764,20 @@ static int gfar_remove(struct of_device *ofdev)
 
 	dev_set_drvdata(&ofdev->dev, NULL);
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	gfar_aic_debugfs_exit(priv);
+#endif
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	gfar_ptp_clock_unregister(priv);
+#endif
 	unregister_netdev(priv->ndev);
 	unmap_group_regs(priv);
 
 	kfree(priv->ftp_rqfpr);
 	kfree(priv->ftp_rqfcr);
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+	free_percpu(priv->local_sh);
+#endif
 	free_netdev(priv->ndev);
 	return 0;
 }
@@ -2759,16 +2391,6 @@ void gfar_halt(struct net_device *dev)
 
 static void free_grp_irqs(struct gfar_priv_grp *grp)
 {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int i;
-	struct gfar_private *priv = grp->priv;
-	int cpus = num_online_cpus();
-
-	if (priv->sps) {
-		for (i = 0; i < cpus; i++)
-			free_irq(grp->msg_virtual_tx[i]->irq, grp);
-	}
-#endif
 	free_irq(grp->interruptError, grp);
 #ifndef CONFIG_RX_TX_BD_XNGE
 	free_irq(grp->interruptTransmit, grp);
@@ -2790,7 +2412,8 @@ void free_bds(struct gfar_private *priv)
 			priv->tx_queue[0]->tx_bd_base,
 			priv->tx_queue[0]->tx_bd_dma_base);
 	} else {
-		mpc85xx_cache_sram_free(priv->tx_queue[0]->tx_bd_base);
+		mpc85xx_cache_sram_free_client(GFAR_SRAM_CLIENT,
+				priv->tx_queue[0]->tx_bd_base);
 	}
 #else
 	dma_free_coherent(&priv->ofdev->dev,
@@ -2841,12 +2464,10 @@ void stop_gfar(struct net_device *dev)
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 /*
  * function: gfar_reset_skb_handler
- * Resetting skb handler spin lock entry in the driver initialization.
- * Execute only once.
+ * Resetting skb handler entry in the driver initialization.
  */
 static void gfar_reset_skb_handler(struct gfar_skb_handler *sh)
 {
-	spin_lock_init(&sh->lock);
 	sh->recycle_max = GFAR_DEFAULT_RECYCLE_MAX;
 	sh->recycle_count = 0;
 	sh->recycle_queue = NULL;
@@ -2858,15 +2479,12 @@ static void gfar_reset_skb_handler(struct gfar_skb_handler *sh)
  * Reset SKB handler struction and free existance socket buffer
  * and data buffer in the recycling queue
  */
-void gfar_free_recycle_queue(struct gfar_skb_handler *sh, int lock_flag)
+void gfar_free_recycle_queue(struct gfar_skb_handler *sh)
 {
-	unsigned long flags = 0;
 	struct sk_buff *clist = NULL;
 	struct sk_buff *skb;
 	/* Get recycling queue */
 	/* just for making sure there is recycle_queue */
-	if (lock_flag)
-		spin_lock_irqsave(&sh->lock, flags);
 	if (sh->recycle_queue) {
 		/* pick one from head; most recent one */
 		clist = sh->recycle_queue;
@@ -2874,55 +2492,200 @@ void gfar_free_recycle_queue(struct gfar_skb_handler *sh, int lock_flag)
 		sh->recycle_count = 0;
 		sh->recycle_queue = NULL;
 	}
-	if (lock_flag)
-		spin_unlock_irqrestore(&sh->lock, flags);
 	while (clist) {
 		skb = clist;
 		clist = clist->next;
 		dev_kfree_skb_any(skb);
 	}
 }
-#endif
 
-static void free_skb_tx_queue(struct gfar_priv_tx_q *tx_queue)
+/*
+ * function: gfar_skbr_init
+ * Allocate the per-CPU magazines and reset the depot. Recycling is only
+ * switched on (by publishing skbuff_truesize) once both are in place.
+ */
+static void gfar_skbr_init(struct gfar_private *priv)
 {
-	struct txbd8 *txbdp;
-	struct gfar_private *priv = netdev_priv(tx_queue->dev);
-	int i, j;
-
-	txbdp = tx_queue->tx_bd_base;
+	struct gfar_skb_depot *depot = &priv->skb_depot;
+	struct gfar_skb_handler *sh;
+	int i, cpu;
 
-	for (i = 0; i < tx_queue->tx_ring_size; i++) {
-		if (!tx_queue->tx_skbuff[i])
-			continue;
+	depot->mag_count = 0;
 
-		dma_unmap_single(&priv->ofdev->dev, txbdp->bufPtr,
-				txbdp->length, DMA_TO_DEVICE);
-		txbdp->lstatus = 0;
-		for (j = 0; j < skb_shinfo(tx_queue->tx_skbuff[i])->nr_frags;
-				j++) {
-			txbdp++;
-			dma_unmap_page(&priv->ofdev->dev, txbdp->bufPtr,
-					txbdp->length, DMA_TO_DEVICE);
+	if (!priv->local_sh) {
+		priv->local_sh = alloc_percpu(struct gfar_skb_handler);
+		if (!priv->local_sh) {
+			printk(KERN_WARNING "%s: skb recycling disabled\n",
+					priv->ndev->name);
+			return;
 		}
-		txbdp++;
-		dev_kfree_skb_any(tx_queue->tx_skbuff[i]);
-		tx_queue->tx_skbuff[i] = NULL;
 	}
-#ifndef CONFIG_GIANFAR_L2SRAM
-	kfree(tx_queue->tx_skbuff);
-#endif
+	for_each_possible_cpu(cpu) {
+		sh = per_cpu_ptr(priv->local_sh, cpu);
+		gfar_free_recycle_queue(sh);
+		gfar_reset_skb_handler(sh);
+		if (sh->recycle_max > depot->recycle_max)
+			sh->recycle_max = depot->recycle_max;
+	}
+
+	for (i = 0; i < priv->num_rx_queues; i++)
+		priv->rx_queue[i]->rx_skbuff_truesize =
+					GFAR_DEFAULT_RECYCLE_TRUESIZE;
+
+	depot->recycle_enable = 1;
+	smp_wmb();
+	priv->skbuff_truesize = GFAR_DEFAULT_RECYCLE_TRUESIZE;
 }
 
-static void free_skb_rx_queue(struct gfar_priv_rx_q *rx_queue)
+/*
+ * function: gfar_skbr_drain
+ * Stop recycling and give every buffer held by the per-CPU magazines and
+ * the depot back to the slab. The caller must already have cleared
+ * skbuff_truesize so that no new buffer can enter the magazines.
+ */
+static void gfar_skbr_drain(struct gfar_private *priv)
 {
-	struct rxbd8 *rxbdp;
-	struct gfar_private *priv = netdev_priv(rx_queue->dev);
-	int i;
+	struct gfar_skb_depot *depot = &priv->skb_depot;
+	struct gfar_skb_handler tmp;
+	unsigned long flags;
+	int i, cpu;
 
-	rxbdp = rx_queue->rx_bd_base;
+	priv->skbuff_truesize = 0;
+	/* Wait for CPUs still running gfar_skbr_free() with the old size */
+	synchronize_sched();
 
-	for (i = 0; i < rx_queue->rx_ring_size; i++) {
+	spin_lock_irqsave(&depot->lock, flags);
+	depot->recycle_enable = 0;
+	spin_unlock_irqrestore(&depot->lock, flags);
+
+	for (i = 0; i < depot->mag_count; i++) {
+		tmp.recycle_queue = depot->mags[i].head;
+		gfar_free_recycle_queue(&tmp);
+		depot->mags[i].head = NULL;
+		depot->mags[i].count = 0;
+	}
+	depot->mag_count = 0;
+
+	if (!priv->local_sh)
+		return;
+
+	for_each_possible_cpu(cpu)
+		gfar_free_recycle_queue(per_cpu_ptr(priv->local_sh, cpu));
+}
+
+/* Give the buffers beyond the first max of a magazine back to the slab */
+static void gfar_skbr_trim(struct sk_buff **head, short int *count,
+		short int max)
+{
+	struct sk_buff *skb;
+
+	while (*count > max && *head) {
+		skb = *head;
+		*head = skb->next;
+		(*count)--;
+		dev_kfree_skb_any(skb);
+	}
+}
+
+/*
+ * function: gfar_skbr_set_max
+ * Set the ceiling of the per-CPU magazine depth. When it drops, every
+ * magazine, per-CPU or parked in the depot, is cut down to the new
+ * ceiling at once. The magazines are only touched by their own CPU, so
+ * recycling is stopped meanwhile as in gfar_skbr_drain().
+ * Must be called under the RTNL, which orders it against open/close.
+ */
+void gfar_skbr_set_max(struct gfar_private *priv, short int max)
+{
+	struct gfar_skb_depot *depot = &priv->skb_depot;
+	struct gfar_skb_handler *sh;
+	unsigned int truesize = priv->skbuff_truesize;
+	int i, cpu;
+
+	/* Magazines are empty and get clamped by gfar_skbr_init() when the
+	 * interface is down, and only grow up to the ceiling otherwise.
+	 */
+	if (max >= depot->recycle_max || !truesize || !priv->local_sh) {
+		depot->recycle_max = max;
+		return;
+	}
+
+	priv->skbuff_truesize = 0;
+	/* Wait for CPUs still running gfar_skbr_alloc()/gfar_skbr_free() */
+	synchronize_sched();
+
+	depot->recycle_max = max;
+	for_each_possible_cpu(cpu) {
+		sh = per_cpu_ptr(priv->local_sh, cpu);
+		if (sh->recycle_max > max)
+			sh->recycle_max = max;
+		gfar_skbr_trim(&sh->recycle_queue, &sh->recycle_count, max);
+	}
+	for (i = 0; i < depot->mag_count; i++)
+		gfar_skbr_trim(&depot->mags[i].head, &depot->mags[i].count,
+				max);
+
+	smp_wmb();
+	priv->skbuff_truesize = truesize;
+}
+#endif
+
+static void free_skb_tx_queue(struct gfar_priv_tx_q *tx_queue)
+{
+	struct txbd8 *txbdp;
+	struct gfar_private *priv = netdev_priv(tx_queue->dev);
+	int i, j;
+
+	txbdp = tx_queue->tx_bd_base;
+
+	for (i = 0; i < tx_queue->tx_ring_size; i++) {
+		if (!tx_queue->tx_skbuff[i])
+			continue;
+
+		dma_unmap_single(&priv->ofdev->dev, txbdp->bufPtr,
+				txbdp->length, DMA_TO_DEVICE);
+		txbdp->lstatus = 0;
+		for (j = 0; j < skb_shinfo(tx_queue->tx_skbuff[i])->nr_frags;
+				j++) {
+			txbdp++;
+			dma_unmap_page(&priv->ofdev->dev, txbdp->bufPtr,
+					txbdp->length, DMA_TO_DEVICE);
+		}
+		txbdp++;
+		dev_kfree_skb_any(tx_queue->tx_skbuff[i]);
+		tx_queue->tx_skbuff[i] = NULL;
+	}
+#ifndef CONFIG_GIANFAR_L2SRAM
+	kfree(tx_queue->tx_skbuff);
+#endif
+}
+
+static void free_skb_rx_queue(struct gfar_priv_rx_q *rx_queue)
+{
+	struct rxbd8 *rxbdp;
+	struct gfar_private *priv = netdev_priv(rx_queue->dev);
+	int i;
+
+	rxbdp = rx_queue->rx_bd_base;
+
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+	if (rx_queue->rx_page) {
+		for (i = 0; i < rx_queue->rx_ring_size; i++) {
+			struct gfar_rx_page *rp = &rx_queue->rx_page[i];
+
+			if (rp->page) {
+				dma_unmap_page(&priv->ofdev->dev, rp->dma,
+					       GFAR_RX_PAGE_BUF,
+					       DMA_FROM_DEVICE);
+				put_page(rp->page);
+			}
+		}
+		kfree(rx_queue->rx_page);
+		rx_queue->rx_page = NULL;
+	}
+#endif
+
+	for (i = 0; i < rx_queue->rx_ring_size; i++) {
 		if (rx_queue->rx_skbuff[i]) {
 			dma_unmap_single(&priv->ofdev->dev,
 					rxbdp->bufPtr, priv->rx_buffer_size,
@@ -2945,30 +2708,10 @@ static void free_skb_resources(struct gfar_private *priv)
 {
 	struct gfar_priv_tx_q *tx_queue = NULL;
 	struct gfar_priv_rx_q *rx_queue = NULL;
-	int i, cpu;
+	int i;
 
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	/* 1: spinlocking of skb_handler is required */
-	gfar_free_recycle_queue(&(priv->skb_handler), 1);
-	for (i = 0; i < priv->num_tx_queues ; i++) {
-		for_each_possible_cpu(cpu) {
-			gfar_free_recycle_queue(
-				per_cpu_ptr(priv->tx_queue[i]->local_sh,
-								cpu), 0);
-		}
-		free_percpu(priv->tx_queue[i]->local_sh);
-	}
-
-	for (i = 0; i < priv->num_rx_queues ; i++) {
-		/* 1: spinlocking of skb_handler is required */
-		gfar_free_recycle_queue(&(priv->rx_queue[i]->skb_handler), 1);
-		for_each_possible_cpu(cpu) {
-			gfar_free_recycle_queue(
-				per_cpu_ptr(priv->rx_queue[i]->local_sh,
-								cpu), 0);
-		}
-		free_percpu(priv->rx_queue[i]->local_sh);
-	}
+	gfar_skbr_drain(priv);
 #endif
 	if(( priv->device_flags & FSL_GIANFAR_DEV_HAS_ARP_PACKET)) {
 		rx_queue = priv->rx_queue[priv->num_rx_queues-1];
@@ -2983,6 +2726,10 @@ static void free_skb_resources(struct gfar_private *priv)
 		if(tx_queue->tx_skbuff)
 			free_skb_tx_queue(tx_queue);
 	}
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	/* the stamped frame may have been freed before completion */
+	clear_bit(0, &priv->hwts_tx_busy);
+#endif
 
 	for (i = 0; i < priv->num_rx_queues; i++) {
 		rx_queue = priv->rx_queue[i];
@@ -3144,11 +2891,6 @@ static int register_grp_irqs(struct gfar_priv_grp *grp)
 	struct gfar_private *priv = grp->priv;
 	struct net_device *dev = priv->ndev;
 	int err;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int i, j;
-	int cpus = num_online_cpus();
-	struct cpumask cpumask_msg_intrs;
-#endif
 
 	/* If the device has multiple interrupts, register for
 	 * them.  Otherwise, only register for the one */
@@ -3191,42 +2933,8 @@ static int register_grp_irqs(struct gfar_priv_grp *grp)
 		}
 	}
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps) {
-		for (i = 0; i < cpus; i++) {
-			sprintf(grp->int_name_vtx[i], "%s_g%d_vtx%d",
-				priv->ndev->name, grp->grp_id, i);
-			err = request_irq(grp->msg_virtual_tx[i]->irq,
-						gfar_virtual_transmit, 0,
-						grp->int_name_vtx[i], grp);
-			if (err < 0) {
-				priv->sps = 0;
-				printk(KERN_WARNING
-				"%s: Can't request msg IRQ %d for dev %s\n",
-				__func__,
-				grp->msg_virtual_tx[i]->irq, dev->name);
-				for (j = 0; j < i; j++) {
-					free_irq(grp->msg_virtual_tx[j]->irq,
-						grp);
-					clrbits32(grp->msg_virtual_tx[j]->mer,
-					1 << grp->msg_virtual_tx[j]->msg_num);
-				}
-				goto vtx_irq_fail;
-			}
-			cpumask_clear(&cpumask_msg_intrs);
-			cpumask_set_cpu(i, &cpumask_msg_intrs);
-			irq_set_affinity(grp->msg_virtual_tx[i]->irq,
-						&cpumask_msg_intrs);
-			fsl_enable_msg(grp->msg_virtual_tx[i]);
-		}
-	}
-#endif
 	return 0;
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-vtx_irq_fail:
-	free_irq(grp->interruptReceive, grp);
-#endif
 rx_irq_fail:
 #ifndef CONFIG_RX_TX_BD_XNGE
 	free_irq(grp->interruptTransmit, grp);
@@ -3244,7 +2952,7 @@ int startup_gfar(struct net_device *ndev)
 {
 	struct gfar_private *priv = netdev_priv(ndev);
 	struct gfar __iomem *regs = NULL;
-	int err, i, j, cpu;
+	int err, i, j;
 
 	for (i = 0; i < priv->num_grps; i++) {
 		regs= priv->gfargrp[i].regs;
@@ -3259,28 +2967,7 @@ int startup_gfar(struct net_device *ndev)
 	gfar_init_mac(ndev);
 
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	priv->skbuff_truesize = GFAR_DEFAULT_RECYCLE_TRUESIZE;
-	gfar_reset_skb_handler(&(priv->skb_handler));
-	for (i = 0;  i < priv->num_tx_queues; i++) {
-		priv->tx_queue[i]->local_sh = alloc_percpu(
-						struct gfar_skb_handler);
-		for_each_possible_cpu(cpu) {
-			gfar_reset_skb_handler(
-				per_cpu_ptr(priv->tx_queue[i]->local_sh, cpu));
-		}
-	}
-	for (i = 0;  i < priv->num_rx_queues; i++) {
-		priv->rx_queue[i]->rx_skbuff_truesize =
-					GFAR_DEFAULT_RECYCLE_TRUESIZE;
-		gfar_reset_skb_handler(&(priv->rx_queue[i]->skb_handler));
-		priv->rx_queue[i]->local_sh = alloc_percpu(
-						struct gfar_skb_handler);
-
-		for_each_possible_cpu(cpu) {
-			gfar_reset_skb_handler(
-				per_cpu_ptr(priv->rx_queue[i]->local_sh, cpu));
-		}
-	}
+	gfar_skbr_init(priv);
 #endif
 
 	for (i = 0; i < priv->num_grps; i++) {
@@ -3558,7 +3245,6 @@ static int gfar_xmit_skb(struct sk_buff *skb, struct net_device *dev, int rq)
 /*software TCP segmentation offload*/
 static int gfar_tso(struct sk_buff *skb, struct net_device *dev, int rq)
 {
-	struct gfar_private *priv = netdev_priv(dev);
 	int i = 0;
 	struct iphdr *iph;
 	int ihl;
@@ -3577,29 +3263,7 @@ static int gfar_tso(struct sk_buff *skb, struct net_device *dev, int rq)
 	int pos;
 	int hsize;
 	int ret;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	int howmany_reuse = 0;
-	struct gfar_skb_handler *sh;
-	int free_skb;
-	struct sk_buff *local_head;
-	unsigned long flags;
-	struct gfar_skb_handler *local_sh;
-
-	local_sh = per_cpu_ptr(priv->tx_queue[rq]->local_sh,
-			smp_processor_id());
 
-	if (local_sh->recycle_queue) {
-		local_head = local_sh->recycle_queue;
-		free_skb = local_sh->recycle_count;
-		local_sh->recycle_queue = NULL;
-		local_sh->recycle_count = 0;
-	} else {
-		local_head = NULL;
-		free_skb = 0;
-	}
-	/* global skb_handler for this device */
-	sh = &priv->skb_handler;
-#endif
 	/*processing mac header*/
 	skb_reset_mac_header(skb);
 	skb->mac_len = skb->network_header - skb->mac_header;
@@ -3645,25 +3309,7 @@ static int gfar_tso(struct sk_buff *skb, struct net_device *dev, int rq)
 			len = mss;
 
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-		if (!free_skb) {
-			spin_lock_irqsave(&sh->lock, flags);
-			if (!free_skb && sh->recycle_count) {
-				/* refill local buffer */
-				local_head = sh->recycle_queue;
-				free_skb = sh->recycle_count;
-				sh->recycle_queue = NULL;
-				sh->recycle_count = 0;
-			}
-			spin_unlock_irqrestore(&sh->lock, flags);
-		}
-		if (local_head) {
-			nskb = local_head;;
-			local_head = nskb->next;
-			nskb->next = NULL;
-			free_skb--;
-			howmany_reuse++;
-		} else
-			nskb = gfar_new_skb(dev);
+		nskb = gfar_skbr_alloc(dev);
 #else
 		nskb = alloc_skb(hsize + doffset + headroom,
 					 GFP_ATOMIC);
@@ -3737,15 +3383,6 @@ skip_fraglist:
 	} while ((offset += len) < skb->len);
 
 out_tso:
-
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	if (free_skb) {
-		/* return to local_sh for next time */
-		local_sh->recycle_queue = local_head;
-		local_sh->recycle_count = free_skb;
-	}
-	priv->extra_stats.rx_skbr += howmany_reuse;
-#endif
 	dev_kfree_skb_any(skb);
 	return ret;
 }
@@ -3802,11 +3439,6 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 #ifdef CONFIG_RX_TX_BD_XNGE
 	rq = smp_processor_id() + 1;
 #else
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps)
-		rq = smp_processor_id();
-	else
-#endif
 		rq = skb->queue_mapping;
 #endif
 	tx_queue = priv->tx_queue[rq];
@@ -3816,6 +3448,9 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* make space for additional header when fcb is needed */
 	if (((skb->ip_summed == CHECKSUM_PARTIAL) ||
+#ifdef CONFIG_GFAR_PTP_CLOCK
+			gfar_ptp_tx_wanted(priv, skb) ||
+#endif
 			(priv->vlgrp && vlan_tx_tag_present(skb))) &&
 			(skb_headroom(skb) < GMAC_FCB_LEN)) {
 		struct sk_buff *skb_new;
@@ -3904,7 +3539,24 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		gfar_tx_vlan(skb, fcb);
 	}
 
-	if (priv->ptimer_present) {
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	/* SO_TIMESTAMPING request: the stamp is picked up at completion.
+	 * TMR_TXTS holds the stamp of the last frame only, so one frame is
+	 * stamped at a time and requests made meanwhile go without.
+	 */
+	if (gfar_ptp_tx_wanted(priv, skb)) {
+		if (!test_and_set_bit(0, &priv->hwts_tx_busy)) {
+			if (fcb == NULL) {
+				fcb = gfar_add_fcb(skb);
+				lstatus |= BD_LFLAG(TXBD_TOE);
+			}
+			if (priv->ptimer_present)
+				fcb->ptp = 0x01;
+			skb_tx(skb)->in_progress = 1;
+		}
+	} else
+#endif
+	if (priv->ptimer_present && !gfar_ptp_tx_busy(priv)) {
 		/* Enable ptp flag so that Tx time stamping happens */
 		if (gfar_ptp_do_txstamp(skb)) {
 			if (fcb == NULL)
@@ -3943,9 +3595,6 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	 * to be transmitted BD.
 	 */
 #ifndef CONFIG_RX_TX_BD_XNGE
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if(!priv->sps)
-#endif
 		spin_lock_irqsave(&tx_queue->txlock, flags);
 #endif
 
@@ -3990,9 +3639,6 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Unlock priv */
 #ifndef CONFIG_RX_TX_BD_XNGE
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (!priv->sps)
-#endif
 		spin_unlock_irqrestore(&tx_queue->txlock, flags);
 #endif
 
@@ -4034,11 +3680,6 @@ int gfar_fast_xmit(struct sk_buff *skb, struct net_device *dev)
 #ifdef CONFIG_RX_TX_BD_XNGE
 	rq = smp_processor_id() + 1;
 #else
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps)
-		rq = smp_processor_id();
-	else
-#endif
 		rq = skb->queue_mapping;
 #endif
 	tx_queue = priv->tx_queue[rq];
@@ -4105,9 +3746,6 @@ int gfar_fast_xmit(struct sk_buff *skb, struct net_device *dev)
 	 */
 
 #ifndef CONFIG_RX_TX_BD_XNGE
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (!priv->sps)
-#endif
 		spin_lock_irqsave(&tx_queue->txlock, flags);
 #endif
 
@@ -4151,9 +3789,6 @@ int gfar_fast_xmit(struct sk_buff *skb, struct net_device *dev)
 	gfar_write(&regs->tstat, TSTAT_CLEAR_THALT >> tx_queue->qindex);
 
 #ifndef CONFIG_RX_TX_BD_XNGE
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (!priv->sps)
-#endif
 		spin_unlock_irqrestore(&tx_queue->txlock, flags);
 #endif
 #ifdef CONFIG_RX_TX_BD_XNGE
@@ -4397,13 +4032,6 @@ static int gfar_change_mtu(struct net_device *dev, int new_mtu)
 	int oldsize = priv->rx_buffer_size;
 	int frame_size = new_mtu + ETH_HLEN;
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (rcv_pkt_steering && priv->sps) {
-		printk(KERN_ERR "Can't change mtu with rcv_pkt_steering on\n");
-		return -EINVAL;
-	}
-#endif
-
 	if (priv->vlgrp)
 		frame_size += VLAN_HLEN;
 
@@ -4507,10 +4135,6 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 	int howmany = 0;
 	u32 lstatus;
 
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	int howmany_recycle = 0;
-#endif
-
 	rx_queue = priv->rx_queue[tx_queue->qindex];
 	bdp = tx_queue->dirty_tx;
 	skb_dirtytx = tx_queue->skb_dirtytx;
@@ -4545,6 +4169,14 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 			bdp = next_txbd(bdp, base, tx_ring_size);
 		}
 
+#ifdef CONFIG_GFAR_PTP_CLOCK
+		if (unlikely(skb_tx(skb)->in_progress)) {
+			gfar_ptp_tx_hwtstamp(priv, skb);
+			/* TMR_TXTS is read, the next frame may be stamped */
+			clear_bit(0, &priv->hwts_tx_busy);
+		}
+#endif
+
 #ifdef CONFIG_TCP_FAST_ACK
 		if (skb->sk &&
 		skb->truesize == SKB_DATA_ALIGN(MAX_TCP_HEADER) + sizeof(struct sk_buff) &&
@@ -4560,7 +4192,7 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 #endif
 		{
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-			howmany_recycle += gfar_kfree_skb(skb, tx_queue->qindex);
+			gfar_kfree_skb(skb, tx_queue->qindex);
 #else
 			dev_kfree_skb_any(skb);
 #endif
@@ -4588,10 +4220,6 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 	tx_queue->skb_dirtytx = skb_dirtytx;
 	tx_queue->dirty_tx = bdp;
 
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	priv->extra_stats.rx_skbr_free += howmany_recycle;
-#endif
-
 	return howmany;
 }
 
@@ -4616,24 +4244,13 @@ static void gfar_schedule_cleanup_tx(struct gfar_priv_grp *gfargrp)
 {
 	unsigned long flags;
 	u32 imask = 0;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int cpu = smp_processor_id();
-#endif
 
 	spin_lock_irqsave(&gfargrp->grplock, flags);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (napi_schedule_prep(&gfargrp->napi_tx[cpu])) {
-#else
 	if (napi_schedule_prep(&gfargrp->napi_tx)) {
-#endif
 		imask = gfar_read(&gfargrp->regs->imask);
 		imask = imask & IMASK_TX_DISABLED;
 		gfar_write(&gfargrp->regs->imask, imask);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		__napi_schedule(&gfargrp->napi_tx[cpu]);
-#else
 		__napi_schedule(&gfargrp->napi_tx);
-#endif
 	} else {
 		gfar_write(&gfargrp->regs->ievent, IEVENT_TX_MASK);
 	}
@@ -4664,34 +4281,7 @@ static void gfar_schedule_cleanup(struct gfar_priv_grp *gfargrp)
 static irqreturn_t gfar_transmit(int irq, void *grp_id)
 {
 #ifdef CONFIG_GIANFAR_TXNAPI
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	struct gfar_priv_grp *grp = (struct gfar_priv_grp *)grp_id;
-	struct gfar_private *priv = grp->priv;
-	unsigned int tstat  = gfar_read(&grp->regs->tstat);
-	int cpu = smp_processor_id();
-	unsigned long flags;
-
-	if (priv->sps) {
-		spin_lock_irqsave(&grp->grplock, flags);
-		if (tstat & (0x8000 >> !cpu))
-			fsl_send_msg(grp->msg_virtual_tx[!cpu], 0x1);
-
-		if (tstat & (0x8000 >> cpu))
-			if (napi_schedule_prep(&grp->napi_tx[cpu]))
-				__napi_schedule(&grp->napi_tx[cpu]);
-
-		gfar_write(&grp->regs->ievent, IEVENT_TX_MASK);
-
-		/* clear TXF0,TXF1 in TSTAT */
-		gfar_write(&grp->regs->tstat, (tstat & 0xC000));
-
-		spin_unlock_irqrestore(&grp->grplock, flags);
-	} else {
-#endif
 		gfar_schedule_cleanup_tx((struct gfar_priv_grp *)grp_id);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	}
-#endif
 #else
 #ifdef CONFIG_GFAR_TX_NONAPI
 	struct gfar_priv_grp *grp = (struct gfar_priv_grp *)grp_id;
@@ -4745,7 +4335,9 @@ static void gfar_skbr_register_truesize(struct gfar_private *priv)
 {
 	int i = 0;
 
-	priv->skbuff_truesize = skbuff_truesize(priv->rx_buffer_size);
+	/* Recycling stays off while the interface is down */
+	if (priv->skb_depot.recycle_enable)
+		priv->skbuff_truesize = skbuff_truesize(priv->rx_buffer_size);
 	for (i = 0; i < priv->num_rx_queues; i++)
 		priv->rx_queue[i]->rx_skbuff_truesize =
 				skbuff_truesize(priv->rx_buffer_size);
@@ -4838,6 +4430,7 @@ static inline void gfar_clean_reclaim_skb(struct sk_buff *skb)
 	skb_reset_tail_pointer(skb);
 	/* shared info clean up */
 	atomic_set(&(skb_shinfo(skb)->dataref), 1);
+	skb_shinfo(skb)->tx_flags.flags = 0;
 	/* We need the data buffer to be aligned properly.  We will
 	 * reserve as many bytes as needed to align the data properly
 	 */
@@ -4850,103 +4443,202 @@ static inline void gfar_clean_reclaim_skb(struct sk_buff *skb)
 
 }
 
-static int gfar_kfree_skb(struct sk_buff *skb, int qindex)
+/* Hand a full magazine over to the depot. Returns 0 if the depot is full */
+static int gfar_skbr_depot_put(struct gfar_private *priv,
+		struct gfar_skb_handler *sh)
 {
-	struct gfar_private *priv;
+	struct gfar_skb_depot *depot = &priv->skb_depot;
+	struct gfar_skb_mag *mag;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&depot->lock, flags);
+	if (likely(depot->recycle_enable &&
+			depot->mag_count < GFAR_RECYCLE_DEPOT_MAGS)) {
+		mag = &depot->mags[depot->mag_count++];
+		mag->head = sh->recycle_queue;
+		mag->count = sh->recycle_count;
+		sh->recycle_queue = NULL;
+		sh->recycle_count = 0;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&depot->lock, flags);
+
+	if (ret)
+		sh->depot_put++;
+	return ret;
+}
+
+/* Load an empty magazine from the depot. Returns 0 if the depot is empty */
+static int gfar_skbr_depot_get(struct gfar_private *priv,
+		struct gfar_skb_handler *sh)
+{
+	struct gfar_skb_depot *depot = &priv->skb_depot;
+	struct gfar_skb_mag *mag;
+	unsigned long flags;
+	int ret = 0;
+
+	/* Unlocked peek, the common RX case on a loaded box is a hit */
+	if (!depot->mag_count)
+		return 0;
+
+	spin_lock_irqsave(&depot->lock, flags);
+	if (depot->mag_count) {
+		mag = &depot->mags[--depot->mag_count];
+		sh->recycle_queue = mag->head;
+		sh->recycle_count = mag->count;
+		mag->head = NULL;
+		mag->count = 0;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&depot->lock, flags);
+
+	if (ret)
+		sh->depot_get++;
+	return ret;
+}
+
+/*
+ * function: gfar_skbr_alloc
+ * Get a receive buffer from this CPU's magazine, refilling it from the
+ * depot when it runs dry. A miss falls back to the slab and deepens the
+ * magazine so that the next burst is served from the cache.
+ * Must be called with bottom halves disabled.
+ */
+static struct sk_buff *gfar_skbr_alloc(struct net_device *dev)
+{
+	struct gfar_private *priv = netdev_priv(dev);
 	struct gfar_skb_handler *sh;
-	unsigned long flags = 0;
+	struct sk_buff *skb;
 
-	if ((skb->skb_owner == NULL) ||
+	if (unlikely(!priv->skbuff_truesize))
+		return gfar_new_skb(dev);
+
+	sh = per_cpu_ptr(priv->local_sh, smp_processor_id());
+	if (unlikely(!sh->recycle_queue) && !gfar_skbr_depot_get(priv, sh)) {
+		sh->recycle_miss++;
+		if (sh->recycle_max < priv->skb_depot.recycle_max)
+			sh->recycle_max = min_t(short int, priv->skb_depot.recycle_max,
+					sh->recycle_max + GFAR_RECYCLE_STEP);
+		return gfar_new_skb(dev);
+	}
+
+	skb = sh->recycle_queue;
+	sh->recycle_queue = skb->next;
+	skb->next = NULL;
+	sh->recycle_count--;
+	sh->recycle_hit++;
+
+	return skb;
+}
+
+/*
+ * function: gfar_skbr_free
+ * Put a clean buffer into this CPU's magazine. A full magazine goes to
+ * the depot; if the depot is full as well we are holding more buffers
+ * than the traffic needs, so the magazine is made shallower and the
+ * buffer is left to the slab. Must be called with bottom halves disabled.
+ */
+static int gfar_skbr_free(struct gfar_private *priv, struct sk_buff *skb)
+{
+	struct gfar_skb_handler *sh;
+
+	sh = per_cpu_ptr(priv->local_sh, smp_processor_id());
+	if (unlikely(sh->recycle_count >= sh->recycle_max) &&
+			!gfar_skbr_depot_put(priv, sh)) {
+		sh->recycle_overflow++;
+		if (sh->recycle_max > GFAR_MIN_RECYCLE_MAX)
+			sh->recycle_max--;
+		return 0;
+	}
+
+	gfar_clean_reclaim_skb(skb);
+	skb->next = sh->recycle_queue;
+	sh->recycle_queue = skb;
+	sh->recycle_count++;
+	sh->recycle_free++;
+
+	return 1;
+}
+
+static inline int gfar_skb_recyclable(struct sk_buff *skb)
+{
+	return !((skb->skb_owner == NULL) ||
 		skb_has_frags(skb) ||
 		skb_cloned(skb) ||
 		skb_header_cloned(skb) ||
-		(atomic_read(&skb->users) > 1))
-			goto _normal_free;
+		(atomic_read(&skb->users) > 1));
+}
+
+static int gfar_kfree_skb(struct sk_buff *skb, int qindex)
+{
+	struct gfar_private *priv;
+
+	/* TX completion in hard irq context (GFAR_TX_NONAPI) must not touch
+	 * the magazines; the deferred free will recycle the buffer from
+	 * softirq context through gfar_recycle_skb().
+	 */
+	if (!gfar_skb_recyclable(skb) || in_irq())
+		goto _normal_free;
 
 	priv = netdev_priv(skb->skb_owner);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps)
-		qindex = 0;
-#endif
+	if (skb->truesize != priv->skbuff_truesize)
+		goto _normal_free;
 
-	if (skb->truesize == priv->skbuff_truesize) {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		if (rcv_pkt_steering && priv->sps)
-			sh = &__get_cpu_var(gfar_cpu_dev).sh;
-		else
-#endif
-			sh = per_cpu_ptr(priv->rx_queue[qindex]->local_sh,
-							smp_processor_id());
-		/* loosly checking */
-		if (likely(sh->recycle_count < sh->recycle_max)) {
-			gfar_clean_reclaim_skb(skb);
-			skb->next = sh->recycle_queue;
-			sh->recycle_queue = skb;
-			sh->recycle_count++;
-			return 1;
-		} else {
-			sh = &priv->skb_handler;
-			gfar_clean_reclaim_skb(skb);
-			spin_lock_irqsave(&sh->lock, flags);
-			if (likely(sh->recycle_count < sh->recycle_max)) {
-				if (unlikely(!sh->recycle_enable)) {
-					spin_unlock_irqrestore(&sh->lock,
-							flags);
-					return 0;
-				}
-				skb->next = sh->recycle_queue;
-				sh->recycle_queue = skb;
-				sh->recycle_count++;
-				spin_unlock_irqrestore(&sh->lock, flags);
-				return 1;
-			} else
-				spin_unlock_irqrestore(&sh->lock, flags);
+	if (gfar_skbr_free(priv, skb))
+		return 1;
 
-		}
-	}
 _normal_free:
 	/* skb is not recyclable */
 	dev_kfree_skb_any(skb);
 	return 0;
 }
 
+/* Called from __kfree_skb() for every buffer the stack releases */
 int gfar_recycle_skb(struct sk_buff *skb)
 {
-	unsigned long int flags;
 	struct gfar_private *priv;
+	int ret = 0;
+
+	if (!gfar_skb_recyclable(skb) || in_irq() || irqs_disabled())
+		return 0;
+
+	priv = netdev_priv(skb->skb_owner);
+	local_bh_disable();
+	if (skb->truesize == priv->skbuff_truesize)
+		ret = gfar_skbr_free(priv, skb);
+	local_bh_enable();
+
+	/* skb is not recyclable if ret is 0 */
+	return ret;
+}
+
+/* Sum the per-CPU recycling counters into the ethtool statistics */
+void gfar_skbr_fold_stats(struct gfar_private *priv)
+{
+	struct gfar_extra_stats *estats = &priv->extra_stats;
 	struct gfar_skb_handler *sh;
+	int cpu;
 
-	if ((skb->skb_owner == NULL) ||
-		skb_has_frags(skb) ||
-		skb_cloned(skb) ||
-		skb_header_cloned(skb) ||
-		(atomic_read(&skb->users) > 1))
-			return 0;
+	estats->rx_skbr = 0;
+	estats->rx_skbr_free = 0;
+	estats->rx_skbr_miss = 0;
+	estats->rx_skbr_overflow = 0;
+	estats->rx_skbr_depot_get = 0;
+	estats->rx_skbr_depot_put = 0;
 
+	if (!priv->local_sh)
+		return;
 
-	priv = netdev_priv(skb->skb_owner);
-	if (skb->truesize == priv->skbuff_truesize) {
-		sh = &priv->skb_handler;
-		/* loosly checking */
-		gfar_clean_reclaim_skb(skb);
-		spin_lock_irqsave(&sh->lock, flags);
-		if (likely(sh->recycle_count < sh->recycle_max)) {
-			/* lock sh for add one */
-			if (unlikely(!sh->recycle_enable)) {
-				spin_unlock_irqrestore(&sh->lock, flags);
-				return 0;
-			}
-			skb->next = sh->recycle_queue;
-			sh->recycle_queue = skb;
-			sh->recycle_count++;
-			spin_unlock_irqrestore(&sh->lock, flags);
-			priv->extra_stats.rx_skbr_free++;
-			return 1;
-		} else
-			spin_unlock_irqrestore(&sh->lock, flags);
+	for_each_possible_cpu(cpu) {
+		sh = per_cpu_ptr(priv->local_sh, cpu);
+		estats->rx_skbr += sh->recycle_hit;
+		estats->rx_skbr_free += sh->recycle_free;
+		estats->rx_skbr_miss += sh->recycle_miss;
+		estats->rx_skbr_overflow += sh->recycle_overflow;
+		estats->rx_skbr_depot_get += sh->depot_get;
+		estats->rx_skbr_depot_put += sh->depot_put;
 	}
-	/* skb is not recyclable */
-	return 0;
 }
 
 #endif /* RECYCLING */
@@ -5147,13 +4839,100 @@ irqreturn_t gfar_receive(int irq, void *grp_id)
 	return IRQ_HANDLED;
 }
 
+/*
+ * function: gfar_flow_count
+ * Account a frame that arrived on a flow steering target queue to the
+ * first rule matching it, which is the one the filer applied. The rule
+ * table may change under us; a torn read only miscounts a frame.
+ */
+static void gfar_flow_count(struct gfar_private *priv, struct sk_buff *skb,
+		struct rxfcb *fcb, int queue)
+{
+	struct gfar_flow_rule *r;
+	struct iphdr *iph;
+	__be16 proto = ((struct ethhdr *)skb->data)->h_proto;
+	unsigned int offset = ETH_HLEN;
+	u16 vid = 0, sport = 0, dport = 0;
+	int tagged = 0, i;
+
+	if (fcb->flags & RXFCB_VLN) {
+		tagged = 1;
+		vid = fcb->vlctl & VLAN_VID_MASK;
+	} else if (proto == htons(ETH_P_8021Q) &&
+		   skb_headlen(skb) >= VLAN_ETH_HLEN) {
+		struct vlan_ethhdr *veth = (struct vlan_ethhdr *)skb->data;
+
+		tagged = 1;
+		vid = ntohs(veth->h_vlan_TCI) & VLAN_VID_MASK;
+		proto = veth->h_vlan_encapsulated_proto;
+		offset = VLAN_ETH_HLEN;
+	}
+
+	if (proto != htons(ETH_P_IP) ||
+	    skb_headlen(skb) < offset + sizeof(struct iphdr))
+		return;
+
+	iph = (struct iphdr *)(skb->data + offset);
+	if (!(iph->frag_off & htons(IP_OFFSET)) &&
+	    skb_headlen(skb) >= offset + (iph->ihl << 2) + 4) {
+		__be16 *ports = (__be16 *)((u8 *)iph + (iph->ihl << 2));
+
+		sport = ntohs(ports[0]);
+		dport = ntohs(ports[1]);
+	}
+
+	for (i = 0; i < priv->flow_max_rules; i++) {
+		r = &priv->flow_rules[i];
+		if (!r->valid || r->queue != queue)
+			continue;
+		if ((r->flow_type == TCP_V4_FLOW &&
+		     iph->protocol != IPPROTO_TCP) ||
+		    (r->flow_type == UDP_V4_FLOW &&
+		     iph->protocol != IPPROTO_UDP))
+			continue;
+		if (r->vid_mask && (!tagged || (vid & r->vid_mask) != r->vid))
+			continue;
+		if ((iph->tos & r->tos_mask) != r->tos ||
+		    (iph->protocol & r->proto_mask) != r->proto ||
+		    (ntohl(iph->saddr) & r->sip_mask) != r->sip ||
+		    (ntohl(iph->daddr) & r->dip_mask) != r->dip ||
+		    (sport & r->sport_mask) != r->sport ||
+		    (dport & r->dport_mask) != r->dport)
+			continue;
+
+		priv->extra_stats.rx_flow_hits[i]++;
+		break;
+	}
+}
+
+/* Account the outcome of a GRO receive */
+static void gfar_count_gro(struct gfar_private *priv, gro_result_t gro)
+{
+	switch (gro) {
+	case GRO_MERGED:
+	case GRO_MERGED_FREE:
+		priv->extra_stats.rx_gro_merged++;
+		break;
+	case GRO_HELD:
+		priv->extra_stats.rx_gro_held++;
+		break;
+	case GRO_NORMAL:
+		priv->extra_stats.rx_gro_normal++;
+		break;
+	case GRO_DROP:
+		priv->extra_stats.kernel_dropped++;
+		break;
+	}
+}
+
 /* gfar_process_frame() -- handle one incoming packet if skb
- * isn't NULL.  */
+ * isn't NULL. It goes up through GRO when @napi is given. */
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull)
+			      int amount_pull, struct napi_struct *napi)
 {
 	struct gfar_private *priv = netdev_priv(dev);
 	struct rxfcb *fcb = NULL;
+	int queue_map = -1;
 
 	int ret;
 
@@ -5162,8 +4941,6 @@ static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
 
 	/* Remove the padded bytes, if there are any */
 	if (amount_pull) {
-		int queue_map;
-
 		/* If FCB->QT field contains a value > num_rx_queues then
 		   a direct mapping to virtual queues using QT as index will
 		   result in a CRASH, when we are going to free the SKB.
@@ -5175,9 +4952,10 @@ static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
 		skb_record_rx_queue(skb, queue_map);
 		skb_pull(skb, amount_pull);
 	}
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps)
-		skb_set_queue_mapping(skb,smp_processor_id());
+
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	if (unlikely(priv->hwts_rx_en))
+		gfar_ptp_rx_hwtstamp(priv, skb);
 #endif
 
 	if (priv->ptimer_present) {
@@ -5185,6 +4963,10 @@ static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
 		skb_pull(skb, 8);
 	}
 
+	if (unlikely(priv->flow_queue_map) && queue_map >= 0 &&
+	    test_bit(queue_map, &priv->flow_queue_map))
+		gfar_flow_count(priv, skb, fcb, queue_map);
+
 	if (priv->rx_csum_enable)
 		gfar_rx_checksum(skb, fcb);
 
@@ -5230,13 +5012,27 @@ drop_pkt:
 #endif
 
 #ifdef CONFIG_NET_GIANFAR_FP
-	if (netdev_fastroute && (try_fastroute(skb, dev, skb->len) != 0))
+	if (netdev_fastroute && !skb_is_nonlinear(skb) &&
+	    (try_fastroute(skb, dev, skb->len) != 0))
 		return 0;
 #endif
 	/* Tell the skb what kind of packet this is */
 	skb->protocol = eth_type_trans(skb, dev);
 
 	/* Send the packet up the stack */
+	if (likely(napi)) {
+		gro_result_t gro;
+
+		if (unlikely(priv->vlgrp && (fcb->flags & RXFCB_VLN)))
+			gro = vlan_gro_receive(napi, priv->vlgrp, fcb->vlctl,
+					       skb);
+		else
+			gro = napi_gro_receive(napi, skb);
+
+		gfar_count_gro(priv, gro);
+		return 0;
+	}
+
 	if (unlikely(priv->vlgrp && (fcb->flags & RXFCB_VLN)))
 		ret = vlan_hwaccel_receive_skb(skb, priv->vlgrp, fcb->vlctl);
 	else
@@ -5248,11 +5044,157 @@ drop_pkt:
 	return 0;
 }
 
+/* Get a fresh receive buffer, from the recycle magazines if possible */
+static inline struct sk_buff *gfar_rx_new_skb(struct gfar_private *priv,
+		struct net_device *dev)
+{
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+	return gfar_skbr_alloc(dev);
+#else
+	return gfar_new_skb(dev);
+#endif
+}
+
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+/* Map the page half in @rp and give it to the controller, allocating a
+ * page first if the ring does not own one yet */
+static int gfar_rx_page_map(struct gfar_priv_rx_q *rx_queue,
+		struct rxbd8 *bdp, struct gfar_rx_page *rp)
+{
+	struct gfar_private *priv = netdev_priv(rx_queue->dev);
+
+	if (!rp->page) {
+		rp->page = alloc_page(GFP_ATOMIC | __GFP_COLD);
+		if (unlikely(!rp->page))
+			return -ENOMEM;
+		rp->offset = 0;
+		priv->extra_stats.rx_page_alloc++;
+	}
+
+	rp->dma = dma_map_page(&priv->ofdev->dev, rp->page, rp->offset,
+			       GFAR_RX_PAGE_BUF, DMA_FROM_DEVICE);
+	gfar_init_rxbdp(rx_queue, bdp, rp->dma);
+
+	return 0;
+}
+
+/* Build the skb for a frame received in a page half.  The first
+ * GFAR_RX_HDR_LEN bytes (FCB and headers) are copied to a small head,
+ * the rest of the frame is attached as a page fragment.  The ring then
+ * keeps the other half of the page if the stack has released it, or
+ * moves on to a new page; NULL means the frame has to be dropped and
+ * the buffer stays with the ring. */
+static struct sk_buff *gfar_rx_page_skb(struct gfar_priv_rx_q *rx_queue,
+		struct gfar_rx_page *rp, unsigned int len)
+{
+	struct gfar_private *priv = netdev_priv(rx_queue->dev);
+	unsigned int hlen = min_t(unsigned int, len, GFAR_RX_HDR_LEN);
+	struct page *page = rp->page;
+	struct page *newpage = NULL;
+	struct sk_buff *skb;
+
+	if (len > hlen && page_count(page) != 1) {
+		newpage = alloc_page(GFP_ATOMIC | __GFP_COLD);
+		if (unlikely(!newpage))
+			return NULL;
+	}
+
+	skb = netdev_alloc_skb(rx_queue->dev, GFAR_RX_HDR_LEN);
+	if (unlikely(!skb)) {
+		if (newpage)
+			__free_page(newpage);
+		return NULL;
+	}
+
+	memcpy(__skb_put(skb, hlen), page_address(page) + rp->offset, hlen);
+	if (len == hlen)
+		return skb;
+
+	skb_fill_page_desc(skb, 0, page, rp->offset + hlen, len - hlen);
+	skb->len += len - hlen;
+	skb->data_len += len - hlen;
+	/* the whole page half stays pinned while the skb holds it */
+	skb->truesize += GFAR_RX_PAGE_BUF;
+
+	if (newpage) {
+		rp->page = newpage;
+		rp->offset = 0;
+		priv->extra_stats.rx_page_alloc++;
+	} else {
+		get_page(page);
+		rp->offset ^= GFAR_RX_PAGE_BUF;
+		priv->extra_stats.rx_page_reuse++;
+	}
+
+	return skb;
+}
+
+static int gfar_clean_rx_page_ring(struct gfar_priv_rx_q *rx_queue,
+		int rx_work_limit, int amount_pull, struct napi_struct *napi)
+{
+	struct net_device *dev = rx_queue->dev;
+	struct gfar_private *priv = netdev_priv(dev);
+	struct rxbd8 *bdp, *base;
+	struct gfar_rx_page *rp;
+	struct sk_buff *skb;
+	int pkt_len;
+	int howmany = 0;
+
+	bdp = rx_queue->cur_rx;
+	base = rx_queue->rx_bd_base;
+
+	while (!((bdp->status & RXBD_EMPTY) || (--rx_work_limit < 0))) {
+		rmb();
+
+		rp = &rx_queue->rx_page[rx_queue->skb_currx];
+		dma_unmap_page(&priv->ofdev->dev, rp->dma, GFAR_RX_PAGE_BUF,
+			       DMA_FROM_DEVICE);
+
+		if (unlikely(!(bdp->status & RXBD_ERR) &&
+				bdp->length > priv->rx_buffer_size))
+			bdp->status = RXBD_LARGE;
+
+		if (unlikely(!(bdp->status & RXBD_LAST) ||
+				bdp->status & RXBD_ERR)) {
+			count_errors(bdp->status, dev);
+		} else {
+			/* Remove the FCS from the packet length */
+			pkt_len = bdp->length - ETH_FCS_LEN;
+			skb = gfar_rx_page_skb(rx_queue, rp, pkt_len);
+			if (likely(skb)) {
+				rx_queue->stats.rx_packets++;
+				rx_queue->stats.rx_bytes += pkt_len;
+				howmany++;
+				skb_record_rx_queue(skb, rx_queue->qindex);
+				gfar_process_frame(dev, skb, amount_pull, napi);
+			} else {
+				rx_queue->stats.rx_dropped++;
+				priv->extra_stats.rx_skbmissing++;
+			}
+		}
+
+		/* The ring always owns a page here, this cannot fail */
+		gfar_rx_page_map(rx_queue, bdp, rp);
+
+		bdp = next_bd(bdp, base, rx_queue->rx_ring_size);
+		rx_queue->skb_currx =
+		    (rx_queue->skb_currx + 1) &
+		    RX_RING_MOD_MASK(rx_queue->rx_ring_size);
+	}
+
+	rx_queue->cur_rx = bdp;
+
+	return howmany;
+}
+#endif
+
 /* gfar_clean_rx_ring() -- Processes each frame in the rx ring
  *   until the budget/quota has been reached. Returns the number
- *   of frames handled
+ *   of frames handled. Frames go through GRO when @napi is given;
+ *   process context callers (ring reconfiguration) pass NULL.
  */
-int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
+int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit,
+		struct napi_struct *napi)
 {
 	struct net_device *dev = rx_queue->dev;
 	struct rxbd8 *bdp, *base;
@@ -5261,23 +5203,6 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 	int amount_pull;
 	int howmany = 0;
 	struct gfar_private *priv = netdev_priv(dev);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int ret;
-#endif
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	int howmany_reuse = 0;
-	struct gfar_skb_handler *sh;
-	int free_skb;
-	struct sk_buff *local_head;
-	unsigned long flags;
-	struct gfar_skb_handler *local_sh;
-	int global_skb_handler = 0; /* 0 if per-cpu SKB handler is in use,
-				       1 if global (stored in 'priv') in use */
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	struct sk_buff *local_tail;
-	int temp;
-#endif
-#endif
 
 	/* Get the first full descriptor */
 	bdp = rx_queue->cur_rx;
@@ -5289,35 +5214,15 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 		amount_pull = (gfar_uses_fcb(priv) ? GMAC_FCB_LEN : 0) +
 				priv->padding;
 
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (rcv_pkt_steering && priv->sps) {
-		local_head = NULL;
-		free_skb = 0;
-		sh = &__get_cpu_var(gfar_cpu_dev).sh;
-	} else {
-#endif
-		local_sh = per_cpu_ptr(rx_queue->local_sh, smp_processor_id());
-		if (local_sh->recycle_queue) {
-			local_head = local_sh->recycle_queue;
-			free_skb = local_sh->recycle_count;
-			local_sh->recycle_queue = NULL;
-			local_sh->recycle_count = 0;
-		} else {
-			local_head = NULL;
-			free_skb = 0;
-		}
-		/* global skb_handler for this device */
-		sh = &rx_queue->skb_handler;
-
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	}
+#ifdef CONFIG_RX_TX_BD_XNGE
+	/* The buffer exchange takes the skb back once it has been received,
+	 * which GRO does not guarantee */
+	napi = NULL;
 #endif
-
-	if ((sh->recycle_count == 0) && (priv->skb_handler.recycle_count > 0)) {
-		global_skb_handler = 1;
-		sh = &priv->skb_handler;
-	}
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+	if (rx_queue->rx_page)
+		return gfar_clean_rx_page_ring(rx_queue, rx_work_limit,
+					       amount_pull, napi);
 #endif
 
 	while (!((bdp->status & RXBD_EMPTY) || (--rx_work_limit < 0))) {
@@ -5325,35 +5230,8 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 		rmb();
 
 #ifndef CONFIG_RX_TX_BD_XNGE
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-		if(!free_skb) {
-			if (global_skb_handler)
-				spin_lock_irqsave(&sh->lock, flags);
-
-			if (sh->recycle_count) {
-				/* refill local buffer */
-				local_head = sh->recycle_queue;
-				free_skb = sh->recycle_count;
-				sh->recycle_queue = NULL;
-				sh->recycle_count = 0;
-			}
-			if (global_skb_handler)
-				spin_unlock_irqrestore(&sh->lock, flags);
-		}
-
-		if (local_head) {
-			newskb = local_head;
-			local_head = newskb->next;
-			newskb->next = NULL;
-			free_skb--;
-			howmany_reuse++;
-		} else
-			newskb = gfar_new_skb(dev);
-#else
 		/* Add another skb for the future */
-		newskb = gfar_new_skb(dev);
-#endif
-
+		newskb = gfar_rx_new_skb(priv, dev);
 #endif
 		skb = rx_queue->rx_skbuff[rx_queue->skb_currx];
 
@@ -5397,30 +5275,14 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 #ifdef CONFIG_RX_TX_BD_XNGE
 				skb->owner = RT_PKT_ID;
 #endif
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-				/* Process packet here or send it to other cpu
-				   for processing based on packet headers
-				   hash value
-				 */
-				if (rcv_pkt_steering && priv->sps) {
-					ret = distribute_packet(dev,
-							skb, amount_pull);
-					if (ret)
-						gfar_process_frame(dev,
-							skb, amount_pull);
-				} else {
-					gfar_process_frame(dev,
-						skb, amount_pull);
-				}
-#else
 #ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
 				if ((rx_queue->qindex >= TCP_CHL_OFFSET) &&
 					priv->tcp_hw_channel[rx_queue->qindex - TCP_CHL_OFFSET]) {
 					gfar_hwaccel_tcp4_receive(priv, rx_queue, skb, amount_pull);
 				} else
 #endif
-					gfar_process_frame(dev, skb, amount_pull);
-#endif
+					gfar_process_frame(dev, skb, amount_pull,
+							   napi);
 #ifdef CONFIG_RX_TX_BD_XNGE
 				newskb = skb->new_skb;
 				skb->owner = 0;
@@ -5436,34 +5298,9 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 		}
 
 #ifdef CONFIG_RX_TX_BD_XNGE
-		if (!newskb) {
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-			if (global_skb_handler)
-				spin_lock_irqsave(&sh->lock, flags);
-
-			if (!free_skb && sh->recycle_count) {
-				/* refill local buffer */
-				local_head = sh->recycle_queue;
-				free_skb = sh->recycle_count;
-				sh->recycle_queue = NULL;
-				sh->recycle_count = 0;
-			}
-			if (global_skb_handler)
-				spin_unlock_irqrestore(&sh->lock, flags);
-
-			if (local_head) {
-				newskb = local_head;
-				local_head = newskb->next;
-				newskb->next = NULL;
-				free_skb--;
-				howmany_reuse++;
-			} else
-				newskb = gfar_new_skb(dev);
-#else
+		if (!newskb)
 			/* Add another skb for the future */
-			newskb = gfar_new_skb(dev);
-#endif
-		}
+			newskb = gfar_rx_new_skb(priv, dev);
 
 		if (!newskb)
 			/* All memory Exhausted,a BUG */
@@ -5483,65 +5320,6 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 		    RX_RING_MOD_MASK(rx_queue->rx_ring_size);
 	}
 
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (rcv_pkt_steering && priv->sps) {
-		if (free_skb > 0) {
-			/* return left over skb to cpu's recycle buffer */
-			if (global_skb_handler)
-				spin_lock_irqsave(&sh->lock, flags);
-			if (sh->recycle_max >= (sh->recycle_count + free_skb)) {
-				temp = free_skb - 1;
-				local_tail = local_head;
-				while (temp--)
-					local_tail = local_tail->next;
-
-				local_tail->next = sh->recycle_queue;
-				sh->recycle_queue = local_head;
-				sh->recycle_count += free_skb;
-				if (global_skb_handler)
-					spin_unlock_irqrestore(&sh->lock,
-							flags);
-			} else {
-				if (global_skb_handler)
-					spin_unlock_irqrestore(&sh->lock,
-							flags);
-				/* free the left over skbs if recycle buffer
-				cant accomodate */
-				temp = free_skb;
-				while (temp--) {
-					local_tail = local_head;
-					local_head = local_head->next;
-					if (local_tail)
-						dev_kfree_skb_any(local_tail);
-				}
-			}
-		}
-	} else {
-#endif
-		if (free_skb) {
-#ifdef CONFIG_RX_TX_BD_XNGE
-			/* Return to local_sh for next time */
-			if (local_sh->recycle_queue) {
-				struct sk_buff *local_tail =
-						local_sh->recycle_queue;
-				while (local_tail->next)
-					local_tail = local_tail->next;
-				local_tail->next = local_head;
-			} else
-				local_sh->recycle_queue = local_head;
-			local_sh->recycle_count += free_skb;
-#else
-			local_sh->recycle_queue = local_head;
-			local_sh->recycle_count = free_skb;
-#endif
-		}
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	}
-#endif
-	priv->extra_stats.rx_skbr += howmany_reuse;
-#endif
-
 	/* Update the current rxbd pointer to be the next one */
 	rx_queue->cur_rx = bdp;
 
@@ -5551,14 +5329,8 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 #ifdef CONFIG_GIANFAR_TXNAPI
 static int gfar_poll_tx(struct napi_struct *napi, int budget)
 {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int cpu = smp_processor_id();
-	struct gfar_priv_grp *gfargrp = container_of(napi,
-					struct gfar_priv_grp, napi_tx[cpu]);
-#else
 	struct gfar_priv_grp *gfargrp = container_of(napi,
 					struct gfar_priv_grp, napi_tx);
-#endif
 	struct gfar_private *priv = gfargrp->priv;
 	struct gfar __iomem *regs = gfargrp->regs;
 	struct gfar_priv_tx_q *tx_queue = NULL;
@@ -5567,71 +5339,52 @@ static int gfar_poll_tx(struct napi_struct *napi, int budget)
 	unsigned long flags;
 	u32 imask, tstat, tstat_local;
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps) {
-		tx_queue = priv->tx_queue[cpu];
-		tx_cleaned = gfar_clean_tx_ring(tx_queue, budget);
-	} else {
-#endif
-		tstat = gfar_read(&regs->tstat);
-		tstat = tstat & TSTAT_TXF_MASK_ALL;
-		tstat_local = tstat;
+	tstat = gfar_read(&regs->tstat);
+	tstat = tstat & TSTAT_TXF_MASK_ALL;
+	tstat_local = tstat;
 
-		while (tstat_local) {
-			num_act_qs++;
-			tstat_local &= (tstat_local - 1);
-		}
+	while (tstat_local) {
+		num_act_qs++;
+		tstat_local &= (tstat_local - 1);
+	}
 
-		budget_per_queue = budget/num_act_qs;
+	budget_per_queue = budget/num_act_qs;
 
-		gfar_write(&regs->ievent, IEVENT_TX_MASK);
+	gfar_write(&regs->ievent, IEVENT_TX_MASK);
 
-		for_each_set_bit(i, &gfargrp->tx_bit_map, priv->num_tx_queues) {
-			mask = mask >> i;
-			if (tstat & mask) {
-				tx_queue = priv->tx_queue[i];
-				spin_lock_irqsave(&tx_queue->txlock, flags);
-				tx_cleaned_per_queue =
-						gfar_clean_tx_ring(tx_queue,
-								budget_per_queue);
-				spin_unlock_irqrestore(&tx_queue->txlock,
-								flags);
-				tx_cleaned += tx_cleaned_per_queue;
-				tx_cleaned_per_queue = 0;
-			}
-			mask = TSTAT_TXF0_MASK;
+	for_each_set_bit(i, &gfargrp->tx_bit_map, priv->num_tx_queues) {
+		mask = mask >> i;
+		if (tstat & mask) {
+			tx_queue = priv->tx_queue[i];
+			spin_lock_irqsave(&tx_queue->txlock, flags);
+			tx_cleaned_per_queue =
+					gfar_clean_tx_ring(tx_queue,
+							budget_per_queue);
+			spin_unlock_irqrestore(&tx_queue->txlock,
+							flags);
+			tx_cleaned += tx_cleaned_per_queue;
+			tx_cleaned_per_queue = 0;
 		}
-
-		budget = (num_act_qs * DEFAULT_TX_RING_SIZE) + 1;
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
+		mask = TSTAT_TXF0_MASK;
 	}
-#endif
+
+	budget = (num_act_qs * DEFAULT_TX_RING_SIZE) + 1;
 	if (tx_cleaned < budget) {
 		napi_complete(napi);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		if (!priv->sps) {
-#endif
-			spin_lock_irq(&gfargrp->grplock);
-			imask = gfar_read(&regs->imask);
-			imask |= IMASK_DEFAULT_TX;
-			gfar_write(&regs->ievent, IEVENT_TX_MASK);
-			gfar_write(&regs->imask, imask);
-			spin_unlock_irq(&gfargrp->grplock);
-			gfar_configure_tx_coalescing(priv, gfargrp->tx_bit_map);
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-		} else {
-			gfar_write(&regs->ievent, IEVENT_TX_MASK);
-		}
+		spin_lock_irq(&gfargrp->grplock);
+		imask = gfar_read(&regs->imask);
+		imask |= IMASK_DEFAULT_TX;
+		gfar_write(&regs->ievent, IEVENT_TX_MASK);
+		gfar_write(&regs->imask, imask);
+		spin_unlock_irq(&gfargrp->grplock);
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+		gfar_aic_update(gfargrp);
 #endif
+		gfar_configure_tx_coalescing(priv, gfargrp->tx_bit_map);
 		return 1;
 	}
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if (priv->sps)
-		return 1;
-	else
-#endif
-		return tx_cleaned;
+	return tx_cleaned;
 }
 
 static int gfar_poll_rx(struct napi_struct *napi, int budget)
@@ -5664,7 +5417,7 @@ static int gfar_poll_rx(struct napi_struct *napi, int budget)
 		if (rstat_rxf & mask) {
 			rx_queue = priv->rx_queue[i];
 			rx_cleaned_per_queue = gfar_clean_rx_ring(rx_queue,
-							budget_per_queue);
+							budget_per_queue, napi);
 			rx_cleaned += rx_cleaned_per_queue;
 			if (rx_cleaned_per_queue >= budget_per_queue) {
 				napi_done = 0;
@@ -5677,6 +5430,9 @@ static int gfar_poll_rx(struct napi_struct *napi, int budget)
 
 	if (napi_done) {
 		napi_complete(napi);
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+		gfar_aic_update(gfargrp);
+#endif
 		gfar_configure_rx_coalescing(priv, gfargrp->rx_bit_map);
 		spin_lock_irq(&gfargrp->grplock);
 		imask = gfar_read(&regs->imask);
@@ -5737,7 +5493,7 @@ static int gfar_poll(struct napi_struct *napi, int budget)
 #endif
 #endif
 			rx_cleaned_per_queue = gfar_clean_rx_ring(rx_queue,
-							budget_per_queue);
+							budget_per_queue, napi);
 			rx_cleaned += rx_cleaned_per_queue;
 			if(rx_cleaned_per_queue < budget_per_queue) {
 				left_over_budget = left_over_budget +
@@ -5763,6 +5519,9 @@ static int gfar_poll(struct napi_struct *napi, int budget)
 
 		/* If we are coalescing interrupts, update the timer */
 		/* Otherwise, clear it */
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+		gfar_aic_update(gfargrp);
+#endif
 		gfar_configure_rx_coalescing(priv, gfargrp->rx_bit_map);
 #ifndef CONFIG_RX_TX_BD_XNGE
 #ifndef CONFIG_GFAR_TX_NONAPI
@@ -6186,20 +5945,20 @@ static struct of_platform_driver gfar_driver = {
 
 static int __init gfar_init(void)
 {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	gfar_cpu_dev_init();
-#endif
 	gfar_1588_proc_init(gfar_match, sizeof(gfar_match));
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	gfar_aic_module_init();
+#endif
 	return of_register_platform_driver(&gfar_driver);
 }
 
 static void __exit gfar_exit(void)
 {
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	gfar_cpu_dev_exit();
-#endif
 	gfar_1588_proc_exit();
 	of_unregister_platform_driver(&gfar_driver);
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	gfar_aic_module_exit();
+#endif
 }
 
 module_init(gfar_init);
@@ -46,10 +46,12 @@
 #include <linux/crc32.h>
 #include <linux/workqueue.h>
 #include <linux/ethtool.h>
+#include <linux/gfar_ptp.h>
 
 #ifdef CONFIG_GIANFAR_L2SRAM
 #include <asm/fsl_85xx_cache_sram.h>
 #define ALIGNMENT 0x20
+#define GFAR_SRAM_CLIENT "gianfar"
 #endif
 
 /* The maximum number of packets to be handled in one call of gfar_poll */
@@ -188,6 +190,10 @@ static inline int devfp_register_tx_hook(devfp_hook_t hook)
 #define GFAR_PTP_MSG_TYPE_OFFS		0x32
 #define GFAR_PTP_SEQ_ID_OFFS		0x50
 #define GFAR_PTP_CTRL_OFFS		0x52
+
+/* IEEE 1588 clock device; its ioctls are in <linux/gfar_ptp.h> */
+#define GFAR_PTP_MAX_ADJ		512000	/* ppb */
+#define GFAR_PTP_EVENT_RING		64	/* power of 2 */
 #define GFAR_PACKET_TYPE_UDP		0x11
 
 /* The number of Exact Match registers */
@@ -371,6 +377,19 @@ static inline int devfp_register_tx_hook(devfp_hook_t hook)
 #define DEFAULT_TXIC mk_ic_value(DEFAULT_TXCOUNT, DEFAULT_TXTIME)
 #define DEFAULT_RXIC mk_ic_value(DEFAULT_RXCOUNT, DEFAULT_RXTIME)
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+/* Adaptive interrupt coalescing */
+#define GFAR_AIC_PROFILE_LATENCY	0
+#define GFAR_AIC_PROFILE_THROUGHPUT	1
+#define GFAR_AIC_INTERVAL	(HZ / 20)	/* rate sampling period */
+#define GFAR_AIC_MAX_FRAMES	0xff		/* ICFT is 8 bits wide */
+#define GFAR_AIC_DEF_LATENCY	100		/* usecs */
+#define GFAR_AIC_MAX_LATENCY	10000		/* usecs */
+#define GFAR_AIC_DEF_IRQ_BUDGET	20000		/* interrupts per second */
+#define GFAR_AIC_MIN_IRQ_BUDGET	1000
+#define GFAR_AIC_MAX_IRQ_BUDGET	200000
+#endif
+
 #define skip_bd(bdp, stride, base, ring_size) ({ \
 	typeof(bdp) new_bd = (bdp) + (stride); \
 	(new_bd >= (base) + (ring_size)) ? (new_bd - (ring_size)) : new_bd; })
@@ -535,6 +554,15 @@ static inline int devfp_register_tx_hook(devfp_hook_t hook)
 
 #define FPR_FILER_MASK	0xFFFFFFFF
 #define MAX_FILER_IDX	0xFF
+
+/* RX flow steering rules live in fixed slots at the bottom of the filer
+ * table, below the hash clusters. GFAR_FLOW_HASH_RESERVE entries are
+ * left free above them for the ETHTOOL_SRXFH hash rules.
+ */
+#define GFAR_FLOW_MAX_RULES	8
+#define GFAR_FLOW_RULE_ENTRIES	16
+#define GFAR_FLOW_HASH_RESERVE	64
+#define RQFCR_Q_SHIFT		10
 /* This default RIR value directly corresponds
  * to the 3-bit hash value generated */
 #define DEFAULT_RIR0	0x05397700
@@ -672,6 +700,9 @@ static inline int devfp_register_tx_hook(devfp_hook_t hook)
 #define TMR_CTRL_TCLK_MASK	0x03ff0000
 #define TMR_PTPD_MAX_FREQ	0x80000
 #define TMR_CTRL_FIPER_START	0x10000000
+#define TMR_TEVENT_ETS2		0x02000000
+#define TMR_TEVENT_ETS1		0x01000000
+#define TMR_TEVENT_PP1		0x00000080
 #define PPS_1588	1
 #define ONE_GIGA	1000000000
 #define GFAR_1588_PROCFS_MAX_SIZE         12
@@ -796,6 +827,10 @@ struct gfar_extra_stats {
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	u64 rx_skbr;
 	u64 rx_skbr_free;
+	u64 rx_skbr_miss;
+	u64 rx_skbr_overflow;
+	u64 rx_skbr_depot_get;
+	u64 rx_skbr_depot_put;
 #endif
 #ifdef CONFIG_NET_GIANFAR_FP
 	u64 rx_fast;
@@ -813,6 +848,14 @@ struct gfar_extra_stats {
 	u64 tx_underrun;
 	u64 rx_skbmissing;
 	u64 tx_timeout;
+	u64 rx_gro_merged;
+	u64 rx_gro_held;
+	u64 rx_gro_normal;
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+	u64 rx_page_alloc;
+	u64 rx_page_reuse;
+#endif
+	u64 rx_flow_hits[GFAR_FLOW_MAX_RULES];
 };
 
 #define GFAR_RMON_LEN ((sizeof(struct rmon_mib) - 16)/sizeof(u32))
@@ -1096,26 +1139,54 @@ struct gfar {
 
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 #define GFAR_DEFAULT_RECYCLE_MAX 64
+#define GFAR_MIN_RECYCLE_MAX	16
+#define GFAR_MAX_RECYCLE_MAX	256
+#define GFAR_RECYCLE_STEP	16
+#define GFAR_RECYCLE_DEPOT_MAGS	8
 #define GFAR_DEFAULT_RECYCLE_TRUESIZE (SKB_DATA_ALIGN(DEFAULT_RX_BUFFER_SIZE \
 		+ RXBUF_ALIGNMENT + NET_SKB_PAD) + sizeof(struct sk_buff))
 
-/* Socket buffer recycling handler for Gianfar driver. This structure has own
- * spinlock to prevent simultaneous access. The member recycle_queue holds
- * top of recyclable socket buffer which are owned by this interface.
- * Maximu size of recyclable buffers are defined by recycle_max, and
- * current size of list is recycle_count.
+/* Socket buffer recycling handler for Gianfar driver. One handler per CPU
+ * (a "magazine") holds the clean socket buffers which are owned by this
+ * interface in recycle_queue. It is only ever touched by its own CPU with
+ * bottom halves disabled, so it needs no lock. recycle_max is the current
+ * depth of the magazine and adapts to traffic between GFAR_MIN_RECYCLE_MAX
+ * and the ceiling held in the depot.
  */
 struct gfar_skb_handler {
-	/* Lock for buffer recycling queue */
-	spinlock_t	lock;
 	short int	recycle_max;
 	short int	recycle_count;
 	short int	recycle_enable;
 	struct sk_buff *recycle_queue;
+	/* Per-CPU statistics, folded into ethtool -S on demand */
+	unsigned long	recycle_hit;
+	unsigned long	recycle_miss;
+	unsigned long	recycle_free;
+	unsigned long	recycle_overflow;
+	unsigned long	depot_get;
+	unsigned long	depot_put;
+};
+
+/* A full magazine parked in the depot */
+struct gfar_skb_mag {
+	struct sk_buff	*head;
+	short int	count;
+};
+
+/* The depot balances magazines between CPUs: a CPU whose magazine runs
+ * over (typically the one doing TX completion) parks it here and a CPU
+ * whose magazine runs dry (typically the one doing RX) picks it up. Whole
+ * magazines move under one lock acquisition, never single buffers.
+ */
+struct gfar_skb_depot {
+	spinlock_t	lock;
+	short int	mag_count;
+	short int	recycle_enable;
+	short int	recycle_max;	/* ceiling for the per-CPU depth */
+	struct gfar_skb_mag mags[GFAR_RECYCLE_DEPOT_MAGS];
 };
 
-extern void gfar_free_recycle_queue(struct gfar_skb_handler *sh,
-		int lock_flag);
+extern void gfar_free_recycle_queue(struct gfar_skb_handler *sh);
 #endif
 
 /* Structure for PTP Time Stamp */
@@ -1208,9 +1279,6 @@ struct gfar_priv_tx_q {
 	unsigned long txic;
 	unsigned short txcount;
 	unsigned short txtime;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	struct gfar_skb_handler *local_sh; /*per_cpu*/
-#endif
 };
 
 /*
@@ -1222,10 +1290,31 @@ struct rx_q_stats {
 	unsigned long rx_dropped;
 };
 
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+/* Each page is split in two receive buffers which are handed to the
+ * stack as skb fragments; only the first GFAR_RX_HDR_LEN bytes of a
+ * frame are copied into the skb head. */
+#define GFAR_RX_PAGE_BUF	(PAGE_SIZE / 2)
+#define GFAR_RX_HDR_LEN		128
+
+/**
+ *	struct gfar_rx_page - page half backing one rx buffer descriptor
+ *	@page: the page, one reference held by the ring
+ *	@offset: offset of the half currently owned by the controller
+ *	@dma: bus address of that half
+ */
+struct gfar_rx_page {
+	struct page *page;
+	unsigned int offset;
+	dma_addr_t dma;
+};
+#endif
+
 /**
  *	struct gfar_priv_rx_q - per rx queue structure
  *	@rxlock: per queue rx spin lock
  *	@rx_skbuff: skb pointers
+ *	@rx_page: page buffers, when the queue runs in page fragment mode
  *	@skb_currx: currently use skb pointer
  *	@rx_bd_base: First rx buffer descriptor
  *	@cur_rx: Next free rx ring entry
@@ -1239,6 +1328,9 @@ struct rx_q_stats {
 struct gfar_priv_rx_q {
 	spinlock_t rxlock __attribute__ ((aligned (SMP_CACHE_BYTES)));
 	struct	sk_buff ** rx_skbuff;
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+	struct	gfar_rx_page *rx_page;
+#endif
 	dma_addr_t rx_bd_dma_base;
 	struct	rxbd8 *rx_bd_base;
 	struct	rxbd8 *cur_rx;
@@ -1253,8 +1345,6 @@ struct gfar_priv_rx_q {
 	unsigned long rxic;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	unsigned int rx_skbuff_truesize;
-	struct gfar_skb_handler skb_handler;
-	struct gfar_skb_handler *local_sh; /*per_cpu*/
 #endif
 };
 
@@ -1272,14 +1362,52 @@ struct gfar_priv_rx_q {
  *	@int_name_er: er interrupt name for this group
  */
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+/**
+ *	struct gfar_aic - adaptive coalescing state of a group, per direction
+ *	@last_packets: packet counter of the group's queues at the last sample
+ *	@last_bytes: byte counter of the group's queues at the last sample
+ *	@pkt_rate: packets per second measured over the last interval
+ *	@byte_rate: bytes per second measured over the last interval
+ *	@frames: frame count threshold currently programmed
+ *	@usecs: timer threshold currently programmed, in microseconds
+ */
+struct gfar_aic {
+	unsigned long last_packets;
+	unsigned long last_bytes;
+	unsigned int pkt_rate;
+	unsigned int byte_rate;
+	unsigned int frames;
+	unsigned int usecs;
+};
+#endif
+
+/**
+ *	struct gfar_flow_rule - RX flow steering rule
+ *	@valid: the slot holds a rule
+ *	@flow_type: ethtool flow type (TCP_V4_FLOW, ..., IP_USER_FLOW)
+ *	@queue: destination RX queue, or -1 to drop the frames
+ *
+ *	Values are in host order and already masked; a mask bit set means
+ *	the bit is compared, a zero mask leaves the field out of the rule.
+ */
+struct gfar_flow_rule {
+	unsigned char valid;
+	u32 flow_type;
+	u32 sip, sip_mask;
+	u32 dip, dip_mask;
+	u16 sport, sport_mask;
+	u16 dport, dport_mask;
+	u16 vid, vid_mask;
+	u8 tos, tos_mask;
+	u8 proto, proto_mask;
+	s32 queue;
+};
+
 struct gfar_priv_grp {
 	spinlock_t grplock __attribute__ ((aligned (SMP_CACHE_BYTES)));
 #ifdef CONFIG_GIANFAR_TXNAPI
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	struct napi_struct napi_tx[NR_CPUS];
-#else
 	struct napi_struct napi_tx;
-#endif
 	struct napi_struct napi_rx;
 #else
 	struct	napi_struct napi;
@@ -1302,11 +1430,12 @@ struct gfar_priv_grp {
 	char int_name_tx[GFAR_INT_NAME_MAX];
 	char int_name_rx[GFAR_INT_NAME_MAX];
 	char int_name_er[GFAR_INT_NAME_MAX];
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	struct fsl_msg_unit *msg_virtual_tx[NR_CPUS];
-	char int_name_vtx[NR_CPUS][GFAR_INT_NAME_MAX];
-#endif
 	u32 rstat_prev;
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	unsigned long aic_stamp;
+	struct gfar_aic rx_aic;
+	struct gfar_aic tx_aic;
+#endif
 };
 
 /* Struct stolen almost completely (and shamelessly) from the FCC enet source
@@ -1414,52 +1543,36 @@ struct gfar_private {
 	struct gfar_regs_1588 __iomem *ptimer;
 	struct resource timer_resource;
 	uint32_t ptimer_present;
+#ifdef CONFIG_GFAR_PTP_CLOCK
+	unsigned char hwts_rx_en;	/* SIOCSHWTSTAMP settings */
+	unsigned char hwts_tx_en;
+	unsigned long hwts_tx_busy;	/* bit 0: a stamped frame in flight */
+#endif
 #ifdef CONFIG_GIANFAR_L2SRAM
 	int bd_in_ram;
+	unsigned char bd_sram;	/* ask for cache-SRAM on the next open */
 #endif
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	unsigned int skbuff_truesize;
-	struct gfar_skb_handler skb_handler;
+	struct gfar_skb_handler *local_sh; /* per_cpu */
+	struct gfar_skb_depot skb_depot;
 #endif
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int sps; /*flag for s/w packet steering */
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	unsigned char aic_rx_enable;
+	unsigned char aic_tx_enable;
+	unsigned char aic_profile;
+	unsigned int aic_latency;	/* usecs */
+	unsigned int aic_irq_budget;	/* interrupts per second */
+	struct dentry *aic_dentry;
 #endif
 	u32 max_filer_rules;
+	struct gfar_flow_rule flow_rules[GFAR_FLOW_MAX_RULES];
+	unsigned int flow_max_rules;
+	unsigned long flow_queue_map;	/* queues targeted by flow rules */
 	u32 *ftp_rqfpr;
 	u32 *ftp_rqfcr;
 };
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-#define INTR_COALESCE_CNT 22
-#define INTR_COALESCE_TIMEOUT 32000 /* in nSecs */
-#define GFAR_CPU_BUFF_SIZE 64
-
-/* producer-consumer buffer for inter cpu packet transfer */
-struct shared_buffer {
-	spinlock_t	lock;
-	struct sk_buff *buffer[GFAR_CPU_BUFF_SIZE];
-	int in;
-	int out;
-	unsigned int buff_cnt;
-};
-
-struct gfar_cpu_dev {
-	struct net_device dev;
-	struct napi_struct napi;
-	struct shared_buffer tx_queue;
-	int intr_coalesce_cnt;
-	struct hrtimer intr_coalesce_timer;
-	struct fsl_msg_unit *msg_virtual_rx;
-	char int_name[GFAR_INT_NAME_MAX];
-	int enabled;
-#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
-	struct gfar_skb_handler sh;
-#endif
-};
-
-extern int rcv_pkt_steering;
-#endif
-
 struct gfar_ptp_attr_t {
 	u32 tclk_period;
 	u32 nominal_freq;
@@ -1531,6 +1644,37 @@ extern int gfar_ptp_do_txstamp(struct sk_buff *skb);
 extern void pmuxcr_guts_write(void);
 extern void gfar_ptp_store_rxstamp(struct net_device *dev, struct sk_buff *skb);
 extern int gfar_ioctl_1588(struct net_device *dev, struct ifreq *ifr, int cmd);
+extern u32 gfar_ptp_addend(void);
+extern void gfar_ptp_write_cnt(struct gfar_regs_1588 __iomem *ptimer,
+			struct gfar_ptp_time *gfar_time);
+extern void gfar_get_tx_timestamp(struct gfar __iomem *regs,
+			struct gfar_ptp_time *tx_time);
+#ifdef CONFIG_GFAR_PTP_CLOCK
+extern int gfar_hwtstamp_ioctl(struct net_device *dev, struct ifreq *ifr);
+extern void gfar_ptp_rx_hwtstamp(struct gfar_private *priv,
+			struct sk_buff *skb);
+extern void gfar_ptp_tx_hwtstamp(struct gfar_private *priv,
+			struct sk_buff *skb);
+extern void gfar_ptp_clock_register(struct gfar_private *priv);
+extern void gfar_ptp_clock_unregister(struct gfar_private *priv);
+
+static inline int gfar_ptp_tx_wanted(struct gfar_private *priv,
+			struct sk_buff *skb)
+{
+	return unlikely(priv->hwts_tx_en && skb_tx(skb)->hardware);
+}
+
+/* TMR_TXTS still has to be read for a SO_TIMESTAMPING frame */
+static inline int gfar_ptp_tx_busy(struct gfar_private *priv)
+{
+	return test_bit(0, &priv->hwts_tx_busy);
+}
+#else
+static inline int gfar_ptp_tx_busy(struct gfar_private *priv)
+{
+	return 0;
+}
+#endif
 extern void gfar_phy_test(struct mii_bus *bus, struct phy_device *phydev,
 		int enable, u32 regnum, u32 read);
 extern void gfar_configure_tx_coalescing(struct gfar_private *priv,
@@ -1538,6 +1682,21 @@ extern void gfar_configure_tx_coalescing(struct gfar_private *priv,
 extern void gfar_configure_rx_coalescing(struct gfar_private *priv,
 					long unsigned int rx_mask);
 void gfar_init_sysfs(struct net_device *dev);
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+extern void gfar_skbr_fold_stats(struct gfar_private *priv);
+extern void gfar_skbr_set_max(struct gfar_private *priv, short int max);
+#endif
+extern unsigned int gfar_usecs2ticks(struct gfar_private *priv,
+					unsigned int usecs);
+extern void gfar_flow_restore(struct gfar_private *priv);
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+extern void gfar_aic_init(struct gfar_private *priv);
+extern void gfar_aic_update(struct gfar_priv_grp *grp);
+extern void gfar_aic_debugfs_init(struct gfar_private *priv);
+extern void gfar_aic_debugfs_exit(struct gfar_private *priv);
+extern void gfar_aic_module_init(void);
+extern void gfar_aic_module_exit(void);
+#endif
 
 extern void gfar_1588_proc_init(struct of_device_id *dev_id, int cnt);
 extern void gfar_1588_proc_exit(void);
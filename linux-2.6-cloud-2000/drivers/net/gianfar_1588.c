@@ -317,11 +317,16 @@ int gfar_ptp_find_and_remove(struct gfar_ptp_circular_t *buf,
 	return 0;
 }
 
-/* Set the 1588 timer counter registers */
-static void gfar_set_1588cnt(struct net_device *dev,
+/* Nominal TMR_ADD value, valid once the timer has been started */
+u32 gfar_ptp_addend(void)
+{
+	return freq_compensation;
+}
+
+/* Set the 1588 timer counter registers and realign the FIPER1 alarm */
+void gfar_ptp_write_cnt(struct gfar_regs_1588 __iomem *ptimer,
 			struct gfar_ptp_time *gfar_time)
 {
-	struct gfar_private *priv = netdev_priv(dev);
 	u32 tempval;
 	u64 alarm_value = 0, temp_alarm_val;
 	struct gfar_ptp_attr_t ptp_attr;
@@ -336,20 +341,28 @@ static void gfar_set_1588cnt(struct net_device *dev,
 	alarm_value = add64_oper(alarm_value, temp_alarm_val);
 	/* We must write the tmr_cnt_l register first */
 	tempval = (u32)gfar_time->low;
-	gfar_write(&priv->ptimer->tmr_cnt_l, tempval);
+	gfar_write(&ptimer->tmr_cnt_l, tempval);
 	tempval = (u32)gfar_time->high;
-	gfar_write(&priv->ptimer->tmr_cnt_h, tempval);
+	gfar_write(&ptimer->tmr_cnt_h, tempval);
 	tempval = (u32)alarm_value;
-	gfar_write(&(priv->ptimer->tmr_alarm1_l), tempval);
+	gfar_write(&(ptimer->tmr_alarm1_l), tempval);
 	tempval = (u32)(alarm_value>>32);
-	gfar_write(&(priv->ptimer->tmr_alarm1_h), tempval);
+	gfar_write(&(ptimer->tmr_alarm1_h), tempval);
 	if (gfar_ptp_cal_attr(&ptp_attr))
 		return;
-	gfar_write(&(priv->ptimer->tmr_fiper1), ptp_attr.tmr_fiper1);
+	gfar_write(&(ptimer->tmr_fiper1), ptp_attr.tmr_fiper1);
+}
+
+static void gfar_set_1588cnt(struct net_device *dev,
+			struct gfar_ptp_time *gfar_time)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+
+	gfar_ptp_write_cnt(priv->ptimer, gfar_time);
 }
 
 /* Get both the time-stamps and use the larger one */
-static void gfar_get_tx_timestamp(struct gfar __iomem *regs,
+void gfar_get_tx_timestamp(struct gfar __iomem *regs,
 			struct gfar_ptp_time *tx_time)
 {
 	struct gfar_ptp_time tx_set_1, tx_set_2;
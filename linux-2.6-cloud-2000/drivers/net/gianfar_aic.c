@@ -0,0 +1,241 @@
+/*
+ * drivers/net/gianfar_aic.c
+ *
+ * Gianfar Ethernet Driver
+ * This driver is designed for the non-CPM ethernet controllers
+ * on the 85xx and 83xx family of integrated processors
+ *
+ * Copyright 2002-2011 Freescale Semiconductor, Inc.
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ * Adaptive interrupt coalescing
+ *
+ * The packet and byte counters of every queue group are sampled from the
+ * NAPI poll routine. Once per GFAR_AIC_INTERVAL the frame count and timer
+ * thresholds of the group's queues are recomputed from the measured rate,
+ * so that the group raises no more than aic_irq_budget interrupts per
+ * second while no frame waits longer than aic_latency microseconds:
+ *
+ *  - below the interrupt budget every frame interrupts (frames = 1);
+ *  - above it, frames = rate / budget, and the timer is the time needed
+ *    to collect that many frames, bounded by the latency target.
+ *
+ * The throughput profile halves the interrupt budget and always runs the
+ * timer at the latency target, trading latency for CPU time.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/jiffies.h>
+#include <linux/netdevice.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/phy.h>
+#include <asm/div64.h>
+
+#include "gianfar.h"
+
+static unsigned int gfar_aic_rate(unsigned long delta, unsigned long elapsed)
+{
+	u64 rate = (u64)delta * HZ;
+
+	do_div(rate, elapsed);
+	return rate > UINT_MAX ? UINT_MAX : (unsigned int)rate;
+}
+
+static void gfar_aic_sample(struct gfar_private *priv, struct gfar_aic *aic,
+		unsigned long packets, unsigned long bytes,
+		unsigned long elapsed)
+{
+	unsigned int budget = priv->aic_irq_budget;
+	unsigned int frames = 1, usecs = 1, fill;
+
+	aic->pkt_rate = gfar_aic_rate(packets - aic->last_packets, elapsed);
+	aic->byte_rate = gfar_aic_rate(bytes - aic->last_bytes, elapsed);
+	aic->last_packets = packets;
+	aic->last_bytes = bytes;
+
+	if (priv->aic_profile == GFAR_AIC_PROFILE_THROUGHPUT)
+		budget /= 2;
+
+	if (aic->pkt_rate > budget) {
+		frames = min_t(unsigned int, GFAR_AIC_MAX_FRAMES,
+				DIV_ROUND_UP(aic->pkt_rate, budget));
+		/* Time it takes to collect 'frames' at the current rate */
+		fill = DIV_ROUND_UP(frames * USEC_PER_SEC, aic->pkt_rate);
+
+		if (priv->aic_profile == GFAR_AIC_PROFILE_THROUGHPUT)
+			usecs = priv->aic_latency;
+		else
+			usecs = min(priv->aic_latency, 2 * fill);
+	}
+
+	aic->frames = frames;
+	aic->usecs = max(usecs, 1U);
+}
+
+/*
+ * function: gfar_aic_update
+ * Called from the NAPI poll routine before the coalescing registers of
+ * the group are rewritten; refreshes rxic/txic of the group's queues
+ * once per sampling interval.
+ */
+void gfar_aic_update(struct gfar_priv_grp *grp)
+{
+	struct gfar_private *priv = grp->priv;
+	unsigned long now = jiffies, elapsed;
+	struct netdev_queue *txq;
+	unsigned long packets, bytes, ic;
+	int i;
+
+	if (!priv->aic_rx_enable && !priv->aic_tx_enable)
+		return;
+
+	elapsed = now - grp->aic_stamp;
+	if (elapsed < GFAR_AIC_INTERVAL || !priv->phydev)
+		return;
+	grp->aic_stamp = now;
+
+	if (priv->aic_rx_enable) {
+		packets = bytes = 0;
+		for_each_set_bit(i, &grp->rx_bit_map, priv->num_rx_queues) {
+			packets += priv->rx_queue[i]->stats.rx_packets;
+			bytes += priv->rx_queue[i]->stats.rx_bytes;
+		}
+		gfar_aic_sample(priv, &grp->rx_aic, packets, bytes, elapsed);
+
+		ic = mk_ic_value(grp->rx_aic.frames,
+				gfar_usecs2ticks(priv, grp->rx_aic.usecs));
+		for_each_set_bit(i, &grp->rx_bit_map, priv->num_rx_queues) {
+			priv->rx_queue[i]->rxic = ic;
+			priv->rx_queue[i]->rxcoalescing = 1;
+		}
+	}
+
+	if (priv->aic_tx_enable) {
+		packets = bytes = 0;
+		for_each_set_bit(i, &grp->tx_bit_map, priv->num_tx_queues) {
+			txq = netdev_get_tx_queue(priv->ndev, i);
+			packets += txq->tx_packets;
+			bytes += txq->tx_bytes;
+		}
+		gfar_aic_sample(priv, &grp->tx_aic, packets, bytes, elapsed);
+
+		ic = mk_ic_value(grp->tx_aic.frames,
+				gfar_usecs2ticks(priv, grp->tx_aic.usecs));
+		for_each_set_bit(i, &grp->tx_bit_map, priv->num_tx_queues) {
+			priv->tx_queue[i]->txic = ic;
+			priv->tx_queue[i]->txcoalescing = 1;
+		}
+	}
+}
+
+void gfar_aic_init(struct gfar_private *priv)
+{
+	int i;
+
+	priv->aic_rx_enable = 0;
+	priv->aic_tx_enable = 0;
+	priv->aic_profile = GFAR_AIC_PROFILE_LATENCY;
+	priv->aic_latency = GFAR_AIC_DEF_LATENCY;
+	priv->aic_irq_budget = GFAR_AIC_DEF_IRQ_BUDGET;
+
+	for (i = 0; i < priv->num_grps; i++)
+		priv->gfargrp[i].aic_stamp = jiffies;
+}
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *gfar_aic_root;
+
+static void gfar_aic_show_one(struct seq_file *m, int grp, const char *dir,
+		int enable, struct gfar_aic *aic)
+{
+	seq_printf(m, "group %d %s: adaptive %s, %u pps, %u Bps, "
+			"%u frames, %u usecs\n", grp, dir,
+			enable ? "on" : "off", aic->pkt_rate, aic->byte_rate,
+			aic->frames, aic->usecs);
+}
+
+static int gfar_aic_show(struct seq_file *m, void *v)
+{
+	struct gfar_private *priv = m->private;
+	struct gfar_priv_grp *grp;
+	int i;
+
+	seq_printf(m, "profile: %s\n",
+			priv->aic_profile == GFAR_AIC_PROFILE_THROUGHPUT ?
+			"throughput" : "latency");
+	seq_printf(m, "latency target: %u usecs\n", priv->aic_latency);
+	seq_printf(m, "irq budget: %u/s\n", priv->aic_irq_budget);
+
+	for (i = 0; i < priv->num_grps; i++) {
+		grp = &priv->gfargrp[i];
+		gfar_aic_show_one(m, i, "rx", priv->aic_rx_enable,
+				&grp->rx_aic);
+		gfar_aic_show_one(m, i, "tx", priv->aic_tx_enable,
+				&grp->tx_aic);
+	}
+	return 0;
+}
+
+static int gfar_aic_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, gfar_aic_show, inode->i_private);
+}
+
+static const struct file_operations gfar_aic_fops = {
+	.owner = THIS_MODULE,
+	.open = gfar_aic_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void gfar_aic_debugfs_init(struct gfar_private *priv)
+{
+	if (!gfar_aic_root)
+		return;
+
+	priv->aic_dentry = debugfs_create_file(priv->ndev->name, S_IRUGO,
+			gfar_aic_root, priv, &gfar_aic_fops);
+}
+
+void gfar_aic_debugfs_exit(struct gfar_private *priv)
+{
+	debugfs_remove(priv->aic_dentry);
+	priv->aic_dentry = NULL;
+}
+
+void gfar_aic_module_init(void)
+{
+	gfar_aic_root = debugfs_create_dir("gianfar_coalesce", NULL);
+	if (IS_ERR(gfar_aic_root))
+		gfar_aic_root = NULL;
+}
+
+void gfar_aic_module_exit(void)
+{
+	debugfs_remove(gfar_aic_root);
+	gfar_aic_root = NULL;
+}
+#else
+void gfar_aic_debugfs_init(struct gfar_private *priv)
+{
+}
+
+void gfar_aic_debugfs_exit(struct gfar_private *priv)
+{
+}
+
+void gfar_aic_module_init(void)
+{
+}
+
+void gfar_aic_module_exit(void)
+{
+}
+#endif
@@ -39,11 +39,13 @@
 #include <linux/phy.h>
 #include <asm/of_device.h>
 #include <linux/in.h>
+#include <linux/if_vlan.h>
 
 #include "gianfar.h"
 
 extern void gfar_start(struct net_device *dev);
-extern int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit);
+extern int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue,
+		int rx_work_limit, struct napi_struct *napi);
 
 #define GFAR_MAX_COAL_USECS 0xffff
 #define GFAR_MAX_COAL_FRAMES 0xff
@@ -61,6 +63,10 @@ static char stat_gstrings[][ETH_GSTRING_LEN] = {
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	"skb-recycled-frames-new",
 	"skb-recycled-frames-free",
+	"skb-recycle-misses",
+	"skb-recycle-overflows",
+	"skb-recycle-depot-get",
+	"skb-recycle-depot-put",
 #endif
 #ifdef CONFIG_NET_GIANFAR_FP
 	"rx-fast-path",
@@ -78,6 +84,21 @@ static char stat_gstrings[][ETH_GSTRING_LEN] = {
 	"tx-underrun-errors",
 	"rx-skb-missing-errors",
 	"tx-timeout-errors",
+	"rx-gro-merged",
+	"rx-gro-held",
+	"rx-gro-normal",
+#ifdef CONFIG_GFAR_RX_PAGE_FRAGS
+	"rx-page-alloc",
+	"rx-page-reuse",
+#endif
+	"rx-flow-rule-0-hits",
+	"rx-flow-rule-1-hits",
+	"rx-flow-rule-2-hits",
+	"rx-flow-rule-3-hits",
+	"rx-flow-rule-4-hits",
+	"rx-flow-rule-5-hits",
+	"rx-flow-rule-6-hits",
+	"rx-flow-rule-7-hits",
 	"tx-rx-64-frames",
 	"tx-rx-65-127-frames",
 	"tx-rx-128-255-frames",
@@ -148,6 +169,9 @@ static void gfar_fill_stats(struct net_device *dev, struct ethtool_stats *dummy,
 	struct gfar __iomem *regs = priv->gfargrp[0].regs;
 	u64 *extra = (u64 *) & priv->extra_stats;
 
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+	gfar_skbr_fold_stats(priv);
+#endif
 	if (priv->device_flags & FSL_GIANFAR_DEV_HAS_RMON) {
 		u32 __iomem *rmon = (u32 __iomem *) &regs->rmon;
 		struct gfar_stats *stats = (struct gfar_stats *) buf;
@@ -243,7 +267,7 @@ static void gfar_get_regs(struct net_device *dev, struct ethtool_regs *regs, voi
 
 /* Convert microseconds to ethernet clock ticks, which changes
  * depending on what speed the controller is running at */
-static unsigned int gfar_usecs2ticks(struct gfar_private *priv, unsigned int usecs)
+unsigned int gfar_usecs2ticks(struct gfar_private *priv, unsigned int usecs)
 {
 	unsigned int count;
 
@@ -321,8 +345,13 @@ static int gfar_gcoalesce(struct net_device *dev, struct ethtool_coalesce *cvals
 	cvals->tx_coalesce_usecs = gfar_ticks2usecs(priv, txtime);
 	cvals->tx_max_coalesced_frames = txcount;
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	cvals->use_adaptive_rx_coalesce = priv->aic_rx_enable;
+	cvals->use_adaptive_tx_coalesce = priv->aic_tx_enable;
+#else
 	cvals->use_adaptive_rx_coalesce = 0;
 	cvals->use_adaptive_tx_coalesce = 0;
+#endif
 
 	cvals->pkt_rate_low = 0;
 	cvals->rx_coalesce_usecs_low = 0;
@@ -365,6 +394,14 @@ static int gfar_scoalesce(struct net_device *dev, struct ethtool_coalesce *cvals
 	if (!(priv->device_flags & FSL_GIANFAR_DEV_HAS_COALESCE))
 		return -EOPNOTSUPP;
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	/* With adaptive coalescing on, the values below only hold until
+	 * the next rate sample reprograms them.
+	 */
+	priv->aic_rx_enable = !!cvals->use_adaptive_rx_coalesce;
+	priv->aic_tx_enable = !!cvals->use_adaptive_tx_coalesce;
+#endif
+
 	/* Set up rx coalescing */
 	/* As of now, we will enable/disable coalescing for all
 	 * queues together in case of eTSEC2, this will be modified
@@ -510,7 +547,7 @@ static int gfar_sringparam(struct net_device *dev, struct ethtool_ringparam *rva
 
 		for (i = 0; i < priv->num_rx_queues; i++)
 			gfar_clean_rx_ring(priv->rx_queue[i],
-					priv->rx_queue[i]->rx_ring_size);
+					priv->rx_queue[i]->rx_ring_size, NULL);
 
 		/* Now we take down the rings to rebuild them */
 		stop_gfar(dev);
@@ -546,6 +583,16 @@ static int gfar_sringparam(struct net_device *dev, struct ethtool_ringparam *rva
 	return err;
 }
 
+static int gfar_flow_rules_in_use(struct gfar_private *priv)
+{
+	int i, cnt = 0;
+
+	for (i = 0; i < priv->flow_max_rules; i++)
+		if (priv->flow_rules[i].valid)
+			cnt++;
+	return cnt;
+}
+
 static int gfar_set_rx_csum(struct net_device *dev, uint32_t data)
 {
 	struct gfar_private *priv = netdev_priv(dev);
@@ -555,6 +602,9 @@ static int gfar_set_rx_csum(struct net_device *dev, uint32_t data)
 	if (!(priv->device_flags & FSL_GIANFAR_DEV_HAS_CSUM))
 		return -EOPNOTSUPP;
 
+	/* The flow steering rules need the parser that comes with it */
+	if (!data && gfar_flow_rules_in_use(priv))
+		return -EBUSY;
 
 	if (dev->flags & IFF_UP) {
 		/* Halt TX and RX, and process the frames which
@@ -571,7 +621,7 @@ static int gfar_set_rx_csum(struct net_device *dev, uint32_t data)
 
 		for (i = 0; i < priv->num_rx_queues; i++)
 			gfar_clean_rx_ring(priv->rx_queue[i],
-					priv->rx_queue[i]->rx_ring_size);
+					priv->rx_queue[i]->rx_ring_size, NULL);
 
 		/* Now we take down the rings to rebuild them */
 		stop_gfar(dev);
@@ -863,6 +913,21 @@ static void ethflow_to_filer_rules(struct gfar_private *priv, u64 ethflow,
 
 }
 
+/* Number of filer entries ethflow_to_filer_rules() writes */
+static int gfar_ethflow_entries(u64 ethflow, u64 class)
+{
+	int n = hweight64(ethflow & (RXH_VLAN | RXH_IP_SRC | RXH_IP_DST |
+			RXH_L3_PROTO | RXH_L4_B_0_1 | RXH_L4_B_2_3));
+
+	if (ethflow & RXH_L2DA)
+		n += 2;
+	if ((class == AH_V4_FLOW || class == ESP_V4_FLOW) &&
+			(ethflow & RXH_AH_ESP_SPI))
+		n += 2;
+
+	return n;
+}
+
 static void gfar_dump_filer_table(struct gfar_private *priv)
 {
 	u32 fcr, fpr, far;
@@ -876,10 +941,12 @@ static void gfar_dump_filer_table(struct gfar_private *priv)
 static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u64 class)
 {
 	unsigned int last_rule_idx = priv->cur_filer_idx;
+	unsigned int flow_end = priv->flow_max_rules * GFAR_FLOW_RULE_ENTRIES;
 	unsigned int cmp_rqfpr;
 	u32 *local_rqfpr = NULL, *local_rqfcr = NULL;
 	int i = 0x0, k = 0x0;
 	int j = priv->max_filer_rules, l = 0x0;
+	int ret = -ENOMEM;
 
 	local_rqfpr = kmalloc((priv->max_filer_rules + 1)*sizeof
 				(u32), GFP_KERNEL);
@@ -894,6 +961,8 @@ static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u
 		goto out;
 	}
 
+	ret = -EINVAL;
+
 	switch (class) {
 	case TCP_V4_FLOW:
 		cmp_rqfpr = RQFPR_IPV4 |RQFPR_TCP;
@@ -920,7 +989,8 @@ static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u
 		goto out;
 	}
 
-	for (i = 0; i < priv->max_filer_rules + 1; i++) {
+	/* The flow steering slots below flow_end are left in place */
+	for (i = flow_end; i < priv->max_filer_rules + 1; i++) {
 		local_rqfpr[j] = priv->ftp_rqfpr[i];
 		local_rqfcr[j] = priv->ftp_rqfcr[i];
 		j--;
@@ -941,13 +1011,8 @@ static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u
 	 */
 	for (l = i+1; l < priv->max_filer_rules; l++) {
 		if ((priv->ftp_rqfcr[l] & RQFCR_CLE) &&
-			!(priv->ftp_rqfcr[l] & RQFCR_AND)) {
-			priv->ftp_rqfcr[l] = RQFCR_CLE | RQFCR_CMP_EXACT |
-				RQFCR_HASHTBL_0 | RQFCR_PID_MASK;
-			priv->ftp_rqfpr[l] = FPR_FILER_MASK;
-			gfar_write_filer(priv, l, priv->ftp_rqfcr[l], priv->ftp_rqfpr[l]);
+			!(priv->ftp_rqfcr[l] & RQFCR_AND))
 			break;
-		}
 
 		if (!(priv->ftp_rqfcr[l] & RQFCR_CLE) && (priv->ftp_rqfcr[l] & RQFCR_AND))
 			continue;
@@ -958,6 +1023,22 @@ static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u
 		}
 	}
 
+	/* The hash rules and the rules popped out above are written downwards
+	 * from l - 1; they must not run into the flow steering slots.
+	 */
+	if (l - gfar_ethflow_entries(ethflow, class) -
+			(priv->max_filer_rules - 1 - j) < (int)flow_end) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	if (l < priv->max_filer_rules) {
+		priv->ftp_rqfcr[l] = RQFCR_CLE | RQFCR_CMP_EXACT |
+			RQFCR_HASHTBL_0 | RQFCR_PID_MASK;
+		priv->ftp_rqfpr[l] = FPR_FILER_MASK;
+		gfar_write_filer(priv, l, priv->ftp_rqfcr[l], priv->ftp_rqfpr[l]);
+	}
+
 	priv->cur_filer_idx = l - 1;
 	last_rule_idx = l;
 
@@ -970,19 +1051,19 @@ static int gfar_ethflow_to_filer_table(struct gfar_private *priv, u64 ethflow, u
 		priv->ftp_rqfcr[priv->cur_filer_idx] = local_rqfcr[k];
 		gfar_write_filer(priv, priv->cur_filer_idx,
 				local_rqfcr[k], local_rqfpr[k]);
-		if (!priv->cur_filer_idx)
+		if (priv->cur_filer_idx <= flow_end)
 			break;
 		priv->cur_filer_idx = priv->cur_filer_idx - 1;
 	}
 	kfree(local_rqfpr);
 	kfree(local_rqfcr);
 
-	return 1;
+	return 0;
 
 out:
 	kfree(local_rqfpr);
 	kfree(local_rqfcr);
-	return 0;
+	return ret;
 }
 
 static int gfar_set_hash_opts(struct gfar_private *priv, struct ethtool_rxnfc *cmd)
@@ -997,8 +1078,429 @@ static int gfar_set_hash_opts(struct gfar_private *priv, struct ethtool_rxnfc *c
 		return -EINVAL;
 
 	/* write the filer rules here */
-	if (!gfar_ethflow_to_filer_table(priv, cmd->data, cmd->flow_type))
-		return -1;
+	return gfar_ethflow_to_filer_table(priv, cmd->data, cmd->flow_type);
+}
+
+/*
+ * RX flow steering
+ *
+ * Every rule owns a slot of GFAR_FLOW_RULE_ENTRIES filer entries at the
+ * bottom of the table, so it is looked at before the hash clusters and
+ * the default rule; unused entries of a slot are masked rules.
+ *
+ * A slot is rewritten while RX is running. Its first entry is turned
+ * into a never-matching AND entry first, which takes the whole chain
+ * behind it out of the search; the rest of the slot is then rewritten
+ * with every entry but the last one still ANDed to that first entry, so
+ * no partial chain can ever match, and the finished chain is switched on
+ * by rewriting the first entry.
+ */
+struct gfar_filer_chain {
+	int n;
+	u32 mask;
+	u32 fcr[GFAR_FLOW_RULE_ENTRIES];
+	u32 fpr[GFAR_FLOW_RULE_ENTRIES];
+};
+
+static void gfar_flow_add(struct gfar_filer_chain *c, u32 fcr, u32 fpr)
+{
+	if (c->n < GFAR_FLOW_RULE_ENTRIES) {
+		c->fcr[c->n] = fcr | RQFCR_AND;
+		c->fpr[c->n] = fpr;
+	}
+	c->n++;
+}
+
+static void gfar_flow_add_field(struct gfar_filer_chain *c, u32 pid,
+		u32 val, u32 mask, u32 width)
+{
+	if (!mask)
+		return;
+
+	/* Full width compares all share the same mask entry */
+	if (mask == width)
+		mask = FPR_FILER_MASK;
+	if (mask != c->mask) {
+		gfar_flow_add(c, RQFCR_PID_MASK | RQFCR_CMP_EXACT, mask);
+		c->mask = mask;
+	}
+	gfar_flow_add(c, pid | RQFCR_CMP_EXACT, val);
+}
+
+static int gfar_flow_compile(struct gfar_flow_rule *r,
+		struct gfar_filer_chain *c)
+{
+	u32 class;
+
+	c->n = 0;
+	switch (r->flow_type) {
+	case TCP_V4_FLOW:
+		class = RQFPR_IPV4 | RQFPR_TCP;
+		break;
+	case UDP_V4_FLOW:
+		class = RQFPR_IPV4 | RQFPR_UDP;
+		break;
+	case SCTP_V4_FLOW:
+	case IP_USER_FLOW:
+		class = RQFPR_IPV4;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (r->vid_mask)
+		class |= RQFPR_VLN;
+
+	gfar_flow_add(c, RQFCR_PID_MASK | RQFCR_CMP_EXACT, class);
+	gfar_flow_add(c, RQFCR_PID_PARSE | RQFCR_CMP_EXACT, class);
+	c->mask = class;
+
+	gfar_flow_add_field(c, RQFCR_PID_VID, r->vid, r->vid_mask,
+			VLAN_VID_MASK);
+	gfar_flow_add_field(c, RQFCR_PID_TOS, r->tos, r->tos_mask, 0xff);
+	gfar_flow_add_field(c, RQFCR_PID_L4P, r->proto, r->proto_mask, 0xff);
+	gfar_flow_add_field(c, RQFCR_PID_SIA, r->sip, r->sip_mask,
+			0xffffffff);
+	gfar_flow_add_field(c, RQFCR_PID_DIA, r->dip, r->dip_mask,
+			0xffffffff);
+	gfar_flow_add_field(c, RQFCR_PID_SPT, r->sport, r->sport_mask,
+			0xffff);
+	gfar_flow_add_field(c, RQFCR_PID_DPT, r->dport, r->dport_mask,
+			0xffff);
+
+	if (c->n > GFAR_FLOW_RULE_ENTRIES)
+		return -ENOSPC;
+
+	/* The last entry closes the chain and carries the action */
+	c->fcr[c->n - 1] &= ~RQFCR_AND;
+	if (r->queue < 0)
+		c->fcr[c->n - 1] |= RQFCR_RJE;
+	else
+		c->fcr[c->n - 1] |= r->queue << RQFCR_Q_SHIFT;
+
+	return 0;
+}
+
+static void gfar_flow_write(struct gfar_private *priv, unsigned int far,
+		u32 fcr, u32 fpr)
+{
+	priv->ftp_rqfcr[far] = fcr;
+	priv->ftp_rqfpr[far] = fpr;
+	gfar_write_filer(priv, far, fcr, fpr);
+}
+
+/* Take the chain in a slot out of the search without a halt */
+static void gfar_flow_disable_slot(struct gfar_private *priv, int slot)
+{
+	unsigned int base = slot * GFAR_FLOW_RULE_ENTRIES;
+	int i;
+
+	for (i = 0; i < GFAR_FLOW_RULE_ENTRIES - 1; i++)
+		gfar_flow_write(priv, base + i, RQFCR_CMP_NOMATCH | RQFCR_AND,
+				FPR_FILER_MASK);
+	gfar_flow_write(priv, base + i, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+}
+
+static void gfar_flow_program_slot(struct gfar_private *priv, int slot,
+		struct gfar_filer_chain *c)
+{
+	unsigned int base = slot * GFAR_FLOW_RULE_ENTRIES;
+	int i;
+
+	gfar_flow_disable_slot(priv, slot);
+
+	for (i = 1; i < c->n; i++)
+		gfar_flow_write(priv, base + i, c->fcr[i], c->fpr[i]);
+	for (; i < GFAR_FLOW_RULE_ENTRIES; i++)
+		gfar_flow_write(priv, base + i, RQFCR_CMP_NOMATCH,
+				FPR_FILER_MASK);
+
+	gfar_flow_write(priv, base, c->fcr[0], c->fpr[0]);
+}
+
+static void gfar_flow_clear_slot(struct gfar_private *priv, int slot)
+{
+	unsigned int base = slot * GFAR_FLOW_RULE_ENTRIES;
+	int i;
+
+	gfar_flow_disable_slot(priv, slot);
+
+	for (i = GFAR_FLOW_RULE_ENTRIES - 1; i >= 0; i--)
+		gfar_flow_write(priv, base + i, RQFCR_CMP_NOMATCH,
+				FPR_FILER_MASK);
+}
+
+static void gfar_flow_update_queue_map(struct gfar_private *priv)
+{
+	unsigned long map = 0;
+	int i;
+
+	for (i = 0; i < priv->flow_max_rules; i++)
+		if (priv->flow_rules[i].valid && priv->flow_rules[i].queue >= 0)
+			map |= 1UL << priv->flow_rules[i].queue;
+	priv->flow_queue_map = map;
+}
+
+/* Reprogram all the flow steering slots, after the filer was reset */
+void gfar_flow_restore(struct gfar_private *priv)
+{
+	struct gfar_filer_chain chain;
+	int i;
+
+	for (i = 0; i < priv->flow_max_rules; i++) {
+		if (priv->flow_rules[i].valid &&
+		    !gfar_flow_compile(&priv->flow_rules[i], &chain))
+			gfar_flow_program_slot(priv, i, &chain);
+		else
+			gfar_flow_clear_slot(priv, i);
+	}
+}
+
+static int gfar_flow_insert(struct gfar_private *priv,
+		struct gfar_flow_rule *new, u32 loc)
+{
+	struct gfar_flow_rule *r;
+	struct gfar_filer_chain chain;
+	int err;
+
+	if (loc >= priv->flow_max_rules)
+		return -EINVAL;
+
+	if (new->queue >= (s32)priv->num_rx_queues)
+		return -EINVAL;
+
+	/* The filer only sees L3/L4 properties with the parser enabled */
+	if (!priv->rx_csum_enable) {
+		pr_info("%s: flow steering needs RX checksumming enabled\n",
+				priv->ndev->name);
+		return -EOPNOTSUPP;
+	}
+
+	err = gfar_flow_compile(new, &chain);
+	if (err)
+		return err;
+
+	/* The RX path only counts hits for valid rules, a torn read of a
+	 * rule being replaced costs at most a miscounted frame.
+	 */
+	r = &priv->flow_rules[loc];
+	r->valid = 0;
+	smp_wmb();
+	*r = *new;
+
+	gfar_flow_program_slot(priv, loc, &chain);
+	priv->extra_stats.rx_flow_hits[loc] = 0;
+
+	smp_wmb();
+	r->valid = 1;
+	gfar_flow_update_queue_map(priv);
+
+	return 0;
+}
+
+static int gfar_flow_delete(struct gfar_private *priv, u32 loc)
+{
+	if (loc >= priv->flow_max_rules || !priv->flow_rules[loc].valid)
+		return -EINVAL;
+
+	priv->flow_rules[loc].valid = 0;
+	gfar_flow_update_queue_map(priv);
+	gfar_flow_clear_slot(priv, loc);
+
+	return 0;
+}
+
+/* Convert an ethtool flow spec; mask bits set in m_u are compared */
+static int gfar_flow_from_spec(struct gfar_flow_rule *r, u32 flow_type,
+		const void *h, const void *m)
+{
+	const struct ethtool_tcpip4_spec *th = h, *tm = m;
+	const struct ethtool_usrip4_spec *uh = h, *um = m;
+
+	memset(r, 0, sizeof(*r));
+	r->flow_type = flow_type;
+
+	switch (flow_type) {
+	case TCP_V4_FLOW:
+	case UDP_V4_FLOW:
+	case SCTP_V4_FLOW:
+		r->sip_mask = ntohl(tm->ip4src);
+		r->dip_mask = ntohl(tm->ip4dst);
+		r->sport_mask = ntohs(tm->psrc);
+		r->dport_mask = ntohs(tm->pdst);
+		r->tos_mask = tm->tos;
+		r->sip = ntohl(th->ip4src) & r->sip_mask;
+		r->dip = ntohl(th->ip4dst) & r->dip_mask;
+		r->sport = ntohs(th->psrc) & r->sport_mask;
+		r->dport = ntohs(th->pdst) & r->dport_mask;
+		r->tos = th->tos & r->tos_mask;
+		if (flow_type == SCTP_V4_FLOW) {
+			r->proto = IPPROTO_SCTP;
+			r->proto_mask = 0xff;
+		}
+		break;
+	case IP_USER_FLOW:
+		if (uh->ip_ver && uh->ip_ver != ETH_RX_NFC_IP4)
+			return -EINVAL;
+		r->sip_mask = ntohl(um->ip4src);
+		r->dip_mask = ntohl(um->ip4dst);
+		r->sport_mask = ntohl(um->l4_4_bytes) >> 16;
+		r->dport_mask = ntohl(um->l4_4_bytes) & 0xffff;
+		r->tos_mask = um->tos;
+		r->proto_mask = um->proto;
+		r->sip = ntohl(uh->ip4src) & r->sip_mask;
+		r->dip = ntohl(uh->ip4dst) & r->dip_mask;
+		r->sport = (ntohl(uh->l4_4_bytes) >> 16) & r->sport_mask;
+		r->dport = ntohl(uh->l4_4_bytes) & r->dport_mask;
+		r->tos = uh->tos & r->tos_mask;
+		r->proto = uh->proto & r->proto_mask;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void gfar_flow_to_spec(struct gfar_flow_rule *r,
+		struct ethtool_rx_flow_spec *fs)
+{
+	struct ethtool_tcpip4_spec *th = &fs->h_u.tcp_ip4_spec;
+	struct ethtool_tcpip4_spec *tm = &fs->m_u.tcp_ip4_spec;
+	struct ethtool_usrip4_spec *uh = &fs->h_u.usr_ip4_spec;
+	struct ethtool_usrip4_spec *um = &fs->m_u.usr_ip4_spec;
+
+	memset(&fs->h_u, 0, sizeof(fs->h_u));
+	memset(&fs->m_u, 0, sizeof(fs->m_u));
+	fs->flow_type = r->flow_type;
+	fs->ring_cookie = r->queue < 0 ? RX_CLS_FLOW_DISC : r->queue;
+
+	if (r->flow_type == IP_USER_FLOW) {
+		uh->ip4src = htonl(r->sip);
+		uh->ip4dst = htonl(r->dip);
+		uh->l4_4_bytes = htonl(r->sport << 16 | r->dport);
+		uh->tos = r->tos;
+		uh->ip_ver = ETH_RX_NFC_IP4;
+		uh->proto = r->proto;
+		um->ip4src = htonl(r->sip_mask);
+		um->ip4dst = htonl(r->dip_mask);
+		um->l4_4_bytes = htonl(r->sport_mask << 16 | r->dport_mask);
+		um->tos = r->tos_mask;
+		um->proto = r->proto_mask;
+	} else {
+		th->ip4src = htonl(r->sip);
+		th->ip4dst = htonl(r->dip);
+		th->psrc = htons(r->sport);
+		th->pdst = htons(r->dport);
+		th->tos = r->tos;
+		tm->ip4src = htonl(r->sip_mask);
+		tm->ip4dst = htonl(r->dip_mask);
+		tm->psrc = htons(r->sport_mask);
+		tm->pdst = htons(r->dport_mask);
+		tm->tos = r->tos_mask;
+	}
+}
+
+static int gfar_add_cls(struct gfar_private *priv,
+		struct ethtool_rx_flow_spec *fs)
+{
+	struct gfar_flow_rule rule;
+	int err;
+
+	err = gfar_flow_from_spec(&rule, fs->flow_type, &fs->h_u, &fs->m_u);
+	if (err)
+		return err;
+
+	rule.queue = fs->ring_cookie == RX_CLS_FLOW_DISC ?
+			-1 : (s32)fs->ring_cookie;
+	if (fs->ring_cookie != RX_CLS_FLOW_DISC &&
+	    fs->ring_cookie >= priv->num_rx_queues)
+		return -EINVAL;
+
+	return gfar_flow_insert(priv, &rule, fs->location);
+}
+
+/* n-tuple filters have no location, they take the first free slot. Their
+ * masks are inverted: a bit set in m_u means "don't care".
+ */
+static int gfar_set_rx_ntuple(struct net_device *dev,
+		struct ethtool_rx_ntuple *cmd)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+	struct ethtool_rx_ntuple_flow_spec *fs = &cmd->fs;
+	struct ethtool_usrip4_spec mask;
+	struct gfar_flow_rule rule;
+	u16 vid_mask;
+	int i, err;
+
+	for (i = 0; i < priv->flow_max_rules; i++)
+		if (!priv->flow_rules[i].valid)
+			break;
+	if (i == priv->flow_max_rules)
+		return -ENOSPC;
+
+	/* usr_ip4_spec is the largest of the IPv4 specs we take */
+	memcpy(&mask, &fs->m_u, sizeof(mask));
+	mask.ip4src = ~mask.ip4src;
+	mask.ip4dst = ~mask.ip4dst;
+	mask.l4_4_bytes = ~mask.l4_4_bytes;
+	mask.tos = ~mask.tos;
+	mask.ip_ver = ~mask.ip_ver;
+	mask.proto = ~mask.proto;
+
+	err = gfar_flow_from_spec(&rule, fs->flow_type, &fs->h_u, &mask);
+	if (err)
+		return err;
+
+	vid_mask = ~fs->vlan_tag_mask & VLAN_VID_MASK;
+	rule.vid_mask = vid_mask;
+	rule.vid = fs->vlan_tag & vid_mask;
+
+	if (fs->action == ETHTOOL_RXNTUPLE_ACTION_DROP)
+		rule.queue = -1;
+	else if (fs->action >= 0 && (u32)fs->action < priv->num_rx_queues)
+		rule.queue = fs->action;
+	else
+		return -EINVAL;
+
+	return gfar_flow_insert(priv, &rule, i);
+}
+
+static int gfar_get_nfc(struct net_device *dev, struct ethtool_rxnfc *cmd,
+		void *rule_locs)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+	u32 *locs = rule_locs;
+	u32 cnt = 0;
+	int i;
+
+	switch (cmd->cmd) {
+	case ETHTOOL_GRXRINGS:
+		cmd->data = priv->num_rx_queues;
+		break;
+	case ETHTOOL_GRXCLSRLCNT:
+		cmd->rule_cnt = gfar_flow_rules_in_use(priv);
+		cmd->data = priv->flow_max_rules;
+		break;
+	case ETHTOOL_GRXCLSRULE:
+		i = cmd->fs.location;
+		if (i >= priv->flow_max_rules || !priv->flow_rules[i].valid)
+			return -EINVAL;
+		gfar_flow_to_spec(&priv->flow_rules[i], &cmd->fs);
+		break;
+	case ETHTOOL_GRXCLSRLALL:
+		for (i = 0; i < priv->flow_max_rules; i++) {
+			if (!priv->flow_rules[i].valid)
+				continue;
+			if (cnt == cmd->rule_cnt)
+				return -EMSGSIZE;
+			locs[cnt++] = i;
+		}
+		cmd->rule_cnt = cnt;
+		cmd->data = priv->flow_max_rules;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
 
 	return 0;
 }
@@ -1012,6 +1514,12 @@ static int gfar_set_nfc(struct net_device *dev, struct ethtool_rxnfc *cmd)
 	case ETHTOOL_SRXFH:
 		ret = gfar_set_hash_opts(priv, cmd);
 		break;
+	case ETHTOOL_SRXCLSRLINS:
+		ret = gfar_add_cls(priv, &cmd->fs);
+		break;
+	case ETHTOOL_SRXCLSRLDEL:
+		ret = gfar_flow_delete(priv, cmd->fs.location);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1046,4 +1554,6 @@ const struct ethtool_ops gfar_ethtool_ops = {
 	.set_wol = gfar_set_wol,
 #endif
 	.set_rxnfc = gfar_set_nfc,
+	.get_rxnfc = gfar_get_nfc,
+	.set_rx_ntuple = gfar_set_rx_ntuple,
 };
@@ -0,0 +1,596 @@
+/*
+ * drivers/net/gianfar_ptp.c
+ *
+ * Gianfar Ethernet Driver -- IEEE 1588 time stamping and clock device
+ *
+ * Copyright 2008-2011 Freescale Semiconductor, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * SIOCSHWTSTAMP turns the eTSEC time stamps into SO_TIMESTAMPING hardware
+ * stamps. Receive stamps come from the 8 byte prefix the controller puts
+ * in front of every frame once RCTRL[TS] is set. Transmit stamps are read
+ * back from TMR_TXTS when the frame completes and are looped to the socket
+ * error queue. TMR_TXTS only keeps the latest stamp, so one frame at a
+ * time is stamped.
+ *
+ * The 1588 timer itself is exported as /dev/gfar_ptp, which offers the
+ * gettime/settime/adjtime/adjfreq operations of a PTP hardware clock.
+ * The timer interrupt puts PPS and external trigger events into a single
+ * producer, single consumer ring, so no lock is taken on either side.
+ * A servo can block in read() or poll() on the next event instead of
+ * polling ioctls.
+ *
+ * With CONFIG_GFAR_PTP_SOFT_CLOCK the timer is emulated from the system
+ * clock, PPS events are generated by an hrtimer, and frames are stamped in
+ * software, so all of the above can be exercised without a 1588 timer.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/seqlock.h>
+#include <linux/net_tstamp.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <asm/irq.h>
+
+#include "gianfar.h"
+
+#ifdef CONFIG_GFAR_PTP_SOFT_CLOCK
+#define gfar_ptp_soft	1
+#else
+#define gfar_ptp_soft	0
+#endif
+
+struct gfar_ptp_clock {
+	struct gfar_private *owner;
+	struct gfar_regs_1588 __iomem *regs;	/* NULL for the soft clock */
+	spinlock_t lock;			/* timer counter access */
+	int irq;
+	u32 event_mask;
+
+	/* Event ring: head is only written by the interrupt handler (or
+	 * the soft PPS timer), tail only by the reader.
+	 */
+	struct gfar_ptp_event ring[GFAR_PTP_EVENT_RING];
+	unsigned int head;
+	unsigned int tail;
+	unsigned int lost;
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+
+	/* Soft clock: time = base_ns + elapsed monotonic time, scaled */
+	seqlock_t soft_seq;
+	s64 soft_base_mono;
+	u64 soft_base_ns;
+	s32 soft_ppb;
+	struct hrtimer soft_pps;
+};
+
+static struct gfar_ptp_clock gfar_ptp = {
+	.lock		= __SPIN_LOCK_UNLOCKED(gfar_ptp.lock),
+	.read_lock	= __MUTEX_INITIALIZER(gfar_ptp.read_lock),
+	.wait		= __WAIT_QUEUE_HEAD_INITIALIZER(gfar_ptp.wait),
+	.soft_seq	= __SEQLOCK_UNLOCKED(gfar_ptp.soft_seq),
+	.irq		= NO_IRQ,
+};
+
+static s64 gfar_ptp_soft_scale(struct gfar_ptp_clock *c, s64 elapsed)
+{
+	return elapsed + div_s64(elapsed * c->soft_ppb, NSEC_PER_SEC);
+}
+
+static u64 gfar_ptp_soft_read(struct gfar_ptp_clock *c)
+{
+	unsigned int seq;
+	u64 ns;
+
+	do {
+		seq = read_seqbegin(&c->soft_seq);
+		ns = c->soft_base_ns + gfar_ptp_soft_scale(c,
+			ktime_to_ns(ktime_get()) - c->soft_base_mono);
+	} while (read_seqretry(&c->soft_seq, seq));
+
+	return ns;
+}
+
+/* Fold the elapsed time into the base; soft_seq held for writing */
+static void gfar_ptp_soft_rebase(struct gfar_ptp_clock *c)
+{
+	s64 now = ktime_to_ns(ktime_get());
+
+	c->soft_base_ns += gfar_ptp_soft_scale(c, now - c->soft_base_mono);
+	c->soft_base_mono = now;
+}
+
+static u64 gfar_ptp_cnt_read(struct gfar_regs_1588 __iomem *regs)
+{
+	u32 lo;
+
+	lo = gfar_read(&regs->tmr_cnt_l);	/* latches tmr_cnt_h */
+	return ((u64)gfar_read(&regs->tmr_cnt_h) << 32) | lo;
+}
+
+static void gfar_ptp_cnt_write(struct gfar_regs_1588 __iomem *regs, u64 ns)
+{
+	struct gfar_ptp_time t;
+
+	t.high = (u32)(ns >> 32);
+	t.low = (u32)ns;
+	gfar_ptp_write_cnt(regs, &t);
+}
+
+static u64 gfar_ptp_gettime(struct gfar_ptp_clock *c)
+{
+	unsigned long flags;
+	u64 ns;
+
+	if (!c->regs)
+		return gfar_ptp_soft_read(c);
+
+	spin_lock_irqsave(&c->lock, flags);
+	ns = gfar_ptp_cnt_read(c->regs);
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	return ns;
+}
+
+static void gfar_ptp_settime(struct gfar_ptp_clock *c, u64 ns)
+{
+	unsigned long flags;
+
+	if (!c->regs) {
+		write_seqlock_irqsave(&c->soft_seq, flags);
+		c->soft_base_mono = ktime_to_ns(ktime_get());
+		c->soft_base_ns = ns;
+		write_sequnlock_irqrestore(&c->soft_seq, flags);
+		return;
+	}
+
+	spin_lock_irqsave(&c->lock, flags);
+	gfar_ptp_cnt_write(c->regs, ns);
+	spin_unlock_irqrestore(&c->lock, flags);
+}
+
+static void gfar_ptp_adjtime(struct gfar_ptp_clock *c, s64 delta)
+{
+	unsigned long flags;
+
+	if (!c->regs) {
+		write_seqlock_irqsave(&c->soft_seq, flags);
+		gfar_ptp_soft_rebase(c);
+		c->soft_base_ns += delta;
+		write_sequnlock_irqrestore(&c->soft_seq, flags);
+		return;
+	}
+
+	spin_lock_irqsave(&c->lock, flags);
+	gfar_ptp_cnt_write(c->regs, gfar_ptp_cnt_read(c->regs) + delta);
+	spin_unlock_irqrestore(&c->lock, flags);
+}
+
+static int gfar_ptp_adjfreq(struct gfar_ptp_clock *c, s32 ppb)
+{
+	unsigned long flags;
+	u32 addend, diff;
+
+	if (ppb > GFAR_PTP_MAX_ADJ || ppb < -GFAR_PTP_MAX_ADJ)
+		return -ERANGE;
+
+	if (!c->regs) {
+		write_seqlock_irqsave(&c->soft_seq, flags);
+		gfar_ptp_soft_rebase(c);
+		c->soft_ppb = ppb;
+		write_sequnlock_irqrestore(&c->soft_seq, flags);
+		return 0;
+	}
+
+	/* The counter advances by TMR_ADD per input clock, so scaling the
+	 * nominal addend scales the clock rate.
+	 */
+	addend = gfar_ptp_addend();
+	if (!addend)
+		return -ENODEV;
+	diff = div_u64((u64)addend * abs(ppb), NSEC_PER_SEC);
+	gfar_write(&c->regs->tmr_add, ppb < 0 ? addend - diff : addend + diff);
+
+	return 0;
+}
+
+/* Producer side of the event ring, called from hard irq context only */
+static void gfar_ptp_queue_event(struct gfar_ptp_clock *c, u32 type, u64 ns)
+{
+	unsigned int head = c->head;
+	struct gfar_ptp_event *ev;
+
+	if (head - ACCESS_ONCE(c->tail) >= GFAR_PTP_EVENT_RING) {
+		c->lost++;
+		return;
+	}
+
+	ev = &c->ring[head & (GFAR_PTP_EVENT_RING - 1)];
+	ev->t.sec = div_u64_rem(ns, NSEC_PER_SEC, &ev->t.nsec);
+	ev->t.reserved = 0;
+	ev->type = type;
+	ev->lost = c->lost;
+	c->lost = 0;
+
+	smp_wmb();	/* entry must be visible before the new head */
+	c->head = head + 1;
+	wake_up_interruptible(&c->wait);
+}
+
+static irqreturn_t gfar_ptp_isr(int irq, void *data)
+{
+	struct gfar_ptp_clock *c = data;
+	u32 ev, lo;
+	u64 ns;
+
+	ev = gfar_read(&c->regs->tmr_tevent) & gfar_read(&c->regs->tmr_temask);
+	if (!ev)
+		return IRQ_NONE;
+
+	if (ev & TMR_TEVENT_ETS1) {
+		lo = gfar_read(&c->regs->tmr_etts1_l);
+		ns = ((u64)gfar_read(&c->regs->tmr_etts1_h) << 32) | lo;
+		gfar_ptp_queue_event(c, GFAR_PTP_EV_EXTTS1, ns);
+	}
+
+	if (ev & TMR_TEVENT_ETS2) {
+		lo = gfar_read(&c->regs->tmr_etts2_l);
+		ns = ((u64)gfar_read(&c->regs->tmr_etts2_h) << 32) | lo;
+		gfar_ptp_queue_event(c, GFAR_PTP_EV_EXTTS2, ns);
+	}
+
+	if (ev & TMR_TEVENT_PP1)
+		gfar_ptp_queue_event(c, GFAR_PTP_EV_PPS, gfar_ptp_gettime(c));
+
+	gfar_write(&c->regs->tmr_tevent, ev);
+
+	return IRQ_HANDLED;
+}
+
+/* Soft clock PPS, re-armed for the next second boundary of the clock */
+static enum hrtimer_restart gfar_ptp_soft_tick(struct hrtimer *timer)
+{
+	struct gfar_ptp_clock *c = container_of(timer, struct gfar_ptp_clock,
+						soft_pps);
+	u32 rem;
+	u64 ns;
+
+	write_seqlock(&c->soft_seq);
+	gfar_ptp_soft_rebase(c);
+	ns = c->soft_base_ns;
+	write_sequnlock(&c->soft_seq);
+
+	if (c->event_mask & GFAR_PTP_EV_PPS)
+		gfar_ptp_queue_event(c, GFAR_PTP_EV_PPS, ns);
+
+	div_u64_rem(ns, NSEC_PER_SEC, &rem);
+	hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC - rem));
+
+	return HRTIMER_RESTART;
+}
+
+static int gfar_ptp_set_events(struct gfar_ptp_clock *c, u32 mask)
+{
+	u32 temask = 0;
+
+	if (mask & ~GFAR_PTP_EV_ALL)
+		return -EINVAL;
+
+	if (!c->regs) {
+		if (mask & ~GFAR_PTP_EV_PPS)
+			return -EOPNOTSUPP;
+		c->event_mask = mask;
+		return 0;
+	}
+
+	if (c->irq == NO_IRQ)
+		return mask ? -EOPNOTSUPP : 0;
+
+	if (mask & GFAR_PTP_EV_PPS)
+		temask |= TMR_TEVENT_PP1;
+	if (mask & GFAR_PTP_EV_EXTTS1)
+		temask |= TMR_TEVENT_ETS1;
+	if (mask & GFAR_PTP_EV_EXTTS2)
+		temask |= TMR_TEVENT_ETS2;
+
+	c->event_mask = mask;
+	gfar_write(&c->regs->tmr_tevent, temask);
+	gfar_write(&c->regs->tmr_temask, temask);
+
+	return 0;
+}
+
+static ssize_t gfar_ptp_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct gfar_ptp_clock *c = &gfar_ptp;
+	unsigned int head, tail, n, i;
+	ssize_t ret;
+
+	if (count < sizeof(struct gfar_ptp_event))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&c->read_lock))
+		return -ERESTARTSYS;
+
+	while ((head = ACCESS_ONCE(c->head)) == c->tail) {
+		mutex_unlock(&c->read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(c->wait,
+				ACCESS_ONCE(c->head) != c->tail))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&c->read_lock))
+			return -ERESTARTSYS;
+	}
+
+	smp_rmb();	/* read the entries only after the head */
+
+	tail = c->tail;
+	n = min_t(unsigned int, head - tail,
+			count / sizeof(struct gfar_ptp_event));
+	ret = 0;
+	for (i = 0; i < n; i++) {
+		if (copy_to_user(buf + ret,
+				&c->ring[(tail + i) & (GFAR_PTP_EVENT_RING - 1)],
+				sizeof(struct gfar_ptp_event))) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+		ret += sizeof(struct gfar_ptp_event);
+	}
+
+	smp_mb();	/* done with the entries before handing them back */
+	c->tail = tail + i;
+	mutex_unlock(&c->read_lock);
+
+	return ret;
+}
+
+static unsigned int gfar_ptp_poll(struct file *file, poll_table *wait)
+{
+	struct gfar_ptp_clock *c = &gfar_ptp;
+
+	poll_wait(file, &c->wait, wait);
+
+	return ACCESS_ONCE(c->head) != c->tail ? POLLIN | POLLRDNORM : 0;
+}
+
+static long gfar_ptp_ioctl(struct file *file, unsigned int cmd,
+		unsigned long arg)
+{
+	struct gfar_ptp_clock *c = &gfar_ptp;
+	void __user *argp = (void __user *)arg;
+	struct gfar_ptp_clock_time t;
+	u64 ns;
+	s64 delta;
+	s32 ppb;
+	u32 mask;
+
+	if (cmd != GFAR_PTP_GETTIME && !capable(CAP_SYS_TIME))
+		return -EPERM;
+
+	switch (cmd) {
+	case GFAR_PTP_GETTIME:
+		ns = gfar_ptp_gettime(c);
+		t.sec = div_u64_rem(ns, NSEC_PER_SEC, &t.nsec);
+		t.reserved = 0;
+		return copy_to_user(argp, &t, sizeof(t)) ? -EFAULT : 0;
+	case GFAR_PTP_SETTIME:
+		if (copy_from_user(&t, argp, sizeof(t)))
+			return -EFAULT;
+		if (t.sec < 0 || t.nsec >= NSEC_PER_SEC)
+			return -EINVAL;
+		gfar_ptp_settime(c, (u64)t.sec * NSEC_PER_SEC + t.nsec);
+		return 0;
+	case GFAR_PTP_ADJTIME:
+		if (copy_from_user(&delta, argp, sizeof(delta)))
+			return -EFAULT;
+		gfar_ptp_adjtime(c, delta);
+		return 0;
+	case GFAR_PTP_ADJFREQ:
+		if (copy_from_user(&ppb, argp, sizeof(ppb)))
+			return -EFAULT;
+		return gfar_ptp_adjfreq(c, ppb);
+	case GFAR_PTP_EVENTS:
+		if (copy_from_user(&mask, argp, sizeof(mask)))
+			return -EFAULT;
+		return gfar_ptp_set_events(c, mask);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations gfar_ptp_fops = {
+	.owner		= THIS_MODULE,
+	.read		= gfar_ptp_read,
+	.poll		= gfar_ptp_poll,
+	.unlocked_ioctl	= gfar_ptp_ioctl,
+};
+
+static struct miscdevice gfar_ptp_misc = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= GFAR_PTP_DEV_NAME,
+	.fops	= &gfar_ptp_fops,
+};
+
+/*
+ * function: gfar_hwtstamp_ioctl
+ * SIOCSHWTSTAMP handler. The controller stamps every received frame once
+ * RCTRL[TS] is set, so any receive filter is reported back as FILTER_ALL.
+ */
+int gfar_hwtstamp_ioctl(struct net_device *dev, struct ifreq *ifr)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+	struct hwtstamp_config config;
+
+	if (copy_from_user(&config, ifr->ifr_data, sizeof(config)))
+		return -EFAULT;
+
+	if (config.flags)
+		return -EINVAL;
+
+	if (!priv->ptimer_present && !gfar_ptp_soft)
+		return -EOPNOTSUPP;
+
+	switch (config.tx_type) {
+	case HWTSTAMP_TX_OFF:
+		priv->hwts_tx_en = 0;
+		break;
+	case HWTSTAMP_TX_ON:
+		priv->hwts_tx_en = 1;
+		break;
+	default:
+		return -ERANGE;
+	}
+
+	switch (config.rx_filter) {
+	case HWTSTAMP_FILTER_NONE:
+		priv->hwts_rx_en = 0;
+		break;
+	default:
+		priv->hwts_rx_en = 1;
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+		break;
+	}
+
+	return copy_to_user(ifr->ifr_data, &config, sizeof(config)) ?
+		-EFAULT : 0;
+}
+
+/* Called with skb->data at the time stamp prefix, if there is one */
+void gfar_ptp_rx_hwtstamp(struct gfar_private *priv, struct sk_buff *skb)
+{
+	struct skb_shared_hwtstamps *shhwtstamps = skb_hwtstamps(skb);
+	u32 *prefix = (u32 *)skb->data;
+	u64 ns;
+
+	if (gfar_ptp_soft)
+		ns = gfar_ptp_soft_read(&gfar_ptp);
+	else if (priv->ptimer_present)
+		ns = ((u64)prefix[0] << 32) | prefix[1];
+	else
+		return;
+
+	memset(shhwtstamps, 0, sizeof(*shhwtstamps));
+	shhwtstamps->hwtstamp = ns_to_ktime(ns);
+}
+
+/*
+ * function: gfar_ptp_tx_hwtstamp
+ * Called at transmit completion for frames that asked for a hardware
+ * stamp; such frames always carry an FCB, which is stripped before the
+ * frame is looped back to the socket error queue. Only one such frame is
+ * in flight, so TMR_TXTS holds its stamp.
+ */
+void gfar_ptp_tx_hwtstamp(struct gfar_private *priv, struct sk_buff *skb)
+{
+	struct skb_shared_hwtstamps shhwtstamps;
+	struct gfar_ptp_time ts;
+	u64 ns;
+
+	if (gfar_ptp_soft) {
+		ns = gfar_ptp_soft_read(&gfar_ptp);
+	} else if (priv->ptimer_present) {
+		gfar_get_tx_timestamp(priv->gfargrp[0].regs, &ts);
+		ns = ((u64)ts.high << 32) | ts.low;
+	} else
+		return;
+
+	memset(&shhwtstamps, 0, sizeof(shhwtstamps));
+	shhwtstamps.hwtstamp = ns_to_ktime(ns);
+	skb_pull(skb, GMAC_FCB_LEN);
+	skb_tstamp_tx(skb, &shhwtstamps);
+}
+
+/*
+ * function: gfar_ptp_clock_register
+ * The 1588 timer is shared by all eTSECs; the first controller that
+ * probes with it (or any controller, for the soft clock) registers
+ * the clock device.
+ */
+void gfar_ptp_clock_register(struct gfar_private *priv)
+{
+	struct gfar_ptp_clock *c = &gfar_ptp;
+	struct device_node *np;
+	int err;
+
+	if (c->owner || (!priv->ptimer_present && !gfar_ptp_soft))
+		return;
+
+	c->head = c->tail = c->lost = 0;
+	c->event_mask = 0;
+
+	if (gfar_ptp_soft) {
+		c->regs = NULL;
+		c->soft_base_mono = ktime_to_ns(ktime_get());
+		c->soft_base_ns = ktime_to_ns(ktime_get_real());
+		c->soft_ppb = 0;
+		hrtimer_init(&c->soft_pps, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		c->soft_pps.function = gfar_ptp_soft_tick;
+		hrtimer_start(&c->soft_pps, ktime_set(1, 0), HRTIMER_MODE_REL);
+	} else {
+		c->regs = priv->ptimer;
+		gfar_write(&c->regs->tmr_temask, 0);
+		np = of_find_compatible_node(NULL, NULL,
+				"fsl,gianfar-ptp-timer");
+		c->irq = np ? irq_of_parse_and_map(np, 0) : NO_IRQ;
+		of_node_put(np);
+		if (c->irq != NO_IRQ && request_irq(c->irq, gfar_ptp_isr, 0,
+					GFAR_PTP_DEV_NAME, c)) {
+			printk(KERN_WARNING "%s: no 1588 timer interrupt, "
+					"events disabled\n", priv->ndev->name);
+			c->irq = NO_IRQ;
+		}
+	}
+
+	err = misc_register(&gfar_ptp_misc);
+	if (err) {
+		printk(KERN_ERR "%s: cannot register /dev/%s (%d)\n",
+				priv->ndev->name, GFAR_PTP_DEV_NAME, err);
+		if (gfar_ptp_soft)
+			hrtimer_cancel(&c->soft_pps);
+		else if (c->irq != NO_IRQ)
+			free_irq(c->irq, c);
+		c->irq = NO_IRQ;
+		return;
+	}
+
+	c->owner = priv;
+	printk(KERN_INFO "%s: IEEE1588 clock /dev/%s (%s)\n",
+			priv->ndev->name, GFAR_PTP_DEV_NAME,
+			gfar_ptp_soft ? "software test clock" : "eTSEC timer");
+}
+
+void gfar_ptp_clock_unregister(struct gfar_private *priv)
+{
+	struct gfar_ptp_clock *c = &gfar_ptp;
+
+	if (c->owner != priv)
+		return;
+
+	misc_deregister(&gfar_ptp_misc);
+
+	if (gfar_ptp_soft) {
+		hrtimer_cancel(&c->soft_pps);
+	} else {
+		gfar_write(&c->regs->tmr_temask, 0);
+		if (c->irq != NO_IRQ)
+			free_irq(c->irq, c);
+	}
+
+	c->irq = NO_IRQ;
+	c->regs = NULL;
+	c->owner = NULL;
+}
@@ -30,6 +30,8 @@
 #include <linux/spinlock.h>
 #include <linux/mm.h>
 #include <linux/device.h>
+#include <linux/rtnetlink.h>
+#include <linux/sched.h>
 
 #include <asm/uaccess.h>
 #include <linux/module.h>
@@ -324,8 +326,7 @@ static ssize_t gfar_show_recycle_max(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
 	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
-	return sprintf(buf, "%d\n",
-		priv->rx_queue[0]->skb_handler.recycle_max);
+	return sprintf(buf, "%d\n", priv->skb_depot.recycle_max);
 }
 
 static ssize_t gfar_set_recycle_max(struct device *dev,
@@ -333,15 +334,20 @@ static ssize_t gfar_set_recycle_max(struct device *dev,
 				const char *buf, size_t count)
 {
 	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
-	unsigned int length = simple_strtoul(buf, NULL, 0);
-	int i = 0;
+	unsigned long length;
+
+	if (strict_strtoul(buf, 0, &length) ||
+			length < GFAR_MIN_RECYCLE_MAX ||
+			length > GFAR_MAX_RECYCLE_MAX)
+		return -EINVAL;
 
-	/* recycling max management is loosely done. If the count is more
-	 * than max, simply don't keep the buffer until the current amount
-	 * lower than max.
+	/* This is the ceiling for the per-CPU magazine depth, which adapts
+	 * below it. Magazines deeper than a lowered ceiling are trimmed.
 	 */
-	for (i = 0; i < priv->num_rx_queues; i++)
-		priv->rx_queue[i]->skb_handler.recycle_max = length;
+	if (!rtnl_trylock())
+		return restart_syscall();
+	gfar_skbr_set_max(priv, length);
+	rtnl_unlock();
 	return count;
 }
 
@@ -349,6 +355,131 @@ static DEVICE_ATTR(recycle_max, 0644, gfar_show_recycle_max,
 				gfar_set_recycle_max);
 #endif
 
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+static ssize_t gfar_show_aic_profile(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%s\n",
+		priv->aic_profile == GFAR_AIC_PROFILE_THROUGHPUT ?
+		"throughput" : "latency");
+}
+
+static ssize_t gfar_set_aic_profile(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	if (sysfs_streq(buf, "latency"))
+		priv->aic_profile = GFAR_AIC_PROFILE_LATENCY;
+	else if (sysfs_streq(buf, "throughput"))
+		priv->aic_profile = GFAR_AIC_PROFILE_THROUGHPUT;
+	else
+		return -EINVAL;
+
+	return count;
+}
+
+static DEVICE_ATTR(aic_profile, 0644, gfar_show_aic_profile,
+				gfar_set_aic_profile);
+
+static ssize_t gfar_show_aic_latency(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%u\n", priv->aic_latency);
+}
+
+static ssize_t gfar_set_aic_latency(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	unsigned long length;
+
+	if (strict_strtoul(buf, 0, &length) ||
+			length == 0 || length > GFAR_AIC_MAX_LATENCY)
+		return -EINVAL;
+
+	priv->aic_latency = length;
+	return count;
+}
+
+static DEVICE_ATTR(aic_latency, 0644, gfar_show_aic_latency,
+				gfar_set_aic_latency);
+
+static ssize_t gfar_show_aic_irq_budget(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%u\n", priv->aic_irq_budget);
+}
+
+static ssize_t gfar_set_aic_irq_budget(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	unsigned long budget;
+
+	if (strict_strtoul(buf, 0, &budget) ||
+			budget < GFAR_AIC_MIN_IRQ_BUDGET ||
+			budget > GFAR_AIC_MAX_IRQ_BUDGET)
+		return -EINVAL;
+
+	priv->aic_irq_budget = budget;
+	return count;
+}
+
+static DEVICE_ATTR(aic_irq_budget, 0644, gfar_show_aic_irq_budget,
+				gfar_set_aic_irq_budget);
+#endif
+
+#ifdef CONFIG_GIANFAR_L2SRAM
+static ssize_t gfar_show_bd_sram(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%d\n", priv->bd_sram);
+}
+
+/* Takes effect when the rings are next allocated (ifdown/ifup) */
+static ssize_t gfar_set_bd_sram(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	unsigned long val;
+
+	if (strict_strtoul(buf, 0, &val))
+		return -EINVAL;
+
+	priv->bd_sram = val ? 1 : 0;
+	return count;
+}
+
+static DEVICE_ATTR(bd_sram, 0644, gfar_show_bd_sram, gfar_set_bd_sram);
+
+static ssize_t gfar_show_bd_placement(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct net_device *ndev = to_net_dev(dev);
+	struct gfar_private *priv = netdev_priv(ndev);
+
+	if (!netif_running(ndev))
+		return sprintf(buf, "none\n");
+
+	return sprintf(buf, "%s\n", priv->bd_in_ram ? "ddr" : "sram");
+}
+
+static DEVICE_ATTR(bd_placement, 0444, gfar_show_bd_placement, NULL);
+#endif
+
 static ssize_t gfar_show_max_filer_rules(struct device *dev,
 					struct device_attribute *attr,
 					char *buf)
@@ -380,8 +511,17 @@ void gfar_init_sysfs(struct net_device *dev)
 	rc |= device_create_file(&dev->dev, &dev_attr_fifo_starve_off);
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	rc |= device_create_file(&dev->dev, &dev_attr_recycle_max);
+#endif
+#ifdef CONFIG_GFAR_ADAPTIVE_COALESCING
+	rc |= device_create_file(&dev->dev, &dev_attr_aic_profile);
+	rc |= device_create_file(&dev->dev, &dev_attr_aic_latency);
+	rc |= device_create_file(&dev->dev, &dev_attr_aic_irq_budget);
 #endif
 	rc |= device_create_file(&dev->dev, &dev_attr_max_filer_rules);
+#ifdef CONFIG_GIANFAR_L2SRAM
+	rc |= device_create_file(&dev->dev, &dev_attr_bd_sram);
+	rc |= device_create_file(&dev->dev, &dev_attr_bd_placement);
+#endif
 	if (rc)
 		dev_err(&dev->dev, "Error creating gianfar sysfs files.\n");
 }
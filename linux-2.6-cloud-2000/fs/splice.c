@@ -34,6 +34,7 @@
 #include <linux/gfp.h>
 #include <linux/socket.h>
 #include <linux/net.h>
+#include <linux/dma_copy.h>
 
 #ifdef CONFIG_SEND_PAGES
 #include <net/tcp.h>
@@ -861,16 +862,21 @@ int pipe_to_file(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 		goto out;
 
 	if (buf->page != page) {
-		/*
-		 * Careful, ->map() uses KM_USER0!
-		 */
-		char *src = buf->ops->map(pipe, buf, 1);
-		char *dst = kmap_atomic(page, KM_USER1);
+		if (!dma_copy_try_page(DMA_COPY_SPLICE, page, offset,
+				       buf->page, buf->offset, this_len)) {
+			flush_dcache_page(page);
+		} else {
+			/*
+			 * Careful, ->map() uses KM_USER0!
+			 */
+			char *src = buf->ops->map(pipe, buf, 1);
+			char *dst = kmap_atomic(page, KM_USER1);
 
-		memcpy(dst + offset, src + buf->offset, this_len);
-		flush_dcache_page(page);
-		kunmap_atomic(dst, KM_USER1);
-		buf->ops->unmap(pipe, buf, src);
+			memcpy(dst + offset, src + buf->offset, this_len);
+			flush_dcache_page(page);
+			kunmap_atomic(dst, KM_USER1);
+			buf->ops->unmap(pipe, buf, src);
+		}
 	}
 	ret = pagecache_write_end(file, mapping, sd->pos, this_len, this_len,
 				page, fsdata);
@@ -160,6 +160,13 @@ static int do_commit(struct ubifs_info *c)
 	if (err)
 		goto out;
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	c->cmt_jiffies = jiffies;
+	spin_lock(&c->cnt_lock);
+	c->cmt_sqnum = c->max_sqnum;
+	spin_unlock(&c->cnt_lock);
+#endif
+
 	spin_lock(&c->cs_lock);
 	c->cmt_state = COMMIT_RESTING;
 	wake_up(&c->cmt_wq);
@@ -225,7 +232,8 @@ out:
  * This function implements various file-system background activities:
  * o when a write-buffer timer expires it synchronizes the appropriate
  *   write-buffer;
- * o when the journal is about to be full, it starts in-advance commit.
+ * o when the journal is about to be full, it starts in-advance commit;
+ * o it does the journal tuning work, see 'ubifs_tune_bgt()'.
  *
  * Note, other stuff like background garbage collection may be added here in
  * future.
@@ -233,6 +241,7 @@ out:
 int ubifs_bg_thread(void *info)
 {
 	int err;
+	long timeout;
 	struct ubifs_info *c = info;
 
 	dbg_msg("background thread \"%s\" started, PID %d",
@@ -246,6 +255,7 @@ int ubifs_bg_thread(void *info)
 		if (try_to_freeze())
 			continue;
 
+		timeout = ubifs_tune_bgt(c);
 		set_current_state(TASK_INTERRUPTIBLE);
 		/* Check if there is something to do */
 		if (!c->need_bgt) {
@@ -256,7 +266,7 @@ int ubifs_bg_thread(void *info)
 			 */
 			if (kthread_should_stop())
 				break;
-			schedule();
+			schedule_timeout(timeout);
 			continue;
 		} else
 			__set_current_state(TASK_RUNNING);
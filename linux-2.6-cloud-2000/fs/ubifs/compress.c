@@ -28,6 +28,10 @@
  */
 
 #include <linux/crypto.h>
+#include <linux/dma_copy.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -133,6 +137,104 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+
+/**
+ * ubifs_compress_policy - compress data of an inode.
+ * @c: UBIFS file-system description object
+ * @ui: the inode the data belongs to
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer where compressed data should be stored
+ * @out_len: output buffer length is returned here
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * This is 'ubifs_compress()' plus statistics and adaptive compression: once
+ * @c->compr_adaptive data nodes of @ui in a row did not compress, the data of
+ * @ui is stored uncompressed without asking the compressor. This saves the
+ * CPU time wasted on already compressed data, like firmware images.
+ */
+void ubifs_compress_policy(struct ubifs_info *c, struct ubifs_inode *ui,
+			   const void *in_buf, int in_len, void *out_buf,
+			   int *out_len, int *compr_type)
+{
+	struct ubifs_compr_stats *st = &c->compr_stats;
+	ktime_t start;
+	s64 ns;
+
+	if (*compr_type == UBIFS_COMPR_NONE || in_len < UBIFS_MIN_COMPR_LEN) {
+		ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+		return;
+	}
+
+	/* @compr_misses is not protected, it is only a hint */
+	if (c->compr_adaptive && ui->compr_misses >= c->compr_adaptive) {
+		*compr_type = UBIFS_COMPR_NONE;
+		ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+		atomic_long_inc(&st->skipped);
+		return;
+	}
+
+	start = ktime_get();
+	ubifs_compress(in_buf, in_len, out_buf, out_len, compr_type);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	atomic64_add(in_len, &st->in_bytes);
+	atomic64_add(ns, &st->cpu_ns);
+	if (*compr_type == UBIFS_COMPR_NONE) {
+		atomic_long_inc(&st->incompressible);
+		atomic64_add(ns, &st->wasted_ns);
+		ui->compr_misses += 1;
+	} else {
+		atomic_long_inc(&st->compressed);
+		atomic64_add(in_len - *out_len, &st->saved_bytes);
+		ui->compr_misses = 0;
+	}
+}
+
+static int compr_stats_show(struct seq_file *s, void *v)
+{
+	struct ubifs_info *c;
+	struct ubifs_compr_stats *st;
+
+	seq_printf(s, "%-10s %10s %14s %10s %14s %14s %14s %14s\n",
+		   "volume", "compressed", "incompressible", "skipped",
+		   "in_bytes", "saved_bytes", "cpu_ns", "wasted_ns");
+
+	spin_lock(&ubifs_infos_lock);
+	list_for_each_entry(c, &ubifs_infos, infos_list) {
+		st = &c->compr_stats;
+		seq_printf(s, "ubi%d_%-5d %10lu %14lu %10lu %14lld %14lld "
+			   "%14lld %14lld\n", c->vi.ubi_num, c->vi.vol_id,
+			   atomic_long_read(&st->compressed),
+			   atomic_long_read(&st->incompressible),
+			   atomic_long_read(&st->skipped),
+			   (long long)atomic64_read(&st->in_bytes),
+			   (long long)atomic64_read(&st->saved_bytes),
+			   (long long)atomic64_read(&st->cpu_ns),
+			   (long long)atomic64_read(&st->wasted_ns));
+	}
+	spin_unlock(&ubifs_infos_lock);
+
+	return 0;
+}
+
+static int compr_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, compr_stats_show, NULL);
+}
+
+static const struct file_operations compr_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= compr_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#endif /* CONFIG_UBIFS_FS_COMPR_POLICY */
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -164,7 +266,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	}
 
 	if (compr_type == UBIFS_COMPR_NONE) {
-		memcpy(out_buf, in_buf, in_len);
+		dma_copy(DMA_COPY_UBIFS, out_buf, in_buf, in_len);
 		*out_len = in_len;
 		return 0;
 	}
@@ -234,6 +336,11 @@ int __init ubifs_compressors_init(void)
 		goto out_lzo;
 
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
+
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (!proc_create("fs/ubifs_compr", S_IRUGO, NULL, &compr_stats_fops))
+		ubifs_warn("cannot create /proc/fs/ubifs_compr");
+#endif
 	return 0;
 
 out_lzo:
@@ -246,6 +353,9 @@ out_lzo:
  */
 void ubifs_compressors_exit(void)
 {
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	remove_proc_entry("fs/ubifs_compr", NULL);
+#endif
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
 }
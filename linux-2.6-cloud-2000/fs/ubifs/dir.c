@@ -52,7 +52,9 @@
  * o %UBIFS_COMPR_FL, which is useful to switch compression on/of on
  *   sub-directory basis;
  * o %UBIFS_SYNC_FL - useful for the same reasons;
- * o %UBIFS_DIRSYNC_FL - similar, but relevant only to directories.
+ * o %UBIFS_DIRSYNC_FL - similar, but relevant only to directories;
+ * o %UBIFS_COMPR_TYPE_FL - the compression type of the directory applies to
+ *   files and sub-directories created in it.
  *
  * This function returns the inherited flags.
  */
@@ -72,6 +74,10 @@ static int inherit_flags(const struct inode *dir, int mode)
 	if (!S_ISDIR(mode))
 		/* The "DIRSYNC" flag only applies to directories */
 		flags &= ~UBIFS_DIRSYNC_FL;
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (S_ISREG(mode) || S_ISDIR(mode))
+		flags |= ui->flags & UBIFS_COMPR_TYPE_FL;
+#endif
 	return flags;
 }
 
@@ -141,6 +147,10 @@ struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
 		ui->compr_type = c->default_compr;
 	else
 		ui->compr_type = UBIFS_COMPR_NONE;
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (ui->flags & UBIFS_COMPR_TYPE_FL)
+		ui->compr_type = ubifs_inode(dir)->compr_type;
+#endif
 	ui->synced_i_size = 0;
 
 	spin_lock(&c->cnt_lock);
@@ -46,13 +46,15 @@
  * Similarly, @i_mutex is not always locked in 'ubifs_readpage()', e.g., the
  * read-ahead path does not lock it ("sys_read -> generic_file_aio_read ->
  * ondemand_readahead -> readpage"). In case of readahead, @I_SYNC flag is not
- * set as well. However, UBIFS disables readahead.
+ * set as well. However, UBIFS disables readahead, unless the asynchronous
+ * read-ahead ('ubifs_readpages()') is configured in.
  */
 
 #include "ubifs.h"
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -888,6 +890,297 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
+#ifdef CONFIG_UBIFS_FS_READAHEAD
+
+/*
+ * Asynchronous read-ahead.
+ *
+ * 'ubifs_readpages()' only inserts the read-ahead pages into the page cache
+ * and queues them, still locked, to the "ubifs_ra" thread. That thread first
+ * looks up the data nodes of the whole window in the TNC, splitting it into
+ * runs of nodes which sit consecutively in one LEB, exactly like bulk-read
+ * does. Then it reads each run with a single UBI read and passes it on to the
+ * "ubifs_unpack" thread, which decompresses the nodes into the pages and
+ * unlocks them. So decompression of one run overlaps with the flash read of
+ * the next one, and the reader only waits for the pages it actually touches.
+ *
+ * Pages which do not belong to any run (holes, scattered nodes) or whose run
+ * could not be read are read by 'do_readpage()' like in 'ubifs_readpage()'.
+ */
+
+static struct workqueue_struct *ubifs_ra_wq;
+static struct workqueue_struct *ubifs_unpack_wq;
+
+/* Runs read but not unpacked yet, bounds the memory held by the buffers */
+static atomic_t ubifs_ra_pending = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(ubifs_ra_wait);
+
+/**
+ * struct ubifs_ra_window - pages of one read-ahead request.
+ * @work: "ubifs_ra" work
+ * @c: UBIFS file-system description object
+ * @cnt: number of pages
+ * @pages: locked pages in ascending index order
+ */
+struct ubifs_ra_window {
+	struct work_struct work;
+	struct ubifs_info *c;
+	int cnt;
+	struct page *pages[];
+};
+
+/**
+ * struct ubifs_ra_run - read-ahead pages served by one flash read.
+ * @list: link in the list of runs of a window
+ * @work: "ubifs_unpack" work
+ * @c: UBIFS file-system description object
+ * @bu: data nodes of the run and the buffer they are read into
+ * @cnt: number of pages
+ * @pages: locked pages in ascending index order
+ *
+ * If @bu.cnt is zero, the pages are read one by one.
+ */
+struct ubifs_ra_run {
+	struct list_head list;
+	struct work_struct work;
+	struct ubifs_info *c;
+	struct bu_info bu;
+	int cnt;
+	struct page *pages[UBIFS_MAX_BULK_READ];
+};
+
+static void ra_readpage(struct page *page)
+{
+	do_readpage(page);
+	unlock_page(page);
+	page_cache_release(page);
+}
+
+/**
+ * ra_unpack_work - decompress a run into its pages.
+ * @work: run work
+ */
+static void ra_unpack_work(struct work_struct *work)
+{
+	struct ubifs_ra_run *run = container_of(work, struct ubifs_ra_run,
+						work);
+	int i, n = 0;
+
+	for (i = 0; i < run->cnt; i++) {
+		struct page *page = run->pages[i];
+
+		if (populate_page(run->c, page, &run->bu, &n)) {
+			/* Let 'do_readpage()' have a go at it */
+			ClearPageError(page);
+			do_readpage(page);
+		}
+		unlock_page(page);
+		page_cache_release(page);
+	}
+
+	kfree(run->bu.buf);
+	kfree(run);
+
+	atomic_dec(&ubifs_ra_pending);
+	wake_up(&ubifs_ra_wait);
+}
+
+/**
+ * ra_lookup - split a read-ahead window into runs.
+ * @win: read-ahead window
+ * @runs: the runs are added here
+ *
+ * This function returns the number of pages placed in runs, which is less
+ * than @win->cnt only if memory ran out.
+ */
+static int ra_lookup(struct ubifs_ra_window *win, struct list_head *runs)
+{
+	struct ubifs_info *c = win->c;
+	struct inode *inode = win->pages[0]->mapping->host;
+	struct ubifs_ra_run *run;
+	pgoff_t index, end;
+	int i = 0, err;
+
+	while (i < win->cnt) {
+		run = kmalloc(sizeof(struct ubifs_ra_run), GFP_NOFS);
+		if (!run)
+			break;
+
+		index = win->pages[i]->index;
+		run->c = c;
+		run->cnt = 0;
+		run->bu.buf = NULL;
+		run->bu.buf_len = c->max_bu_buf_len;
+		data_key_init(c, &run->bu.key, inode->i_ino,
+			      index << UBIFS_BLOCKS_PER_PAGE_SHIFT);
+		err = ubifs_tnc_get_bu_keys(c, &run->bu);
+
+		end = index + (run->bu.blk_cnt >> UBIFS_BLOCKS_PER_PAGE_SHIFT);
+		if (err || !run->bu.cnt || end == index) {
+			/* Nothing to read in one go, this page goes alone */
+			run->bu.cnt = 0;
+			end = index + 1;
+		}
+
+		while (i < win->cnt && win->pages[i]->index < end)
+			run->pages[run->cnt++] = win->pages[i++];
+		list_add_tail(&run->list, runs);
+	}
+
+	return i;
+}
+
+/**
+ * ra_read_run - read the data nodes of a run and queue it for unpacking.
+ * @c: UBIFS file-system description object
+ * @run: the run to read
+ *
+ * This function returns %0 if the run was queued and a negative error code
+ * if its pages have to be read one by one.
+ */
+static int ra_read_run(struct ubifs_info *c, struct ubifs_ra_run *run)
+{
+	struct bu_info *bu = &run->bu;
+	int err;
+
+	if (!bu->cnt)
+		return -ENOENT;
+
+	wait_event(ubifs_ra_wait,
+		   atomic_read(&ubifs_ra_pending) < UBIFS_RA_MAX_PENDING);
+
+	bu->buf_len = bu->zbranch[bu->cnt - 1].offs +
+		      bu->zbranch[bu->cnt - 1].len - bu->zbranch[0].offs;
+	ubifs_assert(bu->buf_len > 0);
+	ubifs_assert(bu->buf_len <= c->leb_size);
+	bu->buf = kmalloc(bu->buf_len, GFP_NOFS | __GFP_NOWARN);
+	if (!bu->buf)
+		return -ENOMEM;
+
+	err = ubifs_tnc_bulk_read(c, bu);
+	if (err) {
+		/* A race with GC is not worth a warning */
+		if (err != -EAGAIN)
+			ubifs_warn("ignoring error %d and skipping read-ahead",
+				   err);
+		kfree(bu->buf);
+		return err;
+	}
+
+	atomic_inc(&ubifs_ra_pending);
+	INIT_WORK(&run->work, ra_unpack_work);
+	queue_work(ubifs_unpack_wq, &run->work);
+	return 0;
+}
+
+/**
+ * ra_read_work - read a read-ahead window.
+ * @work: window work
+ */
+static void ra_read_work(struct work_struct *work)
+{
+	struct ubifs_ra_window *win = container_of(work, struct ubifs_ra_window,
+						   work);
+	struct ubifs_ra_run *run, *tmp;
+	LIST_HEAD(runs);
+	int i, done;
+
+	done = ra_lookup(win, &runs);
+
+	list_for_each_entry_safe(run, tmp, &runs, list) {
+		list_del(&run->list);
+		if (!ra_read_run(win->c, run))
+			continue;
+
+		for (i = 0; i < run->cnt; i++)
+			ra_readpage(run->pages[i]);
+		kfree(run);
+	}
+
+	for (i = done; i < win->cnt; i++)
+		ra_readpage(win->pages[i]);
+
+	kfree(win);
+}
+
+static int ubifs_readpages(struct file *file, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages)
+{
+	struct ubifs_ra_window *win;
+	struct page *page;
+
+	/*
+	 * If we cannot take the pages, the VFS frees them and later reads them
+	 * with 'ubifs_readpage()'.
+	 */
+	win = kmalloc(sizeof(struct ubifs_ra_window) +
+		      nr_pages * sizeof(struct page *), GFP_NOFS | __GFP_NOWARN);
+	if (!win)
+		return 0;
+
+	win->c = mapping->host->i_sb->s_fs_info;
+	win->cnt = 0;
+
+	/* The pages come in descending index order */
+	while (!list_empty(pages)) {
+		page = list_entry(pages->prev, struct page, lru);
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_NOFS)) {
+			page_cache_release(page);
+			continue;
+		}
+		win->pages[win->cnt++] = page;
+	}
+
+	if (!win->cnt) {
+		kfree(win);
+		return 0;
+	}
+
+	INIT_WORK(&win->work, ra_read_work);
+	queue_work(ubifs_ra_wq, &win->work);
+	return 0;
+}
+
+/**
+ * ubifs_ra_init - create the read-ahead threads.
+ *
+ * The threads are not bound to a CPU, so on SMP the unpacking normally runs
+ * on a different CPU than the flash reads.
+ */
+int __init ubifs_ra_init(void)
+{
+	ubifs_ra_wq = create_singlethread_workqueue("ubifs_ra");
+	if (!ubifs_ra_wq)
+		return -ENOMEM;
+
+	ubifs_unpack_wq = create_singlethread_workqueue("ubifs_unpack");
+	if (!ubifs_unpack_wq) {
+		destroy_workqueue(ubifs_ra_wq);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void ubifs_ra_exit(void)
+{
+	destroy_workqueue(ubifs_unpack_wq);
+	destroy_workqueue(ubifs_ra_wq);
+}
+
+/**
+ * ubifs_ra_flush - wait for all queued read-ahead to finish.
+ */
+void ubifs_ra_flush(void)
+{
+	flush_workqueue(ubifs_ra_wq);
+	flush_workqueue(ubifs_unpack_wq);
+}
+
+#endif /* CONFIG_UBIFS_FS_READAHEAD */
+
 static int do_writepage(struct page *page, int len)
 {
 	int err = 0, i, blen;
@@ -1400,6 +1693,12 @@ static ssize_t ubifs_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (err)
 		return err;
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	if (c->coal_ms &&
+	    ((iocb->ki_filp->f_flags & O_DSYNC) || IS_SYNC(inode)))
+		return ubifs_coalesce_write(iocb, iov, nr_segs, pos);
+#endif
+
 	return generic_file_aio_write(iocb, iov, nr_segs, pos);
 }
 
@@ -1546,6 +1845,9 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 
 const struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
+#ifdef CONFIG_UBIFS_FS_READAHEAD
+	.readpages      = ubifs_readpages,
+#endif
 	.writepage      = ubifs_writepage,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
@@ -337,6 +337,25 @@ static void cancel_wbuf_timer_nolock(struct ubifs_wbuf *wbuf)
 	hrtimer_cancel(&wbuf->timer);
 }
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+/**
+ * wbuf_account - account a write-buffer write in the journal statistics.
+ * @c: UBIFS file-system description object
+ * @len: how many bytes were written, a multiple of the min. I/O unit size
+ * @pad: how many of them were padding
+ */
+static void wbuf_account(struct ubifs_info *c, int len, int pad)
+{
+	atomic_long_add(len >> c->min_io_shift, &c->jnl_stats.programs);
+	if (pad) {
+		atomic_long_inc(&c->jnl_stats.syncs);
+		atomic64_add(pad, &c->jnl_stats.pad_bytes);
+	}
+}
+#else
+static inline void wbuf_account(struct ubifs_info *c, int len, int pad) {}
+#endif
+
 /**
  * ubifs_wbuf_sync_nolock - synchronize write-buffer.
  * @wbuf: write-buffer to synchronize
@@ -374,6 +393,7 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 	}
 
 	dirt = wbuf->avail;
+	wbuf_account(c, c->min_io_size, dirt);
 
 	spin_lock(&wbuf->lock);
 	wbuf->offs += c->min_io_size;
@@ -545,6 +565,7 @@ int ubifs_wbuf_write_nolock(struct ubifs_wbuf *wbuf, void *buf, int len)
 					    wbuf->dtype);
 			if (err)
 				goto out;
+			wbuf_account(c, c->min_io_size, 0);
 
 			spin_lock(&wbuf->lock);
 			wbuf->offs += c->min_io_size;
@@ -574,6 +595,7 @@ int ubifs_wbuf_write_nolock(struct ubifs_wbuf *wbuf, void *buf, int len)
 			    c->min_io_size, wbuf->dtype);
 	if (err)
 		goto out;
+	wbuf_account(c, c->min_io_size, 0);
 
 	offs = wbuf->offs + c->min_io_size;
 	len -= wbuf->avail;
@@ -594,6 +616,7 @@ int ubifs_wbuf_write_nolock(struct ubifs_wbuf *wbuf, void *buf, int len)
 				    wbuf->dtype);
 		if (err)
 			goto out;
+		wbuf_account(c, n, 0);
 		offs += n;
 		aligned_len -= n;
 		len -= n;
@@ -857,11 +880,37 @@ int ubifs_wbuf_init(struct ubifs_info *c, struct ubifs_wbuf *wbuf)
 
 	hrtimer_init(&wbuf->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	wbuf->timer.function = wbuf_timer_callback_nolock;
+	ubifs_wbuf_set_timeout(wbuf);
+	return 0;
+}
+
+/**
+ * ubifs_wbuf_set_timeout - set write-buffer timeout.
+ * @wbuf: write-buffer
+ *
+ * The timeout is %WBUF_TIMEOUT_SOFTLIMIT - %WBUF_TIMEOUT_HARDLIMIT seconds,
+ * unless the "wbuf_timeout" mount option is given. Then the soft limit is
+ * that many milliseconds, and the hard limit keeps the same proportion. The
+ * new timeout applies when the timer is started next time.
+ */
+void ubifs_wbuf_set_timeout(struct ubifs_wbuf *wbuf)
+{
 	wbuf->softlimit = ktime_set(WBUF_TIMEOUT_SOFTLIMIT, 0);
 	wbuf->delta = WBUF_TIMEOUT_HARDLIMIT - WBUF_TIMEOUT_SOFTLIMIT;
 	wbuf->delta *= 1000000000ULL;
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	if (wbuf->c->wbuf_timeout) {
+		unsigned long long ns;
+
+		ns = (unsigned long long)wbuf->c->wbuf_timeout * NSEC_PER_MSEC;
+		wbuf->softlimit = ns_to_ktime(ns);
+		ns = div_u64(ns * (WBUF_TIMEOUT_HARDLIMIT -
+				   WBUF_TIMEOUT_SOFTLIMIT),
+			     WBUF_TIMEOUT_SOFTLIMIT);
+		wbuf->delta = min_t(unsigned long long, wbuf->delta, ns);
+	}
+#endif
 	ubifs_assert(wbuf->delta <= ULONG_MAX);
-	return 0;
 }
 
 /**
@@ -124,7 +124,8 @@ static int setflags(struct inode *inode, int flags)
 		}
 	}
 
-	ui->flags = ioctl2ubifs(flags);
+	/* The compression policy is not an ioctl flag, keep it */
+	ui->flags = ioctl2ubifs(flags) | (ui->flags & UBIFS_COMPR_TYPE_FL);
 	ubifs_set_inode_flags(inode);
 	inode->i_ctime = ubifs_current_time(inode);
 	release = ui->dirty;
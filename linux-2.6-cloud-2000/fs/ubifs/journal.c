@@ -713,7 +713,12 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 		compr_type = ui->compr_type;
 
 	out_len = dlen - UBIFS_DATA_NODE_SZ;
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	ubifs_compress_policy(c, ui, buf, len, &data->data, &out_len,
+			      &compr_type);
+#else
 	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
+#endif
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
 
 	dlen = UBIFS_DATA_NODE_SZ + out_len;
@@ -269,6 +269,9 @@ static struct inode *ubifs_alloc_inode(struct super_block *sb)
 	       sizeof(struct ubifs_inode) - sizeof(struct inode));
 	mutex_init(&ui->ui_mutex);
 	spin_lock_init(&ui->ui_lock);
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	INIT_LIST_HEAD(&ui->coal_list);
+#endif
 	return &ui->vfs_inode;
 };
 
@@ -432,6 +435,24 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 			   ubifs_compr_name(c->mount_opts.compr_type));
 	}
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (c->compr_adaptive)
+		seq_printf(s, ",compr_adaptive=%d", c->compr_adaptive);
+#endif
+
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	if (c->coal_ms) {
+		seq_printf(s, ",coalesce=%d", c->coal_ms);
+		seq_printf(s, ",coalesce_bytes=%d", c->coal_bytes);
+	}
+	if (c->wbuf_timeout)
+		seq_printf(s, ",wbuf_timeout=%d", c->wbuf_timeout);
+	if (c->jnl_size)
+		seq_printf(s, ",jnl_size=%lld", c->jnl_size);
+	if (c->commit_interval)
+		seq_printf(s, ",commit_interval=%d", c->commit_interval);
+#endif
+
 	return 0;
 }
 
@@ -445,6 +466,7 @@ static int ubifs_sync_fs(struct super_block *sb, int wait)
 	 * lots of data into the queues, and there will be the second
 	 * '->sync_fs()' call, with non-zero @wait.
 	 */
+	ubifs_coalesce_flush_all(c);
 	if (!wait)
 		return 0;
 
@@ -689,6 +711,9 @@ static int init_constants_sb(struct ubifs_info *c)
 		c->bg_bud_bytes = tmp64;
 	if (c->max_bud_bytes < tmp64 + c->leb_size)
 		c->max_bud_bytes = tmp64 + c->leb_size;
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	c->sb_bud_bytes = c->max_bud_bytes;
+#endif
 
 	err = ubifs_calc_lpt_geom(c);
 	if (err)
@@ -904,6 +929,12 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
+ * Opt_compr_adaptive: give up compressing incompressible files
+ * Opt_coalesce: hold back synchronous writes for this many milliseconds
+ * Opt_coalesce_bytes: but not more than this many bytes per inode
+ * Opt_wbuf_timeout: write-buffer timeout in milliseconds
+ * Opt_jnl_size: journal size limit
+ * Opt_commit_interval: commit the journal at least this often (seconds)
  * Opt_err: just end of array marker
  */
 enum {
@@ -914,6 +945,12 @@ enum {
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
+	Opt_compr_adaptive,
+	Opt_coalesce,
+	Opt_coalesce_bytes,
+	Opt_wbuf_timeout,
+	Opt_jnl_size,
+	Opt_commit_interval,
 	Opt_err,
 };
 
@@ -925,6 +962,16 @@ static const match_table_t tokens = {
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	{Opt_compr_adaptive, "compr_adaptive=%d"},
+#endif
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	{Opt_coalesce, "coalesce=%d"},
+	{Opt_coalesce_bytes, "coalesce_bytes=%s"},
+	{Opt_wbuf_timeout, "wbuf_timeout=%d"},
+	{Opt_jnl_size, "jnl_size=%s"},
+	{Opt_commit_interval, "commit_interval=%d"},
+#endif
 	{Opt_err, NULL},
 };
 
@@ -1024,6 +1071,61 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->default_compr = c->mount_opts.compr_type;
 			break;
 		}
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+		case Opt_compr_adaptive:
+		{
+			int n;
+
+			if (match_int(&args[0], &n) || n < 0) {
+				ubifs_err("bad compr_adaptive value \"%s\"",
+					  p);
+				return -EINVAL;
+			}
+			c->compr_adaptive = n;
+			break;
+		}
+#endif
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+		case Opt_coalesce:
+		case Opt_wbuf_timeout:
+		case Opt_commit_interval:
+		{
+			int n;
+
+			if (match_int(&args[0], &n) || n < 0) {
+				ubifs_err("bad mount option value \"%s\"", p);
+				return -EINVAL;
+			}
+			if (token == Opt_coalesce)
+				c->coal_ms = n;
+			else if (token == Opt_wbuf_timeout)
+				c->wbuf_timeout = n;
+			else
+				c->commit_interval = n;
+			break;
+		}
+		case Opt_coalesce_bytes:
+		case Opt_jnl_size:
+		{
+			char *str = match_strdup(&args[0]);
+			unsigned long long n;
+
+			if (!str)
+				return -ENOMEM;
+			n = memparse(str, NULL);
+			kfree(str);
+			if (token == Opt_coalesce_bytes) {
+				if (n < UBIFS_BLOCK_SIZE || n > INT_MAX) {
+					ubifs_err("bad coalesce_bytes value "
+						  "\"%s\"", p);
+					return -EINVAL;
+				}
+				c->coal_bytes = n;
+			} else
+				c->jnl_size = n;
+			break;
+		}
+#endif
 		default:
 		{
 			unsigned long flag;
@@ -1277,6 +1379,7 @@ static int mount_ubifs(struct ubifs_info *c)
 	err = ubifs_replay_journal(c);
 	if (err)
 		goto out_journal;
+	ubifs_set_jnl_size(c);
 
 	/* Calculate 'min_idx_lebs' after journal replay */
 	c->min_idx_lebs = ubifs_calc_min_idx_lebs(c);
@@ -1368,6 +1471,10 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (err)
 		goto out_infos;
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	c->cmt_jiffies = jiffies;
+	c->cmt_periodic = !mounted_read_only;
+#endif
 	c->always_chk_crc = 0;
 
 	ubifs_msg("mounted UBI device %d, volume %d, name \"%s\"",
@@ -1490,6 +1597,9 @@ static void ubifs_umount(struct ubifs_info *c)
 	if (c->bgt)
 		kthread_stop(c->bgt);
 
+	/* Read-ahead of evicted inodes may still be finishing up */
+	ubifs_ra_flush();
+
 	destroy_journal(c);
 	free_wbufs(c);
 	free_orphans(c);
@@ -1637,6 +1747,10 @@ static int ubifs_remount_rw(struct ubifs_info *c)
 	c->vfs_sb->s_flags &= ~MS_RDONLY;
 	c->remounting_rw = 0;
 	c->always_chk_crc = 0;
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	c->cmt_jiffies = jiffies;
+	c->cmt_periodic = 1;
+#endif
 	err = dbg_check_space_info(c);
 	mutex_unlock(&c->umount_mutex);
 	return err;
@@ -1677,6 +1791,10 @@ static void ubifs_remount_ro(struct ubifs_info *c)
 		kthread_stop(c->bgt);
 		c->bgt = NULL;
 	}
+	ubifs_coalesce_flush_all(c);
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	c->cmt_periodic = 0;
+#endif
 
 	dbg_save_space_info(c);
 
@@ -1807,6 +1925,24 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		ubifs_remount_ro(c);
 	}
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	mutex_lock(&c->log_mutex);
+	ubifs_set_jnl_size(c);
+	mutex_unlock(&c->log_mutex);
+	if (c->jheads) {
+		int i;
+
+		for (i = 0; i < c->jhead_cnt; i++) {
+			struct ubifs_wbuf *wbuf = &c->jheads[i].wbuf;
+
+			mutex_lock_nested(&wbuf->io_mutex, wbuf->jhead);
+			ubifs_wbuf_set_timeout(wbuf);
+			mutex_unlock(&wbuf->io_mutex);
+		}
+	}
+	ubifs_wake_up_bgt(c);
+#endif
+
 	if (c->bulk_read == 1)
 		bu_init(c);
 	else {
@@ -1934,6 +2070,11 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	INIT_LIST_HEAD(&c->old_buds);
 	INIT_LIST_HEAD(&c->orph_list);
 	INIT_LIST_HEAD(&c->orph_new);
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	INIT_LIST_HEAD(&c->coal_list);
+	spin_lock_init(&c->coal_lock);
+	c->coal_bytes = UBIFS_COALESCE_BYTES;
+#endif
 
 	c->vfs_sb = sb;
 	c->highest_inum = UBIFS_FIRST_INO;
@@ -1955,11 +2096,15 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	 * which means the user would have to wait not just for their own I/O
 	 * but the read-ahead I/O as well i.e. completely pointless.
 	 *
-	 * Read-ahead will be disabled because @c->bdi.ra_pages is 0.
+	 * Read-ahead will be disabled because @c->bdi.ra_pages is 0, unless
+	 * the asynchronous read-ahead is configured in, which does defer it.
 	 */
 	c->bdi.name = "ubifs",
 	c->bdi.capabilities = BDI_CAP_MAP_COPY;
 	c->bdi.unplug_io_fn = default_unplug_io_fn;
+#ifdef CONFIG_UBIFS_FS_READAHEAD
+	c->bdi.ra_pages = VM_MAX_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+#endif
 	err  = bdi_init(&c->bdi);
 	if (err)
 		goto out_close;
@@ -2189,12 +2334,24 @@ static int __init ubifs_init(void)
 	if (err)
 		goto out_shrinker;
 
-	err = dbg_debugfs_init();
+	err = ubifs_ra_init();
 	if (err)
 		goto out_compr;
 
+	err = ubifs_tune_init();
+	if (err)
+		goto out_ra;
+
+	err = dbg_debugfs_init();
+	if (err)
+		goto out_tune;
+
 	return 0;
 
+out_tune:
+	ubifs_tune_exit();
+out_ra:
+	ubifs_ra_exit();
 out_compr:
 	ubifs_compressors_exit();
 out_shrinker:
@@ -2213,6 +2370,8 @@ static void __exit ubifs_exit(void)
 	ubifs_assert(atomic_long_read(&ubifs_clean_zn_cnt) == 0);
 
 	dbg_debugfs_exit();
+	ubifs_tune_exit();
+	ubifs_ra_exit();
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
 	kmem_cache_destroy(ubifs_inode_slab);
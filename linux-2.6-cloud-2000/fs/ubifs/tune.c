@@ -0,0 +1,326 @@
+/*
+ * This file is part of UBIFS.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file implements the journal tuning knobs of UBIFS.
+ *
+ * Write coalescing. A synchronous write (file opened with %O_SYNC or
+ * %O_DSYNC, or the file-system mounted with "sync") normally goes to the
+ * journal and the write-buffer is flushed right away. On NAND every flush
+ * programs a whole page, mostly padding when the write is a log line. With
+ * the "coalesce=<ms>" mount option the data of such writes stays in the page
+ * cache instead, and the inode is put on @c->coal_list. The background
+ * thread writes the inode back and flushes its write-buffers at the latest
+ * <ms> milliseconds after the first held back write, or earlier, when the
+ * writer has written "coalesce_bytes" bytes. So a crash loses at most <ms>
+ * milliseconds of synchronous writes, which is the price of the mode. An
+ * explicit 'fsync()' or 'sync()' still writes everything.
+ *
+ * Periodic commit. With "commit_interval=<sec>" the background thread
+ * commits the journal if it was not committed for <sec> seconds and
+ * something was written since. This bounds the replay time at mount.
+ *
+ * The "wbuf_timeout=<ms>" and "jnl_size=<bytes>" options are handled in io.c
+ * and super.c. Statistics of all mounted volumes are in /proc/fs/ubifs_jnl.
+ */
+
+#include "ubifs.h"
+#include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+/**
+ * coalesce_add - account a held back synchronous write.
+ * @c: UBIFS file-system description object
+ * @inode: inode written to
+ * @len: number of bytes written
+ *
+ * This function puts @inode on the coalescing list unless it is there
+ * already. It returns %1 if the inode went over its byte budget and has to
+ * be synchronized by the caller, and %0 otherwise.
+ */
+static int coalesce_add(struct ubifs_info *c, struct inode *inode, int len)
+{
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct inode *ref = igrab(inode);
+	int wake = 0, full = 0;
+
+	spin_lock(&c->coal_lock);
+	if (list_empty(&ui->coal_list) && ref) {
+		/* The list keeps the reference */
+		ui->coal_bytes = 0;
+		ui->coal_deadline = jiffies + msecs_to_jiffies(c->coal_ms);
+		list_add_tail(&ui->coal_list, &c->coal_list);
+		ref = NULL;
+		wake = 1;
+	}
+	ui->coal_bytes += len;
+	if (ui->coal_bytes >= c->coal_bytes && !list_empty(&ui->coal_list)) {
+		list_del_init(&ui->coal_list);
+		full = 1;
+	}
+	spin_unlock(&c->coal_lock);
+
+	atomic_long_inc(&c->jnl_stats.coalesced);
+	if (ref)
+		iput(ref);
+	if (wake)
+		/* Let the background thread know about the new deadline */
+		ubifs_wake_up_bgt(c);
+	return full;
+}
+
+/**
+ * ubifs_coalesce_write - do a synchronous write with coalescing.
+ * @iocb: IO control block
+ * @iov: data to write
+ * @nr_segs: number of elements in @iov
+ * @pos: position in file where to write
+ *
+ * This is 'generic_file_aio_write()' except that the data is not synchronized
+ * to the media right away (see the top of this file).
+ */
+ssize_t ubifs_coalesce_write(struct kiocb *iocb, const struct iovec *iov,
+			     unsigned long nr_segs, loff_t pos)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file->f_mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	ssize_t ret;
+	int err;
+
+	BUG_ON(iocb->ki_pos != pos);
+
+	mutex_lock(&inode->i_mutex);
+	ret = __generic_file_aio_write(iocb, iov, nr_segs, &iocb->ki_pos);
+	mutex_unlock(&inode->i_mutex);
+	if (ret <= 0)
+		return ret;
+
+	if (coalesce_add(c, inode, ret)) {
+		err = vfs_fsync(file, 0);
+		atomic_long_inc(&c->jnl_stats.flushes);
+		/* Drop the reference of the coalescing list */
+		iput(inode);
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+}
+
+/**
+ * coalesce_sync_inode - write back an inode and its held back data.
+ * @c: UBIFS file-system description object
+ * @inode: inode to synchronize
+ *
+ * This is what 'vfs_fsync()' does for a file. Errors are recorded in the
+ * mapping, so that the next 'fsync()' of the file reports them.
+ */
+static void coalesce_sync_inode(struct ubifs_info *c, struct inode *inode)
+{
+	int err;
+
+	err = filemap_write_and_wait(inode->i_mapping);
+	if (!err) {
+		mutex_lock(&inode->i_mutex);
+		err = inode->i_sb->s_op->write_inode(inode, NULL);
+		if (!err)
+			err = ubifs_sync_wbufs_by_inode(c, inode);
+		mutex_unlock(&inode->i_mutex);
+	}
+
+	if (err) {
+		ubifs_err("cannot synchronize inode %lu, error %d",
+			  inode->i_ino, err);
+		mapping_set_error(inode->i_mapping, err);
+	}
+	atomic_long_inc(&c->jnl_stats.flushes);
+}
+
+/**
+ * coalesce_flush - synchronize inodes on the coalescing list.
+ * @c: UBIFS file-system description object
+ * @all: synchronize all inodes, not only those which reached their deadline
+ *
+ * This function returns the number of jiffies until the next deadline, or
+ * %MAX_SCHEDULE_TIMEOUT if the list is empty.
+ */
+static long coalesce_flush(struct ubifs_info *c, int all)
+{
+	struct ubifs_inode *ui;
+	long timeout;
+
+	while (1) {
+		spin_lock(&c->coal_lock);
+		if (list_empty(&c->coal_list)) {
+			spin_unlock(&c->coal_lock);
+			return MAX_SCHEDULE_TIMEOUT;
+		}
+
+		/* The list is sorted by deadline */
+		ui = list_entry(c->coal_list.next, struct ubifs_inode,
+				coal_list);
+		if (!all && time_before(jiffies, ui->coal_deadline)) {
+			timeout = ui->coal_deadline - jiffies;
+			spin_unlock(&c->coal_lock);
+			return timeout;
+		}
+		list_del_init(&ui->coal_list);
+		spin_unlock(&c->coal_lock);
+
+		coalesce_sync_inode(c, &ui->vfs_inode);
+		iput(&ui->vfs_inode);
+		cond_resched();
+	}
+}
+
+/**
+ * ubifs_coalesce_flush_all - synchronize all held back writes.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_coalesce_flush_all(struct ubifs_info *c)
+{
+	coalesce_flush(c, 1);
+}
+
+/**
+ * periodic_commit - start a commit if the commit interval has passed.
+ * @c: UBIFS file-system description object
+ *
+ * This function returns the number of jiffies until the next check.
+ */
+static long periodic_commit(struct ubifs_info *c)
+{
+	unsigned long interval = c->commit_interval * HZ;
+	unsigned long next = c->cmt_jiffies + interval;
+	int dirty;
+
+	if (time_before(jiffies, next))
+		return next - jiffies;
+	if (c->ro_media)
+		return MAX_SCHEDULE_TIMEOUT;
+
+	spin_lock(&c->cnt_lock);
+	dirty = c->max_sqnum != c->cmt_sqnum;
+	spin_unlock(&c->cnt_lock);
+
+	c->cmt_jiffies = jiffies;
+	if (dirty) {
+		dbg_cmt("periodic commit");
+		atomic_long_inc(&c->jnl_stats.commits);
+		ubifs_request_bg_commit(c);
+	}
+
+	return interval;
+}
+
+/**
+ * ubifs_tune_bgt - do the due journal tuning work of the background thread.
+ * @c: UBIFS file-system description object
+ *
+ * This function synchronizes held back writes which reached their deadline
+ * and requests a periodic commit when it is time. It returns how long the
+ * background thread may sleep.
+ */
+long ubifs_tune_bgt(struct ubifs_info *c)
+{
+	long timeout;
+
+	/* After a remount with "coalesce=0" the list still has to drain */
+	timeout = coalesce_flush(c, !c->coal_ms);
+
+	if (c->commit_interval && c->cmt_periodic)
+		timeout = min(timeout, periodic_commit(c));
+
+	return timeout;
+}
+
+/**
+ * ubifs_set_jnl_size - apply the "jnl_size" mount option.
+ * @c: UBIFS file-system description object
+ *
+ * The journal can only be made smaller than what mkfs.ubifs created, because
+ * the log has to be able to refer to all buds. This function mirrors the
+ * limits of 'init_constants_sb()'.
+ */
+void ubifs_set_jnl_size(struct ubifs_info *c)
+{
+	long long min = (long long)(c->jhead_cnt + 1) * c->leb_size + 1;
+	long long size = c->sb_bud_bytes;
+
+	if (c->jnl_size && c->jnl_size < size)
+		size = c->jnl_size;
+	if (size < min + c->leb_size)
+		size = min + c->leb_size;
+
+	c->max_bud_bytes = size;
+	c->bg_bud_bytes = (size * 13) >> 4;
+	if (c->bg_bud_bytes < min)
+		c->bg_bud_bytes = min;
+}
+
+static int jnl_stats_show(struct seq_file *s, void *v)
+{
+	struct ubifs_info *c;
+	struct ubifs_jnl_stats *st;
+
+	seq_printf(s, "%-10s %10s %10s %14s %10s %10s %10s\n",
+		   "volume", "programs", "syncs", "pad_bytes",
+		   "coalesced", "flushes", "commits");
+
+	spin_lock(&ubifs_infos_lock);
+	list_for_each_entry(c, &ubifs_infos, infos_list) {
+		st = &c->jnl_stats;
+		seq_printf(s, "ubi%d_%-5d %10lu %10lu %14lld %10lu %10lu %10lu\n",
+			   c->vi.ubi_num, c->vi.vol_id,
+			   atomic_long_read(&st->programs),
+			   atomic_long_read(&st->syncs),
+			   (long long)atomic64_read(&st->pad_bytes),
+			   atomic_long_read(&st->coalesced),
+			   atomic_long_read(&st->flushes),
+			   atomic_long_read(&st->commits));
+	}
+	spin_unlock(&ubifs_infos_lock);
+
+	return 0;
+}
+
+static int jnl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jnl_stats_show, NULL);
+}
+
+static const struct file_operations jnl_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jnl_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int __init ubifs_tune_init(void)
+{
+	if (!proc_create("fs/ubifs_jnl", S_IRUGO, NULL, &jnl_stats_fops))
+		ubifs_warn("cannot create /proc/fs/ubifs_jnl");
+	return 0;
+}
+
+void ubifs_tune_exit(void)
+{
+	remove_proc_entry("fs/ubifs_jnl", NULL);
+}
@@ -153,6 +153,12 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/* Maximum number of read-ahead runs waiting to be decompressed */
+#define UBIFS_RA_MAX_PENDING 4
+
+/* Default byte budget of an inode with held back synchronous writes */
+#define UBIFS_COALESCE_BYTES (16*1024)
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -352,6 +358,11 @@ struct ubifs_gced_idx_leb {
  * @compr_type: default compression type used for this inode
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
+ * @compr_misses: number of data nodes in a row which did not compress (for
+ *                adaptive compression)
+ * @coal_list: link in the list of inodes with held back synchronous writes
+ * @coal_bytes: bytes written to this inode since it was put on the list
+ * @coal_deadline: when the held back writes have to be synchronized (jiffies)
  * @data_len: length of the data attached to the inode
  * @data: inode's data
  *
@@ -402,6 +413,14 @@ struct ubifs_inode {
 	int flags;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	int compr_misses;
+#endif
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	struct list_head coal_list;
+	int coal_bytes;
+	unsigned long coal_deadline;
+#endif
 	int data_len;
 	void *data;
 };
@@ -789,6 +808,44 @@ struct bu_info {
 	int eof;
 };
 
+/**
+ * struct ubifs_compr_stats - data node compression statistics.
+ * @compressed: number of data nodes stored compressed
+ * @incompressible: number of data nodes which did not compress
+ * @skipped: number of data nodes not even tried because the inode gave up
+ * @in_bytes: bytes fed to the compressors
+ * @saved_bytes: bytes saved by compression
+ * @cpu_ns: time spent in the compressors
+ * @wasted_ns: part of @cpu_ns spent on data which did not compress
+ */
+struct ubifs_compr_stats {
+	atomic_long_t compressed;
+	atomic_long_t incompressible;
+	atomic_long_t skipped;
+	atomic64_t in_bytes;
+	atomic64_t saved_bytes;
+	atomic64_t cpu_ns;
+	atomic64_t wasted_ns;
+};
+
+/**
+ * struct ubifs_jnl_stats - journal write statistics.
+ * @programs: number of flash writes done by write-buffers
+ * @syncs: number of write-buffer synchronizations of a partially filled buffer
+ * @pad_bytes: bytes of padding written by those synchronizations
+ * @coalesced: number of held back synchronous writes
+ * @flushes: number of inode synchronizations of held back writes
+ * @commits: number of periodic commits
+ */
+struct ubifs_jnl_stats {
+	atomic_long_t programs;
+	atomic_long_t syncs;
+	atomic64_t pad_bytes;
+	atomic_long_t coalesced;
+	atomic_long_t flushes;
+	atomic_long_t commits;
+};
+
 /**
  * struct ubifs_node_range - node length range description data structure.
  * @len: fixed node length
@@ -999,6 +1056,10 @@ struct ubifs_debug_info;
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
  *
+ * @compr_adaptive: stop compressing an inode after this many data nodes in a
+ *                  row did not compress, %0 to always try
+ * @compr_stats: data node compression statistics
+ *
  * @log_lebs: number of logical eraseblocks in the log
  * @log_bytes: log size in bytes
  * @log_last: last LEB of the log
@@ -1096,6 +1157,22 @@ struct ubifs_debug_info;
  * @need_bgt: if background thread should run
  * @need_wbuf_sync: if write-buffers have to be synchronized
  *
+ * @coal_list: inodes with held back synchronous writes, oldest first
+ * @coal_lock: protects @coal_list and the coalescing fields of the inodes
+ * @coal_ms: how long synchronous writes may be held back (milliseconds), %0
+ *           if they are not coalesced
+ * @coal_bytes: how many bytes an inode may have held back
+ * @wbuf_timeout: write-buffer timeout (milliseconds), %0 for the default
+ * @commit_interval: commit at least this often (seconds), %0 to commit only
+ *                   when the journal is full
+ * @jnl_size: journal size limit given at mount (bytes), %0 for no limit
+ * @sb_bud_bytes: journal size from the superblock
+ * @cmt_jiffies: time of the last commit
+ * @cmt_sqnum: @max_sqnum at the last commit
+ * @cmt_periodic: periodic commits may be started (the file-system is mounted
+ *                read-write and the journal was replayed)
+ * @jnl_stats: journal write statistics
+ *
  * @gc_lnum: LEB number used for garbage collection
  * @sbuf: a buffer of LEB size used by GC and replay for scanning
  * @idx_gc: list of index LEBs that have been garbage collected
@@ -1241,6 +1318,11 @@ struct ubifs_info {
 	struct mutex bu_mutex;
 	struct bu_info bu;
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	int compr_adaptive;
+	struct ubifs_compr_stats compr_stats;
+#endif
+
 	int log_lebs;
 	long long log_bytes;
 	int log_last;
@@ -1327,6 +1409,21 @@ struct ubifs_info {
 	int need_bgt;
 	int need_wbuf_sync;
 
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+	struct list_head coal_list;
+	spinlock_t coal_lock;
+	int coal_ms;
+	int coal_bytes;
+	int wbuf_timeout;
+	int commit_interval;
+	long long jnl_size;
+	long long sb_bud_bytes;
+	unsigned long cmt_jiffies;
+	unsigned long long cmt_sqnum;
+	int cmt_periodic;
+	struct ubifs_jnl_stats jnl_stats;
+#endif
+
 	int gc_lnum;
 	void *sbuf;
 	struct list_head idx_gc;
@@ -1431,6 +1528,7 @@ int ubifs_wbuf_write_nolock(struct ubifs_wbuf *wbuf, void *buf, int len);
 int ubifs_wbuf_seek_nolock(struct ubifs_wbuf *wbuf, int lnum, int offs,
 			   int dtype);
 int ubifs_wbuf_init(struct ubifs_info *c, struct ubifs_wbuf *wbuf);
+void ubifs_wbuf_set_timeout(struct ubifs_wbuf *wbuf);
 int ubifs_read_node(const struct ubifs_info *c, void *buf, int type, int len,
 		    int lnum, int offs);
 int ubifs_read_node_wbuf(struct ubifs_wbuf *wbuf, void *buf, int type, int len,
@@ -1680,6 +1778,15 @@ int ubifs_calc_dark(const struct ubifs_info *c, int spc);
 /* file.c */
 int ubifs_fsync(struct file *file, int datasync);
 int ubifs_setattr(struct dentry *dentry, struct iattr *attr);
+#ifdef CONFIG_UBIFS_FS_READAHEAD
+int __init ubifs_ra_init(void);
+void ubifs_ra_exit(void);
+void ubifs_ra_flush(void);
+#else
+static inline int ubifs_ra_init(void) { return 0; }
+static inline void ubifs_ra_exit(void) {}
+static inline void ubifs_ra_flush(void) {}
+#endif
 
 /* dir.c */
 struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
@@ -1727,6 +1834,31 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+void ubifs_compress_policy(struct ubifs_info *c, struct ubifs_inode *ui,
+			   const void *in_buf, int in_len, void *out_buf,
+			   int *out_len, int *compr_type);
+#endif
+
+/* tune.c */
+#ifdef CONFIG_UBIFS_FS_JNL_TUNING
+ssize_t ubifs_coalesce_write(struct kiocb *iocb, const struct iovec *iov,
+			     unsigned long nr_segs, loff_t pos);
+long ubifs_tune_bgt(struct ubifs_info *c);
+void ubifs_coalesce_flush_all(struct ubifs_info *c);
+void ubifs_set_jnl_size(struct ubifs_info *c);
+int __init ubifs_tune_init(void);
+void ubifs_tune_exit(void);
+#else
+static inline long ubifs_tune_bgt(struct ubifs_info *c)
+{
+	return MAX_SCHEDULE_TIMEOUT;
+}
+static inline void ubifs_coalesce_flush_all(struct ubifs_info *c) {}
+static inline void ubifs_set_jnl_size(struct ubifs_info *c) {}
+static inline int ubifs_tune_init(void) { return 0; }
+static inline void ubifs_tune_exit(void) {}
+#endif
 
 #include "debug.h"
 #include "misc.h"
@@ -53,6 +53,12 @@
  * tnc.c).
  *
  * ACL support is not implemented.
+ *
+ * The "user.ubifs.compr" extended attribute is not stored as an extended
+ * attribute at all. It reads and sets the compression type of the inode
+ * ("none", "lzo" or "zlib"), which directories pass on to new inodes.
+ * Setting it also switches compression on for the inode. It is not listed by
+ * 'ubifs_listxattr()'.
  */
 
 #include "ubifs.h"
@@ -278,6 +284,114 @@ static int check_namespace(const struct qstr *nm)
 	return type;
 }
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+
+/* The per-inode compression policy */
+#define COMPR_XATTR XATTR_USER_PREFIX "ubifs.compr"
+
+/**
+ * change_compr_policy - set or clear the compression policy of an inode.
+ * @host: the inode
+ * @compr_type: the compression type to set, or %-1 to go back to the default
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int change_compr_policy(struct inode *host, int compr_type)
+{
+	struct ubifs_info *c = host->i_sb->s_fs_info;
+	struct ubifs_inode *ui = ubifs_inode(host);
+	struct ubifs_budget_req req = { .dirtied_ino = 1,
+				.dirtied_ino_d = ALIGN(ui->data_len, 8) };
+	int err, release;
+
+	err = ubifs_budget_space(c, &req);
+	if (err)
+		return err;
+
+	mutex_lock(&ui->ui_mutex);
+	if (compr_type < 0) {
+		ui->flags &= ~UBIFS_COMPR_TYPE_FL;
+		if (S_ISREG(host->i_mode))
+			ui->compr_type = c->default_compr;
+		else
+			ui->compr_type = UBIFS_COMPR_NONE;
+	} else {
+		/* journal.c only looks at the type with compression enabled */
+		ui->flags |= UBIFS_COMPR_TYPE_FL | UBIFS_COMPR_FL;
+		ui->compr_type = compr_type;
+	}
+	ui->compr_misses = 0;
+	host->i_ctime = ubifs_current_time(host);
+	release = ui->dirty;
+	mark_inode_dirty_sync(host);
+	mutex_unlock(&ui->ui_mutex);
+
+	if (release)
+		ubifs_release_budget(c, &req);
+	if (IS_SYNC(host))
+		err = write_inode_now(host, 1);
+	return err;
+}
+
+static int set_compr_policy(struct inode *host, const void *value,
+			    size_t size, int flags)
+{
+	const char *name;
+	int i;
+
+	if (!S_ISREG(host->i_mode) && !S_ISDIR(host->i_mode))
+		return -EPERM;
+
+	if (ubifs_inode(host)->flags & UBIFS_COMPR_TYPE_FL) {
+		if (flags & XATTR_CREATE)
+			return -EEXIST;
+	} else if (flags & XATTR_REPLACE)
+		return -ENODATA;
+
+	for (i = 0; i < UBIFS_COMPR_TYPES_CNT; i++) {
+		name = ubifs_compr_name(i);
+		if (strlen(name) == size && !memcmp(value, name, size))
+			break;
+	}
+	if (i == UBIFS_COMPR_TYPES_CNT)
+		return -EINVAL;
+	if (!ubifs_compr_present(i))
+		return -EOPNOTSUPP;
+
+	return change_compr_policy(host, i);
+}
+
+static ssize_t get_compr_policy(struct inode *host, void *buf, size_t size)
+{
+	struct ubifs_inode *ui = ubifs_inode(host);
+	const char *name;
+	size_t len;
+
+	if (!(ui->flags & UBIFS_COMPR_TYPE_FL))
+		return -ENODATA;
+
+	name = ubifs_compr_name(ui->compr_type);
+	len = strlen(name);
+	if (buf) {
+		/* If @buf is %NULL we are supposed to return the length */
+		if (len > size)
+			return -ERANGE;
+		memcpy(buf, name, len);
+	}
+	return len;
+}
+
+static int remove_compr_policy(struct inode *host)
+{
+	if (!(ubifs_inode(host)->flags & UBIFS_COMPR_TYPE_FL))
+		return -ENODATA;
+
+	return change_compr_policy(host, -1);
+}
+
+#endif /* CONFIG_UBIFS_FS_COMPR_POLICY */
+
 static struct inode *iget_xattr(struct ubifs_info *c, ino_t inum)
 {
 	struct inode *inode;
@@ -312,6 +426,11 @@ int ubifs_setxattr(struct dentry *dentry, const char *name,
 	if (size > UBIFS_MAX_INO_DATA)
 		return -ERANGE;
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (!strcmp(name, COMPR_XATTR))
+		return set_compr_policy(host, value, size, flags);
+#endif
+
 	type = check_namespace(&nm);
 	if (type < 0)
 		return type;
@@ -372,6 +491,11 @@ ssize_t ubifs_getxattr(struct dentry *dentry, const char *name, void *buf,
 	dbg_gen("xattr '%s', ino %lu ('%.*s'), buf size %zd", name,
 		host->i_ino, dentry->d_name.len, dentry->d_name.name, size);
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (!strcmp(name, COMPR_XATTR))
+		return get_compr_policy(host, buf, size);
+#endif
+
 	err = check_namespace(&nm);
 	if (err < 0)
 		return err;
@@ -535,6 +659,11 @@ int ubifs_removexattr(struct dentry *dentry, const char *name)
 		host->i_ino, dentry->d_name.len, dentry->d_name.name);
 	ubifs_assert(mutex_is_locked(&host->i_mutex));
 
+#ifdef CONFIG_UBIFS_FS_COMPR_POLICY
+	if (!strcmp(name, COMPR_XATTR))
+		return remove_compr_policy(host);
+#endif
+
 	err = check_namespace(&nm);
 	if (err < 0)
 		return err;
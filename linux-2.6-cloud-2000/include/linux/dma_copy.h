@@ -0,0 +1,45 @@
+/*
+ * Copy offload of large kernel memory copies to a DMA engine
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ */
+#ifndef _LINUX_DMA_COPY_H
+#define _LINUX_DMA_COPY_H
+
+#include <linux/errno.h>
+#include <linux/string.h>
+
+struct page;
+
+/* Callers of the copy offload service, each with its own threshold */
+enum dma_copy_client {
+	DMA_COPY_UBIFS,		/* UBIFS bulk-read of uncompressed nodes */
+	DMA_COPY_SPLICE,	/* splice from a pipe into the page cache */
+	DMA_COPY_CLIENTS
+};
+
+#ifdef CONFIG_DMA_COPY_OFFLOAD
+extern void dma_copy(enum dma_copy_client client, void *dst,
+		const void *src, size_t len);
+extern int dma_copy_try_page(enum dma_copy_client client,
+		struct page *dst, unsigned int dst_off,
+		struct page *src, unsigned int src_off, size_t len);
+#else
+static inline void dma_copy(enum dma_copy_client client, void *dst,
+		const void *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+static inline int dma_copy_try_page(enum dma_copy_client client,
+		struct page *dst, unsigned int dst_off,
+		struct page *src, unsigned int src_off, size_t len)
+{
+	return -ENODEV;
+}
+#endif
+
+#endif /* _LINUX_DMA_COPY_H */
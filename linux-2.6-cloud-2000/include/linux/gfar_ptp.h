@@ -0,0 +1,47 @@
+/*
+ * Userspace API for the eTSEC IEEE 1588 clock device, /dev/gfar_ptp
+ *
+ * Copyright 2008-2011 Freescale Semiconductor, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ */
+
+#ifndef _LINUX_GFAR_PTP_H
+#define _LINUX_GFAR_PTP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define GFAR_PTP_DEV_NAME		"gfar_ptp"
+#define GFAR_PTP_IOC_MAGIC		'G'
+
+struct gfar_ptp_clock_time {
+	__s64	sec;
+	__u32	nsec;
+	__u32	reserved;
+};
+
+/* Records returned by read() on /dev/gfar_ptp */
+struct gfar_ptp_event {
+	struct gfar_ptp_clock_time t;
+	__u32	type;		/* GFAR_PTP_EV_* */
+	__u32	lost;		/* events dropped just before this one */
+};
+
+#define GFAR_PTP_EV_PPS			0x00000001
+#define GFAR_PTP_EV_EXTTS1		0x00000002
+#define GFAR_PTP_EV_EXTTS2		0x00000004
+#define GFAR_PTP_EV_ALL			0x00000007
+
+#define GFAR_PTP_GETTIME	_IOR(GFAR_PTP_IOC_MAGIC, 1, \
+					struct gfar_ptp_clock_time)
+#define GFAR_PTP_SETTIME	_IOW(GFAR_PTP_IOC_MAGIC, 2, \
+					struct gfar_ptp_clock_time)
+#define GFAR_PTP_ADJTIME	_IOW(GFAR_PTP_IOC_MAGIC, 3, __s64)	/* ns */
+#define GFAR_PTP_ADJFREQ	_IOW(GFAR_PTP_IOC_MAGIC, 4, __s32)	/* ppb */
+#define GFAR_PTP_EVENTS		_IOW(GFAR_PTP_IOC_MAGIC, 5, __u32)
+
+#endif /* _LINUX_GFAR_PTP_H */
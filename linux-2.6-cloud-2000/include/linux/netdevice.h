@@ -1452,6 +1452,9 @@ struct softnet_data {
 	unsigned int		time_squeeze;
 	unsigned int		cpu_collision;
 	unsigned int		received_rps;
+	unsigned int		steered_rps;	/* frames queued to other cpus */
+	unsigned int		sent_rps;	/* IPIs sent to other cpus */
+	unsigned int		backlog_max;	/* input_pkt_queue high water */
 
 #ifdef CONFIG_RPS
 	struct softnet_data	*rps_ipi_list;
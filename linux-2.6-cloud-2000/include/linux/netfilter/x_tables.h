@@ -181,6 +181,7 @@ struct xt_counters_info {
 #ifdef __KERNEL__
 
 #include <linux/netdevice.h>
+#include <linux/seqlock.h>
 
 /**
  * struct xt_action_param - parameters for matches/targets
@@ -452,71 +453,43 @@ extern struct xt_table_info *xt_alloc_table_info(unsigned int size);
 extern void xt_free_table_info(struct xt_table_info *info);
 
 /*
- * Per-CPU spinlock associated with per-cpu table entries, and
- * with a counter for the "reading" side that allows a recursive
- * reader to avoid taking the lock and deadlocking.
+ * Per-CPU sequence count, odd while ip/arp/ip6 tables rule processing
+ * runs on that CPU.
  *
- * "reading" is used by ip/arp/ip6 tables rule processing which runs per-cpu.
- * It needs to ensure that the rules are not being changed while the packet
- * is being processed. In some cases, the read lock will be acquired
- * twice on the same CPU; this is okay because of the count.
+ * Rule processing only updates the counters in this CPU's copy of the
+ * rules, so it needs no lock: it makes the count odd while it runs, and
+ * readers of the counters of other CPUs retry when the count moved (see
+ * get_counters()). Processing can nest on the same CPU, e.g. through a
+ * tunnel's output; the nested call finds the count odd and leaves it.
  *
- * "writing" is used when reading counters.
- *  During replace any readers that are using the old tables have to complete
- *  before freeing the old table. This is handled by the write locking
- *  necessary for reading the counters.
+ * xt_replace_table() waits for each CPU with an odd count to leave the
+ * table, so the old rules, and their counters, are no longer in use
+ * when it returns.
  */
-struct xt_info_lock {
-	spinlock_t lock;
-	unsigned char readers;
-};
-DECLARE_PER_CPU(struct xt_info_lock, xt_info_locks);
-
-/*
- * Note: we need to ensure that preemption is disabled before acquiring
- * the per-cpu-variable, so we do it as a two step process rather than
- * using "spin_lock_bh()".
- *
- * We _also_ need to disable bottom half processing before updating our
- * nesting count, to make sure that the only kind of re-entrancy is this
- * code being called by itself: since the count+lock is not an atomic
- * operation, we can allow no races.
- *
- * _Only_ that special combination of being per-cpu and never getting
- * re-entered asynchronously means that the count is safe.
- */
-static inline void xt_info_rdlock_bh(void)
-{
-	struct xt_info_lock *lock;
-
-	local_bh_disable();
-	lock = &__get_cpu_var(xt_info_locks);
-	if (likely(!lock->readers++))
-		spin_lock(&lock->lock);
-}
-
-static inline void xt_info_rdunlock_bh(void)
-{
-	struct xt_info_lock *lock = &__get_cpu_var(xt_info_locks);
-
-	if (likely(!--lock->readers))
-		spin_unlock(&lock->lock);
-	local_bh_enable();
-}
+DECLARE_PER_CPU(seqcount_t, xt_recseq);
 
 /*
- * The "writer" side needs to get exclusive access to the lock,
- * regardless of readers.  This must be called with bottom half
- * processing (and thus also preemption) disabled.
+ * Returns the value to pass to xt_write_recseq_end(): 1, or 0 when
+ * nested. Must be called with bottom half processing (and thus also
+ * preemption) disabled.
  */
-static inline void xt_info_wrlock(unsigned int cpu)
+static inline unsigned int xt_write_recseq_begin(void)
 {
-	spin_lock(&per_cpu(xt_info_locks, cpu).lock);
+	seqcount_t *s = &__get_cpu_var(xt_recseq);
+	unsigned int addend;
+
+	addend = (s->sequence + 1) & 1;
+	s->sequence += addend;
+	/* The count must be seen before we read table->private */
+	smp_mb();
+	return addend;
 }
 
-static inline void xt_info_wrunlock(unsigned int cpu)
+static inline void xt_write_recseq_end(unsigned int addend)
 {
-	spin_unlock(&per_cpu(xt_info_locks, cpu).lock);
+	/* The counter updates must be seen before the count is even */
+	smp_wmb();
+	__get_cpu_var(xt_recseq).sequence += addend;
 }
 
 /*
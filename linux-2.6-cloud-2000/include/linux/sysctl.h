@@ -275,7 +275,7 @@ enum
 	NET_CORE_AEVENT_ETIME=20,
 	NET_CORE_AEVENT_RSEQTH=21,
 	NET_CORE_WARNINGS=22,
-	RCV_PKT_STEERING = 23,
+	RCV_PKT_STEERING = 23,	/* was: int: rcv_pkt_steering, unused */
 };
 
 /* /proc/sys/net/ethernet */
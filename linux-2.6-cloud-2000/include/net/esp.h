@@ -2,15 +2,48 @@
 #define _NET_ESP_H
 
 #include <linux/skbuff.h>
+#include <linux/spinlock.h>
 
 struct crypto_aead;
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+enum {
+	ESP_PIPE_OUT,
+	ESP_PIPE_IN,
+	ESP_PIPE_MAX
+};
+
+/*
+ * Per-SA, per-direction completion ordering.  Every request takes a
+ * ticket at submission; completions that overtake an older request are
+ * parked on 'held' until the older ones have been handed back to xfrm.
+ */
+struct esp_pipe {
+	spinlock_t		lock;
+	u32			next_ticket;
+	u32			next_done;
+	int			running;
+	struct sk_buff_head	held;
+
+	u64			packets;
+	u64			bytes;
+	u64			errors;
+	u64			reordered;
+	u64			lat_sum_ns;
+	u32			lat_max_ns;
+};
+#endif
+
 struct esp_data {
 	/* 0..255 */
 	int padlen;
 
 	/* Confidentiality & Integrity */
 	struct crypto_aead *aead;
+
+#ifdef CONFIG_INET_ESP_PIPELINE
+	struct esp_pipe pipe[ESP_PIPE_MAX];
+#endif
 };
 
 extern void *pskb_put(struct sk_buff *skb, struct sk_buff *tail, int len);
@@ -86,6 +86,9 @@ struct neigh_statistics {
 	unsigned long forced_gc_runs;	/* number of forced GC runs */
 
 	unsigned long unres_discards;	/* number of unresolved drops */
+
+	unsigned long pcpu_hits;	/* hits in the per-CPU cache */
+	unsigned long locked_lookups;	/* lookups under tbl->lock */
 };
 
 #define NEIGH_CACHE_STAT_INC(tbl, field) this_cpu_inc((tbl)->stats->field)
@@ -111,6 +114,7 @@ struct neighbour {
 	struct sk_buff_head	arp_queue;
 	struct timer_list	timer;
 	const struct neigh_ops	*ops;
+	struct rcu_head		rcu;
 	u8			primary_key[0];
 };
 
@@ -165,6 +169,7 @@ struct neigh_table {
 	unsigned long		last_rand;
 	struct kmem_cache		*kmem_cachep;
 	struct neigh_statistics	__percpu *stats;
+	struct neighbour * __percpu *pcpu_cache;
 	struct neighbour	**hash_buckets;
 	unsigned int		hash_mask;
 	__u32			hash_rnd;
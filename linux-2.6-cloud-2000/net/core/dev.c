@@ -280,11 +280,6 @@ int netdev_fastroute_obstacles;
 EXPORT_SYMBOL(netdev_fastroute_obstacles);
 #endif
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
-int rcv_pkt_steering;
-EXPORT_SYMBOL(rcv_pkt_steering);
-#endif
-
 #ifdef CONFIG_LOCKDEP
 /*
  * register_netdevice() inits txq->_xmit_lock and sets lockdep class
@@ -2521,6 +2516,13 @@ static int enqueue_to_backlog(struct sk_buff *skb, int cpu,
 enqueue:
 			__skb_queue_tail(&sd->input_pkt_queue, skb);
 			input_queue_tail_incr_save(sd, qtail);
+			if (skb_queue_len(&sd->input_pkt_queue) > sd->backlog_max)
+				sd->backlog_max =
+					skb_queue_len(&sd->input_pkt_queue);
+#ifdef CONFIG_RPS
+			if (sd->cpu != smp_processor_id())
+				__get_cpu_var(softnet_data).steered_rps++;
+#endif
 			rps_unlock(sd);
 			local_irq_restore(flags);
 			return NET_RX_SUCCESS;
@@ -3632,9 +3634,11 @@ static void net_rps_action_and_irq_enable(struct softnet_data *sd)
 		while (remsd) {
 			struct softnet_data *next = remsd->rps_ipi_next;
 
-			if (cpu_online(remsd->cpu))
+			if (cpu_online(remsd->cpu)) {
 				__smp_call_function_single(remsd->cpu,
 							   &remsd->csd, 0);
+				sd->sent_rps++;
+			}
 			remsd = next;
 		}
 	} else
@@ -4095,10 +4099,13 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct softnet_data *sd = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   "%08x %08x %08x %08x\n",
 		   sd->processed, sd->dropped, sd->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   sd->cpu_collision, sd->received_rps);
+		   sd->cpu_collision, sd->received_rps,
+		   sd->steered_rps, sd->sent_rps,
+		   skb_queue_len(&sd->input_pkt_queue), sd->backlog_max);
 	return 0;
 }
 
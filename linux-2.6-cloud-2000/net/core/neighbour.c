@@ -36,6 +36,8 @@
 #include <linux/random.h>
 #include <linux/string.h>
 #include <linux/log2.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
 
 #define NEIGH_DEBUG 1
 
@@ -56,6 +58,9 @@
 
 #define PNEIGH_HASHMASK		0xF
 
+/* Slots of the per-CPU lookup cache of each table */
+#define NEIGH_PCPU_CACHE_SIZE	256
+
 static void neigh_timer_handler(unsigned long arg);
 static void __neigh_notify(struct neighbour *n, int type, int flags);
 static void neigh_update_notify(struct neighbour *neigh);
@@ -76,6 +81,17 @@ static const struct file_operations neigh_stat_seq_fops;
      cache.
    - If the entry requires some non-trivial actions, increase
      its reference count and release table lock.
+   - neigh_lookup() walks the buckets under rcu_read_lock_bh() only.
+     Entries are linked in with rcu_assign_pointer(), freed after a
+     grace period, and a replaced bucket array is freed the same way.
+     A lookup takes a reference only if the count is not zero and the
+     entry is not dead; when that fails, or nothing is found, it looks
+     again under tbl->lock.
+
+   Each table also has a small direct mapped cache per CPU, of the
+   entries recently found by neigh_lookup(). A slot only points to an
+   entry, without a reference; neigh_destroy() clears the slots that
+   still point to it before the entry is freed.
 
    Neighbour entries are protected:
    - with reference count.
@@ -258,6 +274,67 @@ int neigh_ifdown(struct neigh_table *tbl, struct net_device *dev)
 }
 EXPORT_SYMBOL(neigh_ifdown);
 
+/* Independent of tbl->hash_rnd, so that an entry stays in its slot */
+static inline struct neighbour **neigh_pcpu_slot(struct neigh_table *tbl,
+						 const void *pkey,
+						 const struct net_device *dev,
+						 int cpu)
+{
+	u32 hash_val = jhash(pkey, tbl->key_len, (unsigned long)dev);
+
+	return &per_cpu_ptr(tbl->pcpu_cache, cpu)[hash_val &
+					(NEIGH_PCPU_CACHE_SIZE - 1)];
+}
+
+static void neigh_pcpu_forget(struct neighbour *n)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		cmpxchg(neigh_pcpu_slot(n->tbl, n->primary_key, n->dev, cpu),
+			n, NULL);
+}
+
+static inline int neigh_match(const struct neighbour *n, const void *pkey,
+			      const struct net_device *dev, int key_len)
+{
+	return dev == n->dev && !memcmp(n->primary_key, pkey, key_len);
+}
+
+/* Take a reference unless the entry is being destroyed or unlinked */
+static inline int neigh_hold_live(struct neighbour *n)
+{
+	if (!atomic_inc_not_zero(&n->refcnt))
+		return 0;
+	if (unlikely(n->dead)) {
+		neigh_release(n);
+		return 0;
+	}
+	return 1;
+}
+
+/* Called under rcu_read_lock_bh(). A lookup racing with
+ * neigh_hash_grow() may miss, the caller then looks under tbl->lock. */
+static struct neighbour *neigh_lookup_rcu(struct neigh_table *tbl,
+					  const void *pkey,
+					  struct net_device *dev)
+{
+	struct neighbour *n, **buckets;
+	unsigned int hash_mask;
+
+	/* neigh_hash_grow() publishes the buckets before the mask */
+	hash_mask = ACCESS_ONCE(tbl->hash_mask);
+	smp_rmb();
+	buckets = rcu_dereference_bh(tbl->hash_buckets);
+
+	for (n = rcu_dereference_bh(buckets[tbl->hash(pkey, dev) & hash_mask]);
+	     n; n = rcu_dereference_bh(n->next)) {
+		if (neigh_match(n, pkey, dev, tbl->key_len))
+			return neigh_hold_live(n) ? n : NULL;
+	}
+	return NULL;
+}
+
 static struct neighbour *neigh_alloc(struct neigh_table *tbl)
 {
 	struct neighbour *n = NULL;
@@ -321,17 +398,40 @@ static void neigh_hash_free(struct neighbour **hash, unsigned int entries)
 		free_pages((unsigned long)hash, get_order(size));
 }
 
+/* A bucket array replaced by neigh_hash_grow(), freed after lookups
+ * under RCU are done with it */
+struct neigh_hash_old {
+	struct rcu_head		rcu;
+	struct neighbour	**hash;
+	unsigned int		entries;
+};
+
+static void neigh_hash_free_rcu(struct rcu_head *head)
+{
+	struct neigh_hash_old *old = container_of(head, struct neigh_hash_old,
+						  rcu);
+
+	neigh_hash_free(old->hash, old->entries);
+	kfree(old);
+}
+
 static void neigh_hash_grow(struct neigh_table *tbl, unsigned long new_entries)
 {
 	struct neighbour **new_hash, **old_hash;
+	struct neigh_hash_old *old;
 	unsigned int i, new_hash_mask, old_entries;
 
 	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
 
 	BUG_ON(!is_power_of_2(new_entries));
+	old = kmalloc(sizeof(*old), GFP_ATOMIC);
+	if (!old)
+		return;
 	new_hash = neigh_hash_alloc(new_entries);
-	if (!new_hash)
+	if (!new_hash) {
+		kfree(old);
 		return;
+	}
 
 	old_entries = tbl->hash_mask + 1;
 	new_hash_mask = new_entries - 1;
@@ -351,31 +451,55 @@ static void neigh_hash_grow(struct neigh_table *tbl, unsigned long new_entries)
 			new_hash[hash_val] = n;
 		}
 	}
-	tbl->hash_buckets = new_hash;
+	/* A lookup that sees the new mask must see the new buckets */
+	rcu_assign_pointer(tbl->hash_buckets, new_hash);
+	smp_wmb();
 	tbl->hash_mask = new_hash_mask;
 
-	neigh_hash_free(old_hash, old_entries);
+	old->hash = old_hash;
+	old->entries = old_entries;
+	call_rcu_bh(&old->rcu, neigh_hash_free_rcu);
 }
 
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
-	struct neighbour *n;
+	struct neighbour *n, **slot;
 	int key_len = tbl->key_len;
 	u32 hash_val;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
-	read_lock_bh(&tbl->lock);
-	hash_val = tbl->hash(pkey, dev);
-	for (n = tbl->hash_buckets[hash_val & tbl->hash_mask]; n; n = n->next) {
-		if (dev == n->dev && !memcmp(n->primary_key, pkey, key_len)) {
-			neigh_hold(n);
-			NEIGH_CACHE_STAT_INC(tbl, hits);
-			break;
+	rcu_read_lock_bh();
+	slot = neigh_pcpu_slot(tbl, pkey, dev, smp_processor_id());
+	n = rcu_dereference_bh(*slot);
+	if (n && neigh_match(n, pkey, dev, key_len) && neigh_hold_live(n)) {
+		NEIGH_CACHE_STAT_INC(tbl, pcpu_hits);
+		goto found;
+	}
+
+	n = neigh_lookup_rcu(tbl, pkey, dev);
+	if (!n) {
+		NEIGH_CACHE_STAT_INC(tbl, locked_lookups);
+		read_lock(&tbl->lock);
+		hash_val = tbl->hash(pkey, dev);
+		for (n = tbl->hash_buckets[hash_val & tbl->hash_mask]; n;
+		     n = n->next) {
+			if (neigh_match(n, pkey, dev, key_len)) {
+				neigh_hold(n);
+				break;
+			}
 		}
+		read_unlock(&tbl->lock);
+		if (!n)
+			goto out;
 	}
-	read_unlock_bh(&tbl->lock);
+	/* We hold a reference, so neigh_destroy() cannot miss the slot */
+	rcu_assign_pointer(*slot, n);
+found:
+	NEIGH_CACHE_STAT_INC(tbl, hits);
+out:
+	rcu_read_unlock_bh();
 	return n;
 }
 EXPORT_SYMBOL(neigh_lookup);
@@ -456,10 +580,10 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 		}
 	}
 
-	n->next = tbl->hash_buckets[hash_val];
-	tbl->hash_buckets[hash_val] = n;
 	n->dead = 0;
 	neigh_hold(n);
+	n->next = tbl->hash_buckets[hash_val];
+	rcu_assign_pointer(tbl->hash_buckets[hash_val], n);
 	write_unlock_bh(&tbl->lock);
 	NEIGH_PRINTK2("neigh %p is created.\n", n);
 	rc = n;
@@ -620,6 +744,13 @@ static inline void neigh_parms_put(struct neigh_parms *parms)
  *	neighbour must already be out of the table;
  *
  */
+static void neigh_free_rcu(struct rcu_head *head)
+{
+	struct neighbour *neigh = container_of(head, struct neighbour, rcu);
+
+	kmem_cache_free(neigh->tbl->kmem_cachep, neigh);
+}
+
 void neigh_destroy(struct neighbour *neigh)
 {
 	struct hh_cache *hh;
@@ -649,13 +780,15 @@ void neigh_destroy(struct neighbour *neigh)
 
 	skb_queue_purge(&neigh->arp_queue);
 
+	/* Lookups still holding the pointer can no longer take a reference */
+	neigh_pcpu_forget(neigh);
 	dev_put(neigh->dev);
 	neigh_parms_put(neigh->parms);
 
 	NEIGH_PRINTK2("neigh %p is destroyed.\n", neigh);
 
 	atomic_dec(&neigh->tbl->entries);
-	kmem_cache_free(neigh->tbl->kmem_cachep, neigh);
+	call_rcu_bh(&neigh->rcu, neigh_free_rcu);
 }
 EXPORT_SYMBOL(neigh_destroy);
 
@@ -1429,6 +1562,11 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 	tbl->stats = alloc_percpu(struct neigh_statistics);
 	if (!tbl->stats)
 		panic("cannot create neighbour cache statistics");
+	tbl->pcpu_cache = __alloc_percpu(NEIGH_PCPU_CACHE_SIZE *
+					 sizeof(struct neighbour *),
+					 __alignof__(struct neighbour *));
+	if (!tbl->pcpu_cache)
+		panic("cannot create neighbour lookup cache");
 
 #ifdef CONFIG_PROC_FS
 	if (!proc_create_data(tbl->id, 0, init_net.proc_net_stat,
@@ -1502,6 +1640,9 @@ int neigh_table_clear(struct neigh_table *tbl)
 	}
 	write_unlock(&neigh_tbl_lock);
 
+	/* Wait for the entries and bucket arrays freed after a grace period */
+	rcu_barrier_bh();
+
 	neigh_hash_free(tbl->hash_buckets, tbl->hash_mask + 1);
 	tbl->hash_buckets = NULL;
 
@@ -1513,6 +1654,9 @@ int neigh_table_clear(struct neigh_table *tbl)
 	free_percpu(tbl->stats);
 	tbl->stats = NULL;
 
+	free_percpu(tbl->pcpu_cache);
+	tbl->pcpu_cache = NULL;
+
 	kmem_cache_destroy(tbl->kmem_cachep);
 	tbl->kmem_cachep = NULL;
 
@@ -2465,12 +2609,12 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 	struct neigh_statistics *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards\n");
+		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards  pcpu_hits locked_lookups\n");
 		return 0;
 	}
 
 	seq_printf(seq, "%08x  %08lx %08lx %08lx  %08lx %08lx  %08lx  "
-			"%08lx %08lx  %08lx %08lx %08lx\n",
+			"%08lx %08lx  %08lx %08lx %08lx  %08lx %08lx\n",
 		   atomic_read(&tbl->entries),
 
 		   st->allocs,
@@ -2487,7 +2631,10 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 
 		   st->periodic_gc_runs,
 		   st->forced_gc_runs,
-		   st->unres_discards
+		   st->unres_discards,
+
+		   st->pcpu_hits,
+		   st->locked_lookups
 		   );
 
 	return 0;
@@ -15,6 +15,10 @@
 #include <net/icmp.h>
 #include <net/protocol.h>
 #include <net/udp.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/net_namespace.h>
 
 struct esp_skb_cb {
 	struct xfrm_skb_cb xfrm;
@@ -23,6 +27,30 @@ struct esp_skb_cb {
 
 #define ESP_SKB_CB(__skb) ((struct esp_skb_cb *)&((__skb)->cb[0]))
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+/* Per-request bookkeeping, kept in front of the IV in the tmp area. */
+struct esp_tmp_hdr {
+	u32 ticket;
+	int err;
+	unsigned int len;
+	ktime_t start;
+};
+
+#define ESP_TMP_HDR_LEN \
+	ALIGN(sizeof(struct esp_tmp_hdr), crypto_tfm_ctx_alignment())
+
+/* Requests may wait in the crypto driver's backlog instead of failing. */
+#define ESP_REQ_FLAGS	CRYPTO_TFM_REQ_MAY_BACKLOG
+
+static inline struct esp_tmp_hdr *esp_tmp_hdr(struct sk_buff *skb)
+{
+	return ESP_SKB_CB(skb)->tmp;
+}
+#else
+#define ESP_TMP_HDR_LEN	0
+#define ESP_REQ_FLAGS	0
+#endif
+
 /*
  * Allocate an AEAD request structure with extra space for SG and IV.
  *
@@ -47,13 +75,15 @@ static void *esp_alloc_tmp(struct crypto_aead *aead, int nfrags)
 
 	len += sizeof(struct scatterlist) * nfrags;
 
-	return kmalloc(len, GFP_ATOMIC);
+	return kmalloc(ESP_TMP_HDR_LEN + len, GFP_ATOMIC);
 }
 
 static inline u8 *esp_tmp_iv(struct crypto_aead *aead, void *tmp)
 {
+	u8 *p = (u8 *)tmp + ESP_TMP_HDR_LEN;
+
 	return crypto_aead_ivsize(aead) ?
-	       PTR_ALIGN((u8 *)tmp, crypto_aead_alignmask(aead) + 1) : tmp;
+	       PTR_ALIGN(p, crypto_aead_alignmask(aead) + 1) : p;
 }
 
 static inline struct aead_givcrypt_request *esp_tmp_givreq(
@@ -93,14 +123,156 @@ static inline struct scatterlist *esp_givreq_sg(
 			     __alignof__(struct scatterlist));
 }
 
-static void esp_output_done(struct crypto_async_request *base, int err)
+#ifdef CONFIG_INET_ESP_PIPELINE
+static inline int esp_ticket_before(u32 a, u32 b)
 {
-	struct sk_buff *skb = base->data;
+	return (s32)(a - b) < 0;
+}
+
+static void esp_pipe_init(struct esp_pipe *p)
+{
+	spin_lock_init(&p->lock);
+	skb_queue_head_init(&p->held);
+}
 
+/* Take a ticket just before the request is handed to the crypto layer. */
+static void esp_pipe_begin(struct esp_pipe *p, struct sk_buff *skb)
+{
+	struct esp_tmp_hdr *h = esp_tmp_hdr(skb);
+
+	h->len = skb->len;
+	h->start = ktime_get();
+
+	spin_lock_bh(&p->lock);
+	h->ticket = p->next_ticket++;
+	spin_unlock_bh(&p->lock);
+}
+
+/* Called with p->lock held. */
+static void esp_pipe_account(struct esp_pipe *p, struct esp_tmp_hdr *h,
+			     int err)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), h->start));
+
+	h->err = err;
+	if (err) {
+		p->errors++;
+		return;
+	}
+
+	p->packets++;
+	p->bytes += h->len;
+	p->lat_sum_ns += ns;
+	if (ns > p->lat_max_ns)
+		p->lat_max_ns = min_t(s64, ns, (u32)~0U);
+}
+
+/*
+ * Hand finished requests back to xfrm in ticket order.  Only one cpu
+ * delivers for a pipe at a time; completions arriving meanwhile are
+ * left on the held queue and picked up before it lets go.  Called and
+ * returns with p->lock held.
+ */
+static void esp_pipe_deliver(struct esp_pipe *p,
+			     void (*finish)(struct sk_buff *, int))
+{
+	struct sk_buff_head run;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&run);
+	p->running = 1;
+
+	for (;;) {
+		while ((skb = skb_peek(&p->held)) &&
+		       esp_tmp_hdr(skb)->ticket == p->next_done) {
+			__skb_unlink(skb, &p->held);
+			__skb_queue_tail(&run, skb);
+			p->next_done++;
+		}
+		if (skb_queue_empty(&run))
+			break;
+
+		spin_unlock_bh(&p->lock);
+		while ((skb = __skb_dequeue(&run)))
+			finish(skb, esp_tmp_hdr(skb)->err);
+		spin_lock_bh(&p->lock);
+	}
+
+	p->running = 0;
+}
+
+static void esp_pipe_complete(struct esp_pipe *p, struct sk_buff *skb,
+			      int err, void (*finish)(struct sk_buff *, int))
+{
+	struct esp_tmp_hdr *h = esp_tmp_hdr(skb);
+	struct sk_buff *prev;
+
+	spin_lock_bh(&p->lock);
+	esp_pipe_account(p, h, err);
+	if (h->ticket != p->next_done)
+		p->reordered++;
+
+	/* completions come nearly in order, so search from the tail */
+	skb_queue_reverse_walk(&p->held, prev) {
+		if (esp_ticket_before(esp_tmp_hdr(prev)->ticket, h->ticket))
+			break;
+	}
+	__skb_queue_after(&p->held, prev, skb);
+
+	if (!p->running)
+		esp_pipe_deliver(p, finish);
+	spin_unlock_bh(&p->lock);
+}
+
+/*
+ * The crypto layer finished @skb synchronously.  If nothing older is
+ * outstanding the caller carries on with @err; otherwise the skb joins
+ * the held queue, goes back through @finish, and -EINPROGRESS is
+ * returned.
+ */
+static int esp_pipe_sync(struct esp_pipe *p, struct sk_buff *skb, int err,
+			 void (*finish)(struct sk_buff *, int))
+{
+	struct esp_tmp_hdr *h = esp_tmp_hdr(skb);
+
+	spin_lock_bh(&p->lock);
+	if (!p->running && h->ticket == p->next_done &&
+	    skb_queue_empty(&p->held)) {
+		esp_pipe_account(p, h, err);
+		p->next_done++;
+		spin_unlock_bh(&p->lock);
+		return err;
+	}
+	spin_unlock_bh(&p->lock);
+
+	esp_pipe_complete(p, skb, err, finish);
+	return -EINPROGRESS;
+}
+#endif
+
+static void esp_output_finish(struct sk_buff *skb, int err)
+{
 	kfree(ESP_SKB_CB(skb)->tmp);
 	xfrm_output_resume(skb, err);
 }
 
+static void esp_output_done(struct crypto_async_request *base, int err)
+{
+	struct sk_buff *skb = base->data;
+#ifdef CONFIG_INET_ESP_PIPELINE
+	struct esp_data *esp = skb_dst(skb)->xfrm->data;
+
+	/* moved from the driver's backlog onto the hardware */
+	if (err == -EINPROGRESS)
+		return;
+
+	esp_pipe_complete(&esp->pipe[ESP_PIPE_OUT], skb, err,
+			  esp_output_finish);
+#else
+	esp_output_finish(skb, err);
+#endif
+}
+
 static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 {
 	int err;
@@ -207,19 +379,35 @@ static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 		     clen + alen);
 	sg_init_one(asg, esph, sizeof(*esph));
 
-	aead_givcrypt_set_callback(req, 0, esp_output_done, skb);
+	aead_givcrypt_set_callback(req, ESP_REQ_FLAGS, esp_output_done, skb);
 	aead_givcrypt_set_crypt(req, sg, sg, clen, iv);
 	aead_givcrypt_set_assoc(req, asg, sizeof(*esph));
 	aead_givcrypt_set_giv(req, esph->enc_data,
 			      XFRM_SKB_CB(skb)->seq.output);
 
 	ESP_SKB_CB(skb)->tmp = tmp;
+#ifdef CONFIG_INET_ESP_PIPELINE
+	esp_pipe_begin(&esp->pipe[ESP_PIPE_OUT], skb);
+#endif
 	err = crypto_aead_givencrypt(req);
 	if (err == -EINPROGRESS)
 		goto error;
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+	/* backlogged, the callback follows */
+	if (err == -EBUSY) {
+		err = -EINPROGRESS;
+		goto error;
+	}
+
+	err = esp_pipe_sync(&esp->pipe[ESP_PIPE_OUT], skb, err,
+			    esp_output_finish);
+	if (err == -EINPROGRESS)
+		goto error;
+#else
 	if (err == -EBUSY)
 		err = NET_XMIT_DROP;
+#endif
 
 	kfree(tmp);
 
@@ -309,11 +497,45 @@ out:
 	return err;
 }
 
+static void esp_input_finish(struct sk_buff *skb, int err)
+{
+	xfrm_input_resume(skb, esp_input_done2(skb, err));
+}
+
 static void esp_input_done(struct crypto_async_request *base, int err)
 {
 	struct sk_buff *skb = base->data;
+#ifdef CONFIG_INET_ESP_PIPELINE
+	struct esp_data *esp = xfrm_input_state(skb)->data;
 
-	xfrm_input_resume(skb, esp_input_done2(skb, err));
+	if (err == -EINPROGRESS)
+		return;
+
+	esp_pipe_complete(&esp->pipe[ESP_PIPE_IN], skb, err,
+			  esp_input_finish);
+#else
+	esp_input_finish(skb, err);
+#endif
+}
+
+/*
+ * Make the payload writable for in-place decryption and return the
+ * number of scatterlist entries it needs.
+ */
+static int esp_input_cow(struct sk_buff *skb)
+{
+	struct sk_buff *trailer;
+
+#ifdef CONFIG_INET_ESP_PIPELINE
+	/*
+	 * The page frags of a received skb that is not cloned belong to it
+	 * alone, so they can be decrypted where they are.  Only clones and
+	 * frag lists go through skb_cow_data(), which linearises.
+	 */
+	if (!skb_cloned(skb) && !skb_has_frags(skb))
+		return skb_shinfo(skb)->nr_frags + 1;
+#endif
+	return skb_cow_data(skb, 0, &trailer);
 }
 
 /*
@@ -327,7 +549,6 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	struct esp_data *esp = x->data;
 	struct crypto_aead *aead = esp->aead;
 	struct aead_request *req;
-	struct sk_buff *trailer;
 	int elen = skb->len - sizeof(*esph) - crypto_aead_ivsize(aead);
 	int nfrags;
 	void *tmp;
@@ -342,7 +563,7 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	if (elen <= 0)
 		goto out;
 
-	if ((err = skb_cow_data(skb, 0, &trailer)) < 0)
+	if ((err = esp_input_cow(skb)) < 0)
 		goto out;
 	nfrags = err;
 
@@ -368,14 +589,29 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	skb_to_sgvec(skb, sg, sizeof(*esph) + crypto_aead_ivsize(aead), elen);
 	sg_init_one(asg, esph, sizeof(*esph));
 
-	aead_request_set_callback(req, 0, esp_input_done, skb);
+	aead_request_set_callback(req, ESP_REQ_FLAGS, esp_input_done, skb);
 	aead_request_set_crypt(req, sg, sg, elen, iv);
 	aead_request_set_assoc(req, asg, sizeof(*esph));
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+	esp_pipe_begin(&esp->pipe[ESP_PIPE_IN], skb);
+#endif
 	err = crypto_aead_decrypt(req);
 	if (err == -EINPROGRESS)
 		goto out;
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+	if (err == -EBUSY) {
+		err = -EINPROGRESS;
+		goto out;
+	}
+
+	err = esp_pipe_sync(&esp->pipe[ESP_PIPE_IN], skb, err,
+			    esp_input_finish);
+	if (err == -EINPROGRESS)
+		goto out;
+#endif
+
 	err = esp_input_done2(skb, err);
 
 out:
@@ -560,6 +796,11 @@ static int esp_init_state(struct xfrm_state *x)
 
 	x->data = esp;
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+	esp_pipe_init(&esp->pipe[ESP_PIPE_OUT]);
+	esp_pipe_init(&esp->pipe[ESP_PIPE_IN]);
+#endif
+
 	if (x->aead)
 		err = esp_init_aead(x);
 	else
@@ -622,6 +863,82 @@ static const struct net_protocol esp4_protocol = {
 	.netns_ok	=	1,
 };
 
+#ifdef CONFIG_INET_ESP_PIPELINE
+static int esp_sa_seq_show_one(struct xfrm_state *x, int count, void *ptr)
+{
+	struct seq_file *seq = ptr;
+	struct esp_data *esp = x->data;
+	struct esp_pipe *p;
+	u64 avg;
+	int i;
+
+	if (x->type != &esp_type || !esp)
+		return 0;
+
+	for (i = 0; i < ESP_PIPE_MAX; i++) {
+		p = &esp->pipe[i];
+
+		spin_lock_bh(&p->lock);
+		avg = p->packets ? div64_u64(p->lat_sum_ns, p->packets) : 0;
+		seq_printf(seq, "%08x %-3s %12llu %16llu %10llu %10llu "
+			   "%8u %10llu %10u\n",
+			   ntohl(x->id.spi), i == ESP_PIPE_OUT ? "out" : "in",
+			   (unsigned long long)p->packets,
+			   (unsigned long long)p->bytes,
+			   (unsigned long long)p->errors,
+			   (unsigned long long)p->reordered,
+			   p->next_ticket - p->next_done,
+			   (unsigned long long)avg, p->lat_max_ns);
+		spin_unlock_bh(&p->lock);
+	}
+	return 0;
+}
+
+static int esp_sa_seq_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq->private;
+	struct xfrm_state_walk walk;
+
+	seq_printf(seq, "spi      dir      packets            bytes     "
+		   "errors  reordered inflight lat_avg_ns lat_max_ns\n");
+
+	xfrm_state_walk_init(&walk, IPPROTO_ESP);
+	xfrm_state_walk(net, &walk, esp_sa_seq_show_one, seq);
+	xfrm_state_walk_done(&walk);
+	return 0;
+}
+
+static int esp_sa_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, esp_sa_seq_show);
+}
+
+static const struct file_operations esp_sa_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = esp_sa_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release_net,
+};
+
+static int __net_init esp4_net_init(struct net *net)
+{
+	if (!proc_net_fops_create(net, "esp4_sa", S_IRUGO, &esp_sa_seq_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+static void __net_exit esp4_net_exit(struct net *net)
+{
+	proc_net_remove(net, "esp4_sa");
+}
+
+static struct pernet_operations esp4_net_ops = {
+	.init = esp4_net_init,
+	.exit = esp4_net_exit,
+};
+#endif
+
 static int __init esp4_init(void)
 {
 	if (xfrm_register_type(&esp_type, AF_INET) < 0) {
@@ -633,11 +950,22 @@ static int __init esp4_init(void)
 		xfrm_unregister_type(&esp_type, AF_INET);
 		return -EAGAIN;
 	}
+#ifdef CONFIG_INET_ESP_PIPELINE
+	if (register_pernet_subsys(&esp4_net_ops) < 0) {
+		printk(KERN_INFO "ip esp init: can't add proc entries\n");
+		inet_del_protocol(&esp4_protocol, IPPROTO_ESP);
+		xfrm_unregister_type(&esp_type, AF_INET);
+		return -EAGAIN;
+	}
+#endif
 	return 0;
 }
 
 static void __exit esp4_fini(void)
 {
+#ifdef CONFIG_INET_ESP_PIPELINE
+	unregister_pernet_subsys(&esp4_net_ops);
+#endif
 	if (inet_del_protocol(&esp4_protocol, IPPROTO_ESP) < 0)
 		printk(KERN_INFO "ip esp close: can't remove protocol\n");
 	if (xfrm_unregister_type(&esp_type, AF_INET) < 0)
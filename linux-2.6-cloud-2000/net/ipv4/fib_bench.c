@@ -0,0 +1,247 @@
+/*
+ * fib_bench - IPv4 FIB lookup benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Looks up random destinations in one FIB table with fib_table_lookup(),
+ * which is the work a route cache miss costs, and reports the lookup rate
+ * in the kernel log. Like tcrypt, everything is done when the module is
+ * loaded, and loading then fails with -EAGAIN so nothing stays behind:
+ *
+ *	modprobe fib_bench table=200 keys=100000 dst=10.0.0.0/8
+ *
+ * The table is used as it is. Dump the routing daemon's routes with
+ * "ip route save" or generate a synthetic FIB, and load it into a spare
+ * table with "ip route restore" or "ip -batch".
+ *
+ * The keys are looked up round robin. A small key set measures lookups
+ * from the cache; one much larger than the cache measures the misses.
+ * Where the CPU has a PMU, cycles, instructions and cache misses per
+ * lookup are counted too.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/inet.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/perf_event.h>
+#include <net/net_namespace.h>
+#include <net/ip_fib.h>
+
+static unsigned int table = RT_TABLE_MAIN;
+module_param(table, uint, 0);
+MODULE_PARM_DESC(table, "FIB table to look up in");
+
+static unsigned int keys = 65536;
+module_param(keys, uint, 0);
+MODULE_PARM_DESC(keys, "number of distinct destinations");
+
+static unsigned int lookups = 1000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "number of lookups to time");
+
+static char *dst = "0.0.0.0/0";
+module_param(dst, charp, 0);
+MODULE_PARM_DESC(dst, "prefix the destinations are drawn from");
+
+#define FIB_BENCH_MAX_KEYS	(1 << 24)
+
+enum {
+	FIB_BENCH_CYCLES,
+	FIB_BENCH_INSTRUCTIONS,
+	FIB_BENCH_CACHE_MISSES,
+	FIB_BENCH_NR_EVENTS,
+};
+
+static const u64 fib_bench_event_ids[FIB_BENCH_NR_EVENTS] = {
+	[FIB_BENCH_CYCLES]	 = PERF_COUNT_HW_CPU_CYCLES,
+	[FIB_BENCH_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+	[FIB_BENCH_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static const char *const fib_bench_event_names[FIB_BENCH_NR_EVENTS] = {
+	[FIB_BENCH_CYCLES]	 = "cycles",
+	[FIB_BENCH_INSTRUCTIONS] = "instructions",
+	[FIB_BENCH_CACHE_MISSES] = "cache misses",
+};
+
+static struct perf_event *fib_bench_events[FIB_BENCH_NR_EVENTS];
+
+#ifdef CONFIG_PERF_EVENTS
+/* Count in this task only, the events are optional */
+static void fib_bench_events_create(void)
+{
+	struct perf_event_attr attr;
+	struct perf_event *event;
+	int i;
+
+	for (i = 0; i < FIB_BENCH_NR_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type   = PERF_TYPE_HARDWARE;
+		attr.config = fib_bench_event_ids[i];
+		attr.size   = sizeof(attr);
+		attr.pinned = 1;
+
+		event = perf_event_create_kernel_counter(&attr, -1, 0, NULL);
+		fib_bench_events[i] = IS_ERR(event) ? NULL : event;
+	}
+}
+
+static void fib_bench_events_release(void)
+{
+	int i;
+
+	for (i = 0; i < FIB_BENCH_NR_EVENTS; i++)
+		if (fib_bench_events[i])
+			perf_event_release_kernel(fib_bench_events[i]);
+}
+
+static void fib_bench_events_read(u64 *counts)
+{
+	u64 enabled, running;
+	int i;
+
+	for (i = 0; i < FIB_BENCH_NR_EVENTS; i++)
+		counts[i] = fib_bench_events[i] ?
+			    perf_event_read_value(fib_bench_events[i],
+						  &enabled, &running) : 0;
+}
+#else
+static inline void fib_bench_events_create(void)
+{
+}
+
+static inline void fib_bench_events_release(void)
+{
+}
+
+static inline void fib_bench_events_read(u64 *counts)
+{
+	memset(counts, 0, FIB_BENCH_NR_EVENTS * sizeof(*counts));
+}
+#endif
+
+static int fib_bench_parse_dst(__be32 *addr, u32 *mask)
+{
+	const char *end;
+	unsigned long plen;
+
+	if (!in4_pton(dst, -1, (u8 *)addr, '/', &end) || *end != '/' ||
+	    strict_strtoul(end + 1, 10, &plen) || plen > 32)
+		return -EINVAL;
+	*mask = plen ? ~0U << (32 - plen) : 0;
+	return 0;
+}
+
+static __be32 *fib_bench_keys(__be32 addr, u32 mask)
+{
+	__be32 *k;
+	unsigned int i;
+
+	k = vmalloc(keys * sizeof(*k));
+	if (!k)
+		return NULL;
+	get_random_bytes(k, keys * sizeof(*k));
+	for (i = 0; i < keys; i++)
+		k[i] = htonl((ntohl(addr) & mask) | ((__force u32)k[i] & ~mask));
+	return k;
+}
+
+static unsigned int fib_bench_run(struct fib_table *tb, const __be32 *k,
+				  unsigned int n)
+{
+	struct fib_result res;
+	struct flowi fl;
+	unsigned int i, j, found = 0;
+	int err;
+
+	memset(&fl, 0, sizeof(fl));
+	for (i = 0, j = 0; i < n; i++) {
+		fl.fl4_dst = k[j];
+		if (++j == keys)
+			j = 0;
+		/* Routes like blackhole match with an error, and no fib_info */
+		err = fib_table_lookup(tb, &fl, &res);
+		if (err <= 0)
+			found++;
+		if (err == 0 && res.fi)
+			fib_info_put(res.fi);
+		if ((i & 1023) == 0)
+			cond_resched();
+	}
+	return found;
+}
+
+static int __init fib_bench_init(void)
+{
+	u64 before[FIB_BENCH_NR_EVENTS], after[FIB_BENCH_NR_EVENTS], c;
+	struct fib_table *tb;
+	unsigned int found;
+	ktime_t start;
+	__be32 addr, *k;
+	s64 ns;
+	u32 mask;
+	int i;
+
+	if (keys == 0 || keys > FIB_BENCH_MAX_KEYS || lookups == 0 ||
+	    fib_bench_parse_dst(&addr, &mask) < 0) {
+		pr_err("invalid keys, lookups or dst\n");
+		return -EINVAL;
+	}
+	tb = fib_get_table(&init_net, table);
+	if (!tb) {
+		pr_err("no table %u\n", table);
+		return -ENOENT;
+	}
+	k = fib_bench_keys(addr, mask);
+	if (!k)
+		return -ENOMEM;
+
+	/* One pass to warm up the caches with as much as fits */
+	fib_bench_run(tb, k, keys);
+
+	fib_bench_events_create();
+	fib_bench_events_read(before);
+	start = ktime_get();
+	found = fib_bench_run(tb, k, lookups);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	fib_bench_events_read(after);
+	fib_bench_events_release();
+	vfree(k);
+
+	if (ns <= 0)
+		ns = 1;
+	pr_info("table %u, %u keys in %s: %u lookups in %lld ns, "
+		"%llu ns/lookup, %llu lookups/s, %u%% found\n",
+		table, keys, dst, lookups, ns, div64_u64(ns, lookups),
+		div64_u64((u64)lookups * NSEC_PER_SEC, ns),
+		(unsigned int)div64_u64((u64)found * 100, lookups));
+
+	for (i = 0; i < FIB_BENCH_NR_EVENTS; i++) {
+		if (!fib_bench_events[i])
+			continue;
+		c = div64_u64((after[i] - before[i]) * 100, lookups);
+		pr_info("%llu.%02llu %s/lookup\n", div64_u64(c, 100),
+			c - div64_u64(c, 100) * 100, fib_bench_event_names[i]);
+	}
+
+	/* Don't stay loaded, the results are in the log */
+	return -EAGAIN;
+}
+
+static void __exit fib_bench_exit(void)
+{
+}
+
+module_init(fib_bench_init);
+module_exit(fib_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IPv4 FIB lookup benchmark");
@@ -112,6 +112,7 @@ struct fib_table *fib_get_table(struct net *net, u32 id)
 	rcu_read_unlock();
 	return NULL;
 }
+EXPORT_SYMBOL_GPL(fib_get_table);
 #endif /* CONFIG_IP_MULTIPLE_TABLES */
 
 void fib_select_default(struct net *net,
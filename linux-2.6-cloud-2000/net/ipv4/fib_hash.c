@@ -274,6 +274,7 @@ out:
 	read_unlock(&fib_hash_lock);
 	return err;
 }
+EXPORT_SYMBOL_GPL(fib_table_lookup);
 
 void fib_table_select_default(struct fib_table *tb,
 			      const struct flowi *flp, struct fib_result *res)
@@ -154,6 +154,7 @@ void free_fib_info(struct fib_info *fi)
 	release_net(fi->fib_net);
 	kfree(fi);
 }
+EXPORT_SYMBOL_GPL(free_fib_info);
 
 void fib_release_info(struct fib_info *fi)
 {
@@ -109,9 +109,9 @@ struct leaf {
 
 struct leaf_info {
 	struct hlist_node hlist;
-	struct rcu_head rcu;
 	int plen;
 	struct list_head falh;
+	struct rcu_head rcu;	/* last, not touched by lookups */
 };
 
 struct tnode {
@@ -148,10 +148,16 @@ struct trie_stat {
 	unsigned int nullpointers;
 	unsigned int prefixes;
 	unsigned int nodesizes[MAX_STAT_DEPTH];
+	unsigned int depths[MAX_STAT_DEPTH];	/* leaves per depth */
 };
 
 struct trie {
 	struct node *trie;
+	/* resize() thresholds, set through /proc/net/fib_triestat */
+	int inflate_threshold;
+	int halve_threshold;
+	int inflate_threshold_root;
+	int halve_threshold_root;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats stats;
 #endif
@@ -177,6 +183,32 @@ static const int sync_pages = 128;
 static struct kmem_cache *fn_alias_kmem __read_mostly;
 static struct kmem_cache *trie_leaf_kmem __read_mostly;
 
+#ifdef CONFIG_IP_FIB_TRIE_ALIGN
+/* Leaves and leaf_infos start on a cache line of their own, a lookup
+ * reads one line of each. */
+static struct kmem_cache *trie_leaf_info_kmem __read_mostly;
+
+static inline struct leaf_info *leaf_info_alloc(void)
+{
+	return kmem_cache_alloc(trie_leaf_info_kmem, GFP_KERNEL);
+}
+
+static inline void leaf_info_release(struct leaf_info *li)
+{
+	kmem_cache_free(trie_leaf_info_kmem, li);
+}
+#else
+static inline struct leaf_info *leaf_info_alloc(void)
+{
+	return kmalloc(sizeof(struct leaf_info), GFP_KERNEL);
+}
+
+static inline void leaf_info_release(struct leaf_info *li)
+{
+	kfree(li);
+}
+#endif
+
 static inline struct tnode *node_parent(struct node *node)
 {
 	return (struct tnode *)(node->parent & ~NODE_TYPE_MASK);
@@ -354,7 +386,7 @@ static inline void free_leaf(struct leaf *l)
 
 static void __leaf_info_free_rcu(struct rcu_head *head)
 {
-	kfree(container_of(head, struct leaf_info, rcu));
+	leaf_info_release(container_of(head, struct leaf_info, rcu));
 }
 
 static inline void free_leaf_info(struct leaf_info *leaf)
@@ -435,7 +467,7 @@ static struct leaf *leaf_new(void)
 
 static struct leaf_info *leaf_info_new(int plen)
 {
-	struct leaf_info *li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
+	struct leaf_info *li = leaf_info_alloc();
 	if (li) {
 		li->plen = plen;
 		INIT_LIST_HEAD(&li->falh);
@@ -529,7 +561,7 @@ static struct node *resize(struct trie *t, struct tnode *tn)
 		return NULL;
 
 	pr_debug("In tnode_resize %p inflate_threshold=%d threshold=%d\n",
-		 tn, inflate_threshold, halve_threshold);
+		 tn, t->inflate_threshold, t->halve_threshold);
 
 	/* No children */
 	if (tn->empty_children == tnode_child_length(tn)) {
@@ -608,12 +640,12 @@ static struct node *resize(struct trie *t, struct tnode *tn)
 	/* Keep root node larger  */
 
 	if (!node_parent((struct node*) tn)) {
-		inflate_threshold_use = inflate_threshold_root;
-		halve_threshold_use = halve_threshold_root;
+		inflate_threshold_use = t->inflate_threshold_root;
+		halve_threshold_use = t->halve_threshold_root;
 	}
 	else {
-		inflate_threshold_use = inflate_threshold;
-		halve_threshold_use = halve_threshold;
+		inflate_threshold_use = t->inflate_threshold;
+		halve_threshold_use = t->halve_threshold;
 	}
 
 	max_work = MAX_WORK;
@@ -1575,6 +1607,7 @@ found:
 	rcu_read_unlock();
 	return ret;
 }
+EXPORT_SYMBOL_GPL(fib_table_lookup);
 
 /*
  * Remove the leaf and return parent.
@@ -2003,10 +2036,21 @@ void __init fib_hash_init(void)
 					  sizeof(struct fib_alias),
 					  0, SLAB_PANIC, NULL);
 
+#ifdef CONFIG_IP_FIB_TRIE_ALIGN
+	trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
+					   sizeof(struct leaf), 0,
+					   SLAB_HWCACHE_ALIGN | SLAB_PANIC,
+					   NULL);
+	trie_leaf_info_kmem = kmem_cache_create("ip_fib_trie_info",
+						sizeof(struct leaf_info), 0,
+						SLAB_HWCACHE_ALIGN | SLAB_PANIC,
+						NULL);
+#else
 	trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
 					   max(sizeof(struct leaf),
 					       sizeof(struct leaf_info)),
 					   0, SLAB_PANIC, NULL);
+#endif
 }
 
 
@@ -2026,6 +2070,10 @@ struct fib_table *fib_hash_table(u32 id)
 
 	t = (struct trie *) tb->tb_data;
 	memset(t, 0, sizeof(*t));
+	t->inflate_threshold = inflate_threshold;
+	t->halve_threshold = halve_threshold;
+	t->inflate_threshold_root = inflate_threshold_root;
+	t->halve_threshold_root = halve_threshold_root;
 
 	if (id == RT_TABLE_LOCAL)
 		pr_info("IPv4 FIB: Using LC-trie version %s\n", VERSION);
@@ -2131,6 +2179,8 @@ static void trie_collect_stats(struct trie *t, struct trie_stat *s)
 			s->totdepth += iter.depth;
 			if (iter.depth > s->maxdepth)
 				s->maxdepth = iter.depth;
+			s->depths[min_t(unsigned int, iter.depth,
+					MAX_STAT_DEPTH - 1)]++;
 
 			hlist_for_each_entry_rcu(li, tmp, &l->list, hlist)
 				++s->prefixes;
@@ -2166,6 +2216,12 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 		   avdepth / 100, avdepth % 100);
 	seq_printf(seq, "\tMax depth:      %u\n", stat->maxdepth);
 
+	seq_puts(seq, "\tDepths:        ");
+	for (i = 0; i <= stat->maxdepth && i < MAX_STAT_DEPTH; i++)
+		if (stat->depths[i] != 0)
+			seq_printf(seq, "  %u: %u", i, stat->depths[i]);
+	seq_putc(seq, '\n');
+
 	seq_printf(seq, "\tLeaves:         %u\n", stat->leaves);
 	bytes = sizeof(struct leaf) * stat->leaves;
 
@@ -2244,6 +2300,11 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 				continue;
 
 			fib_table_print(seq, tb);
+			seq_printf(seq, "\tThresholds:     inflate %d halve %d,"
+				   " root inflate %d halve %d\n",
+				   t->inflate_threshold, t->halve_threshold,
+				   t->inflate_threshold_root,
+				   t->halve_threshold_root);
 
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
@@ -2261,9 +2322,81 @@ static int fib_triestat_seq_open(struct inode *inode, struct file *file)
 	return single_open_net(inode, file, fib_triestat_seq_show);
 }
 
+static int trie_set_threshold(struct trie *t, const char *name, int val)
+{
+	int inflate = t->inflate_threshold;
+	int halve = t->halve_threshold;
+	int inflate_root = t->inflate_threshold_root;
+	int halve_root = t->halve_threshold_root;
+
+	if (val < 1 || val > 100)
+		return -EINVAL;
+	if (!strcmp(name, "inflate_threshold"))
+		inflate = val;
+	else if (!strcmp(name, "halve_threshold"))
+		halve = val;
+	else if (!strcmp(name, "inflate_threshold_root"))
+		inflate_root = val;
+	else if (!strcmp(name, "halve_threshold_root"))
+		halve_root = val;
+	else
+		return -EINVAL;
+
+	/* A node must not qualify for both, or resize() would flip it */
+	if (halve >= inflate || halve_root >= inflate_root)
+		return -EINVAL;
+
+	t->inflate_threshold = inflate;
+	t->halve_threshold = halve;
+	t->inflate_threshold_root = inflate_root;
+	t->halve_threshold_root = halve_root;
+	return 0;
+}
+
+/*
+ * "<table> <threshold> <value>", e.g. "main inflate_threshold 40".
+ * Nodes are checked against the new values the next time a route
+ * change resizes them.
+ */
+static ssize_t fib_triestat_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct net *net = ((struct seq_file *)file->private_data)->private;
+	char kbuf[64], table[16], name[32];
+	struct fib_table *tb;
+	unsigned long id;
+	int val, err;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	if (sscanf(kbuf, "%15s %31s %d", table, name, &val) != 3)
+		return -EINVAL;
+	if (!strcmp(table, "main"))
+		id = RT_TABLE_MAIN;
+	else if (!strcmp(table, "local"))
+		id = RT_TABLE_LOCAL;
+	else if (strict_strtoul(table, 10, &id) || id == 0 || (u32)id != id)
+		return -EINVAL;
+
+	rtnl_lock();
+	tb = fib_get_table(net, id);
+	if (tb)
+		err = trie_set_threshold((struct trie *) tb->tb_data, name, val);
+	else
+		err = -ENOENT;
+	rtnl_unlock();
+
+	return err ? err : count;
+}
+
 static const struct file_operations fib_triestat_fops = {
 	.owner	= THIS_MODULE,
 	.open	= fib_triestat_seq_open,
+	.write	= fib_triestat_write,
 	.read	= seq_read,
 	.llseek	= seq_lseek,
 	.release = single_release_net,
@@ -2643,7 +2776,7 @@ int __net_init fib_proc_init(struct net *net)
 	if (!proc_net_fops_create(net, "fib_trie", S_IRUGO, &fib_trie_fops))
 		goto out1;
 
-	if (!proc_net_fops_create(net, "fib_triestat", S_IRUGO,
+	if (!proc_net_fops_create(net, "fib_triestat", S_IRUGO | S_IWUSR,
 				  &fib_triestat_fops))
 		goto out2;
 
@@ -312,6 +312,7 @@ ipt_do_table(struct sk_buff *skb,
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
+	unsigned int addend;
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -332,7 +333,8 @@ ipt_do_table(struct sk_buff *skb,
 	acpar.hooknum = hook;
 
 	IP_NF_ASSERT(table->valid_hooks & (1 << hook));
-	xt_info_rdlock_bh();
+	local_bh_disable();
+	addend = xt_write_recseq_begin();
 	private = table->private;
 	cpu        = smp_processor_id();
 	table_base = private->entries[cpu];
@@ -428,7 +430,8 @@ ipt_do_table(struct sk_buff *skb,
 			/* Verdict */
 			break;
 	} while (!acpar.hotdrop);
-	xt_info_rdunlock_bh();
+	xt_write_recseq_end(addend);
+	local_bh_enable();
 	pr_debug("Exiting %s; resetting sp from %u to %u\n",
 		 __func__, *stackptr, origptr);
 	*stackptr = origptr;
@@ -886,13 +889,17 @@ get_counters(const struct xt_table_info *t,
 	unsigned int cpu;
 	unsigned int i;
 	unsigned int curcpu;
+	unsigned int start;
+	seqcount_t *seq;
+	u64 bcnt, pcnt;
 
 	/* Instead of clearing (by a previous call to memset())
 	 * the counters and using adds, we set the counters
 	 * with data used by 'current' CPU.
 	 *
-	 * Bottom half has to be disabled to prevent deadlock
-	 * if new softirq were to run and call ipt_do_table
+	 * Bottom half is disabled so that rule processing on this
+	 * CPU cannot update its counters while we read them. The
+	 * counters of other CPUs are read under their xt_recseq.
 	 */
 	local_bh_disable();
 	curcpu = smp_processor_id();
@@ -908,13 +915,16 @@ get_counters(const struct xt_table_info *t,
 		if (cpu == curcpu)
 			continue;
 		i = 0;
-		xt_info_wrlock(cpu);
+		seq = &per_cpu(xt_recseq, cpu);
 		xt_entry_foreach(iter, t->entries[cpu], t->size) {
-			ADD_COUNTER(counters[i], iter->counters.bcnt,
-				    iter->counters.pcnt);
+			do {
+				start = read_seqcount_begin(seq);
+				bcnt = iter->counters.bcnt;
+				pcnt = iter->counters.pcnt;
+			} while (read_seqcount_retry(seq, start));
+			ADD_COUNTER(counters[i], bcnt, pcnt);
 			++i; /* macro does multi eval of i */
 		}
-		xt_info_wrunlock(cpu);
 	}
 	local_bh_enable();
 }
@@ -1197,6 +1207,9 @@ EXPORT_SYMBOL(hook_firewall_asfctrl_cb);
 
 #endif
 
+/* Serializes table updates: do_delta() checks its rule unlocked */
+static DEFINE_MUTEX(ipt_update_mutex);
+
 static int
 __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	     struct xt_table_info *newinfo, unsigned int num_counters,
@@ -1216,11 +1229,12 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 		goto out;
 	}
 
+	mutex_lock(&ipt_update_mutex);
 	t = try_then_request_module(xt_find_table_lock(net, AF_INET, name),
 				    "iptable_%s", name);
 	if (!t || IS_ERR(t)) {
 		ret = t ? PTR_ERR(t) : -ENOENT;
-		goto free_newinfo_counters_untrans;
+		goto unlock_update;
 	}
 
 	/* You lied! */
@@ -1259,6 +1273,7 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 		ret = -EFAULT;
 	vfree(counters);
 	xt_table_unlock(t);
+	mutex_unlock(&ipt_update_mutex);
 #ifdef CONFIG_AS_FASTPATH
 	/* Call the  ASF CTRL CB */
 	if (!ret && pfnfirewall_asfctrl)
@@ -1269,7 +1284,8 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
  put_module:
 	module_put(t->me);
 	xt_table_unlock(t);
- free_newinfo_counters_untrans:
+ unlock_update:
+	mutex_unlock(&ipt_update_mutex);
 	vfree(counters);
  out:
 	return ret;
@@ -1331,7 +1347,7 @@ static int
 do_add_counters(struct net *net, const void __user *user,
                 unsigned int len, int compat)
 {
-	unsigned int i, curcpu;
+	unsigned int i, curcpu, addend;
 	struct xt_counters_info tmp;
 	struct xt_counters *paddc;
 	unsigned int num_counters;
@@ -1399,12 +1415,12 @@ do_add_counters(struct net *net, const void __user *user,
 	/* Choose the copy that is on our node */
 	curcpu = smp_processor_id();
 	loc_cpu_entry = private->entries[curcpu];
-	xt_info_wrlock(curcpu);
+	addend = xt_write_recseq_begin();
 	xt_entry_foreach(iter, loc_cpu_entry, private->size) {
 		ADD_COUNTER(iter->counters, paddc[i].bcnt, paddc[i].pcnt);
 		++i;
 	}
-	xt_info_wrunlock(curcpu);
+	xt_write_recseq_end(addend);
  unlock_up_free:
 	local_bh_enable();
 	xt_table_unlock(t);
@@ -1415,6 +1431,373 @@ do_add_counters(struct net *net, const void __user *user,
 	return ret;
 }
 
+/*
+ * IPT_SO_SET_DELTA inserts, deletes or replaces a single rule without
+ * passing the whole table through userspace.  The new table is put
+ * together from the running one: the entries which stay are copied with
+ * their jumps shifted, only the new rule is checked, and the counters are
+ * carried over per cpu instead of being summed up and handed back.
+ *
+ * The other rules were checked for the hooks they can be reached from.
+ * A delta which makes any of them reachable from another hook (a new
+ * jump to a user chain) is refused with -EOPNOTSUPP: such a change has
+ * to go through IPT_SO_SET_REPLACE, which checks everything.
+ */
+
+/* Offset in the new table of an entry of the old table */
+static inline unsigned int
+delta_shift(unsigned int pos, unsigned int off, int diff)
+{
+	return pos > off ? pos + diff : pos;
+}
+
+/* Name of the target of an entry which was checked */
+static inline const char *delta_target_name(const struct ipt_entry *e)
+{
+	return ipt_get_target_c(e)->u.kernel.target->name;
+}
+
+/* Chain heads, chain tails and the table end are no rules */
+static bool
+delta_fixed_entry(const struct ipt_entry *e, const void *end)
+{
+	const struct ipt_standard_target *t = (void *)ipt_get_target_c(e);
+	const struct ipt_entry *next = (void *)e + e->next_offset;
+
+	if (strcmp(delta_target_name(e), XT_ERROR_TARGET) == 0)
+		return true;
+
+	return strcmp(delta_target_name(e), XT_STANDARD_TARGET) == 0 &&
+	       t->verdict == IPT_RETURN && unconditional(&e->ip) &&
+	       (void *)next < end &&
+	       strcmp(delta_target_name(next), XT_ERROR_TARGET) == 0;
+}
+
+/*
+ * Put the new table together in @entry0: the old table @old0 with
+ * @oldlen bytes at @off replaced by @newe.  Hooks, underflows and jumps
+ * are shifted, and 'mark_source_chains()' is run on the result.
+ */
+static int
+delta_build(struct xt_table_info *newinfo, void *entry0,
+	    const struct xt_table_info *private, const void *old0,
+	    unsigned int valid_hooks, unsigned int off, unsigned int oldlen,
+	    const struct ipt_entry *newe, unsigned int newlen, bool insert)
+{
+	int diff = (int)newlen - (int)oldlen;
+	struct ipt_standard_target *t, *newt = NULL;
+	const struct ipt_entry *olde;
+	struct ipt_entry *iter;
+	unsigned int h, pos;
+
+	memcpy(entry0, old0, off);
+	memcpy(entry0 + off, newe, newlen);
+	memcpy(entry0 + off + newlen, old0 + off + oldlen,
+	       private->size - off - oldlen);
+
+	newinfo->size = private->size + diff;
+	newinfo->number = private->number + !!newlen - !!oldlen;
+	newinfo->stacksize = private->stacksize;
+	for (h = 0; h < NF_INET_NUMHOOKS; h++) {
+		newinfo->hook_entry[h] = private->hook_entry[h];
+		newinfo->underflow[h] = private->underflow[h];
+		if (!(valid_hooks & (1 << h)))
+			continue;
+		newinfo->hook_entry[h] = delta_shift(private->hook_entry[h],
+						     off, diff);
+		/* A rule inserted in front of the policy ends the chain */
+		if (insert && private->underflow[h] == off)
+			newinfo->underflow[h] += diff;
+		else
+			newinfo->underflow[h] = delta_shift(private->underflow[h],
+							    off, diff);
+	}
+
+	if (newlen) {
+		newt = (void *)ipt_get_target(entry0 + off);
+		if (strcmp(newt->target.u.user.name, XT_STANDARD_TARGET) != 0 ||
+		    newt->verdict < 0)
+			newt = NULL;
+	}
+
+	/*
+	 * Shift the jumps of the old entries and give them back the target
+	 * names, which 'mark_source_chains()' looks at.  A jump of the new
+	 * rule has to hit an entry.
+	 */
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		pos = (void *)iter - entry0;
+		if (newt && pos == newt->verdict)
+			newt = NULL;
+		if (newlen && pos == off)
+			continue;
+
+		olde = old0 + (pos < off ? pos : pos - diff);
+		t = (void *)ipt_get_target(iter);
+		strncpy(t->target.u.user.name, delta_target_name(olde),
+			sizeof(t->target.u.user.name));
+		if (strcmp(t->target.u.user.name, XT_STANDARD_TARGET) == 0 &&
+		    t->verdict >= 0)
+			t->verdict = delta_shift(t->verdict, off, diff);
+		iter->comefrom = 0;
+	}
+	if (newt) {
+		duprintf("delta_build: bad jump (%i)\n", newt->verdict);
+		return -EINVAL;
+	}
+
+	if (!mark_source_chains(newinfo, valid_hooks, entry0))
+		return -ELOOP;
+
+	/* Restore the checked targets; no old rule may gain a hook */
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		pos = (void *)iter - entry0;
+		iter->counters = ((struct xt_counters) { 0, 0 });
+		if (newlen && pos == off)
+			continue;
+
+		olde = old0 + (pos < off ? pos : pos - diff);
+		ipt_get_target(iter)->u.kernel.target =
+			ipt_get_target_c(olde)->u.kernel.target;
+		if (iter->comefrom & ~olde->comefrom)
+			return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+static int
+do_delta(struct net *net, const void __user *user, unsigned int len)
+{
+	struct ipt_delta tmp;
+	struct ipt_entry *newe = NULL, *iter, *e;
+	struct xt_counters newc = { 0, 0 };
+	struct xt_table *t, *t2;
+	struct xt_table_info *private, *oldinfo, *newinfo = NULL;
+	unsigned int off, oldlen = 0, newlen, h, cpu, curcpu, pos, addend;
+	void *entry0 = NULL, *old0;
+	bool checked = false;
+	int diff, ret;
+
+	if (len < sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(&tmp, user, sizeof(tmp)) != 0)
+		return -EFAULT;
+	tmp.name[sizeof(tmp.name) - 1] = '\0';
+	off = tmp.offset;
+
+	newlen = len - sizeof(tmp);
+	switch (tmp.op) {
+	case IPT_DELTA_DELETE:
+		if (newlen != 0)
+			return -EINVAL;
+		break;
+	case IPT_DELTA_INSERT:
+	case IPT_DELTA_REPLACE:
+		/* The new rule must keep the rules after it aligned */
+		if (newlen % __alignof__(struct ipt_entry) != 0 ||
+		    newlen < sizeof(struct ipt_entry) +
+			     sizeof(struct xt_entry_target))
+			return -EINVAL;
+		newe = kmalloc(newlen, GFP_KERNEL);
+		if (!newe)
+			return -ENOMEM;
+		if (copy_from_user(newe, user + sizeof(tmp), newlen) != 0) {
+			ret = -EFAULT;
+			goto free_entry;
+		}
+		ret = -EINVAL;
+		if (newe->next_offset != newlen || check_entry(newe, tmp.name))
+			goto free_entry;
+		/* User chains are created with IPT_SO_SET_REPLACE */
+		if (strcmp(ipt_get_target(newe)->u.user.name,
+			   XT_ERROR_TARGET) == 0)
+			goto free_entry;
+		newc = newe->counters;
+		newe->comefrom = 0;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&ipt_update_mutex);
+	t = xt_find_table_lock(net, AF_INET, tmp.name);
+	if (!t || IS_ERR(t)) {
+		ret = t ? PTR_ERR(t) : -ENOENT;
+		goto unlock_update;
+	}
+
+	private = t->private;
+	if (tmp.num_entries != private->number || tmp.size != private->size) {
+		duprintf("do_delta: table changed\n");
+		ret = -EAGAIN;
+		goto unlock_table;
+	}
+
+	/* Find the entry the operation applies to */
+	ret = -EINVAL;
+	old0 = private->entries[raw_smp_processor_id()];
+	e = NULL;
+	xt_entry_foreach(iter, old0, private->size) {
+		pos = (void *)iter - old0;
+		if (pos == off)
+			e = iter;
+		if (pos >= off)
+			break;
+	}
+	if (!e)
+		goto unlock_table;
+
+	if (tmp.op == IPT_DELTA_INSERT) {
+		/* Rules go in front of a rule or of a chain's end */
+		if (strcmp(delta_target_name(e), XT_ERROR_TARGET) == 0)
+			goto unlock_table;
+	} else {
+		if (delta_fixed_entry(e, old0 + private->size))
+			goto unlock_table;
+		oldlen = e->next_offset;
+	}
+
+	/* Policies can be replaced, not deleted */
+	for (h = 0; h < NF_INET_NUMHOOKS; h++) {
+		if (!(t->valid_hooks & (1 << h)) || private->underflow[h] != off)
+			continue;
+		if (tmp.op == IPT_DELTA_DELETE ||
+		    (tmp.op == IPT_DELTA_REPLACE && !check_underflow(newe)))
+			goto unlock_table;
+	}
+
+	if (newlen > INT_MAX - private->size) {
+		ret = -ENOMEM;
+		goto unlock_table;
+	}
+	diff = (int)newlen - (int)oldlen;
+	newinfo = xt_alloc_table_info(private->size + diff);
+	if (!newinfo) {
+		ret = -ENOMEM;
+		goto unlock_table;
+	}
+
+	entry0 = newinfo->entries[raw_smp_processor_id()];
+	ret = delta_build(newinfo, entry0, private, old0, t->valid_hooks,
+			  off, oldlen, newe, newlen,
+			  tmp.op == IPT_DELTA_INSERT);
+	if (ret != 0)
+		goto unlock_table;
+
+	/*
+	 * Looking up matches and targets takes the table lock.  The table
+	 * cannot change meanwhile, replacing it takes ipt_update_mutex.
+	 */
+	xt_table_unlock(t);
+	if (newlen) {
+		ret = find_check_entry(entry0 + off, net, tmp.name,
+				       newinfo->size);
+		if (ret != 0) {
+			module_put(t->me);
+			goto free_newinfo;
+		}
+		checked = true;
+	}
+
+	t2 = xt_find_table_lock(net, AF_INET, tmp.name);
+	if (!t2 || IS_ERR(t2)) {
+		ret = t2 ? PTR_ERR(t2) : -ENOENT;
+		module_put(t->me);
+		goto free_newinfo;
+	}
+	if (t2 != t) {
+		ret = -EAGAIN;
+		module_put(t2->me);
+		xt_table_unlock(t2);
+		module_put(t->me);
+		goto free_newinfo;
+	}
+	/* Same table again, keep the reference taken first */
+	module_put(t2->me);
+	if (t->private != private) {
+		ret = -EAGAIN;
+		goto unlock_table;
+	}
+
+	/* And one copy for every other CPU */
+	for_each_possible_cpu(cpu) {
+		if (newinfo->entries[cpu] && newinfo->entries[cpu] != entry0)
+			memcpy(newinfo->entries[cpu], entry0, newinfo->size);
+	}
+	if (newlen)
+		((struct ipt_entry *)(entry0 + off))->counters = newc;
+
+	oldinfo = xt_replace_table(t, private->number, newinfo, &ret);
+	if (!oldinfo)
+		goto unlock_table;
+
+	/* Update module usage count based on number of rules */
+	if ((oldinfo->number > oldinfo->initial_entries) ||
+	    (newinfo->number <= oldinfo->initial_entries))
+		module_put(t->me);
+	if ((oldinfo->number > oldinfo->initial_entries) &&
+	    (newinfo->number <= oldinfo->initial_entries))
+		module_put(t->me);
+
+	/*
+	 * Carry the counters of the old rules over.  xt_replace_table()
+	 * has waited for the readers of the old table, so its counters
+	 * no longer change.  The new table is in use on the other cpus,
+	 * so all of them are added to the copy of this cpu.
+	 */
+	local_bh_disable();
+	curcpu = smp_processor_id();
+	entry0 = newinfo->entries[curcpu];
+	addend = xt_write_recseq_begin();
+	for_each_possible_cpu(cpu) {
+		old0 = oldinfo->entries[cpu];
+		xt_entry_foreach(iter, old0, oldinfo->size) {
+			pos = (void *)iter - old0;
+			if (pos >= off && pos < off + oldlen)
+				continue;
+			e = entry0 + (pos < off ? pos : pos + diff);
+			ADD_COUNTER(e->counters, iter->counters.bcnt,
+				    iter->counters.pcnt);
+		}
+	}
+	xt_write_recseq_end(addend);
+	local_bh_enable();
+
+	if (oldlen)
+		cleanup_entry(oldinfo->entries[raw_smp_processor_id()] + off,
+			      net);
+	xt_free_table_info(oldinfo);
+#ifdef CONFIG_NETFILTER_TABLE_INDEX
+	if (!memcmp(tmp.name, "filter", 3))
+		firewall_rules = (newinfo->number > 4) ? true : false;
+#endif  /* endif CONFIG_NETFILTER_TABLE_INDEX */
+	xt_table_unlock(t);
+	mutex_unlock(&ipt_update_mutex);
+	kfree(newe);
+#ifdef CONFIG_AS_FASTPATH
+	/* Call the  ASF CTRL CB */
+	if (pfnfirewall_asfctrl)
+		pfnfirewall_asfctrl();
+#endif
+	return 0;
+
+ unlock_table:
+	module_put(t->me);
+	xt_table_unlock(t);
+ free_newinfo:
+	if (newinfo) {
+		if (checked)
+			cleanup_entry(entry0 + off, net);
+		xt_free_table_info(newinfo);
+	}
+ unlock_update:
+	mutex_unlock(&ipt_update_mutex);
+ free_entry:
+	kfree(newe);
+	return ret;
+}
+
 #ifdef CONFIG_COMPAT
 struct compat_ipt_replace {
 	char			name[IPT_TABLE_MAXNAMELEN];
@@ -1892,6 +2275,11 @@ compat_do_ipt_set_ctl(struct sock *sk,	int cmd, void __user *user,
 		ret = do_add_counters(sock_net(sk), user, len, 1);
 		break;
 
+	case IPT_SO_SET_DELTA:
+		/* Userspace falls back to IPT_SO_SET_REPLACE */
+		ret = -EOPNOTSUPP;
+		break;
+
 	default:
 		duprintf("do_ipt_set_ctl:  unknown request %i\n", cmd);
 		ret = -EINVAL;
@@ -2033,6 +2421,14 @@ do_ipt_set_ctl(struct sock *sk, int cmd, void __user *user, unsigned int len)
 		ret = do_add_counters(sock_net(sk), user, len, 0);
 		break;
 
+	case IPT_SO_SET_DELTA:
+		ret = do_delta(sock_net(sk), user, len);
+#ifdef CONFIG_NETFILTER_TABLE_INDEX
+		if (!ret)
+			init_netfilter_table_index();
+#endif  /* endif CONFIG_NETFILTER_TABLE_INDEX */
+		break;
+
 	default:
 		duprintf("do_ipt_set_ctl:  unknown request %i\n", cmd);
 		ret = -EINVAL;
@@ -94,6 +94,8 @@
 #include <linux/rcupdate.h>
 #include <linux/times.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
 #include <net/dst.h>
 #include <net/net_namespace.h>
 #include <net/protocol.h>
@@ -768,6 +770,144 @@ static inline int rt_is_expired(struct rtable *rth)
 	return rth->rt_genid != rt_genid(dev_net(rth->u.dst.dev));
 }
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+/*
+ * Per-CPU route cache.
+ *
+ * Instead of the shared hash table, every CPU has a small direct mapped
+ * table of its own: slot (hash & rt_pcpu_mask) holds at most one route,
+ * and a new route simply replaces the one in its slot. Nothing is shared
+ * on the packet path, so there are no chain locks, no chain walks and no
+ * garbage collection to keep up with, and the cache can never hold more
+ * than rt_pcpu_entries routes per CPU, however many flows there are.
+ * A flow seen on several CPUs has a route on each of them.
+ *
+ * The hash includes rt_genid, so a FIB change makes all routes miss at
+ * once; the stale ones are freed by rt_do_flush() or when the worker
+ * comes by. Slots are only changed with xchg() or cmpxchg(), which lets
+ * the flush and the worker clear the slots of other CPUs, and readers
+ * are under rcu_read_lock_bh() as with the hash table.
+ */
+static struct rtable * __percpu	*rt_pcpu_cache __read_mostly;
+static unsigned int		rt_pcpu_mask __read_mostly;
+
+#define RT_PCPU_ENTRIES_DEFAULT	1024
+#define RT_PCPU_ENTRIES_MAX	(PCPU_MIN_UNIT_SIZE / sizeof(struct rtable *))
+
+/* A reader that migrates just looks in the slot of another CPU */
+static inline struct rtable **rt_chain(unsigned hash)
+{
+	return &__this_cpu_ptr(rt_pcpu_cache)[hash & rt_pcpu_mask];
+}
+
+static inline struct rtable **rt_pcpu_slot(unsigned hash, int cpu)
+{
+	return &per_cpu_ptr(rt_pcpu_cache, cpu)[hash & rt_pcpu_mask];
+}
+
+/* Install rt in the slot of this CPU, freeing the route it replaces */
+static int rt_pcpu_insert(unsigned hash, struct rtable *rt)
+{
+	struct rtable *old;
+
+	if (rt->rt_type == RTN_UNICAST || rt->fl.iif == 0) {
+		int err = arp_bind_neighbour(&rt->u.dst);
+		if (err) {
+			if (net_ratelimit())
+				printk(KERN_WARNING "Neighbour table overflow.\n");
+			rt_drop(rt);
+			return err;
+		}
+	}
+
+	rt->u.dst.rt_next = NULL;
+	local_bh_disable();
+	/* xchg() orders the writes to rt before it can be seen */
+	old = xchg(rt_chain(hash), rt);
+	local_bh_enable();
+	if (old)
+		rt_free(old);
+	return 0;
+}
+
+/* Free the routes, of all CPUs, for which select() is true */
+static void rt_pcpu_free(int (*select)(struct rtable *rth),
+			 int process_context)
+{
+	struct rtable **slots, *rth;
+	unsigned int i;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		slots = per_cpu_ptr(rt_pcpu_cache, cpu);
+		rcu_read_lock_bh();
+		for (i = 0; i <= rt_pcpu_mask; i++) {
+			rth = rcu_dereference_bh(slots[i]);
+			if (rth && select(rth) && cmpxchg(&slots[i], rth, NULL) == rth)
+				rt_free(rth);
+		}
+		rcu_read_unlock_bh();
+		if (process_context && need_resched())
+			cond_resched();
+	}
+}
+
+static int rt_pcpu_flushable(struct rtable *rth)
+{
+#ifdef CONFIG_NET_NS
+	return rt_is_expired(rth);
+#else
+	return 1;
+#endif
+}
+
+/* Same aging as rt_check_expire() gives a route on a chain of its own */
+static int rt_pcpu_aged(struct rtable *rth)
+{
+	if (rt_is_expired(rth))
+		return 1;
+	if (rth->u.dst.expires)
+		return time_after(jiffies, rth->u.dst.expires);
+	return rt_may_expire(rth, ip_rt_gc_timeout, ip_rt_gc_timeout);
+}
+
+static __initdata unsigned long rt_pcpu_entries = RT_PCPU_ENTRIES_DEFAULT;
+static int __init set_rt_pcpu_entries(char *str)
+{
+	if (!str)
+		return 0;
+	rt_pcpu_entries = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("rt_pcpu_entries=", set_rt_pcpu_entries);
+
+static void __init rt_pcpu_init(void)
+{
+	unsigned long entries;
+
+	entries = clamp_t(unsigned long, rt_pcpu_entries, 1,
+			  min_t(unsigned long, RT_PCPU_ENTRIES_MAX,
+				rt_hash_mask + 1));
+	entries = rounddown_pow_of_two(entries);
+	rt_pcpu_mask = entries - 1;
+
+	rt_pcpu_cache = __alloc_percpu(entries * sizeof(struct rtable *),
+				       __alignof__(struct rtable *));
+	if (!rt_pcpu_cache)
+		panic("IP: failed to allocate the per-CPU route cache\n");
+	printk(KERN_INFO "IP route cache: %lu entries per CPU\n", entries);
+}
+#else
+static inline struct rtable **rt_chain(unsigned hash)
+{
+	return &rt_hash_table[hash].chain;
+}
+
+static inline void rt_pcpu_init(void)
+{
+}
+#endif /* CONFIG_IP_ROUTE_PCPU_CACHE */
+
 /*
  * Perform a full scan of hash table and free all entries.
  * Can be called by a softirq or a process.
@@ -779,6 +919,10 @@ static void rt_do_flush(int process_context)
 	struct rtable *rth, *next;
 	struct rtable * tail;
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	rt_pcpu_free(rt_pcpu_flushable, process_context);
+	return;
+#endif
 	for (i = 0; i <= rt_hash_mask; i++) {
 		if (process_context && need_resched())
 			cond_resched();
@@ -866,6 +1010,10 @@ static void rt_check_expire(void)
 	unsigned long delta;
 	u64 mult;
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	rt_pcpu_free(rt_pcpu_aged, 1);
+	return;
+#endif
 	delta = jiffies - expires_ljiffies;
 	expires_ljiffies = jiffies;
 	mult = ((u64)delta) << rt_hash_log;
@@ -1017,6 +1165,17 @@ static int rt_garbage_collect(struct dst_ops *ops)
 
 	RT_CACHE_STAT_INC(gc_total);
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	/* The per-CPU cache is bounded by its size, there is nothing to
+	 * collect. Only fail when the routes in use hit ip_rt_max_size. */
+	if (atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
+		return 0;
+	if (net_ratelimit())
+		printk(KERN_WARNING "dst cache overflow\n");
+	RT_CACHE_STAT_INC(gc_dst_overflow);
+	return 1;
+#endif
+
 	if (now - last_gc < ip_rt_gc_min_interval &&
 	    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size) {
 		RT_CACHE_STAT_INC(gc_ignored);
@@ -1186,6 +1345,12 @@ restart:
 		goto skip_hashing;
 	}
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	if (rt_pcpu_insert(hash, rt))
+		return -ENOBUFS;
+	goto skip_hashing;
+#endif
+
 	rthp = &rt_hash_table[hash].chain;
 
 	spin_lock_bh(rt_hash_lock_addr(hash));
@@ -1396,6 +1561,18 @@ static void rt_del(unsigned hash, struct rtable *rt)
 {
 	struct rtable **rthp, *aux;
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	int cpu;
+
+	ip_rt_put(rt);
+	for_each_possible_cpu(cpu) {
+		if (cmpxchg(rt_pcpu_slot(hash, cpu), rt, NULL) == rt) {
+			rt_free(rt);
+			break;
+		}
+	}
+	return;
+#endif
 	rthp = &rt_hash_table[hash].chain;
 	spin_lock_bh(rt_hash_lock_addr(hash));
 	ip_rt_put(rt);
@@ -1433,6 +1610,12 @@ void ip_rt_redirect(__be32 old_gw, __be32 daddr, __be32 new_gw,
 	if (!rt_caching(net))
 		goto reject_redirect;
 
+#ifdef CONFIG_IP_ROUTE_PCPU_CACHE
+	/* The redirected route would replace the route of one flow, on one
+	 * CPU, and be lost again at the next collision on its slot. */
+	goto reject_redirect;
+#endif
+
 	if (!IN_DEV_SHARED_MEDIA(in_dev)) {
 		if (!inet_addr_onlink(in_dev, new_gw, old_gw))
 			goto reject_redirect;
@@ -1714,7 +1897,7 @@ unsigned short ip_rt_frag_needed(struct net *net, struct iphdr *iph,
 						rt_genid(net));
 
 			rcu_read_lock();
-			for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
+			for (rth = rcu_dereference(*rt_chain(hash)); rth;
 			     rth = rcu_dereference(rth->u.dst.rt_next)) {
 				unsigned short mtu = new_mtu;
 
@@ -2403,7 +2586,7 @@ int ip_route_input_common(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	hash = rt_hash(daddr, saddr, iif, rt_genid(net));
 
 	rcu_read_lock();
-	for (rth = rcu_dereference(rt_hash_table[hash].chain); rth;
+	for (rth = rcu_dereference(*rt_chain(hash)); rth;
 	     rth = rcu_dereference(rth->u.dst.rt_next)) {
 		if ((((__force u32)rth->fl.fl4_dst ^ (__force u32)daddr) |
 		     ((__force u32)rth->fl.fl4_src ^ (__force u32)saddr) |
@@ -2830,7 +3013,7 @@ int __ip_route_output_key(struct net *net, struct rtable **rp,
 	hash = rt_hash(flp->fl4_dst, flp->fl4_src, flp->oif, rt_genid(net));
 
 	rcu_read_lock_bh();
-	for (rth = rcu_dereference_bh(rt_hash_table[hash].chain); rth;
+	for (rth = rcu_dereference_bh(*rt_chain(hash)); rth;
 		rth = rcu_dereference_bh(rth->u.dst.rt_next)) {
 		if (rth->fl.fl4_dst == flp->fl4_dst &&
 		    rth->fl.fl4_src == flp->fl4_src &&
@@ -3441,6 +3624,7 @@ int __init ip_rt_init(void)
 					rhash_entries ? 0 : 512 * 1024);
 	memset(rt_hash_table, 0, (rt_hash_mask + 1) * sizeof(struct rt_hash_bucket));
 	rt_hash_lock_init();
+	rt_pcpu_init();
 
 	ipv4_dst_ops.gc_thresh = (rt_hash_mask + 1);
 	ip_rt_max_size = (rt_hash_mask + 1) * 16;
@@ -0,0 +1,822 @@
+/* Copyright (C) 2003-2011 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing the hash:ip, hash:net, hash:ip,port and
+ * hash:net,iface set types.
+ *
+ * The four types share one implementation: an element is a fixed size key,
+ * of which a type uses only the first klen words, and the key is looked up
+ * in a table of RCU protected chains. The table doubles in size when there
+ * are more than two elements per bucket.
+ *
+ * The net types remember which prefix lengths are in the set. A packet is
+ * looked up once per present prefix length, from the longest to the
+ * shortest, with the address masked to that length. So the lookup does not
+ * depend on the number of elements, only on the number of different prefix
+ * lengths.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <net/ip.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:ip, hash:net, hash:ip,port and hash:net,iface "
+		   "IP set types");
+MODULE_ALIAS("ip_set_hash:ip");
+MODULE_ALIAS("ip_set_hash:net");
+MODULE_ALIAS("ip_set_hash:ip,port");
+MODULE_ALIAS("ip_set_hash:net,iface");
+
+#define HASH_DEFAULT_SIZE	1024
+#define HASH_MIN_SIZE		64
+#define HASH_MAX_BITS		20
+#define HASH_DEFAULT_MAXELEM	65536
+
+enum hash_kind {
+	HASH_IP,
+	HASH_NET,
+	HASH_IPPORT,
+	HASH_NETIFACE,
+};
+
+/* The element key. Unused fields are zero, so keys compare with memcmp. */
+struct hash_key {
+	__be32 ip;
+	__be16 port;
+	u8 proto;
+	u8 cidr;
+	char iface[IFNAMSIZ];
+};
+
+/* Length of the key of the kinds, in 32 bit words */
+static const u8 hash_klen[] = {
+	[HASH_IP]	= 1,
+	[HASH_NET]	= 2,
+	[HASH_IPPORT]	= 2,
+	[HASH_NETIFACE]	= sizeof(struct hash_key) / sizeof(u32),
+};
+
+struct hash_elem {
+	struct hlist_node node;
+	struct rcu_head rcu;
+	struct hash_key key;
+};
+
+struct htable {
+	u8 htable_bits;			/* size of the table is 2^bits */
+	struct hlist_head bucket[0];	/* RCU protected chains */
+};
+
+/* The set data */
+struct hash_set {
+	struct htable *table;		/* the hash table, RCU protected */
+	enum hash_kind kind;		/* which of the set types */
+	u8 klen;			/* used key length in words */
+	u8 netmask;			/* hash:ip: netmask of the addresses */
+	u32 maxelem;			/* max number of elements */
+	u32 elements;			/* current number of elements */
+	u32 initval;			/* random jhash init value */
+	u32 cidrs;			/* net types: bit n-1 set for prefix n */
+	u32 nets[32];			/* net types: elements per prefix */
+};
+
+static struct kmem_cache *hash_elem_cache __read_mostly;
+
+static inline size_t
+htable_size(u8 bits)
+{
+	return sizeof(struct htable) + (sizeof(struct hlist_head) << bits);
+}
+
+static struct htable *
+htable_alloc(u8 bits)
+{
+	struct htable *t = ip_set_alloc(htable_size(bits));
+
+	if (t)
+		t->htable_bits = bits;
+	return t;
+}
+
+static inline u32
+hash_bucket(const struct hash_set *h, const struct htable *t,
+	    const struct hash_key *key)
+{
+	return jhash2((const u32 *)key, h->klen, h->initval) &
+	       ((1U << t->htable_bits) - 1);
+}
+
+static inline bool
+hash_key_equal(const struct hash_set *h, const struct hash_key *a,
+	       const struct hash_key *b)
+{
+	return memcmp(a, b, h->klen * sizeof(u32)) == 0;
+}
+
+/* Find an element, under rcu_read_lock() or the nfnetlink mutex */
+static struct hash_elem *
+hash_find(const struct hash_set *h, const struct htable *t,
+	  const struct hash_key *key)
+{
+	struct hash_elem *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(e, n, &t->bucket[hash_bucket(h, t, key)],
+				 node)
+		if (hash_key_equal(h, &e->key, key))
+			return e;
+	return NULL;
+}
+
+static inline bool
+hash_is_net(const struct hash_set *h)
+{
+	return h->kind == HASH_NET || h->kind == HASH_NETIFACE;
+}
+
+/* Look up a packet key. For the net types the key is tried with all
+ * prefix lengths present in the set, the longest first. */
+static int
+hash_test(const struct hash_set *h, struct hash_key *key)
+{
+	const struct htable *t = rcu_dereference(h->table);
+	__be32 ip = key->ip;
+	u32 cidrs;
+	int cidr;
+
+	if (!hash_is_net(h))
+		return hash_find(h, t, key) != NULL;
+
+	for (cidrs = h->cidrs; cidrs; cidrs &= ~(1U << (cidr - 1))) {
+		cidr = fls(cidrs);
+		key->ip = ip & ip_set_netmask(cidr);
+		key->cidr = cidr;
+		if (hash_find(h, t, key))
+			return 1;
+	}
+	return 0;
+}
+
+static void
+hash_elem_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(hash_elem_cache,
+			container_of(head, struct hash_elem, rcu));
+}
+
+static void
+htable_destroy(struct htable *t)
+{
+	struct hash_elem *e;
+	struct hlist_node *n, *next;
+	u32 i;
+
+	for (i = 0; i < (1U << t->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, next, &t->bucket[i], node)
+			kmem_cache_free(hash_elem_cache, e);
+	ip_set_free(t);
+}
+
+/* Double the hash table. The elements are copied, because the lookups
+ * still running on the old chains must be able to follow them. Resizing is
+ * best effort: when memory is short, the set stays with the old table. */
+static void
+hash_resize(struct hash_set *h)
+{
+	struct htable *t, *orig = h->table;
+	struct hash_elem *e, *ne;
+	struct hlist_node *n;
+	u32 i;
+
+	if (orig->htable_bits >= HASH_MAX_BITS)
+		return;
+	t = htable_alloc(orig->htable_bits + 1);
+	if (!t)
+		return;
+
+	for (i = 0; i < (1U << orig->htable_bits); i++) {
+		hlist_for_each_entry(e, n, &orig->bucket[i], node) {
+			ne = kmem_cache_alloc(hash_elem_cache, GFP_KERNEL);
+			if (!ne) {
+				htable_destroy(t);
+				return;
+			}
+			ne->key = e->key;
+			hlist_add_head(&ne->node,
+				       &t->bucket[hash_bucket(h, t, &ne->key)]);
+		}
+	}
+
+	pr_debug("resized to %u buckets\n", 1U << t->htable_bits);
+	rcu_assign_pointer(h->table, t);
+	synchronize_rcu();
+	htable_destroy(orig);
+}
+
+static int
+hash_add(struct hash_set *h, const struct hash_key *key)
+{
+	struct htable *t = h->table;
+	struct hash_elem *e;
+
+	if (hash_find(h, t, key))
+		return -IPSET_ERR_EXIST;
+	if (h->elements >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	e = kmem_cache_alloc(hash_elem_cache, GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+	e->key = *key;
+	hlist_add_head_rcu(&e->node, &t->bucket[hash_bucket(h, t, key)]);
+
+	h->elements++;
+	if (hash_is_net(h)) {
+		h->nets[key->cidr - 1]++;
+		h->cidrs |= 1U << (key->cidr - 1);
+	}
+
+	if (h->elements > (2U << t->htable_bits))
+		hash_resize(h);
+	return 0;
+}
+
+static int
+hash_del(struct hash_set *h, const struct hash_key *key)
+{
+	struct hash_elem *e = hash_find(h, h->table, key);
+
+	if (!e)
+		return -IPSET_ERR_EXIST;
+
+	hlist_del_rcu(&e->node);
+	call_rcu(&e->rcu, hash_elem_free_rcu);
+
+	h->elements--;
+	if (hash_is_net(h) && --h->nets[key->cidr - 1] == 0)
+		h->cidrs &= ~(1U << (key->cidr - 1));
+	return 0;
+}
+
+static int
+hash_adt(struct hash_set *h, struct hash_key *key, enum ipset_adt adt)
+{
+	switch (adt) {
+	case IPSET_ADD:
+		return hash_add(h, key);
+	case IPSET_DEL:
+		return hash_del(h, key);
+	default:
+		return hash_find(h, h->table, key) != NULL;
+	}
+}
+
+/* Packet lookup */
+
+static int
+hash_kadt(struct ip_set *set, const struct sk_buff *skb,
+	  const struct xt_action_param *par,
+	  const struct ip_set_adt_opt *opt)
+{
+	const struct hash_set *h = set->data;
+	const struct net_device *dev;
+	struct hash_key key;
+
+	memset(&key, 0, sizeof(key));
+	ip4addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &key.ip);
+
+	switch (h->kind) {
+	case HASH_IP:
+		key.ip &= ip_set_netmask(h->netmask);
+		break;
+	case HASH_IPPORT:
+		if (!ip_set_get_ip4_port(skb, opt->flags & IPSET_DIM_TWO_SRC,
+					 &key.port, &key.proto))
+			return 0;
+		break;
+	case HASH_NETIFACE:
+		dev = opt->flags & IPSET_DIM_TWO_SRC ? par->in : par->out;
+		if (!dev)
+			return 0;
+		strncpy(key.iface, dev->name, IFNAMSIZ);
+		break;
+	case HASH_NET:
+		break;
+	}
+
+	return hash_test(h, &key);
+}
+
+/* Userspace add/del/test */
+
+static inline bool
+proto_with_ports(u8 proto)
+{
+	switch (proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+		return true;
+	}
+	return false;
+}
+
+/* Add or delete every address of [ip, ip_to] with the given step, and for
+ * hash:ip,port every port of [port, port_to]. The loops are written so
+ * that they stop at 255.255.255.255 and port 65535. */
+static int
+hash_adt_range(struct hash_set *h, struct hash_key *key, enum ipset_adt adt,
+	       u32 ip, u32 ip_to, u32 hosts, u16 port, u16 port_to, u32 flags)
+{
+	u32 p;
+	int ret;
+
+	for (; ip <= ip_to; ip += hosts) {
+		key->ip = htonl(ip);
+		for (p = port; p <= port_to; p++) {
+			key->port = htons(p);
+			ret = hash_adt(h, key, adt);
+			if (ret && !ip_set_eexist(ret, flags))
+				return ret;
+		}
+		if (ip + hosts - 1 == 0xFFFFFFFF)
+			break;
+	}
+	return 0;
+}
+
+static int
+hash_uadt(struct ip_set *set, struct nlattr *tb[],
+	  enum ipset_adt adt, u32 *lineno, u32 flags)
+{
+	struct hash_set *h = set->data;
+	struct hash_key key;
+	u32 ip, ip_to, hosts = 1;
+	u16 port = 0, port_to = 0;
+	u8 cidr;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PORT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PORT_TO) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = nla_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	/* The sets are created without timeout */
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	memset(&key, 0, sizeof(key));
+	ret = ip_set_get_ipaddr4(tb[IPSET_ATTR_IP], &key.ip);
+	if (ret)
+		return ret;
+
+	switch (h->kind) {
+	case HASH_NETIFACE:
+		if (!tb[IPSET_ATTR_IFACE])
+			return -IPSET_ERR_PROTOCOL;
+		if (tb[IPSET_ATTR_CADT_FLAGS] &&
+		    (ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]) &
+		     IPSET_FLAG_PHYSDEV))
+			/* Bridge port matching is not supported */
+			return -EOPNOTSUPP;
+		strlcpy(key.iface, nla_data(tb[IPSET_ATTR_IFACE]), IFNAMSIZ);
+		/* Fall through */
+	case HASH_NET:
+		if (tb[IPSET_ATTR_IP_TO])
+			return -IPSET_ERR_HASH_RANGE_UNSUPPORTED;
+		cidr = tb[IPSET_ATTR_CIDR] ?
+			nla_get_u8(tb[IPSET_ATTR_CIDR]) : 32;
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		key.ip &= ip_set_netmask(cidr);
+		key.cidr = cidr;
+		return hash_adt(h, &key, adt);
+	case HASH_IPPORT:
+		if (!tb[IPSET_ATTR_PORT])
+			return -IPSET_ERR_PROTOCOL;
+		if (!tb[IPSET_ATTR_PROTO])
+			return -IPSET_ERR_MISSING_PROTO;
+		key.proto = nla_get_u8(tb[IPSET_ATTR_PROTO]);
+		if (!key.proto)
+			return -IPSET_ERR_INVALID_PROTO;
+		if (proto_with_ports(key.proto) ||
+		    key.proto == IPPROTO_ICMP) {
+			port = port_to = ip_set_get_h16(tb[IPSET_ATTR_PORT]);
+			if (tb[IPSET_ATTR_PORT_TO])
+				port_to = ip_set_get_h16(tb[IPSET_ATTR_PORT_TO]);
+			if (port > port_to)
+				swap(port, port_to);
+		}
+		key.port = htons(port);
+		break;
+	case HASH_IP:
+		key.ip &= ip_set_netmask(h->netmask);
+		break;
+	}
+
+	/* hash:ip and hash:ip,port accept address and port ranges */
+	if (adt == IPSET_TEST ||
+	    !(tb[IPSET_ATTR_IP_TO] || tb[IPSET_ATTR_CIDR] || port != port_to))
+		return hash_adt(h, &key, adt);
+
+	ip = ntohl(key.ip);
+	ip_to = ip;
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_ipaddr4(tb[IPSET_ATTR_IP_TO], &key.ip);
+		if (ret)
+			return ret;
+		ip_to = ntohl(key.ip);
+		if (ip > ip_to)
+			swap(ip, ip_to);
+	} else if (tb[IPSET_ATTR_CIDR]) {
+		cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		ip &= ntohl(ip_set_netmask(cidr));
+		ip_to = ip | ~ntohl(ip_set_netmask(cidr));
+	}
+
+	if (h->kind == HASH_IP) {
+		ip &= ntohl(ip_set_netmask(h->netmask));
+		ip_to &= ntohl(ip_set_netmask(h->netmask));
+		hosts = h->netmask == 32 ? 1 : 2U << (32 - h->netmask - 1);
+	}
+
+	return hash_adt_range(h, &key, adt, ip, ip_to, hosts,
+			      port, port_to, flags);
+}
+
+/* Listing */
+
+static int
+hash_elem_list(const struct hash_set *h, struct sk_buff *skb,
+	       const struct hash_key *key)
+{
+	if (ip_set_put_ipaddr4(skb, IPSET_ATTR_IP, key->ip))
+		return -EMSGSIZE;
+
+	switch (h->kind) {
+	case HASH_NETIFACE:
+		NLA_PUT_STRING(skb, IPSET_ATTR_IFACE, key->iface);
+		/* Fall through */
+	case HASH_NET:
+		NLA_PUT_U8(skb, IPSET_ATTR_CIDR, key->cidr);
+		break;
+	case HASH_IPPORT:
+		NLA_PUT_NET16(skb, IPSET_ATTR_PORT, key->port);
+		NLA_PUT_U8(skb, IPSET_ATTR_PROTO, key->proto);
+		break;
+	case HASH_IP:
+		break;
+	}
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_list(const struct ip_set *set, struct sk_buff *skb,
+	  struct netlink_callback *cb)
+{
+	const struct hash_set *h = set->data;
+	const struct htable *t = rcu_dereference(h->table);
+	struct nlattr *atd, *nested;
+	const struct hash_elem *e;
+	struct hlist_node *n;
+	u32 first = cb->args[2];
+	/* We assume that one hash bucket fills into one page */
+	void *incomplete;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	pr_debug("list hash set %s\n", set->name);
+	for (; cb->args[2] < (1U << t->htable_bits); cb->args[2]++) {
+		incomplete = skb_tail_pointer(skb);
+		hlist_for_each_entry_rcu(e, n, &t->bucket[cb->args[2]], node) {
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested)
+				goto nla_put_failure;
+			if (hash_elem_list(h, skb, &e->key))
+				goto nla_put_failure;
+			ipset_nest_end(skb, nested);
+		}
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[2] = 0;
+
+	return 0;
+
+nla_put_failure:
+	nlmsg_trim(skb, incomplete);
+	ipset_nest_end(skb, atd);
+	if (unlikely(first == cb->args[2])) {
+		pr_warning("Can't list set %s: one bucket does not fit into "
+			   "a message. Please report it!\n", set->name);
+		cb->args[2] = 0;
+		return -EMSGSIZE;
+	}
+	return 0;
+}
+
+static int
+hash_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_set *h = set->data;
+	struct nlattr *nested;
+	size_t memsize;
+
+	memsize = sizeof(*h) + htable_size(h->table->htable_bits) +
+		  h->elements * sizeof(struct hash_elem);
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_HASHSIZE,
+		      htonl(1U << h->table->htable_bits));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	if (h->kind == HASH_IP && h->netmask != 32)
+		NLA_PUT_U8(skb, IPSET_ATTR_NETMASK, h->netmask);
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize));
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static void
+hash_flush(struct ip_set *set)
+{
+	struct hash_set *h = set->data;
+	struct htable *t, *orig = h->table;
+
+	t = htable_alloc(orig->htable_bits);
+	if (!t) {
+		pr_warning("cannot flush set %s: out of memory\n", set->name);
+		return;
+	}
+	rcu_assign_pointer(h->table, t);
+	h->elements = 0;
+	h->cidrs = 0;
+	memset(h->nets, 0, sizeof(h->nets));
+	synchronize_rcu();
+	htable_destroy(orig);
+}
+
+static void
+hash_destroy(struct ip_set *set)
+{
+	struct hash_set *h = set->data;
+
+	htable_destroy(h->table);
+	kfree(h);
+	set->data = NULL;
+}
+
+static bool
+hash_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_set *x = a->data;
+	const struct hash_set *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->maxelem == y->maxelem &&
+	       x->netmask == y->netmask;
+}
+
+static const struct ip_set_type_variant hash_variant = {
+	.kadt	= hash_kadt,
+	.uadt	= hash_uadt,
+	.flush	= hash_flush,
+	.destroy = hash_destroy,
+	.head	= hash_head,
+	.list	= hash_list,
+	.same_set = hash_same_set,
+};
+
+static int
+hash_create(struct ip_set *set, struct nlattr *tb[], enum hash_kind kind)
+{
+	u32 hashsize = HASH_DEFAULT_SIZE, maxelem = HASH_DEFAULT_MAXELEM;
+	u8 netmask = 32, bits;
+	struct hash_set *h;
+
+	if (set->family != NFPROTO_IPV4)
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	if (tb[IPSET_ATTR_HASHSIZE]) {
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+		if (hashsize < HASH_MIN_SIZE)
+			hashsize = HASH_MIN_SIZE;
+	}
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	if (tb[IPSET_ATTR_NETMASK]) {
+		if (kind != HASH_IP)
+			return -IPSET_ERR_PROTOCOL;
+		netmask = nla_get_u8(tb[IPSET_ATTR_NETMASK]);
+		if (!netmask || netmask > 32)
+			return -IPSET_ERR_INVALID_NETMASK;
+	}
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	/* Round up to a power of two */
+	bits = min_t(u8, fls(hashsize - 1), HASH_MAX_BITS);
+	h->table = htable_alloc(bits);
+	if (!h->table) {
+		kfree(h);
+		return -ENOMEM;
+	}
+	h->kind = kind;
+	h->klen = hash_klen[kind];
+	h->netmask = netmask;
+	h->maxelem = maxelem;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+
+	set->data = h;
+	set->variant = &hash_variant;
+
+	pr_debug("create %s hashsize %u (%u) maxelem %u: %p(%p)\n",
+		 set->name, 1U << bits, hashsize, maxelem, set->data, h->table);
+
+	return 0;
+}
+
+static int
+hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return hash_create(set, tb, HASH_IP);
+}
+
+static int
+hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return hash_create(set, tb, HASH_NET);
+}
+
+static int
+hash_ipport_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return hash_create(set, tb, HASH_IPPORT);
+}
+
+static int
+hash_netiface_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	return hash_create(set, tb, HASH_NETIFACE);
+}
+
+#define HASH_CREATE_POLICY					\
+	[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },		\
+	[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },		\
+	[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },		\
+	[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },		\
+	[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },		\
+	[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  }
+
+#define HASH_ADT_POLICY						\
+	[IPSET_ATTR_IP]		= { .type = NLA_NESTED },	\
+	[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },	\
+	[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },		\
+	[IPSET_ATTR_PORT]	= { .type = NLA_U16 },		\
+	[IPSET_ATTR_PORT_TO]	= { .type = NLA_U16 },		\
+	[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },		\
+	[IPSET_ATTR_IFACE]	= { .type = NLA_NUL_STRING,	\
+				    .len = IFNAMSIZ - 1 },	\
+	[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },		\
+	[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },		\
+	[IPSET_ATTR_LINENO]	= { .type = NLA_U32 }
+
+static struct ip_set_type hash_types[] __read_mostly = {
+	{
+		.name		= "hash:ip",
+		.protocol	= IPSET_PROTOCOL,
+		.features	= IPSET_TYPE_IP,
+		.dimension	= IPSET_DIM_ONE,
+		.family		= NFPROTO_IPV4,
+		.revision_min	= 0,
+		.revision_max	= 0,
+		.create		= hash_ip_create,
+		.create_policy	= { HASH_CREATE_POLICY },
+		.adt_policy	= { HASH_ADT_POLICY },
+		.me		= THIS_MODULE,
+	},
+	{
+		.name		= "hash:net",
+		.protocol	= IPSET_PROTOCOL,
+		.features	= IPSET_TYPE_IP,
+		.dimension	= IPSET_DIM_ONE,
+		.family		= NFPROTO_IPV4,
+		.revision_min	= 0,
+		.revision_max	= 0,
+		.create		= hash_net_create,
+		.create_policy	= { HASH_CREATE_POLICY },
+		.adt_policy	= { HASH_ADT_POLICY },
+		.me		= THIS_MODULE,
+	},
+	{
+		.name		= "hash:ip,port",
+		.protocol	= IPSET_PROTOCOL,
+		.features	= IPSET_TYPE_IP | IPSET_TYPE_PORT,
+		.dimension	= IPSET_DIM_TWO,
+		.family		= NFPROTO_IPV4,
+		.revision_min	= 0,
+		.revision_max	= 1,	/* SCTP and UDPLITE support added */
+		.create		= hash_ipport_create,
+		.create_policy	= { HASH_CREATE_POLICY },
+		.adt_policy	= { HASH_ADT_POLICY },
+		.me		= THIS_MODULE,
+	},
+	{
+		.name		= "hash:net,iface",
+		.protocol	= IPSET_PROTOCOL,
+		.features	= IPSET_TYPE_IP | IPSET_TYPE_IFACE,
+		.dimension	= IPSET_DIM_TWO,
+		.family		= NFPROTO_IPV4,
+		.revision_min	= 0,
+		.revision_max	= 0,
+		.create		= hash_netiface_create,
+		.create_policy	= { HASH_CREATE_POLICY },
+		.adt_policy	= { HASH_ADT_POLICY },
+		.me		= THIS_MODULE,
+	},
+};
+
+static void
+hash_types_unregister(int n)
+{
+	while (--n >= 0)
+		ip_set_type_unregister(&hash_types[n]);
+}
+
+static int __init
+hash_init(void)
+{
+	int i, ret;
+
+	hash_elem_cache = kmem_cache_create("ip_set_hash",
+					    sizeof(struct hash_elem), 0, 0,
+					    NULL);
+	if (!hash_elem_cache)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(hash_types); i++) {
+		ret = ip_set_type_register(&hash_types[i]);
+		if (ret) {
+			hash_types_unregister(i);
+			kmem_cache_destroy(hash_elem_cache);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static void __exit
+hash_fini(void)
+{
+	hash_types_unregister(ARRAY_SIZE(hash_types));
+	/* Wait for the elements deleted with call_rcu() */
+	rcu_barrier();
+	kmem_cache_destroy(hash_elem_cache);
+}
+
+module_init(hash_init);
+module_exit(hash_fini);
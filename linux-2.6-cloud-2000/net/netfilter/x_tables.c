@@ -743,8 +743,8 @@ void xt_compat_unlock(u_int8_t af)
 EXPORT_SYMBOL_GPL(xt_compat_unlock);
 #endif
 
-DEFINE_PER_CPU(struct xt_info_lock, xt_info_locks);
-EXPORT_PER_CPU_SYMBOL_GPL(xt_info_locks);
+DEFINE_PER_CPU(seqcount_t, xt_recseq);
+EXPORT_PER_CPU_SYMBOL_GPL(xt_recseq);
 
 static int xt_jumpstack_alloc(struct xt_table_info *i)
 {
@@ -792,6 +792,7 @@ xt_replace_table(struct xt_table *table,
 	      int *error)
 {
 	struct xt_table_info *private;
+	unsigned int cpu, seq;
 	int ret;
 
 	ret = xt_jumpstack_alloc(newinfo);
@@ -816,13 +817,26 @@ xt_replace_table(struct xt_table *table,
 	table->private = newinfo;
 	newinfo->initial_entries = private->initial_entries;
 
+	local_bh_enable();
+
 	/*
-	 * Even though table entries have now been swapped, other CPU's
-	 * may still be using the old entries. This is okay, because
-	 * resynchronization happens because of the locking done
-	 * during the get_counters() routine.
+	 * Other CPUs may still be using the old entries. Wait for every
+	 * CPU that is in a table to leave it; when it enters again, it
+	 * sees the new entries. Then the counters of the old entries are
+	 * final for the caller.
 	 */
-	local_bh_enable();
+	smp_mb();
+	for_each_possible_cpu(cpu) {
+		seqcount_t *s = &per_cpu(xt_recseq, cpu);
+
+		seq = ACCESS_ONCE(s->sequence);
+		if (seq & 1) {
+			do {
+				cond_resched();
+				cpu_relax();
+			} while (seq == ACCESS_ONCE(s->sequence));
+		}
+	}
 
 	return private;
 }
@@ -1327,11 +1341,8 @@ static int __init xt_init(void)
 	unsigned int i;
 	int rv;
 
-	for_each_possible_cpu(i) {
-		struct xt_info_lock *lock = &per_cpu(xt_info_locks, i);
-		spin_lock_init(&lock->lock);
-		lock->readers = 0;
-	}
+	for_each_possible_cpu(i)
+		seqcount_init(&per_cpu(xt_recseq, i));
 
 	xt = kmalloc(sizeof(struct xt_af) * NFPROTO_NUMPROTO, GFP_KERNEL);
 	if (!xt)
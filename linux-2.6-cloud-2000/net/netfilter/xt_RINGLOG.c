@@ -0,0 +1,294 @@
+/*
+ * xt_RINGLOG - packet logging into per-CPU rings mapped by userspace
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * ULOG and NFLOG build a netlink message for every logged packet and send
+ * batches of them under a lock; the reader needs a system call per batch.
+ * When a flood hits a logging rule, that work is done for each packet of
+ * the flood. RINGLOG instead copies a fixed size record into a ring of the
+ * CPU the packet is handled on. The rings are mapped by the reader, which
+ * consumes the records without system calls. Nothing is shared between
+ * CPUs and the packet path never waits: when a ring is full, the packet is
+ * counted as dropped.
+ *
+ * The layout of the rings is in <linux/netfilter/xt_RINGLOG.h>.
+ *
+ * This module accepts two parameters:
+ *
+ * ring_size:
+ *   number of records in each ring, rounded up to a power of two.
+ *
+ * snaplen:
+ *   max bytes of a packet in a record, from the network header on.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <net/net_namespace.h>
+
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_RINGLOG.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Xtables: packet logging into mmap'ed per-CPU rings");
+MODULE_ALIAS("ipt_RINGLOG");
+MODULE_ALIAS("ip6t_RINGLOG");
+
+static unsigned int ring_size = 2048;
+module_param(ring_size, uint, 0400);
+MODULE_PARM_DESC(ring_size, "number of records in each per-CPU ring");
+
+static unsigned int snaplen = 128;
+module_param(snaplen, uint, 0400);
+MODULE_PARM_DESC(snaplen, "max bytes of a packet in a record");
+
+/* The kernel side of a ring. Only tail is taken from the shared header,
+ * everything the packet path depends on is kept here. */
+struct ringlog_ring {
+	struct xt_ringlog_hdr *hdr;	/* the mapped buffer */
+	void *data;			/* first record */
+	unsigned long size;		/* of the mapped buffer */
+	u32 head;
+	wait_queue_head_t wait;		/* readers in poll() */
+};
+
+static DEFINE_PER_CPU(struct ringlog_ring, ringlog_rings);
+static u32 ringlog_rec_size;
+static struct proc_dir_entry *ringlog_dir;
+
+static void ringlog_fill(struct xt_ringlog_rec *rec, struct sk_buff *skb,
+			 const struct xt_action_param *par, u32 caplen)
+{
+	const struct xt_ringlog_info *info = par->targinfo;
+
+	if (skb->tstamp.tv64 == 0)
+		__net_timestamp(skb);
+	rec->tstamp = ktime_to_ns(skb->tstamp);
+	rec->len    = skb->len;
+	rec->caplen = caplen;
+	rec->mark   = skb->mark;
+	rec->group  = info->group;
+	rec->pf     = par->family;
+	rec->hook   = par->hooknum;
+
+	if (par->in)
+		strncpy(rec->indev, par->in->name, IFNAMSIZ);
+	else
+		rec->indev[0] = '\0';
+	if (par->out)
+		strncpy(rec->outdev, par->out->name, IFNAMSIZ);
+	else
+		rec->outdev[0] = '\0';
+	memcpy(rec->prefix, info->prefix, sizeof(rec->prefix));
+
+	if (par->in && par->in->hard_header_len > 0 &&
+	    skb->mac_header != skb->network_header) {
+		rec->mac_len = min_t(unsigned int, par->in->hard_header_len,
+				     sizeof(rec->mac));
+		memcpy(rec->mac, skb_mac_header(skb), rec->mac_len);
+	} else
+		rec->mac_len = 0;
+
+	if (caplen)
+		skb_copy_bits(skb, 0, rec->data, caplen);
+}
+
+static unsigned int
+ringlog_tg(struct sk_buff *skb, const struct xt_action_param *par)
+{
+	const struct xt_ringlog_info *info = par->targinfo;
+	struct ringlog_ring *ring;
+	struct xt_ringlog_hdr *hdr;
+	u32 caplen;
+
+	caplen = info->snaplen && info->snaplen < snaplen ?
+		 info->snaplen : snaplen;
+	if (caplen > skb->len)
+		caplen = skb->len;
+
+	/* The ring belongs to this CPU, only keep softirqs out */
+	local_bh_disable();
+	ring = &__get_cpu_var(ringlog_rings);
+	hdr = ring->hdr;
+
+	if (ring->head - ACCESS_ONCE(hdr->tail) >= ring_size) {
+		hdr->drops++;
+		goto out;
+	}
+	/* Don't overwrite the record before the reader has released it */
+	smp_mb();
+
+	ringlog_fill(ring->data + (ring->head & (ring_size - 1)) *
+		     ringlog_rec_size, skb, par, caplen);
+
+	/* The record must be complete before the reader can see it */
+	smp_wmb();
+	hdr->head = ++ring->head;
+
+	/* Pairs with poll_wait() in ringlog_poll() */
+	smp_mb();
+	if (waitqueue_active(&ring->wait))
+		wake_up_interruptible(&ring->wait);
+out:
+	local_bh_enable();
+	return XT_CONTINUE;
+}
+
+static int ringlog_tg_check(const struct xt_tgchk_param *par)
+{
+	const struct xt_ringlog_info *info = par->targinfo;
+
+	if (info->flags & ~XT_RINGLOG_MASK)
+		return -EINVAL;
+	if (info->prefix[sizeof(info->prefix) - 1] != '\0')
+		return -EINVAL;
+	return 0;
+}
+
+static struct xt_target ringlog_tg_reg __read_mostly = {
+	.name       = "RINGLOG",
+	.revision   = 0,
+	.family     = NFPROTO_UNSPEC,
+	.checkentry = ringlog_tg_check,
+	.target     = ringlog_tg,
+	.targetsize = sizeof(struct xt_ringlog_info),
+	.me         = THIS_MODULE,
+};
+
+static int ringlog_open(struct inode *inode, struct file *file)
+{
+	file->private_data = PDE(inode)->data;
+	return 0;
+}
+
+static int ringlog_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ringlog_ring *ring = file->private_data;
+
+	return remap_vmalloc_range(vma, ring->hdr, vma->vm_pgoff);
+}
+
+static unsigned int ringlog_poll(struct file *file, poll_table *wait)
+{
+	struct ringlog_ring *ring = file->private_data;
+	struct xt_ringlog_hdr *hdr = ring->hdr;
+
+	poll_wait(file, &ring->wait, wait);
+	smp_mb();
+	if (ACCESS_ONCE(hdr->head) != ACCESS_ONCE(hdr->tail))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations ringlog_fops = {
+	.owner	= THIS_MODULE,
+	.open	= ringlog_open,
+	.mmap	= ringlog_mmap,
+	.poll	= ringlog_poll,
+};
+
+static void ringlog_free(void)
+{
+	struct ringlog_ring *ring;
+	char name[16];
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ring = &per_cpu(ringlog_rings, cpu);
+		if (!ring->hdr)
+			continue;
+		sprintf(name, "%d", cpu);
+		remove_proc_entry(name, ringlog_dir);
+		vfree(ring->hdr);
+		ring->hdr = NULL;
+	}
+	remove_proc_entry("xt_RINGLOG", init_net.proc_net);
+}
+
+static int ringlog_alloc(void)
+{
+	struct ringlog_ring *ring;
+	struct xt_ringlog_hdr *hdr;
+	char name[16];
+	int cpu;
+
+	BUILD_BUG_ON(sizeof(struct xt_ringlog_hdr) > PAGE_SIZE);
+
+	ringlog_dir = proc_mkdir("xt_RINGLOG", init_net.proc_net);
+	if (!ringlog_dir)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		ring = &per_cpu(ringlog_rings, cpu);
+		init_waitqueue_head(&ring->wait);
+		ring->size = PAGE_ALIGN(PAGE_SIZE +
+					(unsigned long)ring_size *
+					ringlog_rec_size);
+		hdr = vmalloc_user(ring->size);
+		if (!hdr)
+			goto err;
+		ring->hdr = hdr;
+		ring->data = (void *)hdr + PAGE_SIZE;
+
+		hdr->version	 = XT_RINGLOG_VERSION;
+		hdr->rec_size	 = ringlog_rec_size;
+		hdr->nr_recs	 = ring_size;
+		hdr->data_offset = PAGE_SIZE;
+		hdr->snaplen	 = snaplen;
+		hdr->cpu	 = cpu;
+
+		sprintf(name, "%d", cpu);
+		if (!proc_create_data(name, S_IRUSR | S_IWUSR, ringlog_dir,
+				      &ringlog_fops, ring)) {
+			ring->hdr = NULL;
+			vfree(hdr);
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	ringlog_free();
+	return -ENOMEM;
+}
+
+static int __init ringlog_tg_init(void)
+{
+	int ret;
+
+	if (ring_size < 2 || ring_size > 1 << 20 || snaplen > 65535) {
+		pr_err("invalid ring_size or snaplen\n");
+		return -EINVAL;
+	}
+	ring_size = roundup_pow_of_two(ring_size);
+	ringlog_rec_size = ALIGN(sizeof(struct xt_ringlog_rec) + snaplen, 8);
+
+	ret = ringlog_alloc();
+	if (ret < 0)
+		return ret;
+
+	ret = xt_register_target(&ringlog_tg_reg);
+	if (ret < 0)
+		ringlog_free();
+	return ret;
+}
+
+static void __exit ringlog_tg_exit(void)
+{
+	xt_unregister_target(&ringlog_tg_reg);
+	ringlog_free();
+}
+
+module_init(ringlog_tg_init);
+module_exit(ringlog_tg_exit);
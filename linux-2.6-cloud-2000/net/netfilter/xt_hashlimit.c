@@ -19,6 +19,7 @@
 #include <linux/list.h>
 #include <linux/skbuff.h>
 #include <linux/mm.h>
+#include <linux/percpu.h>
 #include <linux/in.h>
 #include <linux/ip.h>
 #if defined(CONFIG_IP6_NF_IPTABLES) || defined(CONFIG_IP6_NF_IPTABLES_MODULE)
@@ -28,6 +29,7 @@
 
 #include <net/net_namespace.h>
 #include <net/netns/generic.h>
+#include <linux/seq_file_net.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
@@ -79,31 +81,47 @@ struct dsthash_ent {
 	/* static / read-only parts in the beginning */
 	struct hlist_node node;
 	struct dsthash_dst dst;
+	u_int32_t credit_cap, cost;
 
-	/* modified structure members in the end */
-	spinlock_t lock;
+	/* modified structure members in the end, updated without locks */
 	unsigned long expires;		/* precalculated expiry time */
 	struct {
 		unsigned long prev;	/* last modification */
 		u_int32_t credit;
-		u_int32_t credit_cap, cost;
 	} rateinfo;
 	struct rcu_head rcu;
 };
 
+/* Counted per CPU, summed up in /proc/net/stat/xt_hashlimit */
+struct hashlimit_stat {
+	unsigned long limited;		/* packets over the limit */
+	unsigned long evicted;		/* entries dropped for new ones */
+	unsigned long failed;		/* packets dropped, no entry */
+};
+
+/* Chains are locked by one of HASHLIMIT_LOCKS spinlocks, only to add and
+ * remove entries. The garbage collector cleans 1/HASHLIMIT_GC_STEPS of
+ * the table per run, so a full pass still takes gc_interval. */
+#define HASHLIMIT_LOCKS		64
+#define HASHLIMIT_GC_STEPS	16
+/* chains searched for an entry to evict when the table is full */
+#define HASHLIMIT_EVICT_SCAN	8
+
 struct xt_hashlimit_htable {
 	struct hlist_node node;		/* global list of all htables */
 	int use;
 	u_int8_t family;
-	bool rnd_initialized;
 
 	struct hashlimit_cfg1 cfg;	/* config */
 
 	/* used internally */
-	spinlock_t lock;		/* lock for list_head */
 	u_int32_t rnd;			/* random seed for hash */
-	unsigned int count;		/* number entries in table */
+	atomic_t count;			/* number entries in table */
+	struct hashlimit_stat __percpu *stats;
 	struct timer_list timer;	/* timer for gc */
+	unsigned long gc_step;		/* jiffies between gc runs */
+	unsigned int gc_next;		/* first chain of the next gc run */
+	spinlock_t locks[HASHLIMIT_LOCKS];
 
 	/* seq_file stuff */
 	struct proc_dir_entry *pde;
@@ -136,75 +154,118 @@ hash_dst(const struct xt_hashlimit_htable *ht, const struct dsthash_dst *dst)
 	return ((u64)hash * ht->cfg.size) >> 32;
 }
 
+static inline spinlock_t *
+hash_lock(struct xt_hashlimit_htable *ht, u_int32_t hash)
+{
+	return &ht->locks[hash & (HASHLIMIT_LOCKS - 1)];
+}
+
 static struct dsthash_ent *
 dsthash_find(const struct xt_hashlimit_htable *ht,
-	     const struct dsthash_dst *dst)
+	     const struct dsthash_dst *dst, u_int32_t hash)
 {
 	struct dsthash_ent *ent;
 	struct hlist_node *pos;
-	u_int32_t hash = hash_dst(ht, dst);
 
 	if (!hlist_empty(&ht->hash[hash])) {
 		hlist_for_each_entry_rcu(ent, pos, &ht->hash[hash], node)
-			if (dst_cmp(ent, dst)) {
-				spin_lock(&ent->lock);
+			if (dst_cmp(ent, dst))
 				return ent;
-			}
 	}
 	return NULL;
 }
 
-/* allocate dsthash_ent, initialize dst, put in htable and lock it */
-static struct dsthash_ent *
-dsthash_alloc_init(struct xt_hashlimit_htable *ht,
-		   const struct dsthash_dst *dst)
+static void dsthash_free_rcu(struct rcu_head *head)
 {
-	struct dsthash_ent *ent;
+	struct dsthash_ent *ent = container_of(head, struct dsthash_ent, rcu);
+
+	kmem_cache_free(hashlimit_cachep, ent);
+}
+
+/* called with the lock of the chain held */
+static inline void
+dsthash_free(struct xt_hashlimit_htable *ht, struct dsthash_ent *ent)
+{
+	hlist_del_rcu(&ent->node);
+	call_rcu_bh(&ent->rcu, dsthash_free_rcu);
+	atomic_dec(&ht->count);
+}
+
+/* The table is full: free the least recently used entry of the first
+ * non-empty chain from hash on. Every use moves expires forward by the
+ * same amount, so the entry expiring first is the one used longest ago. */
+static bool dsthash_evict(struct xt_hashlimit_htable *ht, u_int32_t hash)
+{
+	struct dsthash_ent *ent, *lru;
+	struct hlist_node *pos;
+	unsigned int i;
 
-	spin_lock(&ht->lock);
-	/* initialize hash with random val at the time we allocate
-	 * the first hashtable entry */
-	if (unlikely(!ht->rnd_initialized)) {
-		get_random_bytes(&ht->rnd, sizeof(ht->rnd));
-		ht->rnd_initialized = true;
+	for (i = 0; i < HASHLIMIT_EVICT_SCAN; i++) {
+		spin_lock(hash_lock(ht, hash));
+		lru = NULL;
+		hlist_for_each_entry(ent, pos, &ht->hash[hash], node)
+			if (lru == NULL ||
+			    time_before(ent->expires, lru->expires))
+				lru = ent;
+		if (lru != NULL) {
+			dsthash_free(ht, lru);
+			spin_unlock(hash_lock(ht, hash));
+			this_cpu_inc(ht->stats->evicted);
+			return true;
+		}
+		spin_unlock(hash_lock(ht, hash));
+		if (++hash == ht->cfg.size)
+			hash = 0;
 	}
+	return false;
+}
+
+static inline u_int32_t user2credits(u_int32_t user);
 
-	if (ht->cfg.max && ht->count >= ht->cfg.max) {
-		/* FIXME: do something. question is what.. */
+/* allocate and initialize a dsthash_ent, then put it in the htable */
+static struct dsthash_ent *
+dsthash_alloc_init(struct xt_hashlimit_htable *ht,
+		   const struct dsthash_dst *dst, u_int32_t hash,
+		   unsigned long now)
+{
+	struct dsthash_ent *ent, *old;
+
+	if (atomic_read(&ht->count) >= ht->cfg.max &&
+	    !dsthash_evict(ht, hash)) {
 		if (net_ratelimit())
 			pr_err("max count of %u reached\n", ht->cfg.max);
-		ent = NULL;
-	} else
-		ent = kmem_cache_alloc(hashlimit_cachep, GFP_ATOMIC);
+		return NULL;
+	}
+
+	ent = kmem_cache_alloc(hashlimit_cachep, GFP_ATOMIC);
 	if (!ent) {
 		if (net_ratelimit())
 			pr_err("cannot allocate dsthash_ent\n");
-	} else {
-		memcpy(&ent->dst, dst, sizeof(ent->dst));
-		spin_lock_init(&ent->lock);
+		return NULL;
+	}
+	memcpy(&ent->dst, dst, sizeof(ent->dst));
+	ent->credit_cap = user2credits(ht->cfg.avg * ht->cfg.burst);
+	ent->cost = user2credits(ht->cfg.avg);
+	ent->expires = now + msecs_to_jiffies(ht->cfg.expire);
+	ent->rateinfo.prev = now;
+	ent->rateinfo.credit = ent->credit_cap;
+
+	spin_lock(hash_lock(ht, hash));
+	/* another CPU may have added it since the lookup */
+	old = dsthash_find(ht, dst, hash);
+	if (old == NULL) {
+		hlist_add_head_rcu(&ent->node, &ht->hash[hash]);
+		atomic_inc(&ht->count);
+	}
+	spin_unlock(hash_lock(ht, hash));
 
-		spin_lock(&ent->lock);
-		hlist_add_head_rcu(&ent->node, &ht->hash[hash_dst(ht, dst)]);
-		ht->count++;
+	if (old != NULL) {
+		kmem_cache_free(hashlimit_cachep, ent);
+		return old;
 	}
-	spin_unlock(&ht->lock);
 	return ent;
 }
 
-static void dsthash_free_rcu(struct rcu_head *head)
-{
-	struct dsthash_ent *ent = container_of(head, struct dsthash_ent, rcu);
-
-	kmem_cache_free(hashlimit_cachep, ent);
-}
-
-static inline void
-dsthash_free(struct xt_hashlimit_htable *ht, struct dsthash_ent *ent)
-{
-	hlist_del_rcu(&ent->node);
-	call_rcu_bh(&ent->rcu, dsthash_free_rcu);
-	ht->count--;
-}
 static void htable_gc(unsigned long htlong);
 
 static int htable_create(struct net *net, struct xt_hashlimit_mtinfo1 *minfo,
@@ -230,6 +291,11 @@ static int htable_create(struct net *net, struct xt_hashlimit_mtinfo1 *minfo,
 	                sizeof(struct list_head) * size);
 	if (hinfo == NULL)
 		return -ENOMEM;
+	hinfo->stats = alloc_percpu(struct hashlimit_stat);
+	if (hinfo->stats == NULL) {
+		vfree(hinfo);
+		return -ENOMEM;
+	}
 	minfo->hinfo = hinfo;
 
 	/* copy match config into hashtable config */
@@ -242,25 +308,30 @@ static int htable_create(struct net *net, struct xt_hashlimit_mtinfo1 *minfo,
 
 	for (i = 0; i < hinfo->cfg.size; i++)
 		INIT_HLIST_HEAD(&hinfo->hash[i]);
+	for (i = 0; i < HASHLIMIT_LOCKS; i++)
+		spin_lock_init(&hinfo->locks[i]);
 
 	hinfo->use = 1;
-	hinfo->count = 0;
+	atomic_set(&hinfo->count, 0);
 	hinfo->family = family;
-	hinfo->rnd_initialized = false;
-	spin_lock_init(&hinfo->lock);
+	get_random_bytes(&hinfo->rnd, sizeof(hinfo->rnd));
 
 	hinfo->pde = proc_create_data(minfo->name, 0,
 		(family == NFPROTO_IPV4) ?
 		hashlimit_net->ipt_hashlimit : hashlimit_net->ip6t_hashlimit,
 		&dl_file_ops, hinfo);
 	if (hinfo->pde == NULL) {
+		free_percpu(hinfo->stats);
 		vfree(hinfo);
 		return -ENOMEM;
 	}
 	hinfo->net = net;
 
+	hinfo->gc_step = msecs_to_jiffies(hinfo->cfg.gc_interval) /
+			 HASHLIMIT_GC_STEPS ? : 1;
+	hinfo->gc_next = 0;
 	setup_timer(&hinfo->timer, htable_gc, (unsigned long)hinfo);
-	hinfo->timer.expires = jiffies + msecs_to_jiffies(hinfo->cfg.gc_interval);
+	hinfo->timer.expires = jiffies + hinfo->gc_step;
 	add_timer(&hinfo->timer);
 
 	hlist_add_head(&hinfo->node, &hashlimit_net->htables);
@@ -280,34 +351,47 @@ static bool select_gc(const struct xt_hashlimit_htable *ht,
 	return time_after_eq(jiffies, he->expires);
 }
 
+static void htable_cleanup_chain(struct xt_hashlimit_htable *ht,
+				 unsigned int i,
+				 bool (*select)(const struct xt_hashlimit_htable *ht,
+						const struct dsthash_ent *he))
+{
+	struct dsthash_ent *dh;
+	struct hlist_node *pos, *n;
+
+	spin_lock_bh(hash_lock(ht, i));
+	hlist_for_each_entry_safe(dh, pos, n, &ht->hash[i], node) {
+		if ((*select)(ht, dh))
+			dsthash_free(ht, dh);
+	}
+	spin_unlock_bh(hash_lock(ht, i));
+}
+
 static void htable_selective_cleanup(struct xt_hashlimit_htable *ht,
 			bool (*select)(const struct xt_hashlimit_htable *ht,
 				      const struct dsthash_ent *he))
 {
 	unsigned int i;
 
-	/* lock hash table and iterate over it */
-	spin_lock_bh(&ht->lock);
-	for (i = 0; i < ht->cfg.size; i++) {
-		struct dsthash_ent *dh;
-		struct hlist_node *pos, *n;
-		hlist_for_each_entry_safe(dh, pos, n, &ht->hash[i], node) {
-			if ((*select)(ht, dh))
-				dsthash_free(ht, dh);
-		}
-	}
-	spin_unlock_bh(&ht->lock);
+	for (i = 0; i < ht->cfg.size; i++)
+		htable_cleanup_chain(ht, i, select);
 }
 
-/* hash table garbage collector, run by timer */
+/* hash table garbage collector, run by timer: one step of the table */
 static void htable_gc(unsigned long htlong)
 {
 	struct xt_hashlimit_htable *ht = (struct xt_hashlimit_htable *)htlong;
+	unsigned int i, end;
 
-	htable_selective_cleanup(ht, select_gc);
+	end = ht->gc_next + DIV_ROUND_UP(ht->cfg.size, HASHLIMIT_GC_STEPS);
+	if (end > ht->cfg.size)
+		end = ht->cfg.size;
+	for (i = ht->gc_next; i < end; i++)
+		htable_cleanup_chain(ht, i, select_gc);
+	ht->gc_next = end < ht->cfg.size ? end : 0;
 
 	/* re-add the timer accordingly */
-	ht->timer.expires = jiffies + msecs_to_jiffies(ht->cfg.gc_interval);
+	ht->timer.expires = jiffies + ht->gc_step;
 	add_timer(&ht->timer);
 }
 
@@ -324,6 +408,7 @@ static void htable_destroy(struct xt_hashlimit_htable *hinfo)
 		parent = hashlimit_net->ip6t_hashlimit;
 	remove_proc_entry(hinfo->pde->name, parent);
 	htable_selective_cleanup(hinfo, select_all);
+	free_percpu(hinfo->stats);
 	vfree(hinfo);
 }
 
@@ -403,12 +488,40 @@ user2credits(u_int32_t user)
 	return (user * HZ * CREDITS_PER_JIFFY) / XT_HASHLIMIT_SCALE;
 }
 
+/* The entry is shared by all CPUs and has no lock. Whoever moves prev
+ * forward with cmpxchg() adds the credit of the jiffies in between, so
+ * each jiffy is credited once; credit itself only changes by cmpxchg(). */
 static inline void rateinfo_recalc(struct dsthash_ent *dh, unsigned long now)
 {
-	dh->rateinfo.credit += (now - dh->rateinfo.prev) * CREDITS_PER_JIFFY;
-	if (dh->rateinfo.credit > dh->rateinfo.credit_cap)
-		dh->rateinfo.credit = dh->rateinfo.credit_cap;
-	dh->rateinfo.prev = now;
+	unsigned long prev = ACCESS_ONCE(dh->rateinfo.prev);
+	u_int32_t old, new, delta;
+
+	if (prev == now || cmpxchg(&dh->rateinfo.prev, prev, now) != prev)
+		return;
+
+	if (now - prev > dh->credit_cap / CREDITS_PER_JIFFY)
+		delta = dh->credit_cap;
+	else
+		delta = (now - prev) * CREDITS_PER_JIFFY;
+	do {
+		old = ACCESS_ONCE(dh->rateinfo.credit);
+		if (delta > dh->credit_cap - old)
+			new = dh->credit_cap;
+		else
+			new = old + delta;
+	} while (cmpxchg(&dh->rateinfo.credit, old, new) != old);
+}
+
+static inline bool rateinfo_take(struct dsthash_ent *dh)
+{
+	u_int32_t old;
+
+	do {
+		old = ACCESS_ONCE(dh->rateinfo.credit);
+		if (old < dh->cost)
+			return false;
+	} while (cmpxchg(&dh->rateinfo.credit, old, old - dh->cost) != old);
+	return true;
 }
 
 static inline __be32 maskl(__be32 a, unsigned int l)
@@ -523,40 +636,34 @@ hashlimit_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	unsigned long now = jiffies;
 	struct dsthash_ent *dh;
 	struct dsthash_dst dst;
+	u_int32_t hash;
 
 	if (hashlimit_init_dst(hinfo, &dst, skb, par->thoff) < 0)
 		goto hotdrop;
 
+	hash = hash_dst(hinfo, &dst);
 	rcu_read_lock_bh();
-	dh = dsthash_find(hinfo, &dst);
+	dh = dsthash_find(hinfo, &dst, hash);
 	if (dh == NULL) {
-		dh = dsthash_alloc_init(hinfo, &dst);
+		dh = dsthash_alloc_init(hinfo, &dst, hash, now);
 		if (dh == NULL) {
+			this_cpu_inc(hinfo->stats->failed);
 			rcu_read_unlock_bh();
 			goto hotdrop;
 		}
-		dh->expires = jiffies + msecs_to_jiffies(hinfo->cfg.expire);
-		dh->rateinfo.prev = jiffies;
-		dh->rateinfo.credit = user2credits(hinfo->cfg.avg *
-		                      hinfo->cfg.burst);
-		dh->rateinfo.credit_cap = user2credits(hinfo->cfg.avg *
-		                          hinfo->cfg.burst);
-		dh->rateinfo.cost = user2credits(hinfo->cfg.avg);
 	} else {
 		/* update expiration timeout */
 		dh->expires = now + msecs_to_jiffies(hinfo->cfg.expire);
 		rateinfo_recalc(dh, now);
 	}
 
-	if (dh->rateinfo.credit >= dh->rateinfo.cost) {
+	if (rateinfo_take(dh)) {
 		/* below the limit */
-		dh->rateinfo.credit -= dh->rateinfo.cost;
-		spin_unlock(&dh->lock);
 		rcu_read_unlock_bh();
 		return !(info->cfg.mode & XT_HASHLIMIT_INVERT);
 	}
 
-	spin_unlock(&dh->lock);
+	this_cpu_inc(hinfo->stats->limited);
 	rcu_read_unlock_bh();
 	/* default match is underlimit - so over the limit, we need to invert */
 	return info->cfg.mode & XT_HASHLIMIT_INVERT;
@@ -639,12 +746,12 @@ static struct xt_match hashlimit_mt_reg[] __read_mostly = {
 
 /* PROC stuff */
 static void *dl_seq_start(struct seq_file *s, loff_t *pos)
-	__acquires(htable->lock)
+	__acquires(RCU)
 {
 	struct xt_hashlimit_htable *htable = s->private;
 	unsigned int *bucket;
 
-	spin_lock_bh(&htable->lock);
+	rcu_read_lock_bh();
 	if (*pos >= htable->cfg.size)
 		return NULL;
 
@@ -670,14 +777,13 @@ static void *dl_seq_next(struct seq_file *s, void *v, loff_t *pos)
 }
 
 static void dl_seq_stop(struct seq_file *s, void *v)
-	__releases(htable->lock)
+	__releases(RCU)
 {
-	struct xt_hashlimit_htable *htable = s->private;
 	unsigned int *bucket = (unsigned int *)v;
 
 	if (!IS_ERR(bucket))
 		kfree(bucket);
-	spin_unlock_bh(&htable->lock);
+	rcu_read_unlock_bh();
 }
 
 static int dl_seq_real_show(struct dsthash_ent *ent, u_int8_t family,
@@ -685,7 +791,6 @@ static int dl_seq_real_show(struct dsthash_ent *ent, u_int8_t family,
 {
 	int res;
 
-	spin_lock(&ent->lock);
 	/* recalculate to show accurate numbers */
 	rateinfo_recalc(ent, jiffies);
 
@@ -697,8 +802,8 @@ static int dl_seq_real_show(struct dsthash_ent *ent, u_int8_t family,
 				 ntohs(ent->dst.src_port),
 				 &ent->dst.ip.dst,
 				 ntohs(ent->dst.dst_port),
-				 ent->rateinfo.credit, ent->rateinfo.credit_cap,
-				 ent->rateinfo.cost);
+				 ent->rateinfo.credit, ent->credit_cap,
+				 ent->cost);
 		break;
 #if defined(CONFIG_IP6_NF_IPTABLES) || defined(CONFIG_IP6_NF_IPTABLES_MODULE)
 	case NFPROTO_IPV6:
@@ -708,15 +813,14 @@ static int dl_seq_real_show(struct dsthash_ent *ent, u_int8_t family,
 				 ntohs(ent->dst.src_port),
 				 &ent->dst.ip6.dst,
 				 ntohs(ent->dst.dst_port),
-				 ent->rateinfo.credit, ent->rateinfo.credit_cap,
-				 ent->rateinfo.cost);
+				 ent->rateinfo.credit, ent->credit_cap,
+				 ent->cost);
 		break;
 #endif
 	default:
 		BUG();
 		res = 0;
 	}
-	spin_unlock(&ent->lock);
 	return res;
 }
 
@@ -728,7 +832,7 @@ static int dl_seq_show(struct seq_file *s, void *v)
 	struct hlist_node *pos;
 
 	if (!hlist_empty(&htable->hash[*bucket])) {
-		hlist_for_each_entry(ent, pos, &htable->hash[*bucket], node)
+		hlist_for_each_entry_rcu(ent, pos, &htable->hash[*bucket], node)
 			if (dl_seq_real_show(ent, htable->family, s))
 				return -1;
 	}
@@ -761,6 +865,49 @@ static const struct file_operations dl_file_ops = {
 	.release = seq_release
 };
 
+static int hashlimit_stat_show(struct seq_file *s, void *v)
+{
+	struct hashlimit_net *hashlimit_net = hashlimit_pernet(s->private);
+	struct xt_hashlimit_htable *hinfo;
+	const struct hashlimit_stat *st;
+	struct hashlimit_stat sum;
+	struct hlist_node *pos;
+	int cpu;
+
+	seq_puts(s, "name             family  entries      max"
+		    "    evicted    limited     failed\n");
+	mutex_lock(&hashlimit_mutex);
+	hlist_for_each_entry(hinfo, pos, &hashlimit_net->htables, node) {
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			st = per_cpu_ptr(hinfo->stats, cpu);
+			sum.limited += st->limited;
+			sum.evicted += st->evicted;
+			sum.failed  += st->failed;
+		}
+		seq_printf(s, "%-16s %-6s %8u %8u %10lu %10lu %10lu\n",
+			   hinfo->pde->name,
+			   hinfo->family == NFPROTO_IPV4 ? "ipv4" : "ipv6",
+			   atomic_read(&hinfo->count), hinfo->cfg.max,
+			   sum.evicted, sum.limited, sum.failed);
+	}
+	mutex_unlock(&hashlimit_mutex);
+	return 0;
+}
+
+static int hashlimit_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, hashlimit_stat_show);
+}
+
+static const struct file_operations hashlimit_stat_fops = {
+	.owner   = THIS_MODULE,
+	.open    = hashlimit_stat_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release_net,
+};
+
 static int __net_init hashlimit_proc_net_init(struct net *net)
 {
 	struct hashlimit_net *hashlimit_net = hashlimit_pernet(net);
@@ -775,11 +922,20 @@ static int __net_init hashlimit_proc_net_init(struct net *net)
 		return -ENOMEM;
 	}
 #endif
+	if (!proc_create("xt_hashlimit", S_IRUGO, net->proc_net_stat,
+			 &hashlimit_stat_fops)) {
+#if defined(CONFIG_IP6_NF_IPTABLES) || defined(CONFIG_IP6_NF_IPTABLES_MODULE)
+		proc_net_remove(net, "ip6t_hashlimit");
+#endif
+		proc_net_remove(net, "ipt_hashlimit");
+		return -ENOMEM;
+	}
 	return 0;
 }
 
 static void __net_exit hashlimit_proc_net_exit(struct net *net)
 {
+	remove_proc_entry("xt_hashlimit", net->proc_net_stat);
 	proc_net_remove(net, "ipt_hashlimit");
 #if defined(CONFIG_IP6_NF_IPTABLES) || defined(CONFIG_IP6_NF_IPTABLES_MODULE)
 	proc_net_remove(net, "ip6t_hashlimit");